@@ -0,0 +1,120 @@
+/**************************************************************************
+ * @file    bc_checkpoint_tbl.h
+ * @brief   checkpoint table
+ * @note
+ *      - generated by tools/gen_checkpoint.sh. DO NOT EDIT.
+ **************************************************************************/
+#ifndef BC_CHECKPOINT_TBL_H__
+#define BC_CHECKPOINT_TBL_H__
+
+#if defined(MAINNET)
+static const bc_checkpoint_t kCheckpoint[] = {
+    {        0, {
+        0x6f, 0xe2, 0x8c, 0x0a, 0xb6, 0xf1, 0xb3, 0x72,
+        0xc1, 0xa6, 0xa2, 0x46, 0xae, 0x63, 0xf7, 0x4f,
+        0x93, 0x1e, 0x83, 0x65, 0xe1, 0x5a, 0x08, 0x9c,
+        0x68, 0xd6, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {    11111, {
+        0x1d, 0x7c, 0x6e, 0xb2, 0xfd, 0x42, 0xf5, 0x59,
+        0x25, 0xe9, 0x2e, 0xfa, 0xd6, 0x8b, 0x61, 0xed,
+        0xd2, 0x2f, 0xba, 0x29, 0xfd, 0xe8, 0x78, 0x3d,
+        0xf7, 0x44, 0xe2, 0x69, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {    33333, {
+        0xa6, 0xd0, 0xb5, 0xdf, 0x7d, 0x0d, 0xf0, 0x69,
+        0xce, 0xb1, 0xe7, 0x36, 0xa2, 0x16, 0xad, 0x18,
+        0x7a, 0x50, 0xb0, 0x7a, 0xaa, 0x4e, 0x78, 0x74,
+        0x8a, 0x58, 0xd5, 0x2d, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {    74000, {
+        0x20, 0x1a, 0x66, 0xb8, 0x53, 0xf9, 0xe7, 0x81,
+        0x4a, 0x82, 0x0e, 0x2a, 0xf5, 0xf5, 0xdc, 0x79,
+        0xc0, 0x71, 0x44, 0xe3, 0x1c, 0xe4, 0xc9, 0xa3,
+        0x93, 0x39, 0x57, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   105000, {
+        0x97, 0xdc, 0x6b, 0x1d, 0x15, 0xfb, 0xee, 0xf3,
+        0x73, 0xa7, 0x44, 0xfe, 0xe0, 0xb2, 0x54, 0xb0,
+        0xd2, 0xc8, 0x20, 0xa3, 0xae, 0x7f, 0x02, 0x28,
+        0xce, 0x91, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   134444, {
+        0xfe, 0xb0, 0xd2, 0x42, 0x0d, 0x4a, 0x18, 0x91,
+        0x4c, 0x81, 0xac, 0x30, 0xf4, 0x94, 0xa5, 0xd4,
+        0xff, 0x34, 0xcd, 0x15, 0xd3, 0x4c, 0xfd, 0x2f,
+        0xb1, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   168000, {
+        0x63, 0xb7, 0x03, 0x83, 0x5c, 0xb7, 0x35, 0xcb,
+        0x9a, 0x89, 0xd7, 0x33, 0xcb, 0xe6, 0x6f, 0x21,
+        0x2f, 0x63, 0x79, 0x5e, 0x01, 0x72, 0xea, 0x61,
+        0x9e, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   193000, {
+        0x17, 0x13, 0x8b, 0xca, 0x83, 0xbd, 0xc3, 0xe6,
+        0xf6, 0x0f, 0x01, 0x17, 0x7c, 0x38, 0x77, 0xa9,
+        0x82, 0x66, 0xde, 0x40, 0x73, 0x5f, 0x2a, 0x45,
+        0x9f, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   210000, {
+        0x2e, 0x34, 0x71, 0xa1, 0x9b, 0x8e, 0x22, 0xb7,
+        0xf9, 0x39, 0xc6, 0x36, 0x63, 0x07, 0x66, 0x03,
+        0xcf, 0x69, 0x2f, 0x19, 0x83, 0x7e, 0x34, 0x95,
+        0x8b, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   216116, {
+        0x4e, 0xdf, 0x23, 0x1b, 0xf1, 0x70, 0x23, 0x4e,
+        0x6a, 0x81, 0x14, 0x60, 0xf9, 0x5c, 0x94, 0xaf,
+        0x94, 0x64, 0xe4, 0x1e, 0xe8, 0x33, 0xb4, 0xf4,
+        0xb4, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   225430, {
+        0x32, 0x59, 0x57, 0x30, 0xb1, 0x65, 0xf0, 0x97,
+        0xe7, 0xb8, 0x06, 0xa6, 0x79, 0xcf, 0x7f, 0x3e,
+        0x43, 0x90, 0x40, 0xf7, 0x50, 0x43, 0x38, 0x08,
+        0xc1, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   250000, {
+        0x14, 0xd2, 0xf2, 0x4d, 0x29, 0xbe, 0xd7, 0x53,
+        0x54, 0xf3, 0xf8, 0x8a, 0x5f, 0xb5, 0x00, 0x22,
+        0xfc, 0x06, 0x4b, 0x02, 0x29, 0x1f, 0xdf, 0x87,
+        0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   279000, {
+        0x40, 0x7e, 0xbd, 0xe9, 0x58, 0xe4, 0x41, 0x90,
+        0xfa, 0x9e, 0x81, 0x0e, 0xa1, 0xfc, 0x3a, 0x7e,
+        0xf6, 0x01, 0xc3, 0xb0, 0xa0, 0x72, 0x8c, 0xae,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {   295000, {
+        0x83, 0xa9, 0x32, 0x46, 0xc6, 0x70, 0x03, 0x10,
+        0x5a, 0xf3, 0x3a, 0xe0, 0xb2, 0x9d, 0xd6, 0x6f,
+        0x68, 0x9d, 0x0f, 0x0f, 0xf5, 0x4e, 0x9b, 0x4d,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+};
+#elif defined(TESTNET)
+static const bc_checkpoint_t kCheckpoint[] = {
+    {        0, {
+        0x43, 0x49, 0x7f, 0xd7, 0xf8, 0x26, 0x95, 0x71,
+        0x08, 0xf4, 0xa3, 0x0f, 0xd9, 0xce, 0xc3, 0xae,
+        0xba, 0x79, 0x97, 0x20, 0x84, 0xe9, 0x0e, 0xad,
+        0x01, 0xea, 0x33, 0x09, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {      546, {
+        0x70, 0xcb, 0x6a, 0xf7, 0xeb, 0xbc, 0xb1, 0x31,
+        0x5d, 0x34, 0x14, 0x02, 0x9c, 0x55, 0x6c, 0x55,
+        0xf3, 0xe2, 0xfc, 0x35, 0x3c, 0x4c, 0x90, 0x63,
+        0xa7, 0x6c, 0x93, 0x2a, 0x00, 0x00, 0x00, 0x00,
+    } },
+    {  1447141, {
+        0x5e, 0xf3, 0xd3, 0x02, 0x93, 0x7a, 0x07, 0xc7,
+        0x5d, 0x87, 0xc8, 0x1e, 0xae, 0xd5, 0x3b, 0x6f,
+        0xfe, 0x95, 0x9d, 0x46, 0xf8, 0xc6, 0xa6, 0x28,
+        0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    } },
+};
+#endif
+
+#endif /* BC_CHECKPOINT_TBL_H__ */
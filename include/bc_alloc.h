@@ -0,0 +1,119 @@
+/**************************************************************************
+ * @file    bc_alloc.h
+ * @brief   MALLOC/CALLOC/REALLOC/FREEの実装切替えと統計ヘッダ
+ **************************************************************************/
+#ifndef BC_ALLOC_H__
+#define BC_ALLOC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_ALLOC_SYSTEM         (0)             ///< libc
+#define BC_ALLOC_POOL           (1)             ///< size class pool(大きいものはlibc)
+#define BC_ALLOC_HEAP           (2)             ///< 固定heap(ALLOC_HEAP_KB)
+
+#define BC_ALLOC_SITE_MAX       (512)           ///< 呼び出し元を集計する数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_alloc_ops_t
+ *
+ * allocator実装
+ *      Sizeは管理用headerを含む。p_freeには確保時と同じSizeが渡る。
+ */
+typedef struct {
+    const char  *p_name;
+    void        *(*p_alloc)(size_t Size);
+    void        (*p_free)(void *p, size_t Size);
+    void        *(*p_realloc)(void *p, size_t OldSize, size_t Size);   ///< NULL:alloc+copy+free
+} bc_alloc_ops_t;
+
+
+/** @struct bc_alloc_stat_t
+ *
+ * 統計
+ */
+typedef struct {
+    size_t      in_use;                         ///< 使用中byte数
+    size_t      peak;                           ///< in_useの最大
+    uint64_t    calls;                          ///< 確保回数
+    uint64_t    fails;                          ///< 確保失敗回数
+} bc_alloc_stat_t;
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+extern const bc_alloc_ops_t kBcAllocSystem;
+extern const bc_alloc_ops_t kBcAllocPool;
+extern const bc_alloc_ops_t kBcAllocHeap;     ///< ALLOCATOR=2の場合のみ
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** allocator設定
+ *
+ * 最初の確保より前に呼ぶこと。呼ばない場合はALLOCATORの実装を使う。
+ *
+ * @param[in]   pOps        allocator実装
+ * @retval  true    OK
+ * @retval  false   確保済みのため変更できない
+ */
+bool bc_alloc_set_ops(const bc_alloc_ops_t *pOps);
+
+
+/** MALLOC
+ *
+ * @param[in]   Size        確保長
+ * @param[in]   pFile       呼び出し元(__FILE__)
+ * @param[in]   Line        呼び出し元(__LINE__)
+ * @return      確保した領域(失敗時NULL)
+ */
+void *bc_alloc_malloc(size_t Size, const char *pFile, int Line);
+
+
+/** CALLOC
+ *
+ */
+void *bc_alloc_calloc(size_t Num, size_t Size, const char *pFile, int Line);
+
+
+/** REALLOC
+ *
+ */
+void *bc_alloc_realloc(void *p, size_t Size, const char *pFile, int Line);
+
+
+/** FREE
+ *
+ * @param[in]   p           bc_alloc_malloc()等で確保した領域(NULL可)
+ */
+void bc_alloc_free(void *p);
+
+
+/** 統計取得
+ *
+ * @param[out]  pStat       統計
+ */
+void bc_alloc_get_stat(bc_alloc_stat_t *pStat);
+
+
+/** 統計のlog出力
+ *
+ * 全体と、確保回数の多い呼び出し元を出力する。
+ */
+void bc_alloc_print(void);
+
+#endif /* BC_ALLOC_H__ */
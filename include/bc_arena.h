@@ -0,0 +1,89 @@
+/**************************************************************************
+ * @file    bc_arena.h
+ * @brief   受信メッセージ用bump allocatorヘッダ
+ **************************************************************************/
+#ifndef BC_ARENA_H__
+#define BC_ARENA_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utl_buf.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_ARENA_BLOCK_SZ       (64 * 1024)         ///< 1回に確保する大きさ
+#define BC_ARENA_KEEP_MAX       (1024 * 1024)       ///< bc_arena_reset()で残す大きさの上限
+#define BC_ARENA_ALIGN          (16)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+typedef struct bc_arena_blk_t bc_arena_blk_t;
+
+
+/** @struct bc_arena_t
+ *
+ * 確保した領域は個別に解放せず、bc_arena_reset()でまとめて解放する。
+ */
+typedef struct {
+    bc_arena_blk_t  *p_head;                    ///< 使用中の領域(先頭が最新)
+    size_t          high;                       ///< resetまでに使った合計(次の領域の大きさ)
+} bc_arena_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * @param[out]  pArena      arena
+ */
+void bc_arena_init(bc_arena_t *pArena);
+
+
+/** 確保
+ *
+ * @param[in,out]   pArena      arena
+ * @param[in]       Len         確保する長さ
+ * @return      確保した領域(BC_ARENA_ALIGN境界, 失敗時NULL)
+ */
+void *bc_arena_alloc(bc_arena_t *pArena, size_t Len);
+
+
+/** utl_buf_tとして確保
+ *
+ * pBufはarenaを指すので、utl_buf_free()しないこと。
+ *
+ * @param[in,out]   pArena      arena
+ * @param[out]      pBuf        確保した領域
+ * @param[in]       pData       コピー元(NULL:コピーしない)
+ * @param[in]       Len         確保する長さ
+ * @retval  true    OK
+ */
+bool bc_arena_buf(bc_arena_t *pArena, utl_buf_t *pBuf, const uint8_t *pData, size_t Len);
+
+
+/** まとめて解放
+ *
+ * 次のメッセージで確保し直さないよう、使った大きさ(BC_ARENA_KEEP_MAXまで)の領域を1つ残す。
+ *
+ * @param[in,out]   pArena      arena
+ */
+void bc_arena_reset(bc_arena_t *pArena);
+
+
+/** 全解放
+ *
+ * @param[in,out]   pArena      arena
+ */
+void bc_arena_free(bc_arena_t *pArena);
+
+#endif /* BC_ARENA_H__ */
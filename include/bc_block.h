@@ -0,0 +1,33 @@
+/**************************************************************************
+ * @file    bc_block.h
+ * @brief   block検証ヘッダ
+ **************************************************************************/
+#ifndef BC_BLOCK_H__
+#define BC_BLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bc_arena.h"
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** block検証
+ *
+ * txを先頭から順に読んでTXID, WTXIDを計算し、
+ * headerのmerkle rootとcoinbaseのwitness commitment(BIP141)を確認する。
+ * scriptや署名は確認しない。
+ *
+ * @param[in]       pBlock      raw block
+ * @param[in]       Len         pBlock長
+ * @param[in,out]   pArena      作業領域(tx数 * 64byte程度)
+ * @param[out]      pTxCount    tx数(NULL可)
+ * @retval  true    OK
+ */
+bool bc_block_verify(const uint8_t *pBlock, size_t Len, bc_arena_t *pArena, uint32_t *pTxCount);
+
+#endif /* BC_BLOCK_H__ */
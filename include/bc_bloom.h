@@ -0,0 +1,173 @@
+/**************************************************************************
+ * @file    bc_bloom.h
+ * @brief   bloom filter(BIP37)管理ヘッダ
+ **************************************************************************/
+#ifndef BC_BLOOM_H__
+#define BC_BLOOM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utl_buf.h"
+
+#include "bc_txview.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_BLOOM_SZ_MAX         (36000)         ///< filter長上限(BIP37 MAX_BLOOM_FILTER_SIZE)
+#define BC_BLOOM_HASH_MAX       (50)            ///< hash関数の数上限(BIP37 MAX_HASH_FUNCS)
+#define BC_BLOOM_ELEMENT_MAX    (520)           ///< filteradd要素長上限(BIP37)
+#define BC_BLOOM_FP_TXID_NUM    (256)           ///< 覚えておく誤検出txidの数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+struct bloom;
+
+
+/** @enum bc_bloom_act_t
+ *
+ * 要素追加時にpeerへ送るもの
+ */
+typedef enum {
+    BC_BLOOM_ACT_NONE,                          ///< 送らない
+    BC_BLOOM_ACT_ADD,                           ///< filteradd
+    BC_BLOOM_ACT_RELOAD,                        ///< filterload(作り直し)
+} bc_bloom_act_t;
+
+
+/** @struct bc_bloom_stat_t
+ *
+ * bloom filterで通知されたtxの集計
+ */
+typedef struct {
+    uint32_t    tx_matched;                     ///< 通知されたtx数
+    uint32_t    tx_real;                        ///< そのうち監視対象に一致したtx数
+    uint32_t    tx_descendant;                  ///< そのうち誤検出txの子(BLOOM_UPDATE_ALLで追加されたoutpointに一致)
+    uint32_t    block_tx;                       ///< merkleblockのtx総数
+    uint32_t    block_matched;                  ///< そのうち通知されたtx数
+    uint32_t    block_real;                     ///< そのうち監視対象に一致したtx数
+    uint32_t    block_descendant;               ///< そのうち誤検出txの子
+} bc_bloom_stat_t;
+
+
+/** @struct bc_bloom_t
+ *
+ * peerに載せたfilterの状態
+ */
+typedef struct {
+    bool        loaded;                         ///< true:filterload済み
+    bool        cleared;                        ///< true:filterclear済み(全tx通知)
+    double      rate;                           ///< 目標FP率
+    uint32_t    capacity;                       ///< filterを作った時の想定要素数
+    uint32_t    count;                          ///< filterに入っている(と推定する)要素数
+    uint32_t    bits;                           ///< filter bit数
+    uint32_t    hashes;                         ///< hash関数の数
+    bc_bloom_stat_t cur;                        ///< 最後のfilterload以降の集計
+    bc_bloom_stat_t total;                      ///< 接続以降の集計
+    uint64_t    fp_txid[BC_BLOOM_FP_TXID_NUM];  ///< 最後のfilterload以降の誤検出txid(先頭8byte, 0:空き)
+    uint32_t    fp_num;                         ///< fp_txidの使用数
+} bc_bloom_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** filter作成
+ *
+ * 要素数に余裕を持たせた数と目標FP率から大きさを決める。
+ * BIP37の上限に収まらない場合はFP率を上げ、それでも役に立たない場合は作らない。
+ *
+ * @param[out]      pBloom      filter状態
+ * @param[out]      pFilter     作成したfilter(true時はbloom_free()すること)
+ * @param[in]       pItems      要素
+ * @param[in]       Num         要素数
+ * @param[in]       Rate        目標FP率
+ * @retval  true    作成した(filterload)
+ * @retval  false   作成しない(filterclearで全tx通知)
+ */
+bool bc_bloom_build(bc_bloom_t *pBloom, struct bloom *pFilter, const utl_buf_t *pItems, int Num, double Rate);
+
+
+/** filterclear後の状態にする
+ *
+ * @param[out]      pBloom      filter状態
+ */
+void bc_bloom_clear(bc_bloom_t *pBloom);
+
+
+/** 要素追加
+ *
+ * 推定FP率が目標を超えるまではfilteraddで足し、超えたら作り直す。
+ *
+ * @param[in,out]   pBloom      filter状態
+ * @param[in]       Len         要素長
+ * @return      peerへ送るもの
+ */
+bc_bloom_act_t bc_bloom_add(bc_bloom_t *pBloom, size_t Len);
+
+
+/** filterで通知されたtx受信
+ *
+ * BLOOM_UPDATE_ALLでpeer側のfilterにoutpointが追加されたものとして数える。
+ * merkleblockのtxは実測FP率にも数え、推定・実測どちらかが目標を超えたら作り直す。
+ * 誤検出txのoutputを使うtxは、peerが追加したoutpointに一致しただけなので誤検出に数えない。
+ *
+ * @param[in,out]   pBloom      filter状態
+ * @param[in]       pView       解析済みtx
+ * @param[in]       bReal       true:監視対象に一致した
+ * @param[in]       bBlock      true:merkleblockで一致したtx
+ * @retval  true    作り直しが必要
+ */
+bool bc_bloom_tx(bc_bloom_t *pBloom, const bc_txview_t *pView, bool bReal, bool bBlock);
+
+
+/** merkleblock受信
+ *
+ * @param[in,out]   pBloom      filter状態
+ * @param[in]       TotalTx     blockのtx総数
+ */
+void bc_bloom_block(bc_bloom_t *pBloom, uint32_t TotalTx);
+
+
+/** 推定FP率
+ *
+ * @param[in]       pBloom      filter状態
+ * @return      (1 - e^(-k*n/m))^k (filterclear済みは1)
+ */
+double bc_bloom_fp_rate(const bc_bloom_t *pBloom);
+
+
+/** 実測FP率
+ *
+ * merkleblockで一致したが監視対象でも誤検出txの子でもなかったtxの割合。
+ *
+ * @param[in]       pStat       集計
+ * @return      (block_matched - block_real - block_descendant) / block_tx (block_tx=0は0)
+ */
+double bc_bloom_fp_observed(const bc_bloom_stat_t *pStat);
+
+
+/** 全接続の集計
+ *
+ * 起動してからの全接続分(bc_bloom_t.totalの合計)。
+ *
+ * @param[out]      pStat       集計
+ */
+void bc_bloom_stats(bc_bloom_stat_t *pStat);
+
+
+/** 集計のlog出力
+ *
+ * @param[in]       pBloom      filter状態
+ */
+void bc_bloom_print(const bc_bloom_t *pBloom);
+
+#endif /* BC_BLOOM_H__ */
@@ -0,0 +1,187 @@
+/**************************************************************************
+ * @file    bc_cfilter.h
+ * @brief   BIP157 compact block filter取得ヘッダ
+ **************************************************************************/
+#ifndef BC_CFILTER_H__
+#define BC_CFILTER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "btc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_CFILTER_BATCH        (1000)          ///< getcfheaders/getcfiltersで要求する数
+#define BC_CFILTER_CP_INTERVAL  (1000)          ///< cfcheckptの間隔
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum   bc_cfilter_cp_t
+ *
+ * cfcheckptの他peerとの照合状態
+ */
+typedef enum {
+    BC_CFILTER_CP_NONE,                 ///< 未受信
+    BC_CFILTER_CP_WAIT,                 ///< 他peerの応答待ち
+    BC_CFILTER_CP_AGREED,               ///< 他peerと一致
+    BC_CFILTER_CP_CONFLICT,             ///< 他peerと異なる
+} bc_cfilter_cp_t;
+
+
+/** @struct bc_cfilter_t
+ *
+ * peer毎の取得状態
+ */
+typedef struct {
+    uint32_t    next_height;                    ///< 次のbatchの先頭
+    uint32_t    filter_start;                   ///< 照合を始めるBlock Height
+    uint32_t    end;                            ///< 最後のBlock Height
+    uint8_t     prev_header[BTC_SZ_HASH256];    ///< next_height-1のfilter header
+
+    uint32_t    batch_start;                    ///< 要求中batchの先頭(filter header)
+    uint32_t    batch_stop;                     ///< 要求中batchの最後(0:要求なし)
+    uint8_t     stop_hash[BTC_SZ_HASH256];      ///< 要求中batchのstop_hash
+
+    uint8_t     *p_checkpt;                     ///< cfcheckpt(BTC_SZ_HASH256 * checkpt_num)
+    uint32_t    checkpt_num;
+    bool        checkpt_ok;                     ///< true:cfcheckptを使ってよい(他peerと照合済み)
+    uint32_t    checkpt_gen;                    ///< [helper]照合用のgetcfcheckptを送信した世代
+    uint64_t    checkpt_wait;                   ///< 照合待ちで最後に追加接続を始めた時刻(usec)
+} bc_cfilter_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 取得開始
+ *
+ * cfcheckptを受信するまでbatchは要求しない。
+ *
+ * @param[out]  pCfilter    取得状態
+ * @param[in]   From        最初に照合するBlock Height
+ * @param[in]   To          最後のBlock Height
+ */
+void bc_cfilter_start(bc_cfilter_t *pCfilter, uint32_t From, uint32_t To);
+
+
+/** 取得範囲の延長(新block)
+ *
+ * @param[in,out]   pCfilter    取得状態
+ * @param[in]       To          最後のBlock Height
+ */
+void bc_cfilter_extend(bc_cfilter_t *pCfilter, uint32_t To);
+
+
+/** 解放
+ *
+ * @param[in,out]   pCfilter    取得状態
+ */
+void bc_cfilter_free(bc_cfilter_t *pCfilter);
+
+
+/** BIP158 genesis filterの検証
+ *
+ * genesisのbasic filterとfilter headerがBIP158の値になること、
+ * coinbaseのscriptPubKeyが一致することを確かめる(SipHash・Golomb-Rice復号の確認)。
+ *
+ * @retval  true    OK
+ */
+bool bc_cfilter_genesis_check(void);
+
+
+/** genesisのfilter header
+ *
+ * @param[out]  pHeader     filter header(BTC_SZ_HASH256)
+ */
+void bc_cfilter_genesis_header(uint8_t *pHeader);
+
+
+/** cfcheckpt受信
+ *
+ * 他peerのcfcheckptと一致するまでbatchは要求しない(bc_cfilter_crosscheck())。
+ *
+ * @param[in,out]   pCfilter    取得状態
+ * @param[in]       pStopHash   stop_hash
+ * @param[in]       pHeaders    filter header(BTC_SZ_HASH256 * Num)
+ * @param[in]       Num         filter header数
+ * @retval  true    OK
+ */
+bool bc_cfilter_checkpt(bc_cfilter_t *pCfilter, const uint8_t *pStopHash, const uint8_t *pHeaders, uint32_t Num);
+
+
+/** 照合するcfcheckptのstop_hash
+ *
+ * @param[out]  pStopHash   照合待ちのcfcheckptのstop_hash
+ * @param[out]  pGen        照合待ちの世代(bc_cfilter_checkpt()毎に1～)
+ * @retval  true    照合待ちがある
+ */
+bool bc_cfilter_crosscheck_stop(uint8_t *pStopHash, uint32_t *pGen);
+
+
+/** 他peerのcfcheckptと照合
+ *
+ * @param[in]   pStopHash   stop_hash
+ * @param[in]   pHeaders    filter header(BTC_SZ_HASH256 * Num)
+ * @param[in]   Num         filter header数
+ * @retval  true    一致(または照合待ちではない)
+ */
+bool bc_cfilter_crosscheck(const uint8_t *pStopHash, const uint8_t *pHeaders, uint32_t Num);
+
+
+/** 照合状態
+ *
+ * @return      最後にbc_cfilter_checkpt()したcfcheckptの照合状態
+ */
+bc_cfilter_cp_t bc_cfilter_crosscheck_state(void);
+
+
+/** 次のbatch
+ *
+ * @param[in,out]   pCfilter    取得状態
+ * @param[out]      pStart      getcfheadersのstart_height
+ * @param[out]      pStopHash   getcfheaders/getcfiltersのstop_hash
+ * @retval  true    要求する
+ * @retval  false   要求中 or 残りなし
+ */
+bool bc_cfilter_next(bc_cfilter_t *pCfilter, uint32_t *pStart, uint8_t *pStopHash);
+
+
+/** cfheaders受信
+ *
+ * filter header chainをつなげ、cfcheckptと照合する。
+ * 照合開始より前のfilter hashは使わない。
+ *
+ * @param[in,out]   pCfilter    取得状態
+ * @param[out]      pStart      照合するfilterの先頭Block Height
+ * @param[out]      pNum        照合するfilter数(pHashesの末尾pNum個, 0:なし)
+ * @param[out]      pHeaders    filter header(BTC_SZ_HASH256 * Num)
+ * @param[in]       pStopHash   stop_hash
+ * @param[in]       pPrev       previous_filter_header
+ * @param[in]       pHashes     filter hash(BTC_SZ_HASH256 * Num)
+ * @param[in]       Num         filter hash数
+ * @retval  true    OK
+ */
+bool bc_cfilter_headers(bc_cfilter_t *pCfilter, uint32_t *pStart, uint32_t *pNum, uint8_t *pHeaders,
+                const uint8_t *pStopHash, const uint8_t *pPrev, const uint8_t *pHashes, uint32_t Num);
+
+
+/** 保存済みfilter headerの後から取得する
+ *
+ * cfcheckpt受信後、Heightまでのfilterを保存済みの場合に呼ぶ。
+ *
+ * @param[in,out]   pCfilter    取得状態
+ * @param[in]       Height      保存済みの最後のBlock Height
+ * @param[in]       pHeader     Heightのfilter header
+ */
+void bc_cfilter_skip(bc_cfilter_t *pCfilter, uint32_t Height, const uint8_t *pHeader);
+
+#endif /* BC_CFILTER_H__ */
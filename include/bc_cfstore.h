@@ -0,0 +1,96 @@
+/**************************************************************************
+ * @file    bc_cfstore.h
+ * @brief   compact filter保存ヘッダ
+ **************************************************************************/
+#ifndef BC_CFSTORE_H__
+#define BC_CFSTORE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_CFSTORE_CACHE_NUM    (4096)          ///< memory cacheするfilter数上限
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_CFILTERS, FNAME_CFINDEXを開く。
+ * CFSTORE_MAX_MBが0か失敗した場合は保存しない(他の関数は何もしない)。
+ *
+ * @retval  true    OK
+ */
+bool bc_cfstore_init(void);
+
+
+/** 終了
+ *
+ */
+void bc_cfstore_term(void);
+
+
+/** 保存範囲
+ *
+ * @param[out]  pBase       最初のBlock Height
+ * @param[out]  pTip        最後のBlock Height
+ * @retval  true    保存あり
+ */
+bool bc_cfstore_range(uint32_t *pBase, uint32_t *pTip);
+
+
+/** 検証
+ *
+ * block headerやcfcheckptと一致しないBlock Height以降を破棄する。
+ *
+ * @param[in]   pCheckpt    cfcheckpt(BTC_SZ_HASH256 * Num)
+ * @param[in]   Num         cfcheckpt数
+ */
+void bc_cfstore_verify(const uint8_t *pCheckpt, uint32_t Num);
+
+
+/** filter header取得
+ *
+ * @param[out]  pHeader     filter header
+ * @param[in]   Height      Block Height
+ * @retval  true    取得OK
+ */
+bool bc_cfstore_get_header(uint8_t *pHeader, uint32_t Height);
+
+
+/** filter取得
+ *
+ * memory cacheに無ければファイルから読み、filter hashとfilter headerを確認する。
+ * 不一致の場合はHeight以降を破棄する。
+ *
+ * @param[in]   Height      Block Height
+ * @param[out]  pBlockHash  Block Hash
+ * @param[out]  pHeader     filter header
+ * @param[out]  pLen        filter長
+ * @return      filter(MALLOC, 呼び元でFREEする), NULL:取得失敗
+ */
+uint8_t *bc_cfstore_get(uint32_t Height, uint8_t *pBlockHash, uint8_t *pHeader, size_t *pLen);
+
+
+/** filter追加
+ *
+ * 保存済みの次のBlock Heightのみ追加する(未保存の場合はどこからでも開始できる)。
+ * それ以外や上限サイズを超える場合は何もしない。
+ *
+ * @param[in]   Height      Block Height
+ * @param[in]   pBlockHash  Block Hash
+ * @param[in]   pHeader     filter header
+ * @param[in]   pFilter     filter
+ * @param[in]   Len         pFilter長
+ * @retval  true    追加した
+ */
+bool bc_cfstore_append(uint32_t Height, const uint8_t *pBlockHash, const uint8_t *pHeader, const uint8_t *pFilter, size_t Len);
+
+#endif /* BC_CFSTORE_H__ */
@@ -0,0 +1,78 @@
+/**************************************************************************
+ * @file    bc_checkpoint.h
+ * @brief   checkpoint管理ヘッダ
+ **************************************************************************/
+#ifndef BC_CHECKPOINT_H__
+#define BC_CHECKPOINT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc.h"
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_checkpoint_t
+ *
+ * 埋め込みcheckpoint
+ */
+typedef struct {
+    uint32_t    height;                         ///< Block Height
+    uint8_t     hash[BTC_SZ_HASH256];           ///< Block Hash(内部バイト順)
+} bc_checkpoint_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 最新のcheckpoint取得
+ *
+ * @return      最も高いcheckpoint
+ */
+const bc_checkpoint_t *bc_checkpoint_last(void);
+
+
+/** 起点にするcheckpoint取得
+ *
+ * @return      CHECKPOINT_STARTのcheckpoint(未定義または該当なしなら最新)
+ */
+const bc_checkpoint_t *bc_checkpoint_start(void);
+
+
+/** checkpoint取得
+ *
+ * @param[in]   Height      Block Height
+ * @return      Heightのcheckpoint(無ければNULL)
+ */
+const bc_checkpoint_t *bc_checkpoint_get(uint32_t Height);
+
+
+/** Heightより高い最初のcheckpoint取得
+ *
+ * @param[in]   Height      Block Height
+ * @return      checkpoint(無ければNULL)
+ */
+const bc_checkpoint_t *bc_checkpoint_next(uint32_t Height);
+
+
+/** checkpointとの照合
+ *
+ * @param[in]   Height      Block Height
+ * @param[in]   pHash       Block Hash
+ * @retval  true    Heightがcheckpointではない、またはHashが一致
+ */
+bool bc_checkpoint_check(uint32_t Height, const uint8_t *pHash);
+
+
+/** assume-valid範囲か
+ *
+ * @param[in]   Height      Block Height
+ * @retval  true    最新checkpoint以下(hashがcheckpointにつながるので、PoW検証を省略してよい)
+ */
+bool bc_checkpoint_is_assumed(uint32_t Height);
+
+#endif /* BC_CHECKPOINT_H__ */
@@ -0,0 +1,134 @@
+/**************************************************************************
+ * @file    bc_fblock.h
+ * @brief   filtered block取得スケジューラヘッダ
+ **************************************************************************/
+#ifndef BC_FBLOCK_H__
+#define BC_FBLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_FBLOCK_WINDOW_MAX    (64)            ///< 同時要求数上限(getdata 1回に収まる数)
+#define BC_FBLOCK_TIMEOUT_USEC  (60 * 1000000ULL)   ///< 応答が無ければ要求し直す
+#define BC_FBLOCK_RETRY_MAX     (3)             ///< 要求し直す回数上限(超えたら接続をやめる)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_fblock_slot_t
+ *
+ * 要求中block
+ */
+typedef struct {
+    bool        received;                       ///< true:merkleblock受信済み
+    uint8_t     retry;                          ///< 要求し直した回数
+    uint32_t    matched;                        ///< 一致したtx数
+    uint64_t    expire;                         ///< 要求のtimeout時刻(usec, 0:notfound)
+    uint8_t     bhash[BTC_SZ_HASH256];
+} bc_fblock_slot_t;
+
+
+/** @struct bc_fblock_t
+ *
+ * peer毎の取得状態
+ *      [next_done, next_req) が要求中、[next_req, end] が未要求
+ */
+typedef struct {
+    uint32_t    window;                         ///< 同時要求数
+    uint32_t    next_req;                       ///< 次に要求するBlock Height
+    uint32_t    next_done;                      ///< 次に完了させるBlock Height
+    uint32_t    end;                            ///< 最後に要求するBlock Height
+    bc_fblock_slot_t    slot[BC_FBLOCK_WINDOW_MAX]; ///< [height % BC_FBLOCK_WINDOW_MAX]
+} bc_fblock_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 取得開始
+ *
+ * @param[out]  pFblock     取得状態
+ * @param[in]   From        最初のBlock Height
+ * @param[in]   To          最後のBlock Height
+ * @param[in]   Window      同時要求数(BC_FBLOCK_WINDOW_MAX以下に丸める)
+ */
+void bc_fblock_start(bc_fblock_t *pFblock, uint32_t From, uint32_t To, uint32_t Window);
+
+
+/** 取得範囲の延長(新block)
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[in]       To          最後のBlock Height
+ */
+void bc_fblock_extend(bc_fblock_t *pFblock, uint32_t To);
+
+
+/** 要求するBlock Hash
+ *
+ * 要求中の数がwindowの半分以下になったら、まとめてwindowまで埋める。
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[out]      pHashes     要求するBlock Hash(BTC_SZ_HASH256 * BC_FBLOCK_WINDOW_MAX)
+ * @param[in]       Now         現在時刻(usec)
+ * @return      要求数(0:要求しない)
+ */
+int bc_fblock_request(bc_fblock_t *pFblock, uint8_t *pHashes, uint64_t Now);
+
+
+/** 要求し直すBlock Hash
+ *
+ * timeoutした、またはnotfoundだった要求中のblock。
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[out]      pHashes     要求するBlock Hash(BTC_SZ_HASH256 * BC_FBLOCK_WINDOW_MAX)
+ * @param[in]       Now         現在時刻(usec)
+ * @return      要求数(-1:BC_FBLOCK_RETRY_MAXを超えた)
+ */
+int bc_fblock_retry(bc_fblock_t *pFblock, uint8_t *pHashes, uint64_t Now);
+
+
+/** notfound受信
+ *
+ * 次のbc_fblock_retry()で要求し直す。
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[in]       pHash       Block Hash
+ * @retval  true    要求中のblock
+ */
+bool bc_fblock_notfound(bc_fblock_t *pFblock, const uint8_t *pHash);
+
+
+/** merkleblock受信
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[out]      pHeight     Block Height
+ * @param[in]       pHash       Block Hash
+ * @param[in]       Matched     一致したtx数
+ * @retval  true    要求中のblock
+ */
+bool bc_fblock_received(bc_fblock_t *pFblock, uint32_t *pHeight, const uint8_t *pHash, uint32_t Matched);
+
+
+/** 完了block取り出し
+ *
+ * Block Heightの順に、受信済みのblockを1つ取り出す。
+ *
+ * @param[in,out]   pFblock     取得状態
+ * @param[out]      pHeight     Block Height
+ * @param[out]      pHash       Block Hash
+ * @param[out]      pMatched    一致したtx数
+ * @retval  true    取り出した
+ */
+bool bc_fblock_pop(bc_fblock_t *pFblock, uint32_t *pHeight, uint8_t *pHash, uint32_t *pMatched);
+
+#endif /* BC_FBLOCK_H__ */
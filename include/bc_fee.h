@@ -0,0 +1,93 @@
+/**************************************************************************
+ * @file    bc_fee.h
+ * @brief   fee rate推定ヘッダ
+ * @note    記録できるのはmempoolにある(監視対象とその祖先の)txだけなので、自分のtxの実績からの推定になる
+ * @note    feeがわかるのは入力元が全てmempoolにあるtxだけで、数が揃うまでbc_fee_estimate()は0を返す
+ **************************************************************************/
+#ifndef BC_FEE_H__
+#define BC_FEE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_FEE_TARGET_MAX       (48)            ///< 推定できる最大block数
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_FEEがあれば読み込む。
+ *
+ * @retval  true    読み込んだ
+ */
+bool bc_fee_init(void);
+
+
+/** 終了
+ *
+ * FNAME_FEEに保存する。
+ */
+void bc_fee_term(void);
+
+
+/** 保存
+ *
+ * @retval  true    OK
+ */
+bool bc_fee_save(void);
+
+
+/** blockに入ったtxを記録
+ *
+ * @param[in]   Height      blockのBlock Height
+ * @param[in]   FeeRate     fee rate(satoshi/kvB)
+ * @param[in]   Blocks      最初に受信してからblockに入るまでのblock数(1～)
+ */
+void bc_fee_confirmed(uint32_t Height, uint64_t FeeRate, uint32_t Blocks);
+
+
+/** blockに入らずに無くなったtxを記録
+ *
+ * 置き換え、二重使用。上限によるmempoolからの追い出しは含めない。
+ *
+ * @param[in]   Height      現在のBlock Height
+ * @param[in]   FeeRate     fee rate(satoshi/kvB)
+ * @param[in]   Blocks      最初に受信してから無くなるまでのblock数
+ */
+void bc_fee_failed(uint32_t Height, uint64_t FeeRate, uint32_t Blocks);
+
+
+/** peerのfeefilterを記録
+ *
+ * これより低いfee rateはpeerが中継しないので、推定値の下限にする。
+ *
+ * @param[in]   FeeRate     fee rate(satoshi/kvB)
+ */
+void bc_fee_feefilter(uint64_t FeeRate);
+
+
+/** fee rate推定
+ *
+ * Target block以内にblockに入った割合が十分高いfee rateのうち、最も低い範囲の平均を返す。
+ *
+ * @param[in]   Target      block数(1～BC_FEE_TARGET_MAX)
+ * @return      fee rate(satoshi/kvB, 0:データ不足)
+ */
+uint64_t bc_fee_estimate(uint32_t Target);
+
+
+/** log出力
+ *
+ * 数が足りない間は推定値を出さない。
+ */
+void bc_fee_print(void);
+
+#endif /* BC_FEE_H__ */
@@ -0,0 +1,74 @@
+/**************************************************************************
+ * @file    bc_gcs.h
+ * @brief   BIP158 Golomb-coded set照合ヘッダ
+ **************************************************************************/
+#ifndef BC_GCS_H__
+#define BC_GCS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "btc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_GCS_BASIC            (0x00)          ///< filter type: basic
+#define BC_GCS_P                (19)            ///< basic filterのGolomb-Rice parameter
+#define BC_GCS_M                (784931)        ///< basic filterの1/false positive rate
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_gcs_query_t
+ *
+ * 照合する要素と作業領域
+ *      作業領域を持つので、threadごとに用意すること
+ */
+typedef struct {
+    const utl_buf_t *p_items;                   ///< 照合する要素(参照のみ)
+    int             num;                        ///< p_items数
+    uint64_t        *p_hash;                    ///< 作業領域: 要素のhash(num)
+    uint64_t        *p_tmp;                     ///< 作業領域: sort用(num)
+} bc_gcs_query_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** query初期化
+ *
+ * @param[out]  pQuery      query
+ * @param[in]   pItems      照合する要素(bc_gcs_query_free()まで保持すること)
+ * @param[in]   Num         pItems数
+ * @retval  true    OK
+ */
+bool bc_gcs_query_init(bc_gcs_query_t *pQuery, const utl_buf_t *pItems, int Num);
+
+
+/** query解放
+ *
+ * @param[in,out]   pQuery      query
+ */
+void bc_gcs_query_free(bc_gcs_query_t *pQuery);
+
+
+/** filter照合
+ *
+ * 要素をまとめてhashしてsortし、filterを1回復号しながら突き合わせる。
+ *
+ * @param[in,out]   pQuery      query
+ * @param[in]       pFilter     filter(N(varint) + Golomb-Rice符号)
+ * @param[in]       Len         pFilter長
+ * @param[in]       pBlockHash  Block Hash(先頭16byteがSipHash key)
+ * @retval  true    一致あり(false positiveを含む)
+ */
+bool bc_gcs_match_any(bc_gcs_query_t *pQuery, const uint8_t *pFilter, size_t Len, const uint8_t *pBlockHash);
+
+#endif /* BC_GCS_H__ */
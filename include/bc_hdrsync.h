@@ -0,0 +1,105 @@
+/**************************************************************************
+ * @file    bc_hdrsync.h
+ * @brief   checkpoint区間ごとの並列headers取得ヘッダ
+ **************************************************************************/
+#ifndef BC_HDRSYNC_H__
+#define BC_HDRSYNC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc.h"
+#include "bc_headers.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_HDRSYNC_SEG_MAX      (64)            ///< 区間数上限
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum   bc_hdrsync_ret_t
+ */
+typedef enum {
+    BC_HDRSYNC_NEXT,                    ///< 区間の続きを要求する
+    BC_HDRSYNC_DONE,                    ///< 区間を取得し終えた
+    BC_HDRSYNC_ERROR,                   ///< 不正なheaders
+} bc_hdrsync_ret_t;
+
+
+/** @struct bc_hdrsync_peer_t
+ *
+ * peer毎の区間取得状態
+ */
+typedef struct {
+    int         seg;                            ///< 取得中の区間(-1:なし)
+    uint32_t    height;                         ///< 最後に受信したBlock Height
+    uint8_t     last_hash[BTC_SZ_HASH256];      ///< 最後に受信したBlock Hash
+    uint32_t    stop_height;                    ///< 区間の終わりのBlock Height
+    uint8_t     stop_hash[BTC_SZ_HASH256];      ///< 区間の終わり(hash_stop)
+    FILE        *fp;                            ///< 受信したheader
+    bc_headers_diff_t   diff;                   ///< difficulty検証用(区間の始点が未保存なら最初の期間は不明)
+} bc_hdrsync_peer_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 区間分割
+ *
+ * 保存済みtipから最新checkpointまでをcheckpointごとに分ける。
+ * tipが最新checkpoint以上なら区間は無い(CHECKPOINT_STARTで起点を下げた場合に使う)。
+ *
+ * @retval  true    並列取得する区間がある(2区間以上)
+ */
+bool bc_hdrsync_plan(void);
+
+
+/** peer状態初期化
+ *
+ * @param[out]  pPeer       peer状態
+ */
+void bc_hdrsync_init(bc_hdrsync_peer_t *pPeer);
+
+
+/** 区間割当て
+ *
+ * 未割当ての区間を優先し、無ければ取得中で最も低い区間を重複して割り当てる。
+ *
+ * @param[in,out]   pPeer       peer状態
+ * @param[out]      pStart      getheadersのblock locator
+ * @retval  true    割り当てた(pPeer->stop_hashがhash_stop)
+ * @retval  false   全区間を保存済み
+ */
+bool bc_hdrsync_assign(bc_hdrsync_peer_t *pPeer, uint8_t *pStart);
+
+
+/** headers処理
+ *
+ * 区間を取得し終えたら、低い区間から順に保存する。
+ *
+ * @param[in,out]   pPeer       peer状態
+ * @param[out]      pNextHash   BC_HDRSYNC_NEXT時、次のgetheadersで指定するBlock Hash
+ * @param[in]       pHeaders    受信したheader(BC_PRESYNC_REC_SZ * Count)
+ * @param[in]       Count       header数
+ * @return      処理結果
+ */
+bc_hdrsync_ret_t bc_hdrsync_headers(bc_hdrsync_peer_t *pPeer, uint8_t *pNextHash, const uint8_t *pHeaders, uint32_t Count);
+
+
+/** peer状態解放
+ *
+ * 取得途中の区間は他peerに割り当てられるようにする。
+ *
+ * @param[in,out]   pPeer       peer状態
+ */
+void bc_hdrsync_release(bc_hdrsync_peer_t *pPeer);
+
+#endif /* BC_HDRSYNC_H__ */
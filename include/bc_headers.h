@@ -0,0 +1,183 @@
+/**************************************************************************
+ * @file    bc_headers.h
+ * @brief   block header保存ヘッダ
+ **************************************************************************/
+#ifndef BC_HEADERS_H__
+#define BC_HEADERS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bc_pow.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_HEADERS_SZ           (80)            ///< block header長(txn_countを除く)
+#define BC_HEADERS_OFFSET_PREV  (4)             ///< header中のprev_block位置
+#define BC_HEADERS_OFFSET_TIME  (68)            ///< header中のtime位置
+#define BC_HEADERS_OFFSET_BITS  (72)            ///< header中のnBits位置
+#define BC_HEADERS_LOCATOR_MAX  (32)            ///< block locator hash数上限
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_headers_diff_t
+ *
+ * difficulty検証用に、直前までのheaderから覚えておく値
+ */
+typedef struct {
+    uint32_t    height;                         ///< 最後のheaderのBlock Height
+    uint32_t    bits;                           ///< 最後のheaderのnBits(0:不明)
+    uint32_t    time;                           ///< 最後のheaderのtime
+    uint32_t    period_bits;                    ///< 期間のnBits(testnetの最小difficulty blockを除く, 0:不明)
+    uint32_t    first_time;                     ///< 期間最初のheaderのtime(0:不明)
+} bc_headers_diff_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_HEADERSを開いてmmapする。
+ * 無ければ、bc_flash_get_last_bhash()のBlockを起点として作成する。
+ *
+ * @retval  true    OK
+ */
+bool bc_headers_init(void);
+
+
+/** 終了
+ *
+ */
+void bc_headers_term(void);
+
+
+/** 最後に保存したheader
+ *
+ * @param[out]  pHash       Block Hash(NULL時は取得しない)
+ * @param[out]  pWork       起点からの累積chainwork(NULL時は取得しない)
+ * @return      Block Height(未保存の場合は起点のHeight)
+ */
+uint32_t bc_headers_tip(uint8_t *pHash, bc_pow_work_t *pWork);
+
+
+/** header取得
+ *
+ * @param[out]  pHeader     block header(80byte)
+ * @param[in]   Height      Block Height
+ * @retval  true    取得OK
+ */
+bool bc_headers_get(uint8_t *pHeader, uint32_t Height);
+
+
+/** Block Hash取得
+ *
+ * @param[out]  pHash       Block Hash
+ * @param[in]   Height      Block Height(起点〜tip)
+ * @retval  true    取得OK
+ */
+bool bc_headers_get_hash(uint8_t *pHash, uint32_t Height);
+
+
+/** Block Hash検索
+ *
+ * @param[out]  pHeight     pHashのBlock Height
+ * @param[in]   pHash       Block Hash
+ * @retval  true    保存済み(起点を含む)
+ */
+bool bc_headers_find(uint32_t *pHeight, const uint8_t *pHash);
+
+
+/** block locator作成
+ *
+ * tipから10個、以降は間隔を倍にしながら起点まで並べる。
+ *
+ * @param[out]  pHashes     Block Hash配列(BC_HEADERS_LOCATOR_MAX * BTC_SZ_HASH256)
+ * @return      Block Hash数
+ */
+int bc_headers_locator(uint8_t *pHashes);
+
+
+/** Heightより上の累積chainwork
+ *
+ * @param[out]  pWork       Height+1〜tipのchainwork
+ * @param[in]   Height      Block Height
+ */
+void bc_headers_work_above(bc_pow_work_t *pWork, uint32_t Height);
+
+
+/** difficulty検証用の値を保存済みheaderから作る
+ *
+ * 起点がgenesisでない場合、起点を含む期間は分からない値が残る。
+ *
+ * @param[out]  pDiff       difficulty検証用の値
+ * @param[in]   Height      検証するheaderの1つ前のBlock Height(起点〜tip)
+ */
+void bc_headers_diff_init(bc_headers_diff_t *pDiff, uint32_t Height);
+
+
+/** header検証
+ *
+ * @param[out]      pHash       pHeaderのBlock Hash
+ * @param[in]       pHeader     block header(80byte)
+ * @param[in]       Height      pHeaderのBlock Height
+ * @param[in]       pPrevHash   1つ前のBlock Hash
+ * @param[in,out]   pDiff       difficulty検証用の値(OK時はpHeaderで更新する)
+ * @retval  true    OK
+ *
+ * @note
+ *      - prev_blockがpPrevHashと一致すること
+ *      - checkpointのheightではhashが一致すること(checkpointより下のforkは受け付けない)
+ *      - ASSUMEVALID時、最新checkpoint以下はPoW検証を省略する(CHECKPOINT_STARTで起点を下げた場合)
+ *      - nBitsが前のheaderからのdifficulty調整規則に従うこと。
+ *        期間最初のheaderが分からない調整は1/4～4倍の範囲だけ検証する
+ */
+bool bc_headers_check(uint8_t *pHash, const uint8_t *pHeader, uint32_t Height, const uint8_t *pPrevHash, bc_headers_diff_t *pDiff);
+
+
+/** header追加
+ *
+ * @param[in]   pHeader     検証済みblock header(80byte)
+ * @retval  true    OK
+ */
+bool bc_headers_append(const uint8_t *pHeader);
+
+
+/** header削除
+ *
+ * Heightより上のheaderを削除する(reorg用)。
+ *
+ * @param[in]   Height      残すBlock Height
+ * @param[in]   pHash       HeightのBlock Hash(異なる場合は削除しない)
+ * @retval  true    OK
+ */
+bool bc_headers_truncate(uint32_t Height, const uint8_t *pHash);
+
+
+/** header snapshot出力
+ *
+ * @param[in]   pFname      出力ファイル名
+ * @retval  true    OK
+ */
+bool bc_headers_export(const char *pFname);
+
+
+/** header snapshot読込み
+ *
+ * checksum, checkpoint, linkage, PoWを検証して保存データを置き換える。
+ * 照合済みの位置(FNAME_BLOCK)は変えないので、取り込んだ範囲も照合する。
+ * 起点が照合済みの位置より上のsnapshotは使えない。
+ *
+ * @param[in]   pFname      snapshotファイル名
+ * @retval  true    OK
+ */
+bool bc_headers_import(const char *pFname);
+
+#endif /* BC_HEADERS_H__ */
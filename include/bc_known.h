@@ -0,0 +1,67 @@
+/**************************************************************************
+ * @file    bc_known.h
+ * @brief   既知inv(最近見たtxid)ヘッダ
+ **************************************************************************/
+#ifndef BC_KNOWN_H__
+#define BC_KNOWN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_KNOWN_GEN_MAX        (50000)         ///< 1世代に入れる数(2世代分を覚える)
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_KNOWNがあれば読み込む。
+ *
+ * @retval  true    読み込んだ
+ */
+bool bc_known_init(void);
+
+
+/** 終了
+ *
+ * FNAME_KNOWNに保存する。
+ */
+void bc_known_term(void);
+
+
+/** 保存
+ *
+ * 再起動後に同じtxを取得し直さないよう、bloom filterをそのままFNAME_KNOWNに書く。
+ *
+ * @retval  true    OK
+ */
+bool bc_known_save(void);
+
+
+/** 既知か確認して追加
+ *
+ * 2世代のbloom filterで最近のBC_KNOWN_GEN_MAX～2倍の数を覚える。
+ * 誤って既知とする確率は1e-7程度。
+ *
+ * @param[in]   pHash       txid(32byte)
+ * @retval  true    既知(追加しない)
+ * @retval  false   未知(追加した)
+ */
+bool bc_known_check_add(const uint8_t *pHash);
+
+
+/** 既知か
+ *
+ * @param[in]   pHash       txid(32byte)
+ * @retval  true    既知
+ */
+bool bc_known_find(const uint8_t *pHash);
+
+#endif /* BC_KNOWN_H__ */
@@ -0,0 +1,149 @@
+/**************************************************************************
+ * @file    bc_mempool.h
+ * @brief   監視対象txのmempoolヘッダ
+ **************************************************************************/
+#ifndef BC_MEMPOOL_H__
+#define BC_MEMPOOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bc_txview.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_MEMPOOL_FEE_UNKNOWN  (-1)            ///< 入力の額が分からない
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum bc_mempool_result_t
+ *
+ * bc_mempool_add()の結果
+ */
+typedef enum {
+    BC_MEMPOOL_ADDED,                           ///< 追加した
+    BC_MEMPOOL_IGNORED,                         ///< 監視対象でも祖先でもない
+    BC_MEMPOOL_EXISTS,                          ///< 追加済み
+    BC_MEMPOOL_REPLACED,                        ///< 二重使用のtxをfee rateで置き換えた
+    BC_MEMPOOL_CONFLICT,                        ///< 二重使用(追加しない)
+    BC_MEMPOOL_FULL,                            ///< 上限を超える(追加しない)
+} bc_mempool_result_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_MEMPOOLがあれば読み込む。古すぎるtxは捨てる。
+ * 監視対象のoutpointを戻すため、bc_watch_init()の後で呼ぶ。
+ *
+ * @retval  true    読み込んだ
+ */
+bool bc_mempool_init(void);
+
+
+/** 終了
+ *
+ * FNAME_MEMPOOLに保存し、全txを解放する。
+ */
+void bc_mempool_term(void);
+
+
+/** 保存
+ *
+ * 受信した時刻と一緒に、古い順でFNAME_MEMPOOLに書く。
+ *
+ * @retval  true    OK
+ */
+bool bc_mempool_save(void);
+
+
+/** tx追加
+ *
+ * 監視対象のtx、またはmempool中のtxが使っているtx(祖先)を追加する。
+ * 同じoutpointを使うtxがあれば、fee rateが全て分かっていて高い場合だけ置き換える。
+ * 上限を超えた場合はfee rateの低いものから子孫ごと捨てる。
+ * 置き換えられるtxの分は空くものとして数え、入る場合だけ外す。
+ *
+ * @param[in]   pView       解析済みtx
+ * @param[in]   bWatch      true:監視対象のtx
+ * @return      結果
+ */
+bc_mempool_result_t bc_mempool_add(const bc_txview_t *pView, bool bWatch);
+
+
+/** 追加済みか
+ *
+ * @param[in]   pTxid       txid
+ * @retval  true    追加済み
+ */
+bool bc_mempool_find(const uint8_t *pTxid);
+
+
+/** mempoolに無い入力元txのtxid
+ *
+ * 入力元のtxが全てmempoolに揃うとfeeがわかるので、呼び出し元で要求する。
+ * 承認済みのtxはpeerのmempoolにも無いので、届くのは未承認のものだけになる。
+ *
+ * @param[in]   pView       解析済みtx
+ * @param[out]  pTxids      txid(重複なし, Max * BTC_SZ_TXID)
+ * @param[in]   Max         pTxidsに入る数
+ * @return      txid数
+ */
+int bc_mempool_missing(const bc_txview_t *pView, uint8_t *pTxids, int Max);
+
+
+/** outpointを使っているtx
+ *
+ * @param[in]   pOutpoint   outpoint(txid + index)
+ * @param[out]  pTxid       使っているtxのtxid(NULL可)
+ * @retval  true    使っているtxがある
+ */
+bool bc_mempool_spender(const uint8_t *pOutpoint, uint8_t *pTxid);
+
+
+/** blockに入ったtx
+ *
+ * headersにあるblockのtxだけ渡すこと。
+ * 同じtxを外し、同じoutpointを使っていたtxは子孫ごと捨てる。
+ * feeがわかっているtxは、入るまでのblock数をbc_fee_confirmed()に記録する。
+ *
+ * @param[in]   pView       解析済みtx
+ * @param[in]   Height      blockのBlock Height(0:不明)
+ */
+void bc_mempool_confirm(const bc_txview_t *pView, uint32_t Height);
+
+
+/** block中の全txをbc_mempool_confirm()する
+ *
+ * @param[in]   pBlock      raw block
+ * @param[in]   Len         pBlock長
+ * @param[in]   Height      blockのBlock Height(0:不明)
+ */
+void bc_mempool_block(const uint8_t *pBlock, size_t Len, uint32_t Height);
+
+
+/** 未承認残高
+ *
+ * mempool中のtxの監視対象outputのうち、mempool中で使われていないものの合計。
+ *
+ * @return      satoshi
+ */
+uint64_t bc_mempool_unconfirmed(void);
+
+
+/** log出力
+ *
+ */
+void bc_mempool_print(void);
+
+#endif /* BC_MEMPOOL_H__ */
@@ -0,0 +1,60 @@
+/**************************************************************************
+ * @file    bc_merkle.h
+ * @brief   partial merkle tree検証ヘッダ(BIP37)
+ **************************************************************************/
+#ifndef BC_MERKLE_H__
+#define BC_MERKLE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_MERKLE_TX_MAX        (1000000 / 60)  ///< 1blockのtx数上限(最小tx sizeから)
+#define BC_MERKLE_DEPTH_MAX     (32)            ///< tree高さ上限
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** partial merkle tree検証
+ *
+ * flagsとhashesからmerkle rootを計算し、一致したtxidを取り出す。
+ * 再帰もメモリ確保もせず、hashes/flagsの長さに比例する時間で終わる。
+ *
+ * @param[out]  pRoot       計算したmerkle root
+ * @param[out]  pMatched    一致したtxid(32byte * MatchedMax)
+ * @param[out]  pMatchedNum 一致したtxid数(MatchedMaxを超えた分は格納しない)
+ * @param[in]   MatchedMax  pMatchedに格納できる数
+ * @param[in]   TxCount     blockのtx数
+ * @param[in]   pHashes     hashes(32byte * HashCount)
+ * @param[in]   HashCount   hash数
+ * @param[in]   pFlags      flag bits
+ * @param[in]   FlagBytes   flag byte数
+ * @retval  true    構造が正しい(merkle_rootとの比較は呼び元で行う)
+ */
+bool bc_merkle_verify(uint8_t *pRoot,
+                uint8_t *pMatched, uint32_t *pMatchedNum, uint32_t MatchedMax,
+                uint32_t TxCount,
+                const uint8_t *pHashes, uint32_t HashCount,
+                const uint8_t *pFlags, uint32_t FlagBytes);
+
+
+
+/** merkle root計算
+ *
+ * 1段ずつbc_sha256_hash256_d64()でまとめて計算する。pHashesは作業領域として上書きする。
+ *
+ * @param[out]      pRoot       merkle root
+ * @param[out]      pMutated    true:同じhashが並んでいた(CVE-2012-2459)
+ * @param[in,out]   pHashes     葉のhash(BTC_SZ_HASH256 * (Num + 1)確保すること)
+ * @param[in]       Num         葉の数
+ * @retval  true    OK
+ */
+bool bc_merkle_root(uint8_t *pRoot, bool *pMutated, uint8_t *pHashes, uint32_t Num);
+
+#endif /* BC_MERKLE_H__ */
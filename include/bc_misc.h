@@ -5,15 +5,27 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "user_config.h"
+#ifdef ALLOCATOR
+#include "bc_alloc.h"
+#endif
+
 
 /**************************************************************************
  * macros
  **************************************************************************/
 
+#ifdef ALLOCATOR
+#define CALLOC(n,s)     bc_alloc_calloc(n, s, __FILE__, __LINE__)
+#define REALLOC(p,s)    bc_alloc_realloc(p, s, __FILE__, __LINE__)
+#define MALLOC(s)       bc_alloc_malloc(s, __FILE__, __LINE__)
+#define FREE(p)         bc_alloc_free(p)
+#else
 #define CALLOC      calloc
 #define REALLOC     realloc
 #define MALLOC      malloc
 #define FREE        free
+#endif
 #define MEMCPY      memcpy
 #define MEMSET      memset
 #define MEMCMP      memcmp
@@ -8,5 +8,7 @@
 
 bool bc_network_connect(void);
 ssize_t bc_network_read(int fd, void *buf, size_t nbytes);
+bool bc_network_start_helpers(void);
+void bc_network_stop(void);
 
 #endif /* BC_CONNECT_H__ */
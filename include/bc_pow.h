@@ -0,0 +1,109 @@
+/**************************************************************************
+ * @file    bc_pow.h
+ * @brief   Proof of Work / chainwork計算ヘッダ
+ **************************************************************************/
+#ifndef BC_POW_H__
+#define BC_POW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_POW_LIMIT_BITS       ((uint32_t)0x1d00ffff)  ///< mainnet/testnet共通のpowLimit
+#define BC_POW_WORK_LIMBS       (8)                     ///< 256bit / 32bit
+#define BC_POW_INTERVAL         (2016)                  ///< difficulty調整間隔(block数)
+#define BC_POW_TIMESPAN         (14 * 24 * 60 * 60)     ///< 調整間隔の目標時間(秒)
+#define BC_POW_SPACING          (10 * 60)               ///< 1blockの目標時間(秒)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_pow_work_t
+ *
+ * 累積chainwork(256bit, little endian limb)
+ */
+typedef struct {
+    uint32_t    limb[BC_POW_WORK_LIMBS];
+} bc_pow_work_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** nBitsからtargetに展開
+ *
+ * @param[out]  pTarget     target(32byte, little endian)
+ * @param[in]   Bits        nBits
+ * @retval  true    正常なtarget
+ */
+bool bc_pow_target(uint8_t *pTarget, uint32_t Bits);
+
+
+/** PoW検証
+ *
+ * @param[in]   pHash       Block Hash(内部バイト順)
+ * @param[in]   Bits        nBits
+ * @retval  true    hash <= target かつ target <= powLimit
+ */
+bool bc_pow_check(const uint8_t *pHash, uint32_t Bits);
+
+
+/** difficulty調整後のnBits計算
+ *
+ * 前の期間にかかった時間から次の期間のnBitsを求める(目標時間の1/4～4倍に制限、powLimitを超えない)。
+ *
+ * @param[in]   LastBits    期間最後のheaderのnBits
+ * @param[in]   FirstTime   期間最初のheaderのtime
+ * @param[in]   LastTime    期間最後のheaderのtime
+ * @return      次の期間のnBits
+ */
+uint32_t bc_pow_retarget(uint32_t LastBits, uint32_t FirstTime, uint32_t LastTime);
+
+
+/** difficulty調整幅の検証
+ *
+ * 前の期間の時間が分からない場合に使う。
+ *
+ * @param[in]   Bits        調整後のnBits
+ * @param[in]   LastBits    期間最後のheaderのnBits
+ * @retval  true    LastBitsのtargetの1/4～4倍(powLimit以下)に収まっている
+ */
+bool bc_pow_check_range(uint32_t Bits, uint32_t LastBits);
+
+
+/** chainwork加算
+ *
+ * nBitsから1block分のwork(2^256 / target)を求めて加算する。
+ *
+ * @param[in,out]   pWork   累積chainwork
+ * @param[in]       Bits    nBits
+ */
+void bc_pow_work_add(bc_pow_work_t *pWork, uint32_t Bits);
+
+
+/** chainwork減算
+ *
+ * bc_pow_work_add()で加算した分を戻す。
+ *
+ * @param[in,out]   pWork   累積chainwork
+ * @param[in]       Bits    nBits
+ */
+void bc_pow_work_sub(bc_pow_work_t *pWork, uint32_t Bits);
+
+
+/** chainwork比較
+ *
+ * @retval  <0  pWork1 < pWork2
+ * @retval  0   pWork1 == pWork2
+ * @retval  >0  pWork1 > pWork2
+ */
+int bc_pow_work_cmp(const bc_pow_work_t *pWork1, const bc_pow_work_t *pWork2);
+
+#endif /* BC_POW_H__ */
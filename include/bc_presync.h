@@ -0,0 +1,100 @@
+/**************************************************************************
+ * @file    bc_presync.h
+ * @brief   headers presyncヘッダ
+ **************************************************************************/
+#ifndef BC_PRESYNC_H__
+#define BC_PRESYNC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc.h"
+#include "bc_pow.h"
+#include "bc_headers.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_PRESYNC_REC_SZ       (BC_HEADERS_SZ + 1)     ///< headersのheader長(txn_countを含む)
+#define BC_PRESYNC_HEADERS_MAX  (2000)                  ///< 1つのheadersに含まれる最大数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum   bc_presync_state_t
+ */
+typedef enum {
+    BC_PRESYNC_STATE_IDLE,              ///< 未開始
+    BC_PRESYNC_STATE_DIRECT,            ///< 自chainよりworkが多いことを確認済み: 受信headerを保存する
+    BC_PRESYNC_STATE_PRESYNC,           ///< chainwork累積中: 保存しない
+    BC_PRESYNC_STATE_REDOWNLOAD,        ///< 分岐点から再取得中: commitmentと照合する
+} bc_presync_state_t;
+
+
+/** @enum   bc_presync_ret_t
+ */
+typedef enum {
+    BC_PRESYNC_NEXT,                    ///< 続きを要求する
+    BC_PRESYNC_END,                     ///< peerのheadersを読み終えた
+    BC_PRESYNC_ERROR,                   ///< 不正なheaders
+} bc_presync_ret_t;
+
+
+/** @struct bc_presync_t
+ *
+ * peer毎のheaders同期状態。
+ * 受信したheaders数によらずサイズは一定。
+ */
+typedef struct {
+    bc_presync_state_t  state;
+
+    uint32_t        fork_height;                    ///< 分岐点Block Height
+    uint8_t         fork_hash[BTC_SZ_HASH256];      ///< 分岐点Block Hash
+    bool            b_first;                        ///< 分岐点からの最初のheaders受信中
+
+    uint32_t        height;                         ///< 最後に受信したheaderのBlock Height
+    uint8_t         last_hash[BTC_SZ_HASH256];      ///< 最後に受信したheaderのBlock Hash
+    bc_pow_work_t   work;                           ///< 分岐点から受信したchainwork
+    bc_headers_diff_t   diff;                       ///< difficulty検証用
+    bc_pow_work_t   threshold;                      ///< 分岐点から自chain tipまでのchainwork
+
+    uint32_t        end_height;                     ///< [commitment]thresholdを超えたBlock Height
+    uint8_t         end_hash[BTC_SZ_HASH256];       ///< [commitment]thresholdを超えたBlock Hash
+    FILE            *fp;                            ///< 再取得したheader(メモリではなく一時ファイルに置く)
+    FILE            *undo;                          ///< reorgで外したheader(保存に失敗したら戻す)
+} bc_presync_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 状態初期化
+ *
+ * @param[in,out]   pSync   presync状態
+ */
+void bc_presync_reset(bc_presync_t *pSync);
+
+
+/** headers処理
+ *
+ * 受信したheadersを検証し、分岐点以降のchainworkが自chainを超えたものだけ保存する。
+ *  - 分岐点 == tip : そのまま保存
+ *  - 分岐点 < tip  : chainworkだけ累積し、超えたら分岐点から再取得してcommitmentと照合後に保存
+ *  - 保存前にPoWとdifficulty調整(bc_headers_check())を検証する。
+ *    reorg後の保存に失敗した場合は、外したheaderを戻す
+ *
+ * @param[in,out]   pSync       presync状態
+ * @param[out]      pNextHash   BC_PRESYNC_NEXT時、次のgetheadersで指定するBlock Hash
+ * @param[in]       pHeaders    受信したheader(BC_PRESYNC_REC_SZ * Count)
+ * @param[in]       Count       header数
+ * @return      処理結果
+ */
+bc_presync_ret_t bc_presync_headers(bc_presync_t *pSync, uint8_t *pNextHash, const uint8_t *pHeaders, uint32_t Count);
+
+#endif /* BC_PRESYNC_H__ */
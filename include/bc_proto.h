@@ -11,13 +11,22 @@
 #define PTARM_USE_PRINTFUNC
 #include "bc_misc.h"
 #include "btc.h"
+#include "bc_presync.h"
+#include "bc_hdrsync.h"
+#include "bc_fblock.h"
+#include "bc_cfilter.h"
+#include "bc_rescan.h"
+#include "bc_bloom.h"
+#include "bc_watch.h"
+#include "bc_arena.h"
+#include "bc_sendbuf.h"
 
 
 /**************************************************************************
  * macros
  **************************************************************************/
 
-#define SZ_SEND_BUF             (3096)
+#define SZ_MERKLE_MATCH         (64)            ///< merkleblockで追跡するtx数
 
 
 /**************************************************************************
@@ -29,11 +38,26 @@ typedef struct bc_protoval_t {
 
     int         socket;
 
+    /** true:checkpoint区間取得用の接続 */
+    bool        helper;
+
+    /** peerのservices */
+    uint64_t    services;
+
     /** true:起動後のgetheaders完了 */
     bool        synced;
 
-    /** getheaders-->headers-->getdata後のmerkleblock数(カウントダウン) */
-    uint8_t     merkle_cnt;
+    /** 最後のmerkleblockで一致し、まだtxを受信していない数 */
+    uint16_t    merkle_cnt;
+
+    /** 最後のmerkleblockのBlock Height(0:headersにない) */
+    uint32_t    merkle_height;
+
+    /** 最後のmerkleblockのBlock Hash */
+    uint8_t     merkle_bhash[BTC_SZ_HASH256];
+
+    /** 最後のmerkleblockで一致したtxid(未受信分) */
+    uint8_t     merkle_txid[SZ_MERKLE_MATCH][BTC_SZ_TXID];
 
     /** ブロック高 */
     uint32_t    height;
@@ -43,8 +67,48 @@ typedef struct bc_protoval_t {
     /** headersで最後に読んだBlock Hash */
     uint8_t     last_headers_bhash[BTC_SZ_HASH256];
 
-    /** 送信バッファ */
-    uint8_t     buffer[SZ_SEND_BUF];
+    /** 新block通知を受けた時刻(usec, 0:なし) */
+    uint64_t    announce_usec;
+
+    /** true:新block通知がheaders, false:inv */
+    bool        announce_headers;
+
+    /** headers同期状態 */
+    bc_presync_t    presync;
+
+    /** checkpoint区間取得状態 */
+    bc_hdrsync_peer_t   hdrsync;
+
+    /** filtered block取得状態 */
+    bc_fblock_t     fblock;
+
+    /** true:compact filter(BIP157)で照合する */
+    bool        cfilter;
+
+    /** true:txの通知(inv)を受ける(filterload/filterclear後, CFILTER_TXRELAYのcfilter照合) */
+    bool        txrelay;
+
+    /** compact filter header取得状態 */
+    bc_cfilter_t    cfilter_val;
+
+    /** compact filter(rescan)取得状態 */
+    bc_rescan_peer_t    rescan;
+
+    /** tx要求管理のpeer番号(-1:管理外) */
+    int         txreq_peer;
+
+    /** peerに載せたbloom filter */
+    bc_bloom_t      bloom;
+
+    /** 保存済みcompact filterで照合する範囲(next > end:なし) */
+    uint32_t    cfstore_next;
+    uint32_t    cfstore_end;
+
+    /** 処理中の受信メッセージのchecksum */
+    uint8_t     recv_chksum[4];
+
+    /** 受信メッセージ処理用(処理毎にbc_arena_reset()) */
+    bc_arena_t      arena;
 } bc_protoval_t;
 
 
@@ -60,10 +124,84 @@ typedef struct bc_protoval_t {
 void bc_start(bc_protoval_t *pProtoVal);
 
 
+/** 開始(checkpoint区間・compact filter取得用)
+ *
+ * versionを送信して戻る。取得するものが無くなるとpProtoVal->loopがfalseになる。
+ *
+ * @param[in]       pProtoVal   protocol value
+ */
+void bc_start_helper(bc_protoval_t *pProtoVal);
+
+
 /** 受信データ処理
  *
  * @param[in]       pProtoVal   protocol value
  */
 bool bc_read_message(bc_protoval_t *pProtoVal);
 
+
+/** rescan照合結果処理
+ *
+ * bc_rescan_fd()が読込み可能になったら呼ぶ。
+ * 一致したblockをBlock Height順に要求する。
+ *
+ * @param[in]       pProtoVal   protocol value
+ */
+bool bc_read_rescan(bc_protoval_t *pProtoVal);
+
+
+/** 受信待ちtimeout処理
+ *
+ * 応答の無いtx要求を引き取る。helperはcompact filterの要求も行う。
+ *
+ * @param[in]       pProtoVal   protocol value
+ */
+bool bc_idle(bc_protoval_t *pProtoVal);
+
+
+/** FNAME_WATCH再読込み要求
+ *
+ * signal handlerから呼んでよい。main接続のbc_idle()で読み込み、
+ * 増えた要素をbc_add_watch()する。
+ */
+void bc_reload_watch(void);
+
+
+/** 監視要素の追加
+ *
+ * watch listに追加し、filterload済みならfilteraddで送る。
+ * 推定FP率が落ちていればfilterloadし直す。
+ * 受信threadから呼ぶこと。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @param[in]       Type        種類
+ * @param[in]       pData       要素
+ * @param[in]       Len         pData長
+ * @retval  true    OK
+ */
+bool bc_add_watch(bc_protoval_t *pProtoVal, bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+
+
+/** 送信メッセージ作成
+ *
+ * checksumまで設定する。複数peerに同じメッセージを送る場合に使う。
+ *
+ * @param[in]   pCmd        送信コマンド
+ * @param[in]   pPayload    payload
+ * @param[in]   Len         pPayload長
+ * @return      メッセージ(bc_sendbuf_release()で解放, 失敗時NULL)
+ */
+bc_sendbuf_t *bc_msg_new(const char *pCmd, const uint8_t *pPayload, size_t Len);
+
+
+/** メッセージ送信
+ *
+ * pBufの参照は呼び元に残る。同じpBufを続けて別のpeerに送ってよい。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       pBuf        bc_msg_new()で作成したメッセージ
+ * @retval  true    OK
+ */
+bool bc_send_msg(bc_protoval_t *pProtoVal, bc_sendbuf_t *pBuf);
+
 #endif /* BC_PROTO_H__ */
@@ -0,0 +1,218 @@
+/**************************************************************************
+ * @file    bc_rescan.h
+ * @brief   compact filterによる並列rescanヘッダ
+ **************************************************************************/
+#ifndef BC_RESCAN_H__
+#define BC_RESCAN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "btc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_RESCAN_WINDOW        (4000)          ///< 保持するBlock数(filter hash受信〜取り出し)
+#define BC_RESCAN_CHUNK         (100)           ///< getcfiltersで要求する数
+#define BC_RESCAN_PIPELINE      (2)             ///< peer毎の要求中getcfilters数
+#define BC_RESCAN_WORKER_MAX    (64)            ///< 照合thread数上限
+#define BC_RESCAN_TIMEOUT_USEC  ((uint64_t)60 * 1000000)    ///< getcfilters 1要求あたりの応答待ち時間
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_rescan_chunk_t
+ *
+ * getcfiltersの要求範囲
+ */
+typedef struct {
+    uint32_t    start;
+    uint32_t    stop;
+    uint64_t    expire;                         ///< 受信期限(usec)
+} bc_rescan_chunk_t;
+
+
+/** @struct bc_rescan_result_t
+ *
+ * 照合結果
+ */
+typedef struct {
+    uint32_t    height;                         ///< Block Height
+    bool        matched;                        ///< true:照合一致
+    uint8_t     bhash[BTC_SZ_HASH256];          ///< Block Hash
+    uint8_t     filter_header[BTC_SZ_HASH256];  ///< filter header
+    uint8_t     *p_filter;                      ///< filter(受け取った側でFREEする)
+    size_t      len;                            ///< p_filter長
+} bc_rescan_result_t;
+
+
+/** @struct bc_rescan_peer_t
+ *
+ * peer毎の取得状態
+ */
+typedef struct {
+    uint32_t            gen;                    ///< 割り当てたrescanの世代
+    int                 num;                    ///< 要求中chunk数
+    uint32_t            next;                   ///< chunk[0]で次に受信するBlock Height
+    uint32_t            skip;                   ///< 期限切れで他peerに回した分(受信しても読み捨てる数)
+    uint64_t            skip_expire;            ///< skipの読み捨てを諦める時刻(usec)
+    bc_rescan_chunk_t   chunk[BC_RESCAN_PIPELINE];
+} bc_rescan_peer_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** rescan開始
+ *
+ * 照合threadを起動する。動作中のrescanは破棄する。
+ *
+ * @param[in]   From        最初に照合するBlock Height
+ * @param[in]   To          最後のBlock Height
+ * @param[in]   pItems      照合するscriptPubKey(複製して使う)
+ * @param[in]   Num         pItems数
+ * @retval  true    OK
+ */
+bool bc_rescan_start(uint32_t From, uint32_t To, const utl_buf_t *pItems, int Num);
+
+
+/** rescan停止
+ *
+ */
+void bc_rescan_stop(void);
+
+
+/** 範囲の延長(新block)
+ *
+ * @param[in]   To          最後のBlock Height
+ */
+void bc_rescan_extend(uint32_t To);
+
+
+/** filter hash追加余地
+ *
+ * @return  bc_rescan_hashes()で追加できる数
+ */
+uint32_t bc_rescan_room(void);
+
+
+/** filter hash追加
+ *
+ * cfheadersで検証済みのfilter hashを追加し、getcfiltersで要求できるようにする。
+ *
+ * @param[in]   Start       pHashes[0]のBlock Height
+ * @param[in]   pHashes     filter hash(BTC_SZ_HASH256 * Num)
+ * @param[in]   pHeaders    filter header(BTC_SZ_HASH256 * Num)
+ * @param[in]   Num         filter hash数
+ * @retval  true    OK
+ */
+bool bc_rescan_hashes(uint32_t Start, const uint8_t *pHashes, const uint8_t *pHeaders, uint32_t Num);
+
+
+/** 保存済みfilter追加
+ *
+ * 検証済みのfilterを、getcfiltersで要求せずに照合threadへ渡す。
+ *
+ * @param[in]   Height      Block Height(次に追加するBlock Heightであること)
+ * @param[in]   pBlockHash  Block Hash
+ * @param[in]   pHeader     filter header
+ * @param[in]   pFilter     filter(MALLOCしたもの。失敗時もFREEする)
+ * @param[in]   Len         pFilter長
+ * @retval  true    OK
+ */
+bool bc_rescan_local(uint32_t Height, const uint8_t *pBlockHash, const uint8_t *pHeader, uint8_t *pFilter, size_t Len);
+
+
+/** getcfilters割当て
+ *
+ * 未要求の範囲を低い方から割り当てる。
+ * 期限は先に要求している分の応答を待つ時間も含める。
+ * 期限切れ分がさらにBC_RESCAN_TIMEOUT_USEC届かなければ読み捨てを諦めて割り当てを再開する
+ * (その後に届いた分は要求していないfilterとして失敗になる)。
+ *
+ * @param[in,out]   pPeer       peer状態
+ * @param[out]      pStart      getcfiltersのstart_height
+ * @param[out]      pStopHash   getcfiltersのstop_hash
+ * @param[in]       Now         現在時刻(usec)
+ * @retval  true    割り当てた
+ * @retval  false   要求中が上限 or 未要求なし or 期限切れ分の読み捨て中
+ */
+bool bc_rescan_assign(bc_rescan_peer_t *pPeer, uint32_t *pStart, uint8_t *pStopHash, uint64_t Now);
+
+
+/** 期限切れの確認
+ *
+ * 受信中のchunkが期限を過ぎていれば、受信していない範囲を全て他peerに割り当てられるようにする。
+ * 後から届いた分は読み捨てる。
+ *
+ * @param[in,out]   pPeer       peer状態
+ * @param[in]       Now         現在時刻(usec)
+ * @return      他peerに回したBlock数
+ */
+uint32_t bc_rescan_expire(bc_rescan_peer_t *pPeer, uint64_t Now);
+
+
+/** cfilter受信
+ *
+ * filter hashを確認して照合threadへ渡す。
+ * 以前のrescanで要求したcfilterは読み捨てる。
+ *
+ * @param[in,out]   pPeer       peer状態
+ * @param[in]       pBlockHash  Block Hash
+ * @param[in]       pFilter     filter
+ * @param[in]       Len         pFilter長
+ * @retval  true    OK
+ */
+bool bc_rescan_filter(bc_rescan_peer_t *pPeer, const uint8_t *pBlockHash, const uint8_t *pFilter, size_t Len);
+
+
+/** peer状態解放
+ *
+ * 受信していない範囲は他peerに割り当てられるようにする。
+ *
+ * @param[in,out]   pPeer       peer状態
+ */
+void bc_rescan_release(bc_rescan_peer_t *pPeer);
+
+
+/** 照合完了通知fd
+ *
+ * 照合結果をbc_rescan_pop()できるようになると読込み可能になる。
+ *
+ * @return  fd(-1:rescan停止中)
+ */
+int bc_rescan_fd(void);
+
+
+/** 照合完了通知の消去
+ *
+ * bc_rescan_pop()の前に呼ぶ。
+ */
+void bc_rescan_clear_event(void);
+
+
+/** 照合結果取り出し
+ *
+ * 照合はBlock Height範囲ごとに並列に行うが、取り出しはBlock Height順。
+ *
+ * @param[out]  pResult     照合結果(p_filterはFREEすること)
+ * @retval  true    取り出した
+ * @retval  false   次のBlock Heightが照合中
+ */
+bool bc_rescan_pop(bc_rescan_result_t *pResult);
+
+
+/** rescan完了
+ *
+ * @retval  true    最後のBlock Heightまで取り出した(停止中を含む)
+ */
+bool bc_rescan_done(void);
+
+#endif /* BC_RESCAN_H__ */
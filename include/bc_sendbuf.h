@@ -0,0 +1,76 @@
+/**************************************************************************
+ * @file    bc_sendbuf.h
+ * @brief   送信バッファpoolヘッダ
+ **************************************************************************/
+#ifndef BC_SENDBUF_H__
+#define BC_SENDBUF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_SENDBUF_CLASS_NUM    (3)             ///< size class数
+#define BC_SENDBUF_KEEP         (8)             ///< size classごとに残す空きバッファ数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_sendbuf_t
+ *
+ * 参照カウント付き送信バッファ。
+ * 同じメッセージを複数peerに送る場合は、bc_sendbuf_ref()して各送信後にbc_sendbuf_release()する。
+ */
+typedef struct bc_sendbuf_t {
+    struct bc_sendbuf_t *p_next;                ///< poolの空きlist
+    uint32_t    ref;                            ///< 参照数
+    uint32_t    size;                           ///< data確保長
+    uint32_t    len;                            ///< data使用長(送信長)
+    int         cls;                            ///< size class(-1:poolに戻さない)
+    uint8_t     data[];
+} bc_sendbuf_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** バッファ取得
+ *
+ * Size以上のsize classの空きバッファを返す。大きいものはpoolに戻さない。
+ *
+ * @param[in]   Size        必要な長さ
+ * @return      バッファ(ref=1, len=0, 失敗時NULL)
+ */
+bc_sendbuf_t *bc_sendbuf_get(size_t Size);
+
+
+/** 参照追加
+ *
+ * @param[in,out]   pBuf        バッファ
+ */
+void bc_sendbuf_ref(bc_sendbuf_t *pBuf);
+
+
+/** 参照解放
+ *
+ * 参照が無くなればpoolに戻す。
+ *
+ * @param[in,out]   pBuf        バッファ(NULL可)
+ */
+void bc_sendbuf_release(bc_sendbuf_t *pBuf);
+
+
+/** 終了
+ *
+ * poolの空きバッファを解放する。
+ */
+void bc_sendbuf_term(void);
+
+#endif /* BC_SENDBUF_H__ */
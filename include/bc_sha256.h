@@ -0,0 +1,98 @@
+/**************************************************************************
+ * @file    bc_sha256.h
+ * @brief   SHA256ヘッダ
+ * @note
+ *      - btc_util_hash256()は長さがuint16_tのため、64KB以上のデータはこちらを使う
+ *      - merkle treeなど64byteを大量に計算する場合もこちらが速い(bc_sha256.c参照)
+ **************************************************************************/
+#ifndef BC_SHA256_H__
+#define BC_SHA256_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_SHA256_SZ_HASH       (32)
+#define BC_SHA256_SZ_BLOCK      (64)
+#define BC_SHA256_LANES         (4)             ///< bc_sha256_hash256_d64()で同時に計算する数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_sha256_t
+ *
+ * SHA256 context
+ */
+typedef struct {
+    uint32_t    state[8];
+    uint64_t    total;                          ///< 入力済みbyte数
+    uint8_t     block[BC_SHA256_SZ_BLOCK];      ///< 未処理データ
+} bc_sha256_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * @param[out]  pCtx        context
+ */
+void bc_sha256_init(bc_sha256_t *pCtx);
+
+
+/** データ追加
+ *
+ * @param[in,out]   pCtx    context
+ * @param[in]       pData   データ
+ * @param[in]       Len     pData長
+ */
+void bc_sha256_update(bc_sha256_t *pCtx, const void *pData, size_t Len);
+
+
+/** SHA256値取得
+ *
+ * @param[out]      pHash   SHA256(32byte)
+ * @param[in,out]   pCtx    context
+ */
+void bc_sha256_final(uint8_t *pHash, bc_sha256_t *pCtx);
+
+
+/** SHA256(SHA256(data))
+ *
+ * @param[out]  pHash       HASH256(32byte)
+ * @param[in]   pData       データ
+ * @param[in]   Len         pData長
+ */
+void bc_sha256_hash256(uint8_t *pHash, const void *pData, size_t Len);
+
+
+/** SHA256(SHA256(data))の後半
+ *
+ * bc_sha256_final()で得たSHA256値から、もう一度SHA256を計算する。
+ *
+ * @param[out]  pHash       HASH256(32byte)
+ * @param[in]   pSha256     SHA256(32byte)
+ */
+void bc_sha256_second(uint8_t *pHash, const uint8_t *pSha256);
+
+
+/** 64byteずつのSHA256(SHA256(data))をまとめて計算
+ *
+ * merkle treeの1段分を計算する。BC_SHA256_LANES個ずつ並べて計算する。
+ *
+ * @param[out]  pHash       HASH256(32byte * Num)
+ * @param[in]   pData       データ(64byte * Num)
+ * @param[in]   Num         個数
+ * @note
+ *      - pHashはpDataと同じ位置でもよい(前から順に上書きする)
+ */
+void bc_sha256_hash256_d64(uint8_t *pHash, const uint8_t *pData, size_t Num);
+
+#endif /* BC_SHA256_H__ */
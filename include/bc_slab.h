@@ -0,0 +1,47 @@
+/**************************************************************************
+ * @file    bc_slab.h
+ * @brief   block受信用の大きいバッファpoolヘッダ
+ **************************************************************************/
+#ifndef BC_SLAB_H__
+#define BC_SLAB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_SLAB_SZ              (4000000)       ///< バッファ長(block最大長)
+#define BC_SLAB_KEEP            (2)             ///< 残す空きバッファ数
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** バッファ取得
+ *
+ * @return      BC_SLAB_SZのバッファ(失敗時NULL)
+ */
+uint8_t *bc_slab_get(void);
+
+
+/** バッファ返却
+ *
+ * BC_SLAB_KEEP個までは解放せずに次のbc_slab_get()で返す。
+ *
+ * @param[in]   p           bc_slab_get()で取得したバッファ(NULL可)
+ */
+void bc_slab_put(uint8_t *p);
+
+
+/** 終了
+ *
+ * 空きバッファを解放する。
+ */
+void bc_slab_term(void);
+
+#endif /* BC_SLAB_H__ */
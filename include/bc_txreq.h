@@ -0,0 +1,88 @@
+/**************************************************************************
+ * @file    bc_txreq.h
+ * @brief   接続をまたいだtx要求管理ヘッダ
+ **************************************************************************/
+#ifndef BC_TXREQ_H__
+#define BC_TXREQ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_TXREQ_PEER_MAX       (32)            ///< 同時に扱う接続数
+#define BC_TXREQ_MAX            (32768)         ///< 管理するtx数
+#define BC_TXREQ_PEER_ANN_MAX   (5000)          ///< 1接続が要求中・候補にできるtx数
+#define BC_TXREQ_TIMEOUT_USEC   (30 * 1000000ULL)   ///< 応答が無ければ他の接続で要求し直す
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 接続登録
+ *
+ * @return      peer番号(-1:空きなし)
+ */
+int bc_txreq_peer_add(void);
+
+
+/** 接続解除
+ *
+ * このpeerで要求中のtxは他のpeerで要求し直せるようにする。
+ *
+ * @param[in]   Peer        peer番号(-1可)
+ */
+void bc_txreq_peer_remove(int Peer);
+
+
+/** tx通知(inv)
+ *
+ * どこにも要求していなければPeerで要求することにする。
+ * 要求中なら候補として覚えるだけにする。
+ * PeerがBC_TXREQ_PEER_ANN_MAX個を要求中・候補にしていれば、新しい通知は無視する。
+ *
+ * @param[in]   Peer        通知したpeer番号
+ * @param[in]   pTxid       txid
+ * @param[in]   Now         現在時刻(usec)
+ * @retval  true    Peerでgetdataすること
+ */
+bool bc_txreq_announce(int Peer, const uint8_t *pTxid, uint64_t Now);
+
+
+/** tx受信
+ *
+ * 管理から外す。
+ *
+ * @param[in]   pTxid       txid
+ */
+void bc_txreq_received(const uint8_t *pTxid);
+
+
+/** notfound受信
+ *
+ * Peerを候補から外し、他の候補があれば要求し直せるようにする。
+ *
+ * @param[in]   Peer        notfoundを返したpeer番号
+ * @param[in]   pTxid       txid
+ */
+void bc_txreq_notfound(int Peer, const uint8_t *pTxid);
+
+
+/** 要求し直すtx
+ *
+ * timeoutした要求を候補の残るtxに戻し(候補が無ければ忘れる)、
+ * そのうちPeerが通知していたものをPeerで要求することにする。
+ *
+ * @param[in]   Peer        peer番号
+ * @param[in]   Now         現在時刻(usec)
+ * @param[out]  pTxids      Peerでgetdataするtxid(32byte * 戻り値)
+ * @param[in]   Max         pTxidsに入る数
+ * @return      pTxidsに入れた数
+ */
+int bc_txreq_poll(int Peer, uint64_t Now, uint8_t *pTxids, int Max);
+
+#endif /* BC_TXREQ_H__ */
@@ -0,0 +1,170 @@
+/**************************************************************************
+ * @file    bc_txview.h
+ * @brief   raw txの部分読み(確保なし)ヘッダ
+ **************************************************************************/
+#ifndef BC_TXVIEW_H__
+#define BC_TXVIEW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_TXVIEW_OUTPOINT_SZ   (36)            ///< outpoint長(txid + index)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bc_txview_t
+ *
+ * raw txの各部の位置(raw txを指すだけで確保しない)
+ */
+typedef struct {
+    const uint8_t   *p_tx;                      ///< raw tx
+    uint32_t        len;                        ///< tx長
+    bool            segwit;                     ///< true:marker, flagあり
+    uint32_t        vin_cnt;
+    uint32_t        vout_cnt;
+    const uint8_t   *p_vin;                     ///< 最初のvin
+    const uint8_t   *p_vout;                    ///< 最初のvout
+    const uint8_t   *p_wit;                     ///< 最初のwitness(segwitのみ)
+    const uint8_t   *p_locktime;                ///< locktime
+} bc_txview_t;
+
+
+/** @struct bc_txview_vin_t
+ *
+ * vin(raw txを指す)
+ */
+typedef struct {
+    const uint8_t   *p_outpoint;                ///< txid + index(BC_TXVIEW_OUTPOINT_SZ)
+    const uint8_t   *p_script;                  ///< scriptSig
+    uint32_t        script_len;
+    uint32_t        sequence;
+    const uint8_t   *p_wit;                     ///< 最初のwitness item(NULL:なし)
+    uint32_t        wit_cnt;                    ///< witness item数
+} bc_txview_vin_t;
+
+
+/** @struct bc_txview_vout_t
+ *
+ * vout(raw txを指す)
+ */
+typedef struct {
+    uint64_t        value;
+    const uint8_t   *p_script;                  ///< scriptPubKey
+    uint32_t        script_len;
+} bc_txview_vout_t;
+
+
+/** @struct bc_txview_iter_t
+ *
+ * vin, voutの走査位置
+ */
+typedef struct {
+    uint32_t        idx;
+    const uint8_t   *p;
+    const uint8_t   *p_wit;
+} bc_txview_iter_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** tx解析
+ *
+ * 構造だけを確認し、各部の位置を記録する。scriptSig, witnessは読み飛ばす。
+ * block中のtxにも使えるよう、pDataの後ろに続きがあってもよい。
+ *
+ * @param[out]  pView       解析結果
+ * @param[in]   pData       raw tx
+ * @param[in]   Len         pDataの読める長さ
+ * @retval  true    OK(tx長はpView->len)
+ */
+bool bc_txview_parse(bc_txview_t *pView, const uint8_t *pData, size_t Len);
+
+
+/** vin走査開始
+ *
+ * @param[in]   pView       解析結果
+ * @param[out]  pIter       走査位置
+ */
+void bc_txview_vin_begin(const bc_txview_t *pView, bc_txview_iter_t *pIter);
+
+
+/** 次のvin
+ *
+ * @param[in]       pView       解析結果
+ * @param[in,out]   pIter       走査位置
+ * @param[out]      pVin        vin
+ * @retval  false   終わり
+ */
+bool bc_txview_vin_next(const bc_txview_t *pView, bc_txview_iter_t *pIter, bc_txview_vin_t *pVin);
+
+
+/** vout走査開始
+ *
+ * @param[in]   pView       解析結果
+ * @param[out]  pIter       走査位置
+ */
+void bc_txview_vout_begin(const bc_txview_t *pView, bc_txview_iter_t *pIter);
+
+
+/** 次のvout
+ *
+ * @param[in]       pView       解析結果
+ * @param[in,out]   pIter       走査位置
+ * @param[out]      pVout       vout
+ * @retval  false   終わり
+ */
+bool bc_txview_vout_next(const bc_txview_t *pView, bc_txview_iter_t *pIter, bc_txview_vout_t *pVout);
+
+
+/** witness item
+ *
+ * @param[in]   pVin        vin
+ * @param[in]   Idx         item index
+ * @param[out]  ppData      item
+ * @param[out]  pLen        item長
+ * @retval  false   Idxが範囲外
+ */
+bool bc_txview_wit_item(const bc_txview_vin_t *pVin, uint32_t Idx, const uint8_t **ppData, uint32_t *pLen);
+
+
+/** TXID計算
+ *
+ * witnessを除いた部分をそのままhashする。
+ *
+ * @param[in]   pView       解析結果
+ * @param[out]  pTxid       TXID
+ */
+void bc_txview_txid(const bc_txview_t *pView, uint8_t *pTxid);
+
+
+/** WTXID計算
+ *
+ * witnessを持たないtxはTXIDと同じ。
+ *
+ * @param[in]   pView       解析結果
+ * @param[out]  pWtxid      WTXID
+ */
+void bc_txview_wtxid(const bc_txview_t *pView, uint8_t *pWtxid);
+
+
+/** varint読込み
+ *
+ * @param[in,out]   pp          読込み位置(読んだ分進める)
+ * @param[in]       pEnd        読める範囲の終わり
+ * @param[out]      pVal        値
+ * @retval  false   範囲外
+ */
+bool bc_txview_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal);
+
+#endif /* BC_TXVIEW_H__ */
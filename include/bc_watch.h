@@ -0,0 +1,210 @@
+/**************************************************************************
+ * @file    bc_watch.h
+ * @brief   監視対象(watch list)ヘッダ
+ **************************************************************************/
+#ifndef BC_WATCH_H__
+#define BC_WATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "btc.h"
+
+#include "bc_txview.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BC_WATCH_OUTPOINT_SZ    BC_TXVIEW_OUTPOINT_SZ   ///< outpoint長(txid + index)
+#define BC_WATCH_DATA_MAX       (10000)         ///< 要素長上限(scriptPubKey上限)
+#define BC_WATCH_HEADERS_SZ     (80)            ///< block header長
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum bc_watch_type_t
+ *
+ * 監視要素の種類
+ */
+typedef enum {
+    BC_WATCH_SCRIPT,                            ///< scriptPubKey
+    BC_WATCH_PKH,                               ///< pubkey hash(HASH160)
+    BC_WATCH_OUTPOINT,                          ///< outpoint(txid + index(little endian))
+} bc_watch_type_t;
+
+
+/** 要素追加関数(bc_watch_load())
+ *
+ * @param[in]   pArg        bc_watch_load()のpArg
+ * @param[in]   Type        種類
+ * @param[in]   pData       要素
+ * @param[in]   Len         pData長
+ * @retval  true    追加した
+ */
+typedef bool (*bc_watch_add_t)(void *pArg, bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** 初期化
+ *
+ * FNAME_WATCHがあれば読み込む。
+ *
+ * @retval  true    OK
+ */
+bool bc_watch_init(void);
+
+
+/** 終了
+ *
+ */
+void bc_watch_term(void);
+
+
+/** ファイルからまとめて追加
+ *
+ * 1行1要素のテキスト。'#'以降は無視する。
+ *      - pkh <HASH160 hex>
+ *      - script <scriptPubKey hex>
+ *      - outpoint <txid hex(表示順)>:<index>
+ *
+ * @param[in]   pFname      ファイル名
+ * @param[in]   pAdd        要素毎に呼ぶ関数(NULL:bc_watch_add())
+ * @param[in]   pArg        pAddに渡す値
+ * @retval  true    OK
+ */
+bool bc_watch_load(const char *pFname, bc_watch_add_t pAdd, void *pArg);
+
+
+/** 要素追加
+ *
+ * @param[in]   Type        種類
+ * @param[in]   pData       要素
+ * @param[in]   Len         pData長
+ * @retval  true    追加した
+ * @retval  false   登録済みか不正
+ */
+bool bc_watch_add(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+
+
+/** 要素削除
+ *
+ * @param[in]   Type        種類
+ * @param[in]   pData       要素
+ * @param[in]   Len         pData長
+ * @retval  true    削除した
+ */
+bool bc_watch_remove(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+
+
+/** 要素検索
+ *
+ * @param[in]   Type        種類
+ * @param[in]   pData       要素
+ * @param[in]   Len         pData長
+ * @retval  true    登録済み
+ */
+bool bc_watch_find(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+
+
+/** 登録数
+ *
+ * @return      要素数
+ */
+int bc_watch_count(void);
+
+
+/** 監視対象のoutputか
+ *
+ * scriptPubKeyそのもの、またはP2PKH/P2WPKH/P2PKのpubkey hashで引く。
+ *
+ * @param[in]   pScript     scriptPubKey
+ * @param[in]   Len         pScript長
+ * @retval  true    監視対象
+ */
+bool bc_watch_output(const uint8_t *pScript, size_t Len);
+
+
+/** 監視対象のtxか
+ *
+ * 監視対象のoutputを持つか、監視対象のoutpointか公開鍵で使っていれば一致とする。
+ * 一致したoutputのoutpointは監視要素に追加する。
+ *
+ * @param[in]   pTx         raw tx
+ * @param[in]   Len         pTx長
+ * @retval  true    監視対象
+ */
+bool bc_watch_tx(const uint8_t *pTx, uint32_t Len);
+
+
+/** 監視対象のtxか(解析済み)
+ *
+ * bc_watch_tx()と同じ。
+ *
+ * @param[in]   pView       解析済みtx
+ * @retval  true    監視対象
+ */
+bool bc_watch_txview(const bc_txview_t *pView);
+
+
+/** blockに入ったtxが使ったoutpointを監視対象から外す
+ *
+ * 監視対象のoutpointは使われたら二度と現れないので、登録数が増え続けないようにする。
+ * reorgで戻っても、P2PKH/P2WPKHは公開鍵で一致する。
+ *
+ * @param[in]   pView       解析済みtx
+ * @return      削除した数
+ */
+int bc_watch_spent(const bc_txview_t *pView);
+
+
+/** block中の監視対象tx数
+ *
+ * 各txをbc_watch_txview()で調べる。
+ * headersにあるblockなら、使われたoutpointをbc_watch_spent()で外す。
+ *
+ * @param[in]   pBlock      raw block
+ * @param[in]   Len         pBlock長
+ * @param[in]   bConfirmed  true:headersにあるblock
+ * @return      監視対象tx数(-1:blockが不正)
+ */
+int bc_watch_block(const uint8_t *pBlock, size_t Len, bool bConfirmed);
+
+
+/** bloom filterに入れる要素
+ *
+ * scriptPubKeyはdata pushのうち最長のもの、それ以外はそのまま。
+ *
+ * @param[in]   Type        種類
+ * @param[in]   pData       要素
+ * @param[in]   Len         pData長
+ * @param[out]  pElem       要素(pData内を指す)
+ */
+void bc_watch_bloom_element(bc_watch_type_t Type, const uint8_t *pData, size_t Len, utl_buf_t *pElem);
+
+
+/** bloom filterに入れる全要素
+ *
+ * @param[out]  pNum        要素数
+ * @return      要素の複製(FREE()すること。NULL:確保失敗)
+ */
+utl_buf_t *bc_watch_bloom_elements(int *pNum);
+
+
+/** compact filterで照合するscriptPubKey
+ *
+ * pubkey hashはP2PKHとP2WPKHのscriptPubKeyにする。outpointは含まない。
+ *
+ * @param[out]  pNum        scriptPubKey数
+ * @return      scriptPubKeyの複製(FREE()すること。NULL:確保失敗)
+ */
+utl_buf_t *bc_watch_scripts(int *pNum);
+
+#endif /* BC_WATCH_H__ */
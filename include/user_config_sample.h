@@ -9,12 +9,59 @@
 #define BC_VER_UA               "/nytcoin:0.00/test:0.0/"
 #define FNAME_BLOCK             "block.nyt"
 #define FNAME_SEED              "seed.nyt"
+#define FNAME_HEADERS           "headers.nyt"
+#define FNAME_CFILTERS          "cfilters.nyt"
+#define FNAME_CFINDEX           "cfindex.nyt"
+#define FNAME_WATCH             "watch.txt"
 
 //#define MAINNET
 #define TESTNET
 
 //#define USERPEER
 
+//headersを取得し始めるcheckpointのheight(0:genesis)。未定義なら最新checkpointから
+//#define CHECKPOINT_START        (0)
+
+//最新checkpoint以下のheadersはPoW検証を省略する(CHECKPOINT_STARTが最新より前の場合)
+#define ASSUMEVALID
+
+//checkpoint区間のheadersを並列取得する追加接続数(0:使わない)。tipが最新checkpointより前の場合だけ使う
+#define HDRSYNC_PEERS           (3)
+
+//同時に要求するfiltered block数(最大64)
+#define FBLOCK_WINDOW           (32)
+
+//peerがBIP157に対応していれば、filterloadの代わりにcompact filterで照合する
+#define CFILTER
+
+//CFILTERで照合する接続でも全txの通知を受け、監視対象の未承認txをmempoolに入れる(全txを受信するので通信量が増える)
+#define CFILTER_TXRELAY
+
+//compact filterの照合thread数(0:CPU数)
+#define RESCAN_WORKERS          (0)
+
+//取得したcompact filterを保存する上限サイズ(MB, 0:保存しない)
+#define CFSTORE_MAX_MB          (1024)
+
+//filterloadの目標FP率(大きさは監視要素数から決める)
+#define BLOOM_RATE              (0.0001)
+
+//MALLOC/FREEの実装(0:libc, 1:size class pool, 2:固定heap)。未定義ならlibcを直接使い統計も取らない
+//  統計を1つのmutexで取るので、全threadのMALLOC/FREEがそこで競合する。調査時だけ有効にする
+//#define ALLOCATOR               (0)
+
+//ALLOCATOR=2の固定heapサイズ(KB)
+#define ALLOC_HEAP_KB           (8192)
+
+//MALLOCで使える上限(KB, 0:上限なし)
+#define ALLOC_LIMIT_KB          (0)
+
+//監視対象txのmempool上限(KB)。超えたらfee rateの低いtxから捨てる
+#define MEMPOOL_MAX_KB          (4096)
+
+//mempoolと既知txidを保存する間隔(秒)。終了時にも保存する
+#define MEMPOOL_SAVE_SEC        (600)
+
 
 #ifdef USERPEER
 #define PEER_ADDR_STR           "52.243.61.218"
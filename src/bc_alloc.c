@@ -0,0 +1,510 @@
+/**************************************************************************
+ * @file    bc_alloc.c
+ * @brief   MALLOC/CALLOC/REALLOC/FREEの実装切替えと統計
+ * @note
+ *      - 確保した領域の前に16byteのheaderを置き、長さと呼び出し元を覚える
+ *      - 実装(bc_alloc_ops_t)はheaderを含む長さで確保・解放するだけ
+ *      - 統計と実装は1つのmutexで守る(threadが多いとMALLOC毎に競合する)
+ *      - 固定heapはALLOCATOR=2の場合だけ持つ
+ *      - ここではMALLOC等を使わない(libcか固定heapを直接使う)
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bc_alloc.h"
+
+#define LOG_TAG     "alloc"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#ifndef ALLOCATOR
+#define ALLOCATOR               BC_ALLOC_SYSTEM
+#endif
+#ifndef ALLOC_HEAP_KB
+#define ALLOC_HEAP_KB           (8192)          ///< 固定heapの大きさ(KB)
+#endif
+#ifndef ALLOC_LIMIT_KB
+#define ALLOC_LIMIT_KB          (0)             ///< 使用量の上限(KB, 0:なし)
+#endif
+
+#define HDR_MAGIC               (0xa5)
+#define SITE_NONE               (0xffff)        ///< 集計表に入らなかった呼び出し元
+#define PRINT_SITES             (10)            ///< bc_alloc_print()で出す呼び出し元の数
+
+#define ALIGN16(n)              (((n) + 15) & ~(size_t)15)
+
+//size class pool
+#define POOL_CLASS_NUM          (8)             ///< 32, 64, ..., 4096
+#define POOL_CLASS_MIN_SHIFT    (5)
+#define POOL_SLAB_SZ            (64 * 1024)
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** 確保した領域の前に置くheader(16byte)
+ *
+ * 後ろの領域を16byte境界にするため、size_tが4byteでも16byteにする。
+ */
+typedef struct {
+    size_t      size;                           ///< 要求長
+    uint16_t    site;                           ///< mSite index
+    uint8_t     magic;
+    uint8_t     reserved[13 - sizeof(size_t)];
+} hdr_t;
+
+_Static_assert(sizeof(hdr_t) == 16, "hdr_t must be 16 bytes");
+
+
+/** 呼び出し元の集計 */
+typedef struct {
+    const char  *p_file;                        ///< NULL:未使用
+    int         line;
+    uint64_t    calls;
+    size_t      in_use;
+} site_t;
+
+
+/** pool/heapの空き領域 */
+typedef struct free_t {
+    struct free_t   *p_next;
+    size_t          size;                       ///< heapのみ
+} free_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void *sys_alloc(size_t Size);
+static void sys_free(void *p, size_t Size);
+static void *sys_realloc(void *p, size_t OldSize, size_t Size);
+static int pool_class(size_t Size);
+static void *pool_alloc(size_t Size);
+static void pool_free(void *p, size_t Size);
+#if ALLOCATOR == BC_ALLOC_HEAP
+static void *heap_alloc(size_t Size);
+static void heap_free(void *p, size_t Size);
+#endif
+static uint16_t find_site(const char *pFile, int Line);
+static void *alloc_sub(size_t Size, const char *pFile, int Line);
+static void free_sub(hdr_t *pHdr);
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+const bc_alloc_ops_t kBcAllocSystem = { "system", sys_alloc, sys_free, sys_realloc };
+const bc_alloc_ops_t kBcAllocPool = { "pool", pool_alloc, pool_free, NULL };
+#if ALLOCATOR == BC_ALLOC_HEAP
+const bc_alloc_ops_t kBcAllocHeap = { "heap", heap_alloc, heap_free, NULL };
+#endif
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static const bc_alloc_ops_t *mpOps =
+#if ALLOCATOR == BC_ALLOC_POOL
+        &kBcAllocPool;
+#elif ALLOCATOR == BC_ALLOC_HEAP
+        &kBcAllocHeap;
+#else
+        &kBcAllocSystem;
+#endif
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static bc_alloc_stat_t  mStat;
+static site_t           mSite[BC_ALLOC_SITE_MAX];
+
+static free_t           *mPoolFree[POOL_CLASS_NUM];
+
+#if ALLOCATOR == BC_ALLOC_HEAP
+static uint8_t          mHeap[ALLOC_HEAP_KB * 1024] __attribute__((aligned(16)));
+static free_t           *mHeapFree;
+static bool             mHeapInit;
+#endif
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_alloc_set_ops(const bc_alloc_ops_t *pOps)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (mStat.calls == 0) {
+        mpOps = pOps;
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+void *bc_alloc_malloc(size_t Size, const char *pFile, int Line)
+{
+    pthread_mutex_lock(&mMux);
+    void *p = alloc_sub(Size, pFile, Line);
+    pthread_mutex_unlock(&mMux);
+    return p;
+}
+
+
+void *bc_alloc_calloc(size_t Num, size_t Size, const char *pFile, int Line)
+{
+    if ((Size != 0) && (Num > SIZE_MAX / Size)) {
+        return NULL;
+    }
+    void *p = bc_alloc_malloc(Num * Size, pFile, Line);
+    if (p != NULL) {
+        memset(p, 0, Num * Size);
+    }
+    return p;
+}
+
+
+void *bc_alloc_realloc(void *p, size_t Size, const char *pFile, int Line)
+{
+    if (p == NULL) {
+        return bc_alloc_malloc(Size, pFile, Line);
+    }
+    if (Size == 0) {
+        bc_alloc_free(p);
+        return NULL;
+    }
+
+    void *p_new = NULL;
+    hdr_t *p_hdr = (hdr_t *)p - 1;
+    pthread_mutex_lock(&mMux);
+    if ((mpOps->p_realloc != NULL) &&
+            ((ALLOC_LIMIT_KB == 0) || (mStat.in_use - p_hdr->size + Size <= (size_t)ALLOC_LIMIT_KB * 1024))) {
+        size_t old = p_hdr->size;
+        uint16_t site = p_hdr->site;
+        hdr_t *p_hdr_new = (hdr_t *)mpOps->p_realloc(p_hdr, sizeof(hdr_t) + old, sizeof(hdr_t) + Size);
+        if (p_hdr_new != NULL) {
+            p_hdr_new->size = Size;
+            mStat.in_use += Size - old;
+            if (mStat.peak < mStat.in_use) {
+                mStat.peak = mStat.in_use;
+            }
+            if (site != SITE_NONE) {
+                mSite[site].in_use += Size - old;
+            }
+            p_new = p_hdr_new + 1;
+        } else {
+            mStat.fails++;
+        }
+    } else {
+        p_new = alloc_sub(Size, pFile, Line);
+        if (p_new != NULL) {
+            memcpy(p_new, p, (p_hdr->size < Size) ? p_hdr->size : Size);
+            free_sub(p_hdr);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return p_new;
+}
+
+
+void bc_alloc_free(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&mMux);
+    free_sub((hdr_t *)p - 1);
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_alloc_get_stat(bc_alloc_stat_t *pStat)
+{
+    pthread_mutex_lock(&mMux);
+    *pStat = mStat;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_alloc_print(void)
+{
+    int top[PRINT_SITES];
+    int num = 0;
+
+    pthread_mutex_lock(&mMux);
+    LOGD("alloc(%s): in_use=%lu, peak=%lu, calls=%" PRIu64 ", fails=%" PRIu64 "\n",
+            mpOps->p_name, (unsigned long)mStat.in_use, (unsigned long)mStat.peak, mStat.calls, mStat.fails);
+
+    //確保回数の多い順
+    for (int lp = 0; lp < BC_ALLOC_SITE_MAX; lp++) {
+        if (mSite[lp].p_file == NULL) {
+            continue;
+        }
+        int pos = num;
+        while ((pos > 0) && (mSite[top[pos - 1]].calls < mSite[lp].calls)) {
+            if (pos < PRINT_SITES) {
+                top[pos] = top[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < PRINT_SITES) {
+            top[pos] = lp;
+            if (num < PRINT_SITES) {
+                num++;
+            }
+        }
+    }
+    for (int lp = 0; lp < num; lp++) {
+        const site_t *p_site = &mSite[top[lp]];
+        LOGD("  %s:%d: calls=%" PRIu64 ", in_use=%lu\n",
+                p_site->p_file, p_site->line, p_site->calls, (unsigned long)p_site->in_use);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 確保(mMux取得済み)
+ *
+ */
+static void *alloc_sub(size_t Size, const char *pFile, int Line)
+{
+    mStat.calls++;
+    if ((Size > SIZE_MAX - sizeof(hdr_t)) ||
+            ((ALLOC_LIMIT_KB != 0) && (mStat.in_use + Size > (size_t)ALLOC_LIMIT_KB * 1024))) {
+        mStat.fails++;
+        LOGE("fail: %s:%d: %lu bytes(in_use=%lu)\n", pFile, Line, (unsigned long)Size, (unsigned long)mStat.in_use);
+        return NULL;
+    }
+    hdr_t *p_hdr = (hdr_t *)mpOps->p_alloc(sizeof(hdr_t) + Size);
+    if (p_hdr == NULL) {
+        mStat.fails++;
+        LOGE("fail: %s:%d: %lu bytes(in_use=%lu)\n", pFile, Line, (unsigned long)Size, (unsigned long)mStat.in_use);
+        return NULL;
+    }
+    p_hdr->size = Size;
+    p_hdr->site = find_site(pFile, Line);
+    p_hdr->magic = HDR_MAGIC;
+
+    mStat.in_use += Size;
+    if (mStat.peak < mStat.in_use) {
+        mStat.peak = mStat.in_use;
+    }
+    if (p_hdr->site != SITE_NONE) {
+        mSite[p_hdr->site].calls++;
+        mSite[p_hdr->site].in_use += Size;
+    }
+    return p_hdr + 1;
+}
+
+
+/** 解放(mMux取得済み)
+ *
+ */
+static void free_sub(hdr_t *pHdr)
+{
+    if (pHdr->magic != HDR_MAGIC) {
+        LOGE("fail: invalid free(%p)\n", (void *)(pHdr + 1));
+        abort();
+    }
+    pHdr->magic = 0;
+    mStat.in_use -= pHdr->size;
+    if (pHdr->site != SITE_NONE) {
+        mSite[pHdr->site].in_use -= pHdr->size;
+    }
+    mpOps->p_free(pHdr, sizeof(hdr_t) + pHdr->size);
+}
+
+
+/** 呼び出し元の集計位置(mMux取得済み)
+ *
+ * __FILE__は呼び出し元ごとに同じpointerになるので、pointerとLineで引く。
+ */
+static uint16_t find_site(const char *pFile, int Line)
+{
+    uintptr_t h = ((uintptr_t)pFile >> 3) * 31 + (uintptr_t)Line;
+    h ^= h >> 16;
+    for (int lp = 0; lp < BC_ALLOC_SITE_MAX; lp++) {
+        int idx = (int)((h + lp) & (BC_ALLOC_SITE_MAX - 1));
+        site_t *p_site = &mSite[idx];
+        if (p_site->p_file == NULL) {
+            p_site->p_file = pFile;
+            p_site->line = Line;
+            return (uint16_t)idx;
+        }
+        if ((p_site->p_file == pFile) && (p_site->line == Line)) {
+            return (uint16_t)idx;
+        }
+    }
+    return SITE_NONE;
+}
+
+
+/********************************************************************
+ * system
+ ********************************************************************/
+
+static void *sys_alloc(size_t Size)
+{
+    return malloc(Size);
+}
+
+
+static void sys_free(void *p, size_t Size)
+{
+    (void)Size;
+    free(p);
+}
+
+
+static void *sys_realloc(void *p, size_t OldSize, size_t Size)
+{
+    (void)OldSize;
+    return realloc(p, Size);
+}
+
+
+/********************************************************************
+ * size class pool
+ ********************************************************************/
+
+/** size class(-1:poolを使わない)
+ *
+ */
+static int pool_class(size_t Size)
+{
+    for (int cls = 0; cls < POOL_CLASS_NUM; cls++) {
+        if (Size <= ((size_t)1 << (cls + POOL_CLASS_MIN_SHIFT))) {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+
+/** 確保
+ *
+ * 空きが無ければPOOL_SLAB_SZ単位でlibcから取って分割する。slabは返さない。
+ */
+static void *pool_alloc(size_t Size)
+{
+    int cls = pool_class(Size);
+    if (cls < 0) {
+        return malloc(Size);
+    }
+    if (mPoolFree[cls] == NULL) {
+        size_t sz = (size_t)1 << (cls + POOL_CLASS_MIN_SHIFT);
+        uint8_t *p_slab = (uint8_t *)malloc(POOL_SLAB_SZ);
+        if (p_slab == NULL) {
+            return NULL;
+        }
+        for (size_t pos = 0; pos + sz <= POOL_SLAB_SZ; pos += sz) {
+            free_t *p_free = (free_t *)(p_slab + pos);
+            p_free->p_next = mPoolFree[cls];
+            mPoolFree[cls] = p_free;
+        }
+    }
+    free_t *p_free = mPoolFree[cls];
+    mPoolFree[cls] = p_free->p_next;
+    return p_free;
+}
+
+
+static void pool_free(void *p, size_t Size)
+{
+    int cls = pool_class(Size);
+    if (cls < 0) {
+        free(p);
+        return;
+    }
+    free_t *p_free = (free_t *)p;
+    p_free->p_next = mPoolFree[cls];
+    mPoolFree[cls] = p_free;
+}
+
+
+#if ALLOCATOR == BC_ALLOC_HEAP
+/********************************************************************
+ * 固定heap
+ ********************************************************************/
+
+/** 確保(first fit)
+ *
+ * 空き領域はアドレス順のlistで持ち、解放時に前後と結合する。
+ */
+static void *heap_alloc(size_t Size)
+{
+    if (!mHeapInit) {
+        mHeapFree = (free_t *)mHeap;
+        mHeapFree->p_next = NULL;
+        mHeapFree->size = sizeof(mHeap);
+        mHeapInit = true;
+    }
+
+    size_t sz = ALIGN16(Size);
+    free_t **pp = &mHeapFree;
+    while (*pp != NULL) {
+        free_t *p_free = *pp;
+        if (p_free->size >= sz) {
+            //16byte単位なので余りはfree_tが入る
+            if (p_free->size > sz) {
+                free_t *p_rest = (free_t *)((uint8_t *)p_free + sz);
+                p_rest->p_next = p_free->p_next;
+                p_rest->size = p_free->size - sz;
+                *pp = p_rest;
+            } else {
+                *pp = p_free->p_next;
+            }
+            return p_free;
+        }
+        pp = &p_free->p_next;
+    }
+    return NULL;
+}
+
+
+static void heap_free(void *p, size_t Size)
+{
+    free_t *p_blk = (free_t *)p;
+    p_blk->size = ALIGN16(Size);
+
+    free_t *p_prev = NULL;
+    free_t *p_next = mHeapFree;
+    while ((p_next != NULL) && ((uint8_t *)p_next < (uint8_t *)p_blk)) {
+        p_prev = p_next;
+        p_next = p_next->p_next;
+    }
+    //後ろと結合
+    if ((p_next != NULL) && ((uint8_t *)p_blk + p_blk->size == (uint8_t *)p_next)) {
+        p_blk->size += p_next->size;
+        p_blk->p_next = p_next->p_next;
+    } else {
+        p_blk->p_next = p_next;
+    }
+    //前と結合
+    if ((p_prev != NULL) && ((uint8_t *)p_prev + p_prev->size == (uint8_t *)p_blk)) {
+        p_prev->size += p_blk->size;
+        p_prev->p_next = p_blk->p_next;
+    } else if (p_prev != NULL) {
+        p_prev->p_next = p_blk;
+    } else {
+        mHeapFree = p_blk;
+    }
+}
+#endif  /* ALLOCATOR == BC_ALLOC_HEAP */
@@ -0,0 +1,143 @@
+/**************************************************************************
+ * @file    bc_arena.c
+ * @brief   受信メッセージ用bump allocator
+ * @note
+ *      - 1メッセージの処理中に確保したものは、処理後にbc_arena_reset()でまとめて解放する
+ *      - resetで使った大きさの領域を1つにまとめて残すので、定常状態ではmallocしない
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_arena.h"
+
+#define LOG_TAG     "arena"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define ALIGN_UP(n)             (((n) + BC_ARENA_ALIGN - 1) & ~(size_t)(BC_ARENA_ALIGN - 1))
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+struct bc_arena_blk_t {
+    bc_arena_blk_t  *p_next;
+    size_t          size;                       ///< data長
+    size_t          used;
+    uint8_t         pad[BC_ARENA_ALIGN - (2 * sizeof(size_t) + sizeof(void *)) % BC_ARENA_ALIGN];
+    uint8_t         data[];
+};
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bc_arena_blk_t *new_block(size_t Size);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void bc_arena_init(bc_arena_t *pArena)
+{
+    pArena->p_head = NULL;
+    pArena->high = 0;
+}
+
+
+void *bc_arena_alloc(bc_arena_t *pArena, size_t Len)
+{
+    size_t len = ALIGN_UP((Len > 0) ? Len : 1);
+    bc_arena_blk_t *p_blk = pArena->p_head;
+
+    if ((p_blk == NULL) || (p_blk->size - p_blk->used < len)) {
+        size_t size = (len > BC_ARENA_BLOCK_SZ) ? len : BC_ARENA_BLOCK_SZ;
+        p_blk = new_block(size);
+        if (p_blk == NULL) {
+            return NULL;
+        }
+        p_blk->p_next = pArena->p_head;
+        pArena->p_head = p_blk;
+    }
+    void *p = p_blk->data + p_blk->used;
+    p_blk->used += len;
+    pArena->high += len;
+    return p;
+}
+
+
+bool bc_arena_buf(bc_arena_t *pArena, utl_buf_t *pBuf, const uint8_t *pData, size_t Len)
+{
+    pBuf->buf = (uint8_t *)bc_arena_alloc(pArena, Len);
+    if (pBuf->buf == NULL) {
+        pBuf->len = 0;
+        return false;
+    }
+    if (pData != NULL) {
+        MEMCPY(pBuf->buf, pData, Len);
+    }
+    pBuf->len = (uint32_t)Len;
+    return true;
+}
+
+
+void bc_arena_reset(bc_arena_t *pArena)
+{
+    bc_arena_blk_t *p_blk = pArena->p_head;
+    if (p_blk == NULL) {
+        return;
+    }
+    if ((p_blk->p_next == NULL) && (p_blk->size <= BC_ARENA_KEEP_MAX)) {
+        //1つに収まっていた
+        p_blk->used = 0;
+        pArena->high = 0;
+        return;
+    }
+
+    //複数に分かれた場合は、使った大きさの領域1つにまとめ直す
+    size_t high = (pArena->high > BC_ARENA_BLOCK_SZ) ? pArena->high : BC_ARENA_BLOCK_SZ;
+    bc_arena_free(pArena);
+    if (high <= BC_ARENA_KEEP_MAX) {
+        pArena->p_head = new_block(high);
+    }
+}
+
+
+void bc_arena_free(bc_arena_t *pArena)
+{
+    bc_arena_blk_t *p_blk = pArena->p_head;
+    while (p_blk != NULL) {
+        bc_arena_blk_t *p_next = p_blk->p_next;
+        FREE(p_blk);
+        p_blk = p_next;
+    }
+    pArena->p_head = NULL;
+    pArena->high = 0;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static bc_arena_blk_t *new_block(size_t Size)
+{
+    bc_arena_blk_t *p_blk = (bc_arena_blk_t *)MALLOC(sizeof(bc_arena_blk_t) + Size);
+    if (p_blk == NULL) {
+        LOGE("fail: malloc(%lu)\n", (unsigned long)Size);
+        return NULL;
+    }
+    p_blk->p_next = NULL;
+    p_blk->size = Size;
+    p_blk->used = 0;
+    return p_blk;
+}
@@ -0,0 +1,181 @@
+/**************************************************************************
+ * @file    bc_block.c
+ * @brief   block検証
+ * @note
+ *      - txはbc_txviewで読み、再serializeせずにhashする
+ *      - merkle treeは1段ずつbc_sha256_hash256_d64()で計算する
+ **************************************************************************/
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_block.h"
+#include "bc_txview.h"
+#include "bc_merkle.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "block"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define HEADERS_SZ              (80)
+#define HEADERS_MERKLE_POS      (36)            ///< version(4) + prev_block(32)
+#define TX_SZ_MIN               (60)            ///< witnessを除くtx長の下限
+
+#define COMMIT_SZ               (38)            ///< OP_RETURN + push(36) + header(4) + hash(32)
+#define COMMIT_HDR_SZ           (6)
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+static const uint8_t kCommitHeader[COMMIT_HDR_SZ] = { 0x6a, 0x24, 0xaa, 0x21, 0xa9, 0xed };
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool check_commitment(bool *pFound, const bc_txview_t *pCoinbase, uint8_t *pWtxids, uint32_t Num);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_block_verify(const uint8_t *pBlock, size_t Len, bc_arena_t *pArena, uint32_t *pTxCount)
+{
+    const uint8_t *p = pBlock + HEADERS_SZ;
+    const uint8_t *p_end = pBlock + Len;
+    uint64_t count;
+    bool b_witness = false;
+    bool mutated;
+    uint8_t root[BC_SHA256_SZ_HASH];
+    bc_txview_t coinbase;
+
+    if ((Len < HEADERS_SZ) || !bc_txview_varint(&p, p_end, &count)) {
+        LOGE("fail: invalid header\n");
+        return false;
+    }
+    if ((count == 0) || (count > BC_MERKLE_TX_MAX) || (count > (uint64_t)(p_end - p) / TX_SZ_MIN)) {
+        LOGE("fail: invalid tx count(%" PRIu64 ")\n", count);
+        return false;
+    }
+    //奇数段で1つ重ねる分を足す
+    uint8_t *p_txids = (uint8_t *)bc_arena_alloc(pArena, (count + 1) * BC_SHA256_SZ_HASH);
+    uint8_t *p_wtxids = (uint8_t *)bc_arena_alloc(pArena, (count + 1) * BC_SHA256_SZ_HASH);
+    if ((p_txids == NULL) || (p_wtxids == NULL)) {
+        return false;
+    }
+
+    for (uint64_t lp = 0; lp < count; lp++) {
+        bc_txview_t view;
+        if (!bc_txview_parse(&view, p, p_end - p)) {
+            LOGE("fail: invalid tx(%" PRIu64 ")\n", lp);
+            return false;
+        }
+        uint8_t *p_txid = p_txids + lp * BC_SHA256_SZ_HASH;
+        uint8_t *p_wtxid = p_wtxids + lp * BC_SHA256_SZ_HASH;
+        bc_txview_txid(&view, p_txid);
+        if (lp == 0) {
+            //coinbaseのWTXIDは0
+            coinbase = view;
+            MEMSET(p_wtxid, 0, BC_SHA256_SZ_HASH);
+        } else if (view.segwit) {
+            bc_txview_wtxid(&view, p_wtxid);
+        } else {
+            MEMCPY(p_wtxid, p_txid, BC_SHA256_SZ_HASH);
+        }
+        b_witness |= view.segwit;
+        p += view.len;
+    }
+    if (p != p_end) {
+        LOGE("fail: trailing data(%ld)\n", (long)(p_end - p));
+        return false;
+    }
+
+    if (!bc_merkle_root(root, &mutated, p_txids, (uint32_t)count) || mutated) {
+        LOGE("fail: merkle mutated\n");
+        return false;
+    }
+    if (MEMCMP(root, pBlock + HEADERS_MERKLE_POS, BC_SHA256_SZ_HASH) != 0) {
+        LOGE("fail: merkle root mismatch\n");
+        return false;
+    }
+
+    bool b_commit;
+    if (!check_commitment(&b_commit, &coinbase, p_wtxids, (uint32_t)count)) {
+        return false;
+    }
+    if (b_witness && !b_commit) {
+        LOGE("fail: no witness commitment\n");
+        return false;
+    }
+
+    if (pTxCount != NULL) {
+        *pTxCount = (uint32_t)count;
+    }
+    return true;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** witness commitment確認(BIP141)
+ *
+ * coinbaseのoutputのうち、commitment形式の最後のものと比較する。
+ *
+ * @param[out]      pFound      true:commitmentがある
+ * @param[in]       pCoinbase   coinbase tx
+ * @param[in,out]   pWtxids     WTXID(作業領域として上書きする)
+ * @param[in]       Num         tx数
+ * @retval  true    一致した、またはcommitmentが無い
+ */
+static bool check_commitment(bool *pFound, const bc_txview_t *pCoinbase, uint8_t *pWtxids, uint32_t Num)
+{
+    bc_txview_iter_t iter;
+    bc_txview_vout_t vout;
+    const uint8_t *p_commit = NULL;
+
+    bc_txview_vout_begin(pCoinbase, &iter);
+    while (bc_txview_vout_next(pCoinbase, &iter, &vout)) {
+        if ((vout.script_len >= COMMIT_SZ) && (MEMCMP(vout.p_script, kCommitHeader, COMMIT_HDR_SZ) == 0)) {
+            p_commit = vout.p_script + COMMIT_HDR_SZ;
+        }
+    }
+    *pFound = (p_commit != NULL);
+    if (p_commit == NULL) {
+        return true;
+    }
+
+    //witness reserved value
+    bc_txview_vin_t vin;
+    const uint8_t *p_reserved;
+    uint32_t len;
+    bc_txview_vin_begin(pCoinbase, &iter);
+    if (!bc_txview_vin_next(pCoinbase, &iter, &vin) || (vin.wit_cnt != 1) ||
+            !bc_txview_wit_item(&vin, 0, &p_reserved, &len) || (len != BC_SHA256_SZ_HASH)) {
+        LOGE("fail: witness reserved value\n");
+        return false;
+    }
+
+    uint8_t data[2 * BC_SHA256_SZ_HASH];
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    bool mutated;
+    bc_merkle_root(data, &mutated, pWtxids, Num);
+    MEMCPY(data + BC_SHA256_SZ_HASH, p_reserved, BC_SHA256_SZ_HASH);
+    bc_sha256_hash256_d64(hash, data, 1);
+    if (MEMCMP(hash, p_commit, BC_SHA256_SZ_HASH) != 0) {
+        LOGE("fail: witness commitment mismatch\n");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,346 @@
+/**************************************************************************
+ * @file    bc_bloom.c
+ * @brief   bloom filter(BIP37)管理
+ * @note
+ *      - 大きさは監視要素数と目標FP率から決める(固定値にしない)
+ *      - 追加はfilteraddで行い、推定FP率が目標のBLOOM_RELOAD_RATIO倍を超えたらfilterloadし直す
+ *      - merkleblockのtx総数と、一致したが監視対象でなかったtx数から実測FP率を出し、同じ基準で作り直す
+ *      - nTweakはfilterload毎に/dev/urandomから取る(peerから要素を推測されにくくする)
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "btc.h"
+
+#include "bc_misc.h"
+#include "bc_bloom.h"
+#include "libbloom/bloom.h"
+
+#define LOG_TAG     "bloom"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BLOOM_LN2_SQ            (0.4804530139182014)    ///< ln(2)^2
+#define BLOOM_CAPACITY_MIN      (16)            ///< 想定要素数の下限
+#define BLOOM_HEADROOM          (50)            ///< filteradd用に見込む要素数(%)
+#define BLOOM_RELOAD_RATIO      (2)             ///< 推定FP率が目標の何倍で作り直すか
+#define BLOOM_CLEAR_RATE        (0.5)           ///< 上限サイズでもこのFP率を超えるならfilterclear
+#define BLOOM_FP_SAMPLES_MIN    (4)             ///< 実測FP率で判断する誤検出tx数の下限
+#define BLOOM_TWEAK_DEV         "/dev/urandom"
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void stat_tx(bc_bloom_stat_t *pStat, bool bReal, bool bDescendant, bool bBlock);
+static bool fp_parent(const bc_bloom_t *pBloom, const bc_txview_t *pView);
+static void fp_add(bc_bloom_t *pBloom, const uint8_t *pTxid);
+static uint32_t random_tweak(void);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static bc_bloom_stat_t  mStat;                  ///< 全接続の集計
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_bloom_build(bc_bloom_t *pBloom, struct bloom *pFilter, const utl_buf_t *pItems, int Num, double Rate)
+{
+    bc_bloom_stat_t total = pBloom->total;
+
+    MEMSET(pBloom, 0, sizeof(bc_bloom_t));
+    pBloom->rate = Rate;
+    pBloom->total = total;
+
+    uint32_t capacity = (uint32_t)Num + (uint32_t)Num * BLOOM_HEADROOM / 100;
+    if (capacity < BLOOM_CAPACITY_MIN) {
+        capacity = BLOOM_CAPACITY_MIN;
+    }
+
+    //BIP37の上限に収まるFP率(端数切り上げ分として1byte残す)
+    double rate = Rate;
+    double bits_max = (double)(BC_BLOOM_SZ_MAX - 1) * 8;
+    if (-(double)capacity * log(rate) / BLOOM_LN2_SQ > bits_max) {
+        rate = exp(-bits_max * BLOOM_LN2_SQ / capacity);
+        LOGD("capacity=%" PRIu32 ": rate %f -> %f\n", capacity, Rate, rate);
+        if (rate > BLOOM_CLEAR_RATE) {
+            LOGD("too many elements: clear\n");
+            bc_bloom_clear(pBloom);
+            return false;
+        }
+    }
+
+    if (bloom_init(pFilter, (int)capacity, rate, random_tweak()) != 0) {
+        LOGE("fail: bloom_init\n");
+        bc_bloom_clear(pBloom);
+        return false;
+    }
+    if ((pFilter->bytes > BC_BLOOM_SZ_MAX) || (pFilter->hashes > BC_BLOOM_HASH_MAX)) {
+        LOGE("fail: bloom size(bytes=%d, hashes=%d)\n", pFilter->bytes, pFilter->hashes);
+        bloom_free(pFilter);
+        bc_bloom_clear(pBloom);
+        return false;
+    }
+    for (int lp = 0; lp < Num; lp++) {
+        bloom_add(pFilter, pItems[lp].buf, (int)pItems[lp].len);
+    }
+
+    pBloom->loaded = true;
+    pBloom->rate = rate;
+    pBloom->capacity = capacity;
+    pBloom->count = (uint32_t)Num;
+    pBloom->bits = (uint32_t)pFilter->bytes * 8;
+    pBloom->hashes = (uint32_t)pFilter->hashes;
+    LOGD("elements=%d, capacity=%" PRIu32 ", bytes=%d, hashes=%d, fp=%f\n",
+            Num, capacity, pFilter->bytes, pFilter->hashes, bc_bloom_fp_rate(pBloom));
+    return true;
+}
+
+
+void bc_bloom_clear(bc_bloom_t *pBloom)
+{
+    double rate = pBloom->rate;
+    bc_bloom_stat_t total = pBloom->total;
+
+    MEMSET(pBloom, 0, sizeof(bc_bloom_t));
+    pBloom->rate = rate;
+    pBloom->total = total;
+    pBloom->cleared = true;
+}
+
+
+bc_bloom_act_t bc_bloom_add(bc_bloom_t *pBloom, size_t Len)
+{
+    if (!pBloom->loaded) {
+        //filterclear済みなら全tx通知されている
+        //filterload前なら次のfilterloadに含まれる
+        return BC_BLOOM_ACT_NONE;
+    }
+    if (Len > BC_BLOOM_ELEMENT_MAX) {
+        return BC_BLOOM_ACT_RELOAD;
+    }
+    pBloom->count++;
+    if (bc_bloom_fp_rate(pBloom) > pBloom->rate * BLOOM_RELOAD_RATIO) {
+        LOGD("fp rate degraded(count=%" PRIu32 ", capacity=%" PRIu32 ")\n", pBloom->count, pBloom->capacity);
+        return BC_BLOOM_ACT_RELOAD;
+    }
+    return BC_BLOOM_ACT_ADD;
+}
+
+
+bool bc_bloom_tx(bc_bloom_t *pBloom, const bc_txview_t *pView, bool bReal, bool bBlock)
+{
+    if (!pBloom->loaded) {
+        return false;
+    }
+    bool b_desc = false;
+    if (!bReal) {
+        uint8_t txid[BTC_SZ_TXID];
+        b_desc = fp_parent(pBloom, pView);
+        bc_txview_txid(pView, txid);
+        fp_add(pBloom, txid);
+    }
+    stat_tx(&pBloom->cur, bReal, b_desc, bBlock);
+    stat_tx(&pBloom->total, bReal, b_desc, bBlock);
+    pthread_mutex_lock(&mMux);
+    stat_tx(&mStat, bReal, b_desc, bBlock);
+    pthread_mutex_unlock(&mMux);
+    pBloom->count++;
+
+    double limit = pBloom->rate * BLOOM_RELOAD_RATIO;
+    if (bc_bloom_fp_rate(pBloom) > limit) {
+        LOGD("fp rate degraded(count=%" PRIu32 ", capacity=%" PRIu32 ")\n", pBloom->count, pBloom->capacity);
+        return true;
+    }
+    if ((pBloom->cur.block_matched - pBloom->cur.block_real - pBloom->cur.block_descendant >= BLOOM_FP_SAMPLES_MIN) &&
+            (bc_bloom_fp_observed(&pBloom->cur) > limit)) {
+        LOGD("observed fp rate over budget\n");
+        bc_bloom_print(pBloom);
+        return true;
+    }
+    return false;
+}
+
+
+void bc_bloom_block(bc_bloom_t *pBloom, uint32_t TotalTx)
+{
+    if (!pBloom->loaded) {
+        return;
+    }
+    pBloom->cur.block_tx += TotalTx;
+    pBloom->total.block_tx += TotalTx;
+    pthread_mutex_lock(&mMux);
+    mStat.block_tx += TotalTx;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+double bc_bloom_fp_rate(const bc_bloom_t *pBloom)
+{
+    if (!pBloom->loaded) {
+        return pBloom->cleared ? 1.0 : 0.0;
+    }
+    double k = (double)pBloom->hashes;
+    return pow(1.0 - exp(-k * pBloom->count / pBloom->bits), k);
+}
+
+
+double bc_bloom_fp_observed(const bc_bloom_stat_t *pStat)
+{
+    if (pStat->block_tx == 0) {
+        return 0.0;
+    }
+    return (double)(pStat->block_matched - pStat->block_real - pStat->block_descendant) / pStat->block_tx;
+}
+
+
+void bc_bloom_stats(bc_bloom_stat_t *pStat)
+{
+    pthread_mutex_lock(&mMux);
+    *pStat = mStat;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_bloom_print(const bc_bloom_t *pBloom)
+{
+    bc_bloom_stat_t all;
+    bc_bloom_stats(&all);
+    const bc_bloom_stat_t *stats[] = { &pBloom->cur, &pBloom->total, &all };
+    const char *names[] = { "cur", "total", "all" };
+
+    for (size_t lp = 0; lp < ARRAY_SIZE(stats); lp++) {
+        LOGD("bloom %s: tx=%" PRIu32 "(real=%" PRIu32 ", desc=%" PRIu32 "), block tx=%" PRIu32 "(matched=%" PRIu32 ", real=%" PRIu32 ", desc=%" PRIu32 "), fp=%f\n",
+                names[lp],
+                stats[lp]->tx_matched, stats[lp]->tx_real, stats[lp]->tx_descendant,
+                stats[lp]->block_tx, stats[lp]->block_matched, stats[lp]->block_real, stats[lp]->block_descendant,
+                bc_bloom_fp_observed(stats[lp]));
+    }
+    LOGD("bloom estimated fp=%f, target=%f\n", bc_bloom_fp_rate(pBloom), pBloom->rate);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** tx受信の集計
+ *
+ */
+static void stat_tx(bc_bloom_stat_t *pStat, bool bReal, bool bDescendant, bool bBlock)
+{
+    pStat->tx_matched++;
+    if (bReal) {
+        pStat->tx_real++;
+    }
+    if (bDescendant) {
+        pStat->tx_descendant++;
+    }
+    if (bBlock) {
+        pStat->block_matched++;
+        if (bReal) {
+            pStat->block_real++;
+        }
+        if (bDescendant) {
+            pStat->block_descendant++;
+        }
+    }
+}
+
+
+/** 誤検出txのoutputを使っているか
+ *
+ */
+static bool fp_parent(const bc_bloom_t *pBloom, const bc_txview_t *pView)
+{
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        uint64_t key;
+        MEMCPY(&key, vin.p_outpoint, sizeof(key));
+        if (key == 0) {
+            continue;
+        }
+        for (int lp = 0; lp < BC_BLOOM_FP_TXID_NUM; lp++) {
+            int idx = (int)((key + lp) % BC_BLOOM_FP_TXID_NUM);
+            if (pBloom->fp_txid[idx] == 0) {
+                break;
+            }
+            if (pBloom->fp_txid[idx] == key) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+/** 誤検出txidの記録
+ *
+ * 一杯になったら全て忘れる(以降の子は誤検出に数える)。
+ */
+static void fp_add(bc_bloom_t *pBloom, const uint8_t *pTxid)
+{
+    uint64_t key;
+
+    MEMCPY(&key, pTxid, sizeof(key));
+    if (key == 0) {
+        return;
+    }
+    if (pBloom->fp_num >= BC_BLOOM_FP_TXID_NUM * 3 / 4) {
+        MEMSET(pBloom->fp_txid, 0, sizeof(pBloom->fp_txid));
+        pBloom->fp_num = 0;
+    }
+    for (int lp = 0; lp < BC_BLOOM_FP_TXID_NUM; lp++) {
+        int idx = (int)((key + lp) % BC_BLOOM_FP_TXID_NUM);
+        if (pBloom->fp_txid[idx] == key) {
+            break;
+        }
+        if (pBloom->fp_txid[idx] == 0) {
+            pBloom->fp_txid[idx] = key;
+            pBloom->fp_num++;
+            break;
+        }
+    }
+}
+
+
+/** nTweak
+ *
+ * /dev/urandomが読めない場合はrand()と時刻で代用する。
+ */
+static uint32_t random_tweak(void)
+{
+    uint32_t tweak;
+
+    FILE *fp = fopen(BLOOM_TWEAK_DEV, "rb");
+    if (fp != NULL) {
+        size_t sz = fread(&tweak, sizeof(tweak), 1, fp);
+        fclose(fp);
+        if (sz == 1) {
+            return tweak;
+        }
+    }
+    LOGE("fail: read %s\n", BLOOM_TWEAK_DEV);
+    return (uint32_t)rand() ^ (uint32_t)time(NULL);
+}
@@ -0,0 +1,306 @@
+/**************************************************************************
+ * @file    bc_cfilter.c
+ * @brief   BIP157 compact block filter取得
+ * @note
+ *      - filter header = HASH256(filter hash || 1つ前のfilter header)
+ *      - 1000block毎のfilter headerはcfcheckptと照合する
+ *      - cfcheckptは別peer(helper)のcfcheckptと一致してから使う
+ *      - genesisのfilter headerはBIP158の値と照合する
+ *      - filterの取得と照合はbc_rescan
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_cfilter.h"
+#include "bc_checkpoint.h"
+#include "bc_gcs.h"
+#include "bc_headers.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "cfilter"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+/** genesisのbasic filter(BIP158 test vector) */
+#if defined(MAINNET)
+static const uint8_t kGenesisFilter[] = { 0x01, 0x7f, 0xa8, 0x80 };
+#elif defined(TESTNET)
+static const uint8_t kGenesisFilter[] = { 0x01, 0x9d, 0xfc, 0xa8 };
+#endif
+
+/** genesisのfilter header(BIP158 test vector, 内部バイト順) */
+static const uint8_t kGenesisHeader[] = {
+#if defined(MAINNET)
+    0x9f, 0x3c, 0x30, 0xf0, 0xc3, 0x7f, 0xb9, 0x77, 0xcf, 0x3e, 0x1a, 0x31, 0x73, 0xc6, 0x31, 0xe8,
+    0xff, 0x11, 0x9a, 0xd3, 0x08, 0x8b, 0x6f, 0x5b, 0x2b, 0xce, 0xd0, 0x80, 0x21, 0x39, 0xc2, 0x02,
+#elif defined(TESTNET)
+    0x50, 0xb7, 0x81, 0xae, 0xd7, 0xb7, 0x12, 0x90, 0x12, 0xa6, 0xd2, 0x0e, 0x2d, 0x04, 0x00, 0x27,
+    0x93, 0x7f, 0x3a, 0xff, 0xae, 0xe5, 0x73, 0x77, 0x99, 0x08, 0xeb, 0xb7, 0x79, 0x45, 0x58, 0x21,
+#endif
+};
+
+/** genesis coinbaseのscriptPubKey(mainnet/testnet共通) */
+static const uint8_t kGenesisScript[] = {
+    0x41, 0x04, 0x67, 0x8a, 0xfd, 0xb0, 0xfe, 0x55, 0x48, 0x27, 0x19, 0x67, 0xf1, 0xa6, 0x71, 0x30,
+    0xb7, 0x10, 0x5c, 0xd6, 0xa8, 0x28, 0xe0, 0x39, 0x09, 0xa6, 0x79, 0x62, 0xe0, 0xea, 0x1f, 0x61,
+    0xde, 0xb6, 0x49, 0xf6, 0xbc, 0x3f, 0x4c, 0xef, 0x38, 0xc4, 0xf3, 0x55, 0x04, 0xe5, 0x1e, 0xc1,
+    0x12, 0xde, 0x5c, 0x38, 0x4d, 0xf7, 0xba, 0x0b, 0x8d, 0x57, 0x8a, 0x4c, 0x70, 0x2b, 0x6b, 0xf1,
+    0x1d, 0x5f, 0xac,
+};
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+/** cfcheckptの照合状態(main peerとhelperで共有) */
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static bc_cfilter_cp_t  mCpState;
+static uint32_t         mCpGen;                         ///< bc_cfilter_checkpt()した回数
+static uint8_t          mCpStop[BTC_SZ_HASH256];        ///< stop_hash
+static uint32_t         mCpNum;                         ///< filter header数
+static uint8_t          mCpDigest[BTC_SZ_HASH256];      ///< HASH256(filter header)
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void bc_cfilter_start(bc_cfilter_t *pCfilter, uint32_t From, uint32_t To)
+{
+    bc_cfilter_free(pCfilter);
+    MEMSET(pCfilter, 0, sizeof(bc_cfilter_t));
+    pCfilter->filter_start = From;
+    pCfilter->end = To;
+    LOGD("compact filter: %" PRIu32 " - %" PRIu32 "\n", From, To);
+}
+
+
+void bc_cfilter_extend(bc_cfilter_t *pCfilter, uint32_t To)
+{
+    if (pCfilter->end < To) {
+        pCfilter->end = To;
+    }
+}
+
+
+void bc_cfilter_free(bc_cfilter_t *pCfilter)
+{
+    FREE(pCfilter->p_checkpt);
+    pCfilter->p_checkpt = NULL;
+    pCfilter->checkpt_num = 0;
+}
+
+
+bool bc_cfilter_genesis_check(void)
+{
+    uint8_t buf[2 * BTC_SZ_HASH256];
+    uint8_t header[BTC_SZ_HASH256];
+
+    //filter header = HASH256(HASH256(filter) || 0)
+    bc_sha256_hash256(buf, kGenesisFilter, sizeof(kGenesisFilter));
+    MEMSET(buf + BTC_SZ_HASH256, 0, BTC_SZ_HASH256);
+    bc_sha256_hash256(header, buf, sizeof(buf));
+    if (MEMCMP(header, kGenesisHeader, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: genesis filter header\n");
+        return false;
+    }
+
+    const bc_checkpoint_t *p_genesis = bc_checkpoint_get(0);
+    if (p_genesis == NULL) {
+        LOGE("fail: no genesis\n");
+        return false;
+    }
+    bc_gcs_query_t query;
+    utl_buf_t item;
+    item.buf = (uint8_t *)kGenesisScript;
+    item.len = sizeof(kGenesisScript);
+    if (!bc_gcs_query_init(&query, &item, 1)) {
+        return false;
+    }
+    bool ret = bc_gcs_match_any(&query, kGenesisFilter, sizeof(kGenesisFilter), p_genesis->hash);
+    bc_gcs_query_free(&query);
+    if (!ret) {
+        LOGE("fail: genesis filter match\n");
+    }
+    return ret;
+}
+
+
+void bc_cfilter_genesis_header(uint8_t *pHeader)
+{
+    MEMCPY(pHeader, kGenesisHeader, BTC_SZ_HASH256);
+}
+
+
+bool bc_cfilter_checkpt(bc_cfilter_t *pCfilter, const uint8_t *pStopHash, const uint8_t *pHeaders, uint32_t Num)
+{
+    if (Num != pCfilter->end / BC_CFILTER_CP_INTERVAL) {
+        LOGE("fail: cfcheckpt count(%" PRIu32 ")\n", Num);
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    mCpState = BC_CFILTER_CP_WAIT;
+    mCpGen++;
+    MEMCPY(mCpStop, pStopHash, BTC_SZ_HASH256);
+    mCpNum = Num;
+    bc_sha256_hash256(mCpDigest, pHeaders, Num * BTC_SZ_HASH256);
+    pthread_mutex_unlock(&mMux);
+    pCfilter->checkpt_ok = false;
+    FREE(pCfilter->p_checkpt);
+    pCfilter->p_checkpt = (uint8_t *)MALLOC(Num * BTC_SZ_HASH256 + 1);
+    MEMCPY(pCfilter->p_checkpt, pHeaders, Num * BTC_SZ_HASH256);
+    pCfilter->checkpt_num = Num;
+
+    //直前のcheckpointからfilter headerをつなげる
+    uint32_t cp = (pCfilter->filter_start > 0) ? (pCfilter->filter_start - 1) / BC_CFILTER_CP_INTERVAL : 0;
+    if (cp == 0) {
+        pCfilter->next_height = 0;
+        MEMSET(pCfilter->prev_header, 0, BTC_SZ_HASH256);
+    } else {
+        pCfilter->next_height = cp * BC_CFILTER_CP_INTERVAL + 1;
+        MEMCPY(pCfilter->prev_header, pCfilter->p_checkpt + (cp - 1) * BTC_SZ_HASH256, BTC_SZ_HASH256);
+    }
+    pCfilter->batch_stop = 0;
+    return true;
+}
+
+
+bool bc_cfilter_crosscheck_stop(uint8_t *pStopHash, uint32_t *pGen)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = (mCpState == BC_CFILTER_CP_WAIT);
+    if (ret) {
+        MEMCPY(pStopHash, mCpStop, BTC_SZ_HASH256);
+        *pGen = mCpGen;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_cfilter_crosscheck(const uint8_t *pStopHash, const uint8_t *pHeaders, uint32_t Num)
+{
+    bool ret = true;
+    uint8_t digest[BTC_SZ_HASH256];
+
+    bc_sha256_hash256(digest, pHeaders, Num * BTC_SZ_HASH256);
+    pthread_mutex_lock(&mMux);
+    if ((mCpState == BC_CFILTER_CP_WAIT) && (MEMCMP(pStopHash, mCpStop, BTC_SZ_HASH256) == 0)) {
+        if ((Num == mCpNum) && (MEMCMP(digest, mCpDigest, BTC_SZ_HASH256) == 0)) {
+            mCpState = BC_CFILTER_CP_AGREED;
+            LOGD("cfcheckpt agreed\n");
+        } else {
+            mCpState = BC_CFILTER_CP_CONFLICT;
+            LOGE("fail: cfcheckpt conflict\n");
+            ret = false;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bc_cfilter_cp_t bc_cfilter_crosscheck_state(void)
+{
+    pthread_mutex_lock(&mMux);
+    bc_cfilter_cp_t ret = mCpState;
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_cfilter_next(bc_cfilter_t *pCfilter, uint32_t *pStart, uint8_t *pStopHash)
+{
+    if ((pCfilter->p_checkpt == NULL) || !pCfilter->checkpt_ok ||
+            (pCfilter->batch_stop != 0) || (pCfilter->next_height > pCfilter->end)) {
+        //cfcheckpt未受信・未照合 or 要求中 or 残りなし
+        return false;
+    }
+
+    uint32_t stop = pCfilter->next_height + BC_CFILTER_BATCH - 1;
+    if (stop > pCfilter->end) {
+        stop = pCfilter->end;
+    }
+    if (!bc_headers_get_hash(pCfilter->stop_hash, stop)) {
+        LOGE("fail: no header(%" PRIu32 ")\n", stop);
+        return false;
+    }
+    pCfilter->batch_start = pCfilter->next_height;
+    pCfilter->batch_stop = stop;
+    *pStart = pCfilter->batch_start;
+    MEMCPY(pStopHash, pCfilter->stop_hash, BTC_SZ_HASH256);
+    return true;
+}
+
+
+bool bc_cfilter_headers(bc_cfilter_t *pCfilter, uint32_t *pStart, uint32_t *pNum, uint8_t *pHeaders,
+                const uint8_t *pStopHash, const uint8_t *pPrev, const uint8_t *pHashes, uint32_t Num)
+{
+    if ((pCfilter->batch_stop == 0) || (MEMCMP(pStopHash, pCfilter->stop_hash, BTC_SZ_HASH256) != 0)) {
+        LOGE("fail: unrequested cfheaders\n");
+        return false;
+    }
+    if (Num != pCfilter->batch_stop - pCfilter->batch_start + 1) {
+        LOGE("fail: cfheaders count(%" PRIu32 ")\n", Num);
+        return false;
+    }
+    if (MEMCMP(pPrev, pCfilter->prev_header, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: previous filter header mismatch(%" PRIu32 ")\n", pCfilter->batch_start);
+        return false;
+    }
+
+    uint8_t buf[2 * BTC_SZ_HASH256];
+    uint8_t header[BTC_SZ_HASH256];
+    MEMCPY(header, pPrev, BTC_SZ_HASH256);
+    for (uint32_t lp = 0; lp < Num; lp++) {
+        uint32_t height = pCfilter->batch_start + lp;
+        MEMCPY(buf, pHashes + lp * BTC_SZ_HASH256, BTC_SZ_HASH256);
+        MEMCPY(buf + BTC_SZ_HASH256, header, BTC_SZ_HASH256);
+        bc_sha256_hash256(header, buf, sizeof(buf));
+        MEMCPY(pHeaders + lp * BTC_SZ_HASH256, header, BTC_SZ_HASH256);
+
+        if ((height == 0) && (MEMCMP(header, kGenesisHeader, BTC_SZ_HASH256) != 0)) {
+            LOGE("fail: genesis filter header mismatch\n");
+            return false;
+        }
+        uint32_t cp = height / BC_CFILTER_CP_INTERVAL;
+        if ((height % BC_CFILTER_CP_INTERVAL == 0) && (cp > 0) && (cp <= pCfilter->checkpt_num)) {
+            if (MEMCMP(header, pCfilter->p_checkpt + (cp - 1) * BTC_SZ_HASH256, BTC_SZ_HASH256) != 0) {
+                LOGE("fail: filter header checkpoint mismatch(%" PRIu32 ")\n", height);
+                return false;
+            }
+        }
+    }
+
+    MEMCPY(pCfilter->prev_header, header, BTC_SZ_HASH256);
+    pCfilter->next_height = pCfilter->batch_stop + 1;
+
+    //照合開始より前のfilterは要らない
+    *pStart = pCfilter->batch_start;
+    if (*pStart < pCfilter->filter_start) {
+        *pStart = pCfilter->filter_start;
+    }
+    *pNum = (*pStart <= pCfilter->batch_stop) ? pCfilter->batch_stop - *pStart + 1 : 0;
+    pCfilter->batch_stop = 0;
+    return true;
+}
+
+
+void bc_cfilter_skip(bc_cfilter_t *pCfilter, uint32_t Height, const uint8_t *pHeader)
+{
+    if ((pCfilter->batch_stop == 0) && (pCfilter->next_height <= Height)) {
+        pCfilter->next_height = Height + 1;
+        MEMCPY(pCfilter->prev_header, pHeader, BTC_SZ_HASH256);
+    }
+}
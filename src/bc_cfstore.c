@@ -0,0 +1,673 @@
+/**************************************************************************
+ * @file    bc_cfstore.c
+ * @brief   compact filter保存
+ * @note
+ *      - FNAME_CFILTERSにfilterを高さ順に追記し、FNAME_CFINDEXで高さから引く
+ *      - indexにはBlock Hash, filter hash, filter headerを置き、読込み時に確認する
+ *        (genesisのfilter headerはBIP158の値と照合する)
+ *      - 最近読んだfilterはLRUでmemoryに置く
+ *      - 保存範囲は連続した1区間(先頭側には追加しない)
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "btc.h"
+
+#include "bc_misc.h"
+#include "bc_cfstore.h"
+#include "bc_cfilter.h"
+#include "bc_headers.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "cfstore"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#ifndef CFSTORE_MAX_MB
+#define CFSTORE_MAX_MB          (0)                     ///< 保存の上限サイズ(MB, 0:保存しない)
+#endif
+#ifndef FNAME_CFILTERS
+#define FNAME_CFILTERS          "cfilters.nyt"
+#endif
+#ifndef FNAME_CFINDEX
+#define FNAME_CFINDEX           "cfindex.nyt"
+#endif
+
+#define STORE_MAGIC             ((uint32_t)0x4654594e)  ///< "NYTF"
+#define STORE_VERSION           ((uint32_t)1)
+#define STORE_GROW              (8192)                  ///< index拡張単位(record数)
+
+#define CP_INTERVAL             (1000)                  ///< cfcheckptの間隔
+#define CACHE_SZ_MAX            (32 * 1024 * 1024)      ///< memory cacheの合計サイズ上限
+
+#define M_STORE                 ((struct store_t *)mpMap)
+#define M_RECORD(idx)           ((struct record_t *)(mpMap + sizeof(struct store_t) + (size_t)(idx) * sizeof(struct record_t)))
+#define M_IDX_SIZE(num)         (sizeof(struct store_t) + (size_t)(num) * sizeof(struct record_t))
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+#pragma pack(1)
+
+/** @struct store_t
+ *
+ * FNAME_CFINDEX先頭
+ */
+struct store_t {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    base_height;                    ///< 最初のBlock Height
+    uint32_t    count;                          ///< 保存数
+};
+
+
+/** @struct record_t
+ *
+ * FNAME_CFINDEXのBlock Height毎
+ */
+struct record_t {
+    uint64_t    offset;                         ///< FNAME_CFILTERS中の位置
+    uint32_t    len;                            ///< filter長
+    uint8_t     bhash[BTC_SZ_HASH256];          ///< Block Hash
+    uint8_t     filter_hash[BTC_SZ_HASH256];    ///< HASH256(filter)
+    uint8_t     header[BTC_SZ_HASH256];         ///< filter header
+};
+
+#pragma pack()
+
+
+/** @struct cache_t
+ *
+ */
+typedef struct {
+    uint32_t    height;
+    uint8_t     *p_data;                        ///< NULL:未使用
+    size_t      len;
+    int         prev;                           ///< LRU(-1:先頭)
+    int         next;                           ///< LRU(-1:末尾) or 空きlist
+    int         hnext;                          ///< 同じbucket
+} cache_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static int              mIdxFd = -1;
+static int              mDataFd = -1;
+static uint8_t          *mpMap;
+static uint32_t         mCapacity;              ///< mmap済みrecord数
+static uint64_t         mDataSize;              ///< FNAME_CFILTERSの有効サイズ
+static uint64_t         mMaxBytes;
+static bool             mFull;
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+
+static cache_t          mCache[BC_CFSTORE_CACHE_NUM];
+static int              mBucket[BC_CFSTORE_CACHE_NUM];
+static int              mLruHead;
+static int              mLruTail;
+static int              mFreeHead;
+static size_t           mCacheSize;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool store_map(uint32_t Capacity);
+static bool record_match(uint32_t Idx);
+static void truncate_from(uint32_t Height);
+static void filter_header(uint8_t *pHeader, const uint8_t *pFilterHash, const uint8_t *pPrev);
+static void genesis_header(uint8_t *pHeader, const uint8_t *pFilterHash);
+
+static void cache_init(void);
+static void cache_free(void);
+static int cache_find(uint32_t Height);
+static void cache_put(uint32_t Height, const uint8_t *pData, size_t Len);
+static void cache_remove(int Idx);
+static void cache_unlink(int Idx);
+static void cache_push_front(int Idx);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_cfstore_init(void)
+{
+    struct stat st;
+
+    if (CFSTORE_MAX_MB == 0) {
+        return true;
+    }
+    mMaxBytes = (uint64_t)CFSTORE_MAX_MB * 1024 * 1024;
+    mFull = false;
+    cache_init();
+
+    mIdxFd = open(FNAME_CFINDEX, O_RDWR | O_CREAT, 0644);
+    if (mIdxFd < 0) {
+        LOGE("fail: open(%s): %s\n", FNAME_CFINDEX, strerror(errno));
+        goto LABEL_ERROR;
+    }
+    mDataFd = open(FNAME_CFILTERS, O_RDWR | O_CREAT, 0644);
+    if (mDataFd < 0) {
+        LOGE("fail: open(%s): %s\n", FNAME_CFILTERS, strerror(errno));
+        goto LABEL_ERROR;
+    }
+
+    if ((fstat(mIdxFd, &st) != 0) || ((size_t)st.st_size < sizeof(struct store_t))) {
+        //新規
+        struct store_t store;
+        MEMSET(&store, 0, sizeof(store));
+        store.magic = STORE_MAGIC;
+        store.version = STORE_VERSION;
+        if ((ftruncate(mIdxFd, 0) != 0) || (write(mIdxFd, &store, sizeof(store)) != sizeof(store))) {
+            LOGE("fail: write header: %s\n", strerror(errno));
+            goto LABEL_ERROR;
+        }
+        if (!store_map(0)) {
+            goto LABEL_ERROR;
+        }
+    } else {
+        if (!store_map((uint32_t)((st.st_size - sizeof(struct store_t)) / sizeof(struct record_t)))) {
+            goto LABEL_ERROR;
+        }
+        if ((M_STORE->magic != STORE_MAGIC) || (M_STORE->version != STORE_VERSION) ||
+                (M_STORE->count > mCapacity)) {
+            LOGE("fail: invalid store(%s)\n", FNAME_CFINDEX);
+            goto LABEL_ERROR;
+        }
+    }
+
+    //filterを書き終える前に止まった分は捨てる
+    if (fstat(mDataFd, &st) != 0) {
+        LOGE("fail: fstat: %s\n", strerror(errno));
+        goto LABEL_ERROR;
+    }
+    while ((M_STORE->count > 0) &&
+            (M_RECORD(M_STORE->count - 1)->offset + M_RECORD(M_STORE->count - 1)->len > (uint64_t)st.st_size)) {
+        M_STORE->count--;
+    }
+    truncate_from(M_STORE->base_height + M_STORE->count);
+    LOGD("store(base=%" PRIu32 ", count=%" PRIu32 ", size=%" PRIu64 ")\n", M_STORE->base_height, M_STORE->count, mDataSize);
+    return true;
+
+LABEL_ERROR:
+    bc_cfstore_term();
+    return false;
+}
+
+
+void bc_cfstore_term(void)
+{
+    pthread_mutex_lock(&mMux);
+    if (mpMap != NULL) {
+        msync(mpMap, M_IDX_SIZE(mCapacity), MS_SYNC);
+        munmap(mpMap, M_IDX_SIZE(mCapacity));
+        mpMap = NULL;
+    }
+    if (mIdxFd >= 0) {
+        close(mIdxFd);
+        mIdxFd = -1;
+    }
+    if (mDataFd >= 0) {
+        fsync(mDataFd);
+        close(mDataFd);
+        mDataFd = -1;
+    }
+    mCapacity = 0;
+    cache_free();
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_cfstore_range(uint32_t *pBase, uint32_t *pTip)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if ((mpMap != NULL) && (M_STORE->count > 0)) {
+        *pBase = M_STORE->base_height;
+        *pTip = M_STORE->base_height + M_STORE->count - 1;
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+void bc_cfstore_verify(const uint8_t *pCheckpt, uint32_t Num)
+{
+    pthread_mutex_lock(&mMux);
+    if ((mpMap == NULL) || (M_STORE->count == 0)) {
+        goto LABEL_EXIT;
+    }
+
+    //reorg: 一致しなくなるのは末尾側なので二分探索する
+    if (!record_match(M_STORE->count - 1)) {
+        uint32_t lo = 0;
+        uint32_t hi = M_STORE->count - 1;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (record_match(mid)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        LOGD("reorg: %" PRIu32 "\n", M_STORE->base_height + lo);
+        truncate_from(M_STORE->base_height + lo);
+    }
+
+    //cfcheckpt
+    for (uint32_t cp = 1; cp <= Num; cp++) {
+        uint32_t height = cp * CP_INTERVAL;
+        if ((height < M_STORE->base_height) || (M_STORE->count == 0)) {
+            continue;
+        }
+        if (height >= M_STORE->base_height + M_STORE->count) {
+            break;
+        }
+        const struct record_t *p_rec = M_RECORD(height - M_STORE->base_height);
+        if (MEMCMP(p_rec->header, pCheckpt + (cp - 1) * BTC_SZ_HASH256, BTC_SZ_HASH256) != 0) {
+            //直前のcheckpointから後ろは信用しない
+            LOGE("fail: checkpoint mismatch(%" PRIu32 ")\n", height);
+            truncate_from(height - CP_INTERVAL + 1);
+            break;
+        }
+    }
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_cfstore_get_header(uint8_t *pHeader, uint32_t Height)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if ((mpMap != NULL) && (Height >= M_STORE->base_height) && (Height < M_STORE->base_height + M_STORE->count)) {
+        MEMCPY(pHeader, M_RECORD(Height - M_STORE->base_height)->header, BTC_SZ_HASH256);
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+uint8_t *bc_cfstore_get(uint32_t Height, uint8_t *pBlockHash, uint8_t *pHeader, size_t *pLen)
+{
+    uint8_t *p_data = NULL;
+
+    pthread_mutex_lock(&mMux);
+    if ((mpMap == NULL) || (Height < M_STORE->base_height) || (Height >= M_STORE->base_height + M_STORE->count)) {
+        goto LABEL_EXIT;
+    }
+    uint32_t idx = Height - M_STORE->base_height;
+    const struct record_t *p_rec = M_RECORD(idx);
+    MEMCPY(pBlockHash, p_rec->bhash, BTC_SZ_HASH256);
+    MEMCPY(pHeader, p_rec->header, BTC_SZ_HASH256);
+    *pLen = p_rec->len;
+
+    int cache = cache_find(Height);
+    if (cache >= 0) {
+        p_data = (uint8_t *)MALLOC(p_rec->len + 1);
+        if (p_data == NULL) {
+            LOGE("fail: malloc(%" PRIu32 ")\n", Height);
+            goto LABEL_EXIT;
+        }
+        MEMCPY(p_data, mCache[cache].p_data, p_rec->len);
+        cache_unlink(cache);
+        cache_push_front(cache);
+        goto LABEL_EXIT;
+    }
+
+    uint8_t hash[BTC_SZ_HASH256];
+    p_data = (uint8_t *)MALLOC(p_rec->len + 1);
+    if (p_data == NULL) {
+        LOGE("fail: malloc(%" PRIu32 ")\n", Height);
+        goto LABEL_EXIT;
+    }
+    ssize_t sz = pread(mDataFd, p_data, p_rec->len, (off_t)p_rec->offset);
+    if (sz == (ssize_t)p_rec->len) {
+        bc_sha256_hash256(hash, p_data, p_rec->len);
+        if (MEMCMP(hash, p_rec->filter_hash, BTC_SZ_HASH256) == 0) {
+            if (idx > 0) {
+                filter_header(hash, p_rec->filter_hash, M_RECORD(idx - 1)->header);
+            } else if (Height == 0) {
+                genesis_header(hash, p_rec->filter_hash);
+            } else {
+                //先頭の1つ前は保存していないので、filter hashの確認だけ
+                MEMCPY(hash, p_rec->header, BTC_SZ_HASH256);
+            }
+        }
+    }
+    if ((sz != (ssize_t)p_rec->len) || (MEMCMP(hash, p_rec->header, BTC_SZ_HASH256) != 0)) {
+        LOGE("fail: broken filter(%" PRIu32 ")\n", Height);
+        FREE(p_data);
+        p_data = NULL;
+        truncate_from(Height);
+        goto LABEL_EXIT;
+    }
+    cache_put(Height, p_data, p_rec->len);
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return p_data;
+}
+
+
+bool bc_cfstore_append(uint32_t Height, const uint8_t *pBlockHash, const uint8_t *pHeader, const uint8_t *pFilter, size_t Len)
+{
+    bool ret = false;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    bc_sha256_hash256(hash, pFilter, Len);
+
+    pthread_mutex_lock(&mMux);
+    if ((mpMap == NULL) || mFull) {
+        goto LABEL_EXIT;
+    }
+    if ((M_STORE->count > 0) && (Height != M_STORE->base_height + M_STORE->count)) {
+        goto LABEL_EXIT;
+    }
+    uint32_t count = M_STORE->count;
+    if (mDataSize + Len + M_IDX_SIZE(count + 1) > mMaxBytes) {
+        LOGD("store full(height=%" PRIu32 ")\n", Height);
+        mFull = true;
+        goto LABEL_EXIT;
+    }
+    if ((count > 0) || (Height == 0)) {
+        uint8_t header[BTC_SZ_HASH256];
+        if (count > 0) {
+            filter_header(header, hash, M_RECORD(count - 1)->header);
+        } else {
+            genesis_header(header, hash);
+        }
+        if (MEMCMP(header, pHeader, BTC_SZ_HASH256) != 0) {
+            LOGE("fail: filter header chain(%" PRIu32 ")\n", Height);
+            goto LABEL_EXIT;
+        }
+    }
+    if ((count >= mCapacity) && !store_map(count + STORE_GROW)) {
+        //拡張前のmmapのまま。次の追記で再度拡張する
+        LOGE("fail: grow index(height=%" PRIu32 ")\n", Height);
+        goto LABEL_EXIT;
+    }
+    if (pwrite(mDataFd, pFilter, Len, (off_t)mDataSize) != (ssize_t)Len) {
+        LOGE("fail: write filter: %s\n", strerror(errno));
+        goto LABEL_EXIT;
+    }
+
+    struct record_t *p_rec = M_RECORD(count);
+    p_rec->offset = mDataSize;
+    p_rec->len = (uint32_t)Len;
+    MEMCPY(p_rec->bhash, pBlockHash, BTC_SZ_HASH256);
+    MEMCPY(p_rec->filter_hash, hash, BTC_SZ_HASH256);
+    MEMCPY(p_rec->header, pHeader, BTC_SZ_HASH256);
+    if (count == 0) {
+        M_STORE->base_height = Height;
+    }
+    M_STORE->count = count + 1;         //recordを書いてから増やす
+    mDataSize += Len;
+    cache_put(Height, pFilter, Len);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** index mmap(再)設定
+ *
+ * 失敗した場合は元のmmapを残す。
+ *
+ * @param[in]   Capacity    mmapするrecord数(ファイルも拡張する)
+ * @retval  true    OK
+ */
+static bool store_map(uint32_t Capacity)
+{
+    size_t len = M_IDX_SIZE(Capacity);
+
+    if (ftruncate(mIdxFd, len) != 0) {
+        LOGE("fail: ftruncate: %s\n", strerror(errno));
+        return false;
+    }
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, mIdxFd, 0);
+    if (p == MAP_FAILED) {
+        LOGE("fail: mmap: %s\n", strerror(errno));
+        return false;
+    }
+    if (mpMap != NULL) {
+        munmap(mpMap, M_IDX_SIZE(mCapacity));
+    }
+    mpMap = (uint8_t *)p;
+    mCapacity = Capacity;
+    return true;
+}
+
+
+/** recordとblock headerの一致確認(lock済み)
+ *
+ */
+static bool record_match(uint32_t Idx)
+{
+    uint8_t hash[BTC_SZ_HASH256];
+
+    return bc_headers_get_hash(hash, M_STORE->base_height + Idx) &&
+            (MEMCMP(hash, M_RECORD(Idx)->bhash, BTC_SZ_HASH256) == 0);
+}
+
+
+/** Height以降を破棄(lock済み)
+ *
+ */
+static void truncate_from(uint32_t Height)
+{
+    uint32_t count = (Height > M_STORE->base_height) ? Height - M_STORE->base_height : 0;
+    if (count < M_STORE->count) {
+        M_STORE->count = count;
+        mFull = false;
+        for (int lp = 0; lp < BC_CFSTORE_CACHE_NUM; lp++) {
+            if ((mCache[lp].p_data != NULL) && (mCache[lp].height >= Height)) {
+                cache_remove(lp);
+            }
+        }
+    }
+    mDataSize = (M_STORE->count > 0) ?
+            M_RECORD(M_STORE->count - 1)->offset + M_RECORD(M_STORE->count - 1)->len : 0;
+    if (ftruncate(mDataFd, (off_t)mDataSize) != 0) {
+        LOGE("fail: ftruncate: %s\n", strerror(errno));
+    }
+}
+
+
+/** filter header = HASH256(filter hash || 1つ前のfilter header)
+ *
+ */
+static void filter_header(uint8_t *pHeader, const uint8_t *pFilterHash, const uint8_t *pPrev)
+{
+    uint8_t buf[2 * BTC_SZ_HASH256];
+
+    MEMCPY(buf, pFilterHash, BTC_SZ_HASH256);
+    MEMCPY(buf + BTC_SZ_HASH256, pPrev, BTC_SZ_HASH256);
+    bc_sha256_hash256(pHeader, buf, sizeof(buf));
+}
+
+
+/** genesisのfilter header(BIP158の値と一致しなければ0)
+ *
+ */
+static void genesis_header(uint8_t *pHeader, const uint8_t *pFilterHash)
+{
+    uint8_t prev[BTC_SZ_HASH256];
+    uint8_t genesis[BTC_SZ_HASH256];
+
+    MEMSET(prev, 0, sizeof(prev));
+    filter_header(pHeader, pFilterHash, prev);
+    bc_cfilter_genesis_header(genesis);
+    if (MEMCMP(pHeader, genesis, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: genesis filter header\n");
+        MEMSET(pHeader, 0, BTC_SZ_HASH256);
+    }
+}
+
+
+/** memory cache初期化
+ *
+ */
+static void cache_init(void)
+{
+    for (int lp = 0; lp < BC_CFSTORE_CACHE_NUM; lp++) {
+        mCache[lp].p_data = NULL;
+        mCache[lp].next = lp + 1;
+        mBucket[lp] = -1;
+    }
+    mCache[BC_CFSTORE_CACHE_NUM - 1].next = -1;
+    mFreeHead = 0;
+    mLruHead = -1;
+    mLruTail = -1;
+    mCacheSize = 0;
+}
+
+
+/** memory cache解放
+ *
+ */
+static void cache_free(void)
+{
+    for (int lp = 0; lp < BC_CFSTORE_CACHE_NUM; lp++) {
+        if (mCache[lp].p_data != NULL) {
+            cache_remove(lp);
+        }
+    }
+}
+
+
+/** memory cache検索
+ *
+ * @return  index(-1:なし)
+ */
+static int cache_find(uint32_t Height)
+{
+    int idx = mBucket[Height % BC_CFSTORE_CACHE_NUM];
+    while ((idx >= 0) && (mCache[idx].height != Height)) {
+        idx = mCache[idx].hnext;
+    }
+    return idx;
+}
+
+
+/** memory cache追加
+ *
+ * 空きが無ければ最も古く使ったものから追い出す。
+ * 確保できない場合はcacheしない。
+ */
+static void cache_put(uint32_t Height, const uint8_t *pData, size_t Len)
+{
+    if ((Len > CACHE_SZ_MAX) || (cache_find(Height) >= 0)) {
+        return;
+    }
+    uint8_t *p_data = (uint8_t *)MALLOC(Len + 1);
+    if (p_data == NULL) {
+        LOGE("fail: malloc(cache)\n");
+        return;
+    }
+    while ((mFreeHead < 0) || (mCacheSize + Len > CACHE_SZ_MAX)) {
+        cache_remove(mLruTail);
+    }
+    int idx = mFreeHead;
+    cache_t *p = &mCache[idx];
+    mFreeHead = p->next;
+
+    p->height = Height;
+    p->p_data = p_data;
+    MEMCPY(p->p_data, pData, Len);
+    p->len = Len;
+    p->hnext = mBucket[Height % BC_CFSTORE_CACHE_NUM];
+    mBucket[Height % BC_CFSTORE_CACHE_NUM] = idx;
+    cache_push_front(idx);
+    mCacheSize += Len;
+}
+
+
+/** memory cache削除
+ *
+ */
+static void cache_remove(int Idx)
+{
+    cache_t *p = &mCache[Idx];
+
+    int *p_link = &mBucket[p->height % BC_CFSTORE_CACHE_NUM];
+    while (*p_link != Idx) {
+        p_link = &mCache[*p_link].hnext;
+    }
+    *p_link = p->hnext;
+    cache_unlink(Idx);
+
+    mCacheSize -= p->len;
+    FREE(p->p_data);
+    p->p_data = NULL;
+    p->next = mFreeHead;
+    mFreeHead = Idx;
+}
+
+
+/** LRUから外す
+ *
+ */
+static void cache_unlink(int Idx)
+{
+    cache_t *p = &mCache[Idx];
+
+    if (p->prev >= 0) {
+        mCache[p->prev].next = p->next;
+    } else {
+        mLruHead = p->next;
+    }
+    if (p->next >= 0) {
+        mCache[p->next].prev = p->prev;
+    } else {
+        mLruTail = p->prev;
+    }
+}
+
+
+/** LRU先頭(最近使った)に置く
+ *
+ */
+static void cache_push_front(int Idx)
+{
+    cache_t *p = &mCache[Idx];
+
+    p->prev = -1;
+    p->next = mLruHead;
+    if (mLruHead >= 0) {
+        mCache[mLruHead].prev = Idx;
+    } else {
+        mLruTail = Idx;
+    }
+    mLruHead = Idx;
+}
@@ -0,0 +1,94 @@
+/**************************************************************************
+ * @file    bc_checkpoint.c
+ * @brief   checkpoint管理
+ * @note
+ *      - テーブルはcheckpoints/{mainnet,testnet}.txtからビルド時に生成する(tools/gen_checkpoint.sh)
+ *      - 先頭はgenesis(height 0)
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bc_misc.h"
+#include "bc_checkpoint.h"
+
+#define LOG_TAG     "checkpoint"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+#include "bc_checkpoint_tbl.h"
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+const bc_checkpoint_t *bc_checkpoint_last(void)
+{
+    return &kCheckpoint[ARRAY_SIZE(kCheckpoint) - 1];
+}
+
+
+const bc_checkpoint_t *bc_checkpoint_start(void)
+{
+#ifdef CHECKPOINT_START
+    const bc_checkpoint_t *p_cp = bc_checkpoint_get(CHECKPOINT_START);
+    if (p_cp != NULL) {
+        return p_cp;
+    }
+    LOGE("CHECKPOINT_START(%" PRIu32 ") is not checkpoint\n", (uint32_t)CHECKPOINT_START);
+#endif
+    return bc_checkpoint_last();
+}
+
+
+const bc_checkpoint_t *bc_checkpoint_get(uint32_t Height)
+{
+    for (size_t lp = 0; lp < ARRAY_SIZE(kCheckpoint); lp++) {
+        if (kCheckpoint[lp].height == Height) {
+            return &kCheckpoint[lp];
+        }
+    }
+    return NULL;
+}
+
+
+const bc_checkpoint_t *bc_checkpoint_next(uint32_t Height)
+{
+    for (size_t lp = 0; lp < ARRAY_SIZE(kCheckpoint); lp++) {
+        if (kCheckpoint[lp].height > Height) {
+            return &kCheckpoint[lp];
+        }
+    }
+    return NULL;
+}
+
+
+bool bc_checkpoint_check(uint32_t Height, const uint8_t *pHash)
+{
+    for (size_t lp = 0; lp < ARRAY_SIZE(kCheckpoint); lp++) {
+        if (kCheckpoint[lp].height == Height) {
+            if (MEMCMP(kCheckpoint[lp].hash, pHash, BTC_SZ_HASH256) != 0) {
+                LOGE("fail: checkpoint mismatch(height=%" PRIu32 ")\n", Height);
+                return false;
+            }
+            LOGD("checkpoint OK(height=%" PRIu32 ")\n", Height);
+            break;
+        }
+        if (kCheckpoint[lp].height > Height) {
+            break;
+        }
+    }
+    return true;
+}
+
+
+bool bc_checkpoint_is_assumed(uint32_t Height)
+{
+    return Height <= bc_checkpoint_last()->height;
+}
@@ -0,0 +1,174 @@
+/**************************************************************************
+ * @file    bc_fblock.c
+ * @brief   filtered block取得スケジューラ
+ * @note
+ *      - 複数blockを1つのgetdataで要求し、windowの数だけ応答を待たずに流す
+ *      - 応答の順序が前後しても、Block Heightの順に取り出す
+ *      - 応答の無い要求・notfoundはBC_FBLOCK_RETRY_MAX回まで要求し直す
+ **************************************************************************/
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bc_misc.h"
+#include "bc_fblock.h"
+#include "bc_headers.h"
+
+#define LOG_TAG     "fblock"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_SLOT(fb, height)      (&(fb)->slot[(height) % BC_FBLOCK_WINDOW_MAX])
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bc_fblock_slot_t *find_slot(bc_fblock_t *pFblock, uint32_t *pHeight, const uint8_t *pHash);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void bc_fblock_start(bc_fblock_t *pFblock, uint32_t From, uint32_t To, uint32_t Window)
+{
+    MEMSET(pFblock, 0, sizeof(bc_fblock_t));
+    if ((Window == 0) || (Window > BC_FBLOCK_WINDOW_MAX)) {
+        Window = BC_FBLOCK_WINDOW_MAX;
+    }
+    pFblock->window = Window;
+    pFblock->next_req = From;
+    pFblock->next_done = From;
+    pFblock->end = To;
+    LOGD("filtered block: %" PRIu32 " - %" PRIu32 "(window=%" PRIu32 ")\n", From, To, Window);
+}
+
+
+void bc_fblock_extend(bc_fblock_t *pFblock, uint32_t To)
+{
+    if ((pFblock->window > 0) && (pFblock->end < To)) {
+        pFblock->end = To;
+    }
+}
+
+
+int bc_fblock_request(bc_fblock_t *pFblock, uint8_t *pHashes, uint64_t Now)
+{
+    uint32_t inflight = pFblock->next_req - pFblock->next_done;
+    int num = 0;
+
+    if ((pFblock->window == 0) || (pFblock->next_req > pFblock->end) || (inflight > pFblock->window / 2)) {
+        return 0;
+    }
+    while ((inflight < pFblock->window) && (pFblock->next_req <= pFblock->end)) {
+        bc_fblock_slot_t *p_slot = M_SLOT(pFblock, pFblock->next_req);
+        if (!bc_headers_get_hash(p_slot->bhash, pFblock->next_req)) {
+            //reorgでtipが下がった
+            pFblock->end = pFblock->next_req - 1;
+            break;
+        }
+        p_slot->received = false;
+        p_slot->retry = 0;
+        p_slot->matched = 0;
+        p_slot->expire = Now + BC_FBLOCK_TIMEOUT_USEC;
+        MEMCPY(pHashes + num * BTC_SZ_HASH256, p_slot->bhash, BTC_SZ_HASH256);
+        num++;
+        inflight++;
+        pFblock->next_req++;
+    }
+    return num;
+}
+
+
+int bc_fblock_retry(bc_fblock_t *pFblock, uint8_t *pHashes, uint64_t Now)
+{
+    int num = 0;
+
+    for (uint32_t height = pFblock->next_done; height < pFblock->next_req; height++) {
+        bc_fblock_slot_t *p_slot = M_SLOT(pFblock, height);
+        if (p_slot->received || (p_slot->expire > Now)) {
+            continue;
+        }
+        if (p_slot->retry >= BC_FBLOCK_RETRY_MAX) {
+            LOGE("fail: block %" PRIu32 " not received\n", height);
+            return -1;
+        }
+        LOGD("retry block %" PRIu32 "(%s)\n", height, (p_slot->expire == 0) ? "notfound" : "timeout");
+        p_slot->retry++;
+        p_slot->expire = Now + BC_FBLOCK_TIMEOUT_USEC;
+        MEMCPY(pHashes + num * BTC_SZ_HASH256, p_slot->bhash, BTC_SZ_HASH256);
+        num++;
+    }
+    return num;
+}
+
+
+bool bc_fblock_notfound(bc_fblock_t *pFblock, const uint8_t *pHash)
+{
+    uint32_t height;
+    bc_fblock_slot_t *p_slot = find_slot(pFblock, &height, pHash);
+    if (p_slot == NULL) {
+        return false;
+    }
+    LOGD("notfound block %" PRIu32 "\n", height);
+    p_slot->expire = 0;
+    return true;
+}
+
+
+bool bc_fblock_received(bc_fblock_t *pFblock, uint32_t *pHeight, const uint8_t *pHash, uint32_t Matched)
+{
+    bc_fblock_slot_t *p_slot = find_slot(pFblock, pHeight, pHash);
+    if (p_slot == NULL) {
+        return false;
+    }
+    p_slot->received = true;
+    p_slot->matched = Matched;
+    return true;
+}
+
+
+bool bc_fblock_pop(bc_fblock_t *pFblock, uint32_t *pHeight, uint8_t *pHash, uint32_t *pMatched)
+{
+    if (pFblock->next_done == pFblock->next_req) {
+        return false;
+    }
+    bc_fblock_slot_t *p_slot = M_SLOT(pFblock, pFblock->next_done);
+    if (!p_slot->received) {
+        return false;
+    }
+    *pHeight = pFblock->next_done;
+    MEMCPY(pHash, p_slot->bhash, BTC_SZ_HASH256);
+    *pMatched = p_slot->matched;
+    pFblock->next_done++;
+    return true;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 未受信の要求中block検索
+ *
+ * @param[in]   pFblock     取得状態
+ * @param[out]  pHeight     Block Height
+ * @param[in]   pHash       Block Hash
+ * @return      slot(無ければNULL)
+ */
+static bc_fblock_slot_t *find_slot(bc_fblock_t *pFblock, uint32_t *pHeight, const uint8_t *pHash)
+{
+    for (uint32_t height = pFblock->next_done; height < pFblock->next_req; height++) {
+        bc_fblock_slot_t *p_slot = M_SLOT(pFblock, height);
+        if (!p_slot->received && (MEMCMP(p_slot->bhash, pHash, BTC_SZ_HASH256) == 0)) {
+            *pHeight = height;
+            return p_slot;
+        }
+    }
+    return NULL;
+}
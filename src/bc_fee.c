@@ -0,0 +1,354 @@
+/**************************************************************************
+ * @file    bc_fee.c
+ * @brief   fee rate推定
+ * @note
+ *      - mempoolでfeeがわかったtxについて、受信からblockに入るまでのblock数をfee rateの区間毎に数える
+ *      - SPVなので見えるのは監視対象のtxとその祖先だけ。推定は自分のtxの実績で、数が少ない間は0を返す
+ *        (block中の他のtxは入力の額も受信時刻もわからないので使えない)
+ *      - 記録できるのは入力元が全てmempoolにある(未承認の親を持つ)監視対象txだけなので、ほとんど0のままになる。
+ *        txの通知を受けていること(filterload, またはCFILTERならCFILTER_TXRELAY)が前提
+ *      - 区間は1satoshi/vBから1.1倍ずつ。数はblock毎にDECAY倍して古いものほど軽くする
+ *      - 記録・推定とも区間数分の計算だけで、使うメモリは固定
+ *      - 保存はsnap_t + 集計値 + HASH256。一時fileに書いてからrenameする
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_sha256.h"
+#include "bc_fee.h"
+
+#define LOG_TAG     "fee"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#ifndef FNAME_FEE
+#define FNAME_FEE               "fee.nyt"
+#endif
+
+#define BUCKET_MIN              (1000.0)        ///< 最初の区間(satoshi/kvB)
+#define BUCKET_STEP             (1.1)
+#define BUCKET_NUM              (98)            ///< 1000～10000000satoshi/kvB
+#define DECAY                   (0.998)         ///< 1blockあたり(半減期約350block)
+#define SUCCESS_PCT             (0.85)          ///< Target以内に入った割合
+#define SUFFICIENT_TX           (4.0)           ///< 判定に使う最小の数(減衰後)
+#define SNAP_MAGIC              (0x4546594e)    ///< "NYFE"
+#define SNAP_VERSION            (1)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** 集計値 */
+typedef struct {
+    double      tx[BUCKET_NUM];                             ///< blockに入った数
+    double      fee[BUCKET_NUM];                            ///< fee rateの合計
+    double      conf[BC_FEE_TARGET_MAX][BUCKET_NUM];        ///< [n]: n+1 block以内に入った数
+    double      fail[BC_FEE_TARGET_MAX][BUCKET_NUM];        ///< [n]: n+1 block以上待って無くなった数
+} stat_t;
+
+
+#pragma pack(1)
+
+/** @struct snap_t
+ *
+ * FNAME_FEE先頭
+ *      snap_t + stat_t + HASH256(ここまで)
+ */
+struct snap_t {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        height;
+    uint64_t        floor;
+};
+
+#pragma pack()
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static int bucket_idx(uint64_t FeeRate);
+static void decay_to(uint32_t Height);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static stat_t           mStat;
+static uint32_t         mHeight;                ///< 減衰させたBlock Height
+static uint64_t         mFloor;                 ///< 最後に受信したfeefilter
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_fee_init(void)
+{
+    bool ret = false;
+    struct snap_t snap;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    uint8_t hash_file[BC_SHA256_SZ_HASH];
+    bc_sha256_t ctx;
+
+    FILE *fp = fopen(FNAME_FEE, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    if ((fread(&snap, sizeof(snap), 1, fp) != 1) ||
+            (snap.magic != SNAP_MAGIC) || (snap.version != SNAP_VERSION)) {
+        LOGE("fail: invalid %s\n", FNAME_FEE);
+        goto LABEL_EXIT;
+    }
+    if ((fread(&mStat, sizeof(mStat), 1, fp) != 1) ||
+            (fread(hash_file, sizeof(hash_file), 1, fp) != 1)) {
+        LOGE("fail: fread(%s)\n", FNAME_FEE);
+        goto LABEL_EXIT;
+    }
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    bc_sha256_update(&ctx, &mStat, sizeof(mStat));
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+    if (MEMCMP(hash, hash_file, sizeof(hash)) != 0) {
+        LOGE("fail: checksum(%s)\n", FNAME_FEE);
+        goto LABEL_EXIT;
+    }
+    mHeight = snap.height;
+    mFloor = snap.floor;
+    LOGD("load: height=%" PRIu32 "\n", mHeight);
+    ret = true;
+
+LABEL_EXIT:
+    if (!ret) {
+        MEMSET(&mStat, 0, sizeof(mStat));
+    }
+    pthread_mutex_unlock(&mMux);
+    fclose(fp);
+    return ret;
+}
+
+
+void bc_fee_term(void)
+{
+    bc_fee_save();
+}
+
+
+bool bc_fee_save(void)
+{
+    bool ret = false;
+    struct snap_t snap;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    bc_sha256_t ctx;
+
+    FILE *fp = fopen(FNAME_FEE ".tmp", "wb");
+    if (fp == NULL) {
+        LOGE("fail: fopen(%s): %s\n", FNAME_FEE ".tmp", strerror(errno));
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    MEMSET(&snap, 0, sizeof(snap));
+    snap.magic = SNAP_MAGIC;
+    snap.version = SNAP_VERSION;
+    snap.height = mHeight;
+    snap.floor = mFloor;
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    bc_sha256_update(&ctx, &mStat, sizeof(mStat));
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+    if ((fwrite(&snap, sizeof(snap), 1, fp) == 1) &&
+            (fwrite(&mStat, sizeof(mStat), 1, fp) == 1) &&
+            (fwrite(hash, sizeof(hash), 1, fp) == 1)) {
+        ret = true;
+    } else {
+        LOGE("fail: fwrite(%s)\n", FNAME_FEE ".tmp");
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    if (ret && (rename(FNAME_FEE ".tmp", FNAME_FEE) != 0)) {
+        LOGE("fail: rename(%s): %s\n", FNAME_FEE, strerror(errno));
+        ret = false;
+    }
+    return ret;
+}
+
+
+void bc_fee_confirmed(uint32_t Height, uint64_t FeeRate, uint32_t Blocks)
+{
+    if (Blocks == 0) {
+        return;
+    }
+
+    int idx = bucket_idx(FeeRate);
+    pthread_mutex_lock(&mMux);
+    decay_to(Height);
+    mStat.tx[idx] += 1.0;
+    mStat.fee[idx] += (double)FeeRate;
+    //BC_FEE_TARGET_MAXより遅いものは、どのTargetでも入らなかった数になる
+    for (uint32_t lp = Blocks - 1; lp < BC_FEE_TARGET_MAX; lp++) {
+        mStat.conf[lp][idx] += 1.0;
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_fee_failed(uint32_t Height, uint64_t FeeRate, uint32_t Blocks)
+{
+    int idx = bucket_idx(FeeRate);
+    pthread_mutex_lock(&mMux);
+    decay_to(Height);
+    //待ったblock数より短いTargetでは入らなかった
+    for (uint32_t lp = 0; (lp < Blocks) && (lp < BC_FEE_TARGET_MAX); lp++) {
+        mStat.fail[lp][idx] += 1.0;
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_fee_feefilter(uint64_t FeeRate)
+{
+    pthread_mutex_lock(&mMux);
+    mFloor = FeeRate;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+uint64_t bc_fee_estimate(uint32_t Target)
+{
+    double conf = 0.0;
+    double tx = 0.0;
+    double fail = 0.0;
+    double fee = 0.0;
+    double pass_tx = 0.0;
+    double pass_fee = 0.0;
+    uint64_t ret = 0;
+
+    if (Target == 0) {
+        Target = 1;
+    } else if (Target > BC_FEE_TARGET_MAX) {
+        Target = BC_FEE_TARGET_MAX;
+    }
+    const int t = (int)Target - 1;
+
+    pthread_mutex_lock(&mMux);
+    //高い方から十分な数になるまで区間をまとめ、割合を満たさなくなる手前までを使う
+    for (int lp = BUCKET_NUM - 1; lp >= 0; lp--) {
+        conf += mStat.conf[t][lp];
+        tx += mStat.tx[lp];
+        fail += mStat.fail[t][lp];
+        fee += mStat.fee[lp];
+        if (tx + fail < SUFFICIENT_TX) {
+            continue;
+        }
+        if (conf / (tx + fail) < SUCCESS_PCT) {
+            break;
+        }
+        pass_tx = tx;
+        pass_fee = fee;
+        conf = 0.0;
+        tx = 0.0;
+        fail = 0.0;
+        fee = 0.0;
+    }
+    if (pass_tx > 0.0) {
+        ret = (uint64_t)(pass_fee / pass_tx);
+        if (ret < mFloor) {
+            ret = mFloor;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+void bc_fee_print(void)
+{
+    static const uint32_t kTarget[] = { 1, 2, 3, 6, 12, 24, BC_FEE_TARGET_MAX };
+
+    double tx = 0.0;
+    double fail = 0.0;
+    pthread_mutex_lock(&mMux);
+    for (int lp = 0; lp < BUCKET_NUM; lp++) {
+        tx += mStat.tx[lp];
+        fail += mStat.fail[0][lp];
+    }
+    uint64_t fee_floor = mFloor;
+    pthread_mutex_unlock(&mMux);
+
+    //推定に使える数(減衰後)
+    if (tx + fail < SUFFICIENT_TX) {
+        //mempoolでfeeがわかったtxがまだ無い
+        LOGD("estimatefee: not enough samples(confirmed=%.1f, failed=%.1f)\n", tx, fail);
+        return;
+    }
+    LOGD("estimatefee(satoshi/kvB):\n");
+    for (int lp = 0; lp < ARRAY_SIZE(kTarget); lp++) {
+        LOGD("  %2" PRIu32 " block: %" PRIu64 "\n", kTarget[lp], bc_fee_estimate(kTarget[lp]));
+    }
+    LOGD("  feefilter: %" PRIu64 "\n", fee_floor);
+    LOGD("  samples: confirmed=%.1f, failed=%.1f\n", tx, fail);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static int bucket_idx(uint64_t FeeRate)
+{
+    if (FeeRate <= BUCKET_MIN) {
+        return 0;
+    }
+    int idx = (int)(log((double)FeeRate / BUCKET_MIN) / log(BUCKET_STEP));
+    return (idx < BUCKET_NUM) ? idx : BUCKET_NUM - 1;
+}
+
+
+/** Heightまで減衰させる(mMux取得済み)
+ *
+ * 古いblockの記録(rescan中など)では減衰させない。
+ */
+static void decay_to(uint32_t Height)
+{
+    if (mHeight == 0) {
+        mHeight = Height;
+    }
+    if (Height <= mHeight) {
+        return;
+    }
+
+    double f = pow(DECAY, Height - mHeight);
+    for (int lp = 0; lp < BUCKET_NUM; lp++) {
+        mStat.tx[lp] *= f;
+        mStat.fee[lp] *= f;
+        for (int t = 0; t < BC_FEE_TARGET_MAX; t++) {
+            mStat.conf[t][lp] *= f;
+            mStat.fail[t][lp] *= f;
+        }
+    }
+    mHeight = Height;
+}
@@ -9,6 +9,7 @@
 
 #include "bc_flash.h"
 #include "bc_proto.h"
+#include "bc_checkpoint.h"
 
 #define LOG_TAG     "flash"
 #include "utl_log.h"
@@ -29,15 +30,6 @@
  * const variables
  **************************************************************************/
 
-//エンディアンを逆順にし忘れないように注意！
-const uint32_t kBlockHeight = 1447141;
-const uint8_t kBlockHashStart[] = {
-    0x5e, 0xf3, 0xd3, 0x02, 0x93, 0x7a, 0x07, 0xc7,
-    0x5d, 0x87, 0xc8, 0x1e, 0xae, 0xd5, 0x3b, 0x6f,
-    0xfe, 0x95, 0x9d, 0x46, 0xf8, 0xc6, 0xa6, 0x28,
-    0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-};
-
 
 /**************************************************************************
  * static variables
@@ -92,9 +84,10 @@ void bc_flash_get_last_bhash(uint32_t *pHeight, uint8_t *pHash)
         MEMCPY(pHash, data + sizeof(uint32_t), BTC_SZ_HASH256);
         LOGD("height=%" PRIu32 "\n", *pHeight);
     } else {
-        fp = fopen(FNAME_BLOCK, "w");
-        *pHeight = kBlockHeight;
-        MEMCPY(pHash, kBlockHashStart, BTC_SZ_HASH256);
+        //checkpointから開始する
+        const bc_checkpoint_t *p_cp = bc_checkpoint_start();
+        *pHeight = p_cp->height;
+        MEMCPY(pHash, p_cp->hash, BTC_SZ_HASH256);
         bc_flash_save_last_bhash(*pHeight, pHash);
         LOGD("initialize height=%" PRIu32 "\n", *pHeight);
     }
@@ -0,0 +1,368 @@
+/**************************************************************************
+ * @file    bc_gcs.c
+ * @brief   BIP158 Golomb-coded set照合
+ * @note
+ *      - 要素: SipHash-2-4 → [0, N*M)へ写像 → sort
+ *      - filter: 64bitずつ読んでGolomb-Rice復号し、sort済み要素とmergeする
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "bc_misc.h"
+#include "bc_gcs.h"
+
+#define LOG_TAG     "gcs"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define ROTL64(x, b)            (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+} while (0)
+
+#define SORT_INSERTION_MAX      (32)            ///< これ以下は挿入sort
+#define RADIX_BITS              (8)
+#define PEEK_BITS               (57)            ///< peek()で確実に読めるbit数
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct sipkey_t
+ *
+ * keyを入れた初期状態
+ */
+typedef struct {
+    uint64_t    v[4];
+} sipkey_t;
+
+
+/** @struct bitreader_t
+ *
+ */
+typedef struct {
+    const uint8_t   *p_data;
+    size_t          len;                ///< byte数
+    uint64_t        pos;                ///< bit位置
+} bitreader_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void sipkey_init(sipkey_t *pKey, const uint8_t *pBlockHash);
+static uint64_t siphash24(const sipkey_t *pKey, const uint8_t *pData, size_t Len);
+static inline uint64_t hash_to_range(uint64_t Hash, uint64_t F);
+static void sort_u64(uint64_t *pData, uint64_t *pTmp, int Num, uint64_t Max);
+static inline uint64_t peek(const bitreader_t *pReader);
+static inline bool golomb_decode(bitreader_t *pReader, uint64_t *pVal);
+static size_t read_varint(const uint8_t *pData, size_t Len, uint64_t *pVal);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_gcs_query_init(bc_gcs_query_t *pQuery, const utl_buf_t *pItems, int Num)
+{
+    MEMSET(pQuery, 0, sizeof(bc_gcs_query_t));
+    pQuery->p_items = pItems;
+    pQuery->num = Num;
+    if (Num > 0) {
+        pQuery->p_hash = (uint64_t *)MALLOC(sizeof(uint64_t) * Num);
+        pQuery->p_tmp = (uint64_t *)MALLOC(sizeof(uint64_t) * Num);
+        if ((pQuery->p_hash == NULL) || (pQuery->p_tmp == NULL)) {
+            bc_gcs_query_free(pQuery);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void bc_gcs_query_free(bc_gcs_query_t *pQuery)
+{
+    FREE(pQuery->p_hash);
+    FREE(pQuery->p_tmp);
+    MEMSET(pQuery, 0, sizeof(bc_gcs_query_t));
+}
+
+
+bool bc_gcs_match_any(bc_gcs_query_t *pQuery, const uint8_t *pFilter, size_t Len, const uint8_t *pBlockHash)
+{
+    uint64_t n;
+    size_t sz = read_varint(pFilter, Len, &n);
+    if ((sz == 0) || (n == 0) || (pQuery->num == 0)) {
+        return false;
+    }
+    uint64_t f = n * BC_GCS_M;
+
+    //要素をまとめてhash
+    sipkey_t key;
+    sipkey_init(&key, pBlockHash);
+    for (int lp = 0; lp < pQuery->num; lp++) {
+        const utl_buf_t *p_item = &pQuery->p_items[lp];
+        pQuery->p_hash[lp] = hash_to_range(siphash24(&key, p_item->buf, p_item->len), f);
+    }
+    sort_u64(pQuery->p_hash, pQuery->p_tmp, pQuery->num, f);
+
+    //merge
+    bitreader_t reader;
+    reader.p_data = pFilter + sz;
+    reader.len = Len - sz;
+    reader.pos = 0;
+
+    const uint64_t *p_query = pQuery->p_hash;
+    const uint64_t *p_end = pQuery->p_hash + pQuery->num;
+    uint64_t value = 0;
+    for (uint64_t lp = 0; lp < n; lp++) {
+        uint64_t delta;
+        if (!golomb_decode(&reader, &delta)) {
+            LOGE("fail: broken filter\n");
+            return false;
+        }
+        value += delta;
+        while (*p_query < value) {
+            p_query++;
+            if (p_query == p_end) {
+                return false;
+            }
+        }
+        if (*p_query == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** SipHash key設定
+ *
+ * key: Block Hashの先頭16byte
+ */
+static void sipkey_init(sipkey_t *pKey, const uint8_t *pBlockHash)
+{
+    uint64_t k0;
+    uint64_t k1;
+
+    MEMCPY(&k0, pBlockHash, sizeof(k0));
+    MEMCPY(&k1, pBlockHash + sizeof(k0), sizeof(k1));
+    pKey->v[0] = 0x736f6d6570736575ULL ^ k0;
+    pKey->v[1] = 0x646f72616e646f6dULL ^ k1;
+    pKey->v[2] = 0x6c7967656e657261ULL ^ k0;
+    pKey->v[3] = 0x7465646279746573ULL ^ k1;
+}
+
+
+/** SipHash-2-4
+ *
+ */
+static uint64_t siphash24(const sipkey_t *pKey, const uint8_t *pData, size_t Len)
+{
+    uint64_t v0 = pKey->v[0];
+    uint64_t v1 = pKey->v[1];
+    uint64_t v2 = pKey->v[2];
+    uint64_t v3 = pKey->v[3];
+    uint64_t m;
+    const uint8_t *p_end = pData + (Len & ~(size_t)7);
+
+    for (; pData != p_end; pData += 8) {
+        MEMCPY(&m, pData, sizeof(m));
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    m = (uint64_t)Len << 56;
+    switch (Len & 7) {
+    case 7: m |= (uint64_t)pData[6] << 48;  //fall through
+    case 6: m |= (uint64_t)pData[5] << 40;  //fall through
+    case 5: m |= (uint64_t)pData[4] << 32;  //fall through
+    case 4: m |= (uint64_t)pData[3] << 24;  //fall through
+    case 3: m |= (uint64_t)pData[2] << 16;  //fall through
+    case 2: m |= (uint64_t)pData[1] << 8;   //fall through
+    case 1: m |= (uint64_t)pData[0];        //fall through
+    default: break;
+    }
+    v3 ^= m;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/** [0, F)への写像
+ *
+ */
+static inline uint64_t hash_to_range(uint64_t Hash, uint64_t F)
+{
+    return (uint64_t)(((unsigned __int128)Hash * F) >> 64);
+}
+
+
+/** 昇順sort
+ *
+ * 少数は挿入sort、それ以外はMaxのbit数分だけのLSD radix sort。
+ *
+ * @param[in,out]   pData       sort対象
+ * @param[out]      pTmp        作業領域(Num)
+ * @param[in]       Num         要素数
+ * @param[in]       Max         要素の上限(これ未満)
+ */
+static void sort_u64(uint64_t *pData, uint64_t *pTmp, int Num, uint64_t Max)
+{
+    if (Num <= SORT_INSERTION_MAX) {
+        for (int lp = 1; lp < Num; lp++) {
+            uint64_t v = pData[lp];
+            int lp2 = lp;
+            while ((lp2 > 0) && (pData[lp2 - 1] > v)) {
+                pData[lp2] = pData[lp2 - 1];
+                lp2--;
+            }
+            pData[lp2] = v;
+        }
+        return;
+    }
+
+    uint32_t count[1 << RADIX_BITS];
+    uint64_t *p_src = pData;
+    uint64_t *p_dst = pTmp;
+    for (int shift = 0; (shift < 64) && ((Max - 1) >> shift); shift += RADIX_BITS) {
+        MEMSET(count, 0, sizeof(count));
+        for (int lp = 0; lp < Num; lp++) {
+            count[(p_src[lp] >> shift) & ((1 << RADIX_BITS) - 1)]++;
+        }
+        uint32_t sum = 0;
+        for (int lp = 0; lp < (1 << RADIX_BITS); lp++) {
+            uint32_t c = count[lp];
+            count[lp] = sum;
+            sum += c;
+        }
+        for (int lp = 0; lp < Num; lp++) {
+            p_dst[count[(p_src[lp] >> shift) & ((1 << RADIX_BITS) - 1)]++] = p_src[lp];
+        }
+        uint64_t *p = p_src;
+        p_src = p_dst;
+        p_dst = p;
+    }
+    if (p_src != pData) {
+        MEMCPY(pData, p_src, sizeof(uint64_t) * Num);
+    }
+}
+
+
+/** pos位置から64bit読込み(MSB first)
+ *
+ * 上位PEEK_BITS以上が有効。末尾より後ろは0。
+ */
+static inline uint64_t peek(const bitreader_t *pReader)
+{
+    size_t idx = (size_t)(pReader->pos >> 3);
+    uint64_t v;
+
+    if (idx + sizeof(uint64_t) <= pReader->len) {
+        MEMCPY(&v, pReader->p_data + idx, sizeof(v));
+        v = __builtin_bswap64(v);
+    } else {
+        v = 0;
+        for (size_t lp = 0; lp < sizeof(uint64_t); lp++) {
+            v <<= 8;
+            if (idx + lp < pReader->len) {
+                v |= pReader->p_data[idx + lp];
+            }
+        }
+    }
+    return v << (pReader->pos & 7);
+}
+
+
+/** Golomb-Rice復号
+ *
+ */
+static inline bool golomb_decode(bitreader_t *pReader, uint64_t *pVal)
+{
+    uint64_t total = (uint64_t)pReader->len * 8;
+    uint64_t q = 0;
+
+    //商: 1の連続
+    for (;;) {
+        uint64_t w = ~peek(pReader);
+        int ones = (w == 0) ? 64 : __builtin_clzll(w);
+        if (ones < PEEK_BITS) {
+            q += ones;
+            pReader->pos += ones + 1;
+            break;
+        }
+        q += PEEK_BITS;
+        pReader->pos += PEEK_BITS;
+        if (pReader->pos >= total) {
+            return false;
+        }
+    }
+
+    //余り: BC_GCS_P bit
+    uint64_t r = peek(pReader) >> (64 - BC_GCS_P);
+    pReader->pos += BC_GCS_P;
+    if (pReader->pos > total) {
+        return false;
+    }
+    *pVal = (q << BC_GCS_P) | r;
+    return true;
+}
+
+
+/** varint読込み
+ *
+ * @return  読込みサイズ(0:失敗)
+ */
+static size_t read_varint(const uint8_t *pData, size_t Len, uint64_t *pVal)
+{
+    if (Len < 1) {
+        return 0;
+    }
+    size_t sz;
+    switch (pData[0]) {
+    case 0xfd:
+        sz = 3;
+        break;
+    case 0xfe:
+        sz = 5;
+        break;
+    case 0xff:
+        sz = 9;
+        break;
+    default:
+        *pVal = pData[0];
+        return 1;
+    }
+    if (Len < sz) {
+        return 0;
+    }
+    *pVal = 0;
+    for (size_t lp = sz - 1; lp > 0; lp--) {
+        *pVal = (*pVal << 8) | pData[lp];
+    }
+    return sz;
+}
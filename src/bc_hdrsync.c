@@ -0,0 +1,275 @@
+/**************************************************************************
+ * @file    bc_hdrsync.c
+ * @brief   checkpoint区間ごとの並列headers取得
+ * @note
+ *      - 区間の始点・終点はcheckpointなので、区間ごとに独立して検証できる
+ *      - 取得したheaderは一時ファイルに置き、低い区間から順にbc_headersへつなげる
+ **************************************************************************/
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_hdrsync.h"
+#include "bc_headers.h"
+#include "bc_presync.h"
+#include "bc_checkpoint.h"
+
+#define LOG_TAG     "hdrsync"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum   seg_state_t
+ */
+typedef enum {
+    SEG_FREE,                           ///< 未割当て
+    SEG_RUNNING,                        ///< 取得中
+    SEG_DONE,                           ///< 取得済み(未保存)
+    SEG_STORED,                         ///< 保存済み
+} seg_state_t;
+
+
+/** @struct seg_t
+ *
+ * 区間(start_height, stop_height]
+ */
+typedef struct {
+    seg_state_t state;
+    int         owners;                         ///< 取得中のpeer数
+    uint32_t    start_height;
+    uint8_t     start_hash[BTC_SZ_HASH256];
+    uint32_t    stop_height;
+    uint8_t     stop_hash[BTC_SZ_HASH256];
+    FILE        *fp;                            ///< 取得済みheader
+} seg_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static seg_t            mSeg[BC_HDRSYNC_SEG_MAX];
+static int              mSegNum;
+static int              mSegStored;             ///< 保存済み区間数
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void stitch(void);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_hdrsync_plan(void)
+{
+    uint8_t hash[BTC_SZ_HASH256];
+
+    pthread_mutex_lock(&mMux);
+    if (mSegStored < mSegNum) {
+        //前回の区間が残っている
+        pthread_mutex_unlock(&mMux);
+        return true;
+    }
+
+    mSegNum = 0;
+    mSegStored = 0;
+    uint32_t height = bc_headers_tip(hash, NULL);
+    const bc_checkpoint_t *p_cp;
+    while (((p_cp = bc_checkpoint_next(height)) != NULL) && (mSegNum < BC_HDRSYNC_SEG_MAX)) {
+        seg_t *p_seg = &mSeg[mSegNum];
+        MEMSET(p_seg, 0, sizeof(seg_t));
+        p_seg->state = SEG_FREE;
+        p_seg->start_height = height;
+        MEMCPY(p_seg->start_hash, hash, BTC_SZ_HASH256);
+        p_seg->stop_height = p_cp->height;
+        MEMCPY(p_seg->stop_hash, p_cp->hash, BTC_SZ_HASH256);
+        LOGD("segment[%d]: %" PRIu32 " - %" PRIu32 "\n", mSegNum, p_seg->start_height, p_seg->stop_height);
+        mSegNum++;
+
+        height = p_cp->height;
+        MEMCPY(hash, p_cp->hash, BTC_SZ_HASH256);
+    }
+    if (mSegNum < 2) {
+        //1区間なら通常のgetheadersと変わらない
+        mSegNum = 0;
+    }
+    bool ret = (mSegNum > 0);
+    pthread_mutex_unlock(&mMux);
+
+    return ret;
+}
+
+
+void bc_hdrsync_init(bc_hdrsync_peer_t *pPeer)
+{
+    MEMSET(pPeer, 0, sizeof(bc_hdrsync_peer_t));
+    pPeer->seg = -1;
+}
+
+
+bool bc_hdrsync_assign(bc_hdrsync_peer_t *pPeer, uint8_t *pStart)
+{
+    int seg = -1;
+
+    pthread_mutex_lock(&mMux);
+    for (int lp = mSegStored; lp < mSegNum; lp++) {
+        if (mSeg[lp].state == SEG_FREE) {
+            seg = lp;
+            break;
+        }
+    }
+    if (seg < 0) {
+        //取得中で最も低い区間(保存を止めている区間)
+        for (int lp = mSegStored; lp < mSegNum; lp++) {
+            if (mSeg[lp].state == SEG_RUNNING) {
+                seg = lp;
+                break;
+            }
+        }
+    }
+    if (seg >= 0) {
+        seg_t *p_seg = &mSeg[seg];
+        p_seg->state = SEG_RUNNING;
+        p_seg->owners++;
+        pPeer->seg = seg;
+        pPeer->height = p_seg->start_height;
+        MEMCPY(pPeer->last_hash, p_seg->start_hash, BTC_SZ_HASH256);
+        pPeer->stop_height = p_seg->stop_height;
+        MEMCPY(pPeer->stop_hash, p_seg->stop_hash, BTC_SZ_HASH256);
+        MEMCPY(pStart, p_seg->start_hash, BTC_SZ_HASH256);
+        bc_headers_diff_init(&pPeer->diff, p_seg->start_height);
+        pPeer->fp = tmpfile();
+        LOGD("assign segment[%d](owners=%d)\n", seg, p_seg->owners);
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if ((seg >= 0) && (pPeer->fp == NULL)) {
+        LOGE("fail: tmpfile\n");
+        bc_hdrsync_release(pPeer);
+        return false;
+    }
+    return seg >= 0;
+}
+
+
+bc_hdrsync_ret_t bc_hdrsync_headers(bc_hdrsync_peer_t *pPeer, uint8_t *pNextHash, const uint8_t *pHeaders, uint32_t Count)
+{
+    if (pPeer->seg < 0) {
+        return BC_HDRSYNC_ERROR;
+    }
+    if (Count == 0) {
+        LOGE("fail: peer does not have segment[%d]\n", pPeer->seg);
+        return BC_HDRSYNC_ERROR;
+    }
+
+    for (uint32_t lp = 0; lp < Count; lp++) {
+        const uint8_t *p = pHeaders + lp * BC_PRESYNC_REC_SZ;
+        uint32_t height = pPeer->height + 1;
+        uint8_t hash[BTC_SZ_HASH256];
+
+        if ((height > pPeer->stop_height) || !bc_headers_check(hash, p, height, pPeer->last_hash, &pPeer->diff)) {
+            return BC_HDRSYNC_ERROR;
+        }
+        if (fwrite(p, BC_HEADERS_SZ, 1, pPeer->fp) != 1) {
+            LOGE("fail: fwrite\n");
+            return BC_HDRSYNC_ERROR;
+        }
+        pPeer->height = height;
+        MEMCPY(pPeer->last_hash, hash, BTC_SZ_HASH256);
+    }
+    if (pPeer->height < pPeer->stop_height) {
+        MEMCPY(pNextHash, pPeer->last_hash, BTC_SZ_HASH256);
+        return BC_HDRSYNC_NEXT;
+    }
+
+    //区間完了(終点はcheckpointと照合済み)
+    pthread_mutex_lock(&mMux);
+    seg_t *p_seg = &mSeg[pPeer->seg];
+    p_seg->owners--;
+    if (p_seg->state == SEG_RUNNING) {
+        LOGD("segment[%d] done\n", pPeer->seg);
+        p_seg->state = SEG_DONE;
+        p_seg->fp = pPeer->fp;
+        stitch();
+    } else {
+        //重複して割り当てた他peerが先に終えた
+        fclose(pPeer->fp);
+    }
+    pthread_mutex_unlock(&mMux);
+
+    //owners減算済みなのでbc_hdrsync_release()は使わない
+    bc_hdrsync_init(pPeer);
+    return BC_HDRSYNC_DONE;
+}
+
+
+void bc_hdrsync_release(bc_hdrsync_peer_t *pPeer)
+{
+    if (pPeer->fp != NULL) {
+        //途中で終わった
+        pthread_mutex_lock(&mMux);
+        seg_t *p_seg = &mSeg[pPeer->seg];
+        p_seg->owners--;
+        if ((p_seg->state == SEG_RUNNING) && (p_seg->owners == 0)) {
+            p_seg->state = SEG_FREE;
+        }
+        pthread_mutex_unlock(&mMux);
+        fclose(pPeer->fp);
+    }
+    bc_hdrsync_init(pPeer);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 取得済み区間を低い順に保存(lock済み)
+ *
+ * 区間最初の期間は取得時にdifficultyを検証できないので、保存済みheaderにつなげて検証し直す。
+ */
+static void stitch(void)
+{
+    uint8_t header[BC_HEADERS_SZ];
+    uint8_t prev_hash[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+    bc_headers_diff_t diff;
+
+    while ((mSegStored < mSegNum) && (mSeg[mSegStored].state == SEG_DONE)) {
+        seg_t *p_seg = &mSeg[mSegStored];
+        bool ret = true;
+
+        bc_headers_diff_init(&diff, p_seg->start_height);
+        MEMCPY(prev_hash, p_seg->start_hash, BTC_SZ_HASH256);
+        rewind(p_seg->fp);
+        while (fread(header, sizeof(header), 1, p_seg->fp) == 1) {
+            if (!bc_headers_check(hash, header, diff.height + 1, prev_hash, &diff) ||
+                    !bc_headers_append(header)) {
+                ret = false;
+                break;
+            }
+            MEMCPY(prev_hash, hash, BTC_SZ_HASH256);
+        }
+        fclose(p_seg->fp);
+        p_seg->fp = NULL;
+        if (!ret) {
+            //保存済みtipとつながらない、またはdifficultyが合わない: 取り直す
+            LOGE("fail: stitch segment[%d]\n", mSegStored);
+            bc_headers_truncate(p_seg->start_height, p_seg->start_hash);
+            p_seg->state = SEG_FREE;
+            break;
+        }
+        p_seg->state = SEG_STORED;
+        LOGD("segment[%d] stored(tip=%" PRIu32 ")\n", mSegStored, p_seg->stop_height);
+        mSegStored++;
+    }
+}
@@ -0,0 +1,808 @@
+/**************************************************************************
+ * @file    bc_headers.c
+ * @brief   block header保存
+ * @note
+ *      - FNAME_HEADERSにheaderを高さ順に保存し、mmapして参照する
+ *      - snapshotは同じheader列にchecksumを付けたもの
+ *      - Block Hash→Block Heightはmemory上のopen addressing表で引く
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bc_misc.h"
+#include "bc_headers.h"
+#include "bc_checkpoint.h"
+#include "bc_flash.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "headers"
+#include "utl_log.h"
+#include "btc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#if defined(MAINNET)
+#define BC_GENESIS              BTC_GENESIS_BTCMAIN
+#define BC_GENESIS_TIME         ((uint32_t)1231006505)
+#elif defined(TESTNET)
+#define BC_GENESIS              BTC_GENESIS_BTCTEST
+#define BC_GENESIS_TIME         ((uint32_t)1296688602)
+#endif
+
+#define STORE_MAGIC             ((uint32_t)0x4854594e)  ///< "NYTH"
+#define STORE_VERSION           ((uint32_t)1)
+#define STORE_GROW              (8192)                  ///< 拡張単位(header数)
+
+#define SNAP_MAGIC              ((uint32_t)0x5354594e)  ///< "NYTS"
+#define SNAP_VERSION            ((uint32_t)1)
+
+#define INDEX_MIN               (1024)                  ///< 索引の最小slot数
+
+
+#define M_STORE                 ((struct store_t *)mpMap)
+#define M_RECORD(idx)           (mpMap + sizeof(struct store_t) + (size_t)(idx) * BC_HEADERS_SZ)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+#pragma pack(1)
+
+/** @struct store_t
+ *
+ * FNAME_HEADERS先頭
+ */
+struct store_t {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        base_height;                    ///< 起点Block Height(headerは+1から)
+    uint32_t        count;                          ///< 保存header数
+    uint8_t         base_hash[BTC_SZ_HASH256];      ///< 起点Block Hash
+    bc_pow_work_t   chainwork;                      ///< 起点からの累積chainwork
+};
+
+
+/** @struct snap_t
+ *
+ * snapshot先頭
+ *      snap_t + header[count] + HASH256(ここまで)
+ */
+struct snap_t {
+    uint32_t        magic;
+    uint32_t        version;
+    uint8_t         genesis[BTC_SZ_HASH256];        ///< 対象chain
+    uint32_t        base_height;
+    uint32_t        count;
+    uint8_t         base_hash[BTC_SZ_HASH256];
+};
+
+#pragma pack()
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static int              mFd = -1;
+static uint8_t          *mpMap;
+static uint32_t         mCapacity;                  ///< mmap済みheader数
+static uint8_t          mTipHash[BTC_SZ_HASH256];   ///< 最後のBlock Hash
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t         *mpIndex;                   ///< prev_blockの索引(header index + 1, 0:空き)
+static uint32_t         mIndexMask;                 ///< 索引のslot数 - 1
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool store_map(uint32_t Capacity);
+static bool store_reserve(uint32_t Count);
+static void store_update_tiphash(void);
+static void index_build(void);
+static void index_add(uint32_t Idx);
+static bool index_find(uint32_t *pIdx, const uint8_t *pHash);
+static bool get_hash(uint8_t *pHash, uint32_t Height);
+static bool get_bits_time(uint32_t *pBits, uint32_t *pTime, uint32_t Height);
+static bool check_bits(const bc_headers_diff_t *pDiff, uint32_t Height, uint32_t Bits, uint32_t Time);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_headers_init(void)
+{
+    struct stat st;
+
+    mFd = open(FNAME_HEADERS, O_RDWR | O_CREAT, 0644);
+    if (mFd < 0) {
+        LOGE("fail: open(%s): %s\n", FNAME_HEADERS, strerror(errno));
+        return false;
+    }
+    if (fstat(mFd, &st) != 0) {
+        LOGE("fail: fstat: %s\n", strerror(errno));
+        goto LABEL_ERROR;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct store_t)) {
+        //新規
+        struct store_t store;
+        MEMSET(&store, 0, sizeof(store));
+        store.magic = STORE_MAGIC;
+        store.version = STORE_VERSION;
+        bc_flash_get_last_bhash(&store.base_height, store.base_hash);
+        if ((ftruncate(mFd, 0) != 0) || (write(mFd, &store, sizeof(store)) != sizeof(store))) {
+            LOGE("fail: write header: %s\n", strerror(errno));
+            goto LABEL_ERROR;
+        }
+        if (!store_map(0)) {
+            goto LABEL_ERROR;
+        }
+        LOGD("new store(base=%" PRIu32 ")\n", store.base_height);
+    } else {
+        if (!store_map((uint32_t)((st.st_size - sizeof(struct store_t)) / BC_HEADERS_SZ))) {
+            goto LABEL_ERROR;
+        }
+        if ((M_STORE->magic != STORE_MAGIC) || (M_STORE->version != STORE_VERSION) ||
+                (M_STORE->count > mCapacity)) {
+            LOGE("fail: invalid store(%s)\n", FNAME_HEADERS);
+            goto LABEL_ERROR;
+        }
+        LOGD("store(base=%" PRIu32 ", count=%" PRIu32 ")\n", M_STORE->base_height, M_STORE->count);
+    }
+    store_update_tiphash();
+    index_build();
+
+    return true;
+
+LABEL_ERROR:
+    bc_headers_term();
+    return false;
+}
+
+
+void bc_headers_term(void)
+{
+    if (mpMap != NULL) {
+        msync(mpMap, sizeof(struct store_t) + (size_t)mCapacity * BC_HEADERS_SZ, MS_SYNC);
+        munmap(mpMap, sizeof(struct store_t) + (size_t)mCapacity * BC_HEADERS_SZ);
+        mpMap = NULL;
+    }
+    FREE(mpIndex);
+    mpIndex = NULL;
+    mIndexMask = 0;
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+    mCapacity = 0;
+}
+
+
+uint32_t bc_headers_tip(uint8_t *pHash, bc_pow_work_t *pWork)
+{
+    pthread_mutex_lock(&mMux);
+    uint32_t height = M_STORE->base_height + M_STORE->count;
+    if (pHash != NULL) {
+        MEMCPY(pHash, mTipHash, BTC_SZ_HASH256);
+    }
+    if (pWork != NULL) {
+        *pWork = M_STORE->chainwork;
+    }
+    pthread_mutex_unlock(&mMux);
+
+    return height;
+}
+
+
+bool bc_headers_get(uint8_t *pHeader, uint32_t Height)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if ((Height > M_STORE->base_height) && (Height <= M_STORE->base_height + M_STORE->count)) {
+        MEMCPY(pHeader, M_RECORD(Height - M_STORE->base_height - 1), BC_HEADERS_SZ);
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+
+    return ret;
+}
+
+
+bool bc_headers_get_hash(uint8_t *pHash, uint32_t Height)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = get_hash(pHash, Height);
+    pthread_mutex_unlock(&mMux);
+
+    return ret;
+}
+
+
+bool bc_headers_find(uint32_t *pHeight, const uint8_t *pHash)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (MEMCMP(pHash, mTipHash, BTC_SZ_HASH256) == 0) {
+        *pHeight = M_STORE->base_height + M_STORE->count;
+        ret = true;
+    } else {
+        //header[idx]のprev_blockはheader[idx - 1]のBlock Hash
+        uint32_t idx;
+        if (index_find(&idx, pHash)) {
+            *pHeight = M_STORE->base_height + idx;
+            ret = true;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+
+    return ret;
+}
+
+
+int bc_headers_locator(uint8_t *pHashes)
+{
+    int num = 0;
+    uint32_t step = 1;
+
+    pthread_mutex_lock(&mMux);
+    uint32_t height = M_STORE->base_height + M_STORE->count;
+    while (true) {
+        get_hash(pHashes + num * BTC_SZ_HASH256, height);
+        num++;
+        if ((num >= BC_HEADERS_LOCATOR_MAX - 1) || (height < M_STORE->base_height + step)) {
+            break;
+        }
+        height -= step;
+        if (num >= 10) {
+            step *= 2;
+        }
+    }
+    if (height != M_STORE->base_height) {
+        //最後は起点
+        get_hash(pHashes + num * BTC_SZ_HASH256, M_STORE->base_height);
+        num++;
+    }
+    pthread_mutex_unlock(&mMux);
+
+    return num;
+}
+
+
+void bc_headers_work_above(bc_pow_work_t *pWork, uint32_t Height)
+{
+    MEMSET(pWork, 0, sizeof(bc_pow_work_t));
+
+    pthread_mutex_lock(&mMux);
+    uint32_t idx = (Height > M_STORE->base_height) ? Height - M_STORE->base_height : 0;
+    for (; idx < M_STORE->count; idx++) {
+        uint32_t bits;
+        MEMCPY(&bits, M_RECORD(idx) + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+        bc_pow_work_add(pWork, bits);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_headers_diff_init(bc_headers_diff_t *pDiff, uint32_t Height)
+{
+    uint32_t bits;
+    uint32_t time;
+
+    MEMSET(pDiff, 0, sizeof(bc_headers_diff_t));
+    pDiff->height = Height;
+
+    pthread_mutex_lock(&mMux);
+    if (get_bits_time(&pDiff->bits, &pDiff->time, Height)) {
+        uint32_t h = Height - Height % BC_POW_INTERVAL;
+        if (get_bits_time(&bits, &time, h)) {
+            pDiff->first_time = time;
+        }
+        //testnetの最小difficulty blockを飛ばす
+        h = Height;
+        while (get_bits_time(&bits, &time, h)) {
+            if ((h % BC_POW_INTERVAL == 0) || (bits != BC_POW_LIMIT_BITS)) {
+                pDiff->period_bits = bits;
+                break;
+            }
+            h--;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_headers_check(uint8_t *pHash, const uint8_t *pHeader, uint32_t Height, const uint8_t *pPrevHash, bc_headers_diff_t *pDiff)
+{
+    uint32_t bits;
+    uint32_t time;
+
+    if (MEMCMP(pHeader + BC_HEADERS_OFFSET_PREV, pPrevHash, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: prev_block not linked(height=%" PRIu32 ")\n", Height);
+        return false;
+    }
+    btc_util_hash256(pHash, pHeader, BC_HEADERS_SZ);
+    if (!bc_checkpoint_check(Height, pHash)) {
+        return false;
+    }
+    MEMCPY(&bits, pHeader + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+    MEMCPY(&time, pHeader + BC_HEADERS_OFFSET_TIME, sizeof(time));
+#ifdef ASSUMEVALID
+    if (!bc_checkpoint_is_assumed(Height))
+#endif
+    {
+        if (!bc_pow_check(pHash, bits)) {
+            LOGE("fail: PoW(height=%" PRIu32 ")\n", Height);
+            return false;
+        }
+    }
+    if (pDiff == NULL) {
+        return true;
+    }
+
+    if (pDiff->height + 1 != Height) {
+        //続きではない
+        MEMSET(pDiff, 0, sizeof(bc_headers_diff_t));
+    }
+    if (!check_bits(pDiff, Height, bits, time)) {
+        LOGE("fail: difficulty(height=%" PRIu32 ", bits=%08" PRIx32 ")\n", Height, bits);
+        return false;
+    }
+    if (Height % BC_POW_INTERVAL == 0) {
+        pDiff->first_time = time;
+    }
+    if ((Height % BC_POW_INTERVAL == 0) || (bits != BC_POW_LIMIT_BITS)) {
+        pDiff->period_bits = bits;
+    }
+    pDiff->height = Height;
+    pDiff->bits = bits;
+    pDiff->time = time;
+    return true;
+}
+
+
+bool bc_headers_append(const uint8_t *pHeader)
+{
+    bool ret = false;
+    uint32_t bits;
+
+    pthread_mutex_lock(&mMux);
+    if (MEMCMP(pHeader + BC_HEADERS_OFFSET_PREV, mTipHash, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: not linked to tip\n");
+        goto LABEL_EXIT;
+    }
+    if (!store_reserve(M_STORE->count + 1)) {
+        LOGE("fail: store full(count=%" PRIu32 ")\n", M_STORE->count);
+        goto LABEL_EXIT;
+    }
+    MEMCPY(M_RECORD(M_STORE->count), pHeader, BC_HEADERS_SZ);
+    MEMCPY(&bits, pHeader + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+    bc_pow_work_add(&M_STORE->chainwork, bits);
+    M_STORE->count++;
+    index_add(M_STORE->count - 1);
+    btc_util_hash256(mTipHash, pHeader, BC_HEADERS_SZ);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_headers_truncate(uint32_t Height, const uint8_t *pHash)
+{
+    bool ret = false;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    pthread_mutex_lock(&mMux);
+    if (!get_hash(hash, Height) || (MEMCMP(hash, pHash, BTC_SZ_HASH256) != 0)) {
+        LOGE("fail: height=%" PRIu32 " not in store\n", Height);
+        goto LABEL_EXIT;
+    }
+    while (M_STORE->base_height + M_STORE->count > Height) {
+        uint32_t bits;
+        MEMCPY(&bits, M_RECORD(M_STORE->count - 1) + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+        bc_pow_work_sub(&M_STORE->chainwork, bits);
+        M_STORE->count--;
+    }
+    MEMCPY(mTipHash, hash, BTC_SZ_HASH256);
+    index_build();
+    LOGD("truncate: tip=%" PRIu32 "\n", Height);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_headers_export(const char *pFname)
+{
+    bool ret = false;
+    struct snap_t snap;
+    bc_sha256_t ctx;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    FILE *fp = fopen(pFname, "wb");
+    if (fp == NULL) {
+        LOGE("fail: fopen(%s): %s\n", pFname, strerror(errno));
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    MEMSET(&snap, 0, sizeof(snap));
+    snap.magic = SNAP_MAGIC;
+    snap.version = SNAP_VERSION;
+    MEMCPY(snap.genesis, btc_util_get_genesis_block(BC_GENESIS), BTC_SZ_HASH256);
+    snap.base_height = M_STORE->base_height;
+    snap.count = M_STORE->count;
+    MEMCPY(snap.base_hash, M_STORE->base_hash, BTC_SZ_HASH256);
+
+    size_t len = (size_t)snap.count * BC_HEADERS_SZ;
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    bc_sha256_update(&ctx, M_RECORD(0), len);
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+
+    if ((fwrite(&snap, sizeof(snap), 1, fp) == 1) &&
+            ((len == 0) || (fwrite(M_RECORD(0), len, 1, fp) == 1)) &&
+            (fwrite(hash, sizeof(hash), 1, fp) == 1)) {
+        LOGD("export: base=%" PRIu32 ", count=%" PRIu32 "\n", snap.base_height, snap.count);
+        ret = true;
+    } else {
+        LOGE("fail: fwrite(%s)\n", pFname);
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    return ret;
+}
+
+
+bool bc_headers_import(const char *pFname)
+{
+    bool ret = false;
+    struct stat st;
+    uint8_t *p_map = MAP_FAILED;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    int fd = open(pFname, O_RDONLY);
+    if (fd < 0) {
+        LOGE("fail: open(%s): %s\n", pFname, strerror(errno));
+        return false;
+    }
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct snap_t) + BTC_SZ_HASH256)) {
+        LOGE("fail: invalid snapshot size\n");
+        goto LABEL_EXIT;
+    }
+    p_map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p_map == MAP_FAILED) {
+        LOGE("fail: mmap: %s\n", strerror(errno));
+        goto LABEL_EXIT;
+    }
+    madvise(p_map, st.st_size, MADV_SEQUENTIAL);
+
+    //format
+    const struct snap_t *p_snap = (const struct snap_t *)p_map;
+    const uint8_t *p_hdr = p_map + sizeof(struct snap_t);
+    size_t len = (size_t)p_snap->count * BC_HEADERS_SZ;
+    if ((p_snap->magic != SNAP_MAGIC) || (p_snap->version != SNAP_VERSION)) {
+        LOGE("fail: not snapshot(magic=%08" PRIx32 ", version=%" PRIu32 ")\n", p_snap->magic, p_snap->version);
+        goto LABEL_EXIT;
+    }
+    if (MEMCMP(p_snap->genesis, btc_util_get_genesis_block(BC_GENESIS), BTC_SZ_HASH256) != 0) {
+        LOGE("fail: other chain\n");
+        goto LABEL_EXIT;
+    }
+    if ((size_t)st.st_size != sizeof(struct snap_t) + len + BTC_SZ_HASH256) {
+        LOGE("fail: size mismatch\n");
+        goto LABEL_EXIT;
+    }
+
+    //checksum
+    bc_sha256_hash256(hash, p_map, sizeof(struct snap_t) + len);
+    if (MEMCMP(hash, p_hdr + len, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: checksum\n");
+        goto LABEL_EXIT;
+    }
+
+    //起点はcheckpointか、現在の起点と同じであること
+    const bc_checkpoint_t *p_cp = bc_checkpoint_get(p_snap->base_height);
+    if ((p_cp == NULL) || (MEMCMP(p_cp->hash, p_snap->base_hash, BTC_SZ_HASH256) != 0)) {
+        if ((p_snap->base_height != M_STORE->base_height) ||
+                (MEMCMP(p_snap->base_hash, M_STORE->base_hash, BTC_SZ_HASH256) != 0)) {
+            LOGE("fail: base(height=%" PRIu32 ") is not checkpoint\n", p_snap->base_height);
+            goto LABEL_EXIT;
+        }
+    }
+    //照合済みの位置(FNAME_BLOCK)はそのまま使うので、それより上を起点にはできない
+    uint32_t last_height;
+    bc_flash_get_last_bhash(&last_height, hash);
+    if (p_snap->base_height > last_height) {
+        LOGE("fail: base(height=%" PRIu32 ") is above last scanned block(%" PRIu32 ")\n", p_snap->base_height, last_height);
+        goto LABEL_EXIT;
+    }
+    if (p_snap->base_height + p_snap->count <= bc_headers_tip(NULL, NULL)) {
+        LOGE("fail: snapshot(tip=%" PRIu32 ") is not newer than store\n", p_snap->base_height + p_snap->count);
+        goto LABEL_EXIT;
+    }
+
+    //linkage, checkpoint, PoW, difficulty
+    bc_pow_work_t work;
+    bc_headers_diff_t diff;
+    MEMSET(&work, 0, sizeof(work));
+    MEMSET(&diff, 0, sizeof(diff));
+    diff.height = p_snap->base_height;
+    if (p_snap->base_height == 0) {
+        diff.bits = BC_POW_LIMIT_BITS;
+        diff.time = BC_GENESIS_TIME;
+        diff.period_bits = BC_POW_LIMIT_BITS;
+        diff.first_time = BC_GENESIS_TIME;
+    }
+    MEMCPY(hash, p_snap->base_hash, BTC_SZ_HASH256);
+    for (uint32_t lp = 0; lp < p_snap->count; lp++) {
+        const uint8_t *p = p_hdr + (size_t)lp * BC_HEADERS_SZ;
+        uint32_t bits;
+        if (!bc_headers_check(hash, p, p_snap->base_height + lp + 1, hash, &diff)) {
+            goto LABEL_EXIT;
+        }
+        MEMCPY(&bits, p + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+        bc_pow_work_add(&work, bits);
+    }
+
+    //置き換え
+    pthread_mutex_lock(&mMux);
+    if (store_reserve(p_snap->count)) {
+        M_STORE->base_height = p_snap->base_height;
+        MEMCPY(M_STORE->base_hash, p_snap->base_hash, BTC_SZ_HASH256);
+        MEMCPY(M_RECORD(0), p_hdr, len);
+        M_STORE->count = p_snap->count;
+        M_STORE->chainwork = work;
+        store_update_tiphash();
+        index_build();
+        msync(mpMap, sizeof(struct store_t) + (size_t)mCapacity * BC_HEADERS_SZ, MS_SYNC);
+        LOGD("import: base=%" PRIu32 ", count=%" PRIu32 "\n", M_STORE->base_height, M_STORE->count);
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+
+LABEL_EXIT:
+    if (p_map != MAP_FAILED) {
+        munmap(p_map, st.st_size);
+    }
+    close(fd);
+    return ret;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** mmap(再)設定
+ *
+ * 失敗しても今のmmapはそのまま使える(新しくmmapできてから外す)。
+ *
+ * @param[in]   Capacity    mmapするheader数(ファイルも拡張する)
+ * @retval  true    OK
+ */
+static bool store_map(uint32_t Capacity)
+{
+    size_t len = sizeof(struct store_t) + (size_t)Capacity * BC_HEADERS_SZ;
+
+    if (ftruncate(mFd, len) != 0) {
+        LOGE("fail: ftruncate: %s\n", strerror(errno));
+        return false;
+    }
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (p == MAP_FAILED) {
+        LOGE("fail: mmap: %s\n", strerror(errno));
+        return false;
+    }
+    if (mpMap != NULL) {
+        munmap(mpMap, sizeof(struct store_t) + (size_t)mCapacity * BC_HEADERS_SZ);
+    }
+    mpMap = (uint8_t *)p;
+    mCapacity = Capacity;
+    return true;
+}
+
+
+/** 容量確保
+ *
+ * @param[in]   Count       必要なheader数
+ * @retval  true    OK
+ */
+static bool store_reserve(uint32_t Count)
+{
+    if (Count <= mCapacity) {
+        return true;
+    }
+    return store_map(Count + STORE_GROW);
+}
+
+
+/** mTipHash更新
+ *
+ */
+static void store_update_tiphash(void)
+{
+    if (M_STORE->count == 0) {
+        MEMCPY(mTipHash, M_STORE->base_hash, BTC_SZ_HASH256);
+    } else {
+        btc_util_hash256(mTipHash, M_RECORD(M_STORE->count - 1), BC_HEADERS_SZ);
+    }
+}
+
+
+/** 索引作り直し(lock済み)
+ *
+ * 確保できない場合は索引なし(bc_headers_find()は線形探索)にする。
+ */
+static void index_build(void)
+{
+    uint32_t num = INDEX_MIN;
+    while (num < M_STORE->count * 2) {
+        num <<= 1;
+    }
+    FREE(mpIndex);
+    mpIndex = (uint32_t *)CALLOC(num, sizeof(uint32_t));
+    if (mpIndex == NULL) {
+        LOGE("fail: index(%" PRIu32 ")\n", num);
+        mIndexMask = 0;
+        return;
+    }
+    mIndexMask = num - 1;
+    for (uint32_t idx = 0; idx < M_STORE->count; idx++) {
+        index_add(idx);
+    }
+}
+
+
+/** 索引追加(lock済み)
+ *
+ * 使用率が1/2を超える場合は広げて作り直す。
+ *
+ * @param[in]   Idx         追加したheaderのindex
+ */
+static void index_add(uint32_t Idx)
+{
+    if (mpIndex == NULL) {
+        return;
+    }
+    if ((Idx + 1) * 2 > mIndexMask + 1) {
+        index_build();
+        return;
+    }
+    //Block Hashはそれ自体が一様なので先頭4byteをそのまま使う
+    uint32_t key;
+    MEMCPY(&key, M_RECORD(Idx) + BC_HEADERS_OFFSET_PREV, sizeof(key));
+    uint32_t pos = key & mIndexMask;
+    while (mpIndex[pos] != 0) {
+        pos = (pos + 1) & mIndexMask;
+    }
+    mpIndex[pos] = Idx + 1;
+}
+
+
+/** 索引検索(lock済み)
+ *
+ * @param[out]  pIdx        prev_blockがpHashのheaderのindex
+ * @param[in]   pHash       Block Hash
+ * @retval  true    あり
+ */
+static bool index_find(uint32_t *pIdx, const uint8_t *pHash)
+{
+    if (mpIndex == NULL) {
+        for (uint32_t idx = M_STORE->count; idx > 0; idx--) {
+            if (MEMCMP(M_RECORD(idx - 1) + BC_HEADERS_OFFSET_PREV, pHash, BTC_SZ_HASH256) == 0) {
+                *pIdx = idx - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+    uint32_t key;
+    MEMCPY(&key, pHash, sizeof(key));
+    for (uint32_t pos = key & mIndexMask; mpIndex[pos] != 0; pos = (pos + 1) & mIndexMask) {
+        uint32_t idx = mpIndex[pos] - 1;
+        if ((idx < M_STORE->count) && (MEMCMP(M_RECORD(idx) + BC_HEADERS_OFFSET_PREV, pHash, BTC_SZ_HASH256) == 0)) {
+            *pIdx = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** Block Hash取得(lock済み)
+ *
+ */
+static bool get_hash(uint8_t *pHash, uint32_t Height)
+{
+    if (Height == M_STORE->base_height) {
+        MEMCPY(pHash, M_STORE->base_hash, BTC_SZ_HASH256);
+        return true;
+    }
+    if ((Height > M_STORE->base_height) && (Height <= M_STORE->base_height + M_STORE->count)) {
+        btc_util_hash256(pHash, M_RECORD(Height - M_STORE->base_height - 1), BC_HEADERS_SZ);
+        return true;
+    }
+    return false;
+}
+
+
+/** nBitsとtime取得(lock済み)
+ *
+ * 起点はgenesisの場合だけ分かる。
+ */
+static bool get_bits_time(uint32_t *pBits, uint32_t *pTime, uint32_t Height)
+{
+    if (Height == M_STORE->base_height) {
+        if (Height != 0) {
+            return false;
+        }
+        *pBits = BC_POW_LIMIT_BITS;
+        *pTime = BC_GENESIS_TIME;
+        return true;
+    }
+    if ((Height > M_STORE->base_height) && (Height <= M_STORE->base_height + M_STORE->count)) {
+        const uint8_t *p = M_RECORD(Height - M_STORE->base_height - 1);
+        MEMCPY(pBits, p + BC_HEADERS_OFFSET_BITS, sizeof(uint32_t));
+        MEMCPY(pTime, p + BC_HEADERS_OFFSET_TIME, sizeof(uint32_t));
+        return true;
+    }
+    return false;
+}
+
+
+/** difficulty調整規則の検証
+ *
+ * @param[in]   pDiff       直前までのheaderの値
+ * @param[in]   Height      検証するheaderのBlock Height
+ * @param[in]   Bits        検証するheaderのnBits
+ * @param[in]   Time        検証するheaderのtime
+ * @retval  true    OK(比較するheaderが無い場合を含む)
+ */
+static bool check_bits(const bc_headers_diff_t *pDiff, uint32_t Height, uint32_t Bits, uint32_t Time)
+{
+    if (pDiff->bits == 0) {
+        //起点直後
+        return true;
+    }
+    if (Height % BC_POW_INTERVAL == 0) {
+        if (pDiff->first_time == 0) {
+            return bc_pow_check_range(Bits, pDiff->bits);
+        }
+        return Bits == bc_pow_retarget(pDiff->bits, pDiff->first_time, pDiff->time);
+    }
+#ifdef TESTNET
+    //前のblockから20分空けば最小difficultyでよい
+    if (Time > pDiff->time + BC_POW_SPACING * 2) {
+        return Bits == BC_POW_LIMIT_BITS;
+    }
+    return (pDiff->period_bits == 0) || (Bits == pDiff->period_bits);
+#else
+    return Bits == pDiff->bits;
+#endif
+}
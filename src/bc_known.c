@@ -0,0 +1,288 @@
+/**************************************************************************
+ * @file    bc_known.c
+ * @brief   既知inv(最近見たtxid)
+ * @note
+ *      - rolling bloom filter: 現世代がBC_KNOWN_GEN_MAX個になったら前世代を捨てて入れ替える
+ *      - txidは外から与えられるので、起動毎の乱数tweakを混ぜてからbit位置を決める
+ *      - 複数の接続から使うのでmutexで守る
+ *      - 保存はtweakとbit列そのまま(snap_t + HASH256)。一時fileに書いてからrenameする
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_sha256.h"
+#include "bc_known.h"
+
+#define LOG_TAG     "known"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BITS_SHIFT              (21)            ///< 1世代2M bit(256KB)
+#define BITS_NUM                (1UL << BITS_SHIFT)
+#define HASH_NUM                (12)            ///< FP率 (1-e^(-12*50000/2M))^12 ≒ 6e-8
+
+#ifndef FNAME_KNOWN
+#define FNAME_KNOWN             "known.nyt"
+#endif
+#define SNAP_MAGIC              (0x4b4e594e)    ///< "NYNK"
+#define SNAP_VERSION            (1)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+#pragma pack(1)
+
+/** @struct snap_t
+ *
+ * FNAME_KNOWN先頭
+ *      snap_t + mBits + HASH256(ここまで)
+ */
+struct snap_t {
+    uint32_t        magic;
+    uint32_t        version;
+    uint64_t        tweak[2];
+    uint32_t        cur;
+    uint32_t        count;
+};
+
+#pragma pack()
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void get_pos(uint32_t *pPos, const uint8_t *pHash);
+static bool find_gen(const uint8_t *pBits, const uint32_t *pPos);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t          mBits[2][BITS_NUM / 8];
+static int              mCur;                   ///< 現世代(mBits[mCur])
+static uint32_t         mCount;                 ///< 現世代の数
+static uint64_t         mTweak[2];
+static bool             mInit;
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_known_init(void)
+{
+    bool ret = false;
+    struct snap_t snap;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    uint8_t hash_file[BC_SHA256_SZ_HASH];
+    bc_sha256_t ctx;
+
+    FILE *fp = fopen(FNAME_KNOWN, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    if ((fread(&snap, sizeof(snap), 1, fp) != 1) ||
+            (snap.magic != SNAP_MAGIC) || (snap.version != SNAP_VERSION) ||
+            (snap.cur > 1) || (snap.count > BC_KNOWN_GEN_MAX)) {
+        LOGE("fail: invalid %s\n", FNAME_KNOWN);
+        goto LABEL_EXIT;
+    }
+    if ((fread(mBits, sizeof(mBits), 1, fp) != 1) ||
+            (fread(hash_file, sizeof(hash_file), 1, fp) != 1)) {
+        LOGE("fail: fread(%s)\n", FNAME_KNOWN);
+        goto LABEL_EXIT;
+    }
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    bc_sha256_update(&ctx, mBits, sizeof(mBits));
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+    if (MEMCMP(hash, hash_file, sizeof(hash)) != 0) {
+        LOGE("fail: checksum(%s)\n", FNAME_KNOWN);
+        goto LABEL_EXIT;
+    }
+    mTweak[0] = snap.tweak[0];
+    mTweak[1] = snap.tweak[1];
+    mCur = (int)snap.cur;
+    mCount = snap.count;
+    mInit = true;
+    LOGD("load: count=%" PRIu32 "\n", mCount);
+    ret = true;
+
+LABEL_EXIT:
+    if (!ret) {
+        MEMSET(mBits, 0, sizeof(mBits));
+    }
+    pthread_mutex_unlock(&mMux);
+    fclose(fp);
+    return ret;
+}
+
+
+void bc_known_term(void)
+{
+    bc_known_save();
+}
+
+
+bool bc_known_save(void)
+{
+    bool ret = false;
+    struct snap_t snap;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    bc_sha256_t ctx;
+
+    pthread_mutex_lock(&mMux);
+    bool b_init = mInit;
+    pthread_mutex_unlock(&mMux);
+    if (!b_init) {
+        //まだ使っていない(tweakも決まっていない)
+        return true;
+    }
+
+    FILE *fp = fopen(FNAME_KNOWN ".tmp", "wb");
+    if (fp == NULL) {
+        LOGE("fail: fopen(%s): %s\n", FNAME_KNOWN ".tmp", strerror(errno));
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    MEMSET(&snap, 0, sizeof(snap));
+    snap.magic = SNAP_MAGIC;
+    snap.version = SNAP_VERSION;
+    snap.tweak[0] = mTweak[0];
+    snap.tweak[1] = mTweak[1];
+    snap.cur = (uint32_t)mCur;
+    snap.count = mCount;
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    bc_sha256_update(&ctx, mBits, sizeof(mBits));
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+    if ((fwrite(&snap, sizeof(snap), 1, fp) == 1) &&
+            (fwrite(mBits, sizeof(mBits), 1, fp) == 1) &&
+            (fwrite(hash, sizeof(hash), 1, fp) == 1)) {
+        ret = true;
+    } else {
+        LOGE("fail: fwrite(%s)\n", FNAME_KNOWN ".tmp");
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    if (ret && (rename(FNAME_KNOWN ".tmp", FNAME_KNOWN) != 0)) {
+        LOGE("fail: rename(%s): %s\n", FNAME_KNOWN, strerror(errno));
+        ret = false;
+    }
+    return ret;
+}
+
+
+bool bc_known_check_add(const uint8_t *pHash)
+{
+    uint32_t pos[HASH_NUM];
+    bool ret;
+
+    pthread_mutex_lock(&mMux);
+    get_pos(pos, pHash);
+    ret = find_gen(mBits[0], pos) || find_gen(mBits[1], pos);
+    if (!ret) {
+        if (mCount >= BC_KNOWN_GEN_MAX) {
+            //前世代を捨てる
+            mCur ^= 1;
+            MEMSET(mBits[mCur], 0, sizeof(mBits[mCur]));
+            mCount = 0;
+        }
+        for (int lp = 0; lp < HASH_NUM; lp++) {
+            mBits[mCur][pos[lp] >> 3] |= 1 << (pos[lp] & 7);
+        }
+        mCount++;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_known_find(const uint8_t *pHash)
+{
+    uint32_t pos[HASH_NUM];
+    bool ret;
+
+    pthread_mutex_lock(&mMux);
+    get_pos(pos, pHash);
+    ret = find_gen(mBits[0], pos) || find_gen(mBits[1], pos);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** bit位置(mMux取得済み)
+ *
+ * txidの前半・後半にtweakを混ぜて2つの64bit値にし、double hashingで位置を作る。
+ */
+static void get_pos(uint32_t *pPos, const uint8_t *pHash)
+{
+    if (!mInit) {
+        mTweak[0] = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ (uint64_t)time(NULL);
+        mTweak[1] = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+        mInit = true;
+    }
+
+    uint64_t h[2];
+    for (int lp = 0; lp < 2; lp++) {
+        uint64_t a;
+        uint64_t b;
+        MEMCPY(&a, pHash + 16 * lp, sizeof(a));
+        MEMCPY(&b, pHash + 16 * lp + 8, sizeof(b));
+        uint64_t x = a ^ mTweak[lp] ^ (b * 0x9e3779b97f4a7c15ULL);
+        //murmur3 finalizer
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        h[lp] = x;
+    }
+    h[1] |= 1;
+    for (int lp = 0; lp < HASH_NUM; lp++) {
+        pPos[lp] = (uint32_t)((h[0] + lp * h[1]) >> (64 - BITS_SHIFT));
+    }
+}
+
+
+/** 1世代に入っているか
+ *
+ */
+static bool find_gen(const uint8_t *pBits, const uint32_t *pPos)
+{
+    for (int lp = 0; lp < HASH_NUM; lp++) {
+        if ((pBits[pPos[lp] >> 3] & (1 << (pPos[lp] & 7))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
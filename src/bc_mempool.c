@@ -0,0 +1,947 @@
+/**************************************************************************
+ * @file    bc_mempool.c
+ * @brief   監視対象txのmempool
+ * @note
+ *      - 監視対象のtxと、mempool中のtxが使っているtx(祖先)だけを持つ
+ *      - txidのhash表と、使っているoutpointのhash表の2つで引く。二重使用はoutpointの表を見るだけでわかる
+ *      - outpointの表の要素(spend_t)はtxと一緒に確保し、outpointはtxのコピーを指す
+ *      - feeは入力元のtxが全てmempoolにある場合だけわかる(それ以外はBC_MEMPOOL_FEE_UNKNOWN)
+ *      - 祖先は子より先に届くと捨てられるので、監視対象のtxを入れた後にbc_mempool_missing()の分を要求し直してもらう
+ *      - 額はpeerから来るので、MAX_MONEYを超えるものはfee不明にする。fee rateの比較は商と余りで行う
+ *      - 上限(MEMPOOL_MAX_KB)を超えたらfee rateの低いtxから子孫ごと捨てる。件数は少ないので全件から探す
+ *      - 複数の接続から使うのでmutexで守る
+ *      - 受信時とblockに入った時のBlock Heightからfee推定(bc_fee)の記録を作る。二重使用・置き換えで無くなったtxも記録する
+ *      - 上限による追い出しはこちらの都合なので、fee推定には記録しない
+ *      - FNAME_MEMPOOLに古い順に保存し、起動時に同じ順で追加し直す(祖先の判定・置き換えが同じ結果になる)
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "btc.h"
+
+#include "bc_misc.h"
+#include "bc_sha256.h"
+#include "bc_watch.h"
+#include "bc_known.h"
+#include "bc_headers.h"
+#include "bc_fee.h"
+#include "bc_mempool.h"
+
+#define LOG_TAG     "mempool"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#ifndef MEMPOOL_MAX_KB
+#define MEMPOOL_MAX_KB          (4096)
+#endif
+
+#ifndef FNAME_MEMPOOL
+#define FNAME_MEMPOOL           "mempool.nyt"
+#endif
+
+#define BUCKET_NUM              (4096)          ///< hash表のbucket数(2のべき)
+#define MAX_MONEY               (21000000ULL * 100000000ULL)    ///< satoshi
+#define OUTPOINT_IDX(p)         ((p) + BTC_SZ_TXID)
+#define EXPIRE_SEC              (14 * 24 * 3600)    ///< 読み込み時に捨てる古さ
+#define SNAP_MAGIC              (0x504d594e)    ///< "NYMP"
+#define SNAP_VERSION            (2)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+#pragma pack(1)
+
+/** @struct snap_t
+ *
+ * FNAME_MEMPOOL先頭
+ *      snap_t + (record_t + raw tx) * count + HASH256(ここまで)
+ */
+struct snap_t {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        count;
+};
+
+
+/** @struct record_t
+ *
+ * FNAME_MEMPOOLのtx毎
+ */
+struct record_t {
+    uint64_t        time;                       ///< 最初に受信した時刻
+    uint32_t        height;                     ///< 最初に受信した時のBlock Height
+    uint8_t         watch;
+    uint32_t        len;                        ///< raw tx長
+};
+
+#pragma pack()
+
+
+struct entry_t;
+
+/** 使っているoutpoint */
+typedef struct spend_t {
+    struct spend_t  *p_hnext;                   ///< 同じbucketの次
+    struct entry_t  *p_entry;                   ///< 使っているtx
+    const uint8_t   *p_outpoint;                ///< p_entry->viewの中を指す
+} spend_t;
+
+
+/** mempool中のtx */
+typedef struct entry_t {
+    struct entry_t  *p_hnext;                   ///< 同じbucketの次
+    struct entry_t  *p_prev;                    ///< 全件list
+    struct entry_t  *p_next;
+    uint8_t         txid[BTC_SZ_TXID];
+    bc_txview_t     view;                       ///< raw txのコピーを指す
+    int64_t         fee;                        ///< BC_MEMPOOL_FEE_UNKNOWN:不明
+    uint32_t        vsize;
+    uint32_t        size;                       ///< 確保サイズ
+    uint64_t        time;                       ///< 最初に受信した時刻
+    uint32_t        height;                     ///< 最初に受信した時のBlock Height
+    bool            watch;
+    bool            mark;                       ///< 置き換えで外す(add()中だけ使う)
+    spend_t         spend[];                    ///< vin_cnt個, その後ろにraw tx
+} entry_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bc_mempool_result_t add(const bc_txview_t *pView, bool bWatch, uint64_t Time, uint32_t Height);
+static bool load(const uint8_t *pData, size_t Len);
+static uint32_t get_index(const uint8_t *pOutpoint);
+static void set_index(uint8_t *pOutpoint, uint32_t Idx);
+static uint32_t hash_txid(const uint8_t *pTxid);
+static uint32_t hash_outpoint(const uint8_t *pOutpoint);
+static entry_t *find(const uint8_t *pTxid);
+static spend_t *find_spend(const uint8_t *pOutpoint);
+static entry_t *new_entry(const bc_txview_t *pView, const uint8_t *pTxid, bool bWatch, uint64_t Time, uint32_t Height);
+static void insert(entry_t *pEntry);
+static void remove_entry(entry_t *pEntry);
+static void remove_tree(entry_t *pEntry, bool bFailed);
+static uint64_t feerate(const entry_t *pEntry);
+static bool has_child(const uint8_t *pTxid, uint32_t VoutCnt);
+static void update_children(const entry_t *pEntry);
+static int64_t calc_fee(const bc_txview_t *pView);
+static uint32_t calc_vsize(const bc_txview_t *pView);
+static bool feerate_higher(int64_t Fee1, uint32_t Vsize1, int64_t Fee2, uint32_t Vsize2);
+static void mark_tree(entry_t *pEntry);
+static void unmark_all(void);
+static bool make_room(uint32_t Size, int64_t Fee, uint32_t Vsize);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static entry_t          *mTxid[BUCKET_NUM];
+static spend_t          *mSpend[BUCKET_NUM];
+static entry_t          *mpHead;                ///< 全件list
+static int              mCount;
+static size_t           mUsage;                 ///< 確保サイズの合計
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_mempool_init(void)
+{
+    bool ret = false;
+    uint8_t *p_data = NULL;
+
+    FILE *fp = fopen(FNAME_MEMPOOL, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    long len;
+    if ((fseek(fp, 0, SEEK_END) != 0) || ((len = ftell(fp)) < 0) || (fseek(fp, 0, SEEK_SET) != 0)) {
+        LOGE("fail: seek(%s)\n", FNAME_MEMPOOL);
+        goto LABEL_EXIT;
+    }
+    //上限まで入っていても、記録の分を足して2倍あれば足りる
+    if (((size_t)len < sizeof(struct snap_t) + BC_SHA256_SZ_HASH) || ((size_t)len > (size_t)MEMPOOL_MAX_KB * 1024 * 2)) {
+        LOGE("fail: invalid size(%s)\n", FNAME_MEMPOOL);
+        goto LABEL_EXIT;
+    }
+    p_data = (uint8_t *)MALLOC(len);
+    if (p_data == NULL) {
+        LOGE("fail: MALLOC(%ld)\n", len);
+        goto LABEL_EXIT;
+    }
+    if (fread(p_data, len, 1, fp) != 1) {
+        LOGE("fail: fread(%s)\n", FNAME_MEMPOOL);
+        goto LABEL_EXIT;
+    }
+    ret = load(p_data, len);
+
+LABEL_EXIT:
+    FREE(p_data);
+    fclose(fp);
+    return ret;
+}
+
+
+void bc_mempool_term(void)
+{
+    bc_mempool_save();
+    pthread_mutex_lock(&mMux);
+    while (mpHead != NULL) {
+        remove_entry(mpHead);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_mempool_save(void)
+{
+    bool ret = true;
+    struct snap_t snap;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    bc_sha256_t ctx;
+
+    FILE *fp = fopen(FNAME_MEMPOOL ".tmp", "wb");
+    if (fp == NULL) {
+        LOGE("fail: fopen(%s): %s\n", FNAME_MEMPOOL ".tmp", strerror(errno));
+        return false;
+    }
+
+    pthread_mutex_lock(&mMux);
+    MEMSET(&snap, 0, sizeof(snap));
+    snap.magic = SNAP_MAGIC;
+    snap.version = SNAP_VERSION;
+    snap.count = (uint32_t)mCount;
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, &snap, sizeof(snap));
+    ret = (fwrite(&snap, sizeof(snap), 1, fp) == 1);
+
+    //古い順(listの後ろから)
+    const entry_t *p = mpHead;
+    while ((p != NULL) && (p->p_next != NULL)) {
+        p = p->p_next;
+    }
+    for (; ret && (p != NULL); p = p->p_prev) {
+        struct record_t rec;
+        rec.time = p->time;
+        rec.height = p->height;
+        rec.watch = (uint8_t)p->watch;
+        rec.len = p->view.len;
+        bc_sha256_update(&ctx, &rec, sizeof(rec));
+        bc_sha256_update(&ctx, p->view.p_tx, p->view.len);
+        ret = (fwrite(&rec, sizeof(rec), 1, fp) == 1) &&
+                (fwrite(p->view.p_tx, p->view.len, 1, fp) == 1);
+    }
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(hash, hash);
+    ret = ret && (fwrite(hash, sizeof(hash), 1, fp) == 1);
+    if (!ret) {
+        LOGE("fail: fwrite(%s)\n", FNAME_MEMPOOL ".tmp");
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    if (ret && (rename(FNAME_MEMPOOL ".tmp", FNAME_MEMPOOL) != 0)) {
+        LOGE("fail: rename(%s): %s\n", FNAME_MEMPOOL, strerror(errno));
+        ret = false;
+    }
+    return ret;
+}
+
+
+bc_mempool_result_t bc_mempool_add(const bc_txview_t *pView, bool bWatch)
+{
+    pthread_mutex_lock(&mMux);
+    bc_mempool_result_t ret = add(pView, bWatch, (uint64_t)time(NULL), bc_headers_tip(NULL, NULL));
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_mempool_find(const uint8_t *pTxid)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = (find(pTxid) != NULL);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+int bc_mempool_missing(const bc_txview_t *pView, uint8_t *pTxids, int Max)
+{
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    int num = 0;
+
+    pthread_mutex_lock(&mMux);
+    bc_txview_vin_begin(pView, &it);
+    while ((num < Max) && bc_txview_vin_next(pView, &it, &vin)) {
+        if (find(vin.p_outpoint) != NULL) {
+            continue;
+        }
+        int lp;
+        for (lp = 0; lp < num; lp++) {
+            if (MEMCMP(pTxids + lp * BTC_SZ_TXID, vin.p_outpoint, BTC_SZ_TXID) == 0) {
+                break;
+            }
+        }
+        if (lp == num) {
+            MEMCPY(pTxids + num * BTC_SZ_TXID, vin.p_outpoint, BTC_SZ_TXID);
+            num++;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return num;
+}
+
+
+bool bc_mempool_spender(const uint8_t *pOutpoint, uint8_t *pTxid)
+{
+    pthread_mutex_lock(&mMux);
+    const spend_t *p_spend = find_spend(pOutpoint);
+    if ((p_spend != NULL) && (pTxid != NULL)) {
+        MEMCPY(pTxid, p_spend->p_entry->txid, BTC_SZ_TXID);
+    }
+    pthread_mutex_unlock(&mMux);
+    return p_spend != NULL;
+}
+
+
+void bc_mempool_confirm(const bc_txview_t *pView, uint32_t Height)
+{
+    uint8_t txid[BTC_SZ_TXID];
+
+    bc_txview_txid(pView, txid);
+
+    pthread_mutex_lock(&mMux);
+    //子はfeeを計算済みなので残す
+    entry_t *p_entry = find(txid);
+    if (p_entry != NULL) {
+        if ((p_entry->fee != BC_MEMPOOL_FEE_UNKNOWN) && (p_entry->height > 0) && (Height > p_entry->height)) {
+            bc_fee_confirmed(Height, feerate(p_entry), Height - p_entry->height);
+        }
+        remove_entry(p_entry);
+    }
+
+    //同じoutpointを使っていたtxは無効になる
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        spend_t *p_spend = find_spend(vin.p_outpoint);
+        if (p_spend != NULL) {
+            LOGE("double spend confirmed, drop:\n");
+            TXIDD(p_spend->p_entry->txid);
+            remove_tree(p_spend->p_entry, true);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_mempool_block(const uint8_t *pBlock, size_t Len, uint32_t Height)
+{
+    const uint8_t *p = pBlock + BC_WATCH_HEADERS_SZ;
+    const uint8_t *p_end = pBlock + Len;
+    uint64_t count;
+
+    if ((Len < BC_WATCH_HEADERS_SZ) || !bc_txview_varint(&p, p_end, &count)) {
+        return;
+    }
+    for (uint64_t lp = 0; lp < count; lp++) {
+        bc_txview_t view;
+        if (!bc_txview_parse(&view, p, p_end - p)) {
+            LOGE("fail: invalid tx(%" PRIu64 ")\n", lp);
+            return;
+        }
+        if (lp > 0) {
+            //coinbaseはmempoolに無い
+            bc_mempool_confirm(&view, Height);
+        }
+        p += view.len;
+    }
+}
+
+
+uint64_t bc_mempool_unconfirmed(void)
+{
+    uint64_t amount = 0;
+
+    pthread_mutex_lock(&mMux);
+    for (const entry_t *p = mpHead; p != NULL; p = p->p_next) {
+        if (!p->watch) {
+            continue;
+        }
+        uint8_t outpoint[BC_TXVIEW_OUTPOINT_SZ];
+        MEMCPY(outpoint, p->txid, BTC_SZ_TXID);
+        bc_txview_iter_t it;
+        bc_txview_vout_t vout;
+        bc_txview_vout_begin(&p->view, &it);
+        while (bc_txview_vout_next(&p->view, &it, &vout)) {
+            set_index(outpoint, it.idx - 1);
+            if (bc_watch_output(vout.p_script, vout.script_len) && (find_spend(outpoint) == NULL)) {
+                amount += vout.value;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return amount;
+}
+
+
+void bc_mempool_print(void)
+{
+    int count;
+    size_t usage;
+
+    pthread_mutex_lock(&mMux);
+    count = mCount;
+    usage = mUsage;
+    pthread_mutex_unlock(&mMux);
+    uint64_t amount = bc_mempool_unconfirmed();
+    LOGD("mempool: %d tx, %lu bytes, unconfirmed=%" PRIu64 "\n", count, (unsigned long)usage, amount);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** tx追加(mMux取得済み)
+ *
+ * @param[in]   pView       解析済みtx
+ * @param[in]   bWatch      true:監視対象のtx
+ * @param[in]   Time        最初に受信した時刻
+ * @param[in]   Height      最初に受信した時のBlock Height
+ * @return      結果
+ */
+static bc_mempool_result_t add(const bc_txview_t *pView, bool bWatch, uint64_t Time, uint32_t Height)
+{
+    uint8_t txid[BTC_SZ_TXID];
+    entry_t *p_conflict[8];
+    int conflict_num = 0;
+
+    bc_txview_txid(pView, txid);
+
+    if (find(txid) != NULL) {
+        return BC_MEMPOOL_EXISTS;
+    }
+    if (!bWatch && !has_child(txid, pView->vout_cnt)) {
+        return BC_MEMPOOL_IGNORED;
+    }
+
+    //同じoutpointを使っているtx
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        spend_t *p_spend = find_spend(vin.p_outpoint);
+        if (p_spend == NULL) {
+            continue;
+        }
+        int lp;
+        for (lp = 0; lp < conflict_num; lp++) {
+            if (p_conflict[lp] == p_spend->p_entry) {
+                break;
+            }
+        }
+        if (lp < conflict_num) {
+            continue;
+        }
+        if (conflict_num == ARRAY_SIZE(p_conflict)) {
+            LOGE("fail: too many conflicts\n");
+            return BC_MEMPOOL_CONFLICT;
+        }
+        p_conflict[conflict_num++] = p_spend->p_entry;
+    }
+
+    int64_t fee = calc_fee(pView);
+    uint32_t vsize = calc_vsize(pView);
+    if (conflict_num > 0) {
+        //fee, fee rateとも置き換えられるtxより大きい場合だけ置き換える
+        bool b_replace = (fee != BC_MEMPOOL_FEE_UNKNOWN);
+        int64_t fee_sum = 0;
+        for (int lp = 0; lp < conflict_num; lp++) {
+            const entry_t *p = p_conflict[lp];
+            LOGE("double spend: %s tx conflicts with:\n", (p->watch) ? "watch" : "ancestor");
+            TXIDD(p->txid);
+            if (p->fee == BC_MEMPOOL_FEE_UNKNOWN) {
+                b_replace = false;
+            } else {
+                fee_sum += p->fee;
+                b_replace = b_replace && feerate_higher(fee, vsize, p->fee, p->vsize);
+            }
+        }
+        LOGE("  new tx(fee=%" PRId64 ", vsize=%" PRIu32 "):\n", fee, vsize);
+        TXIDD(txid);
+        if (!b_replace || (fee <= fee_sum)) {
+            return BC_MEMPOOL_CONFLICT;
+        }
+    }
+
+    entry_t *p_entry = new_entry(pView, txid, bWatch, Time, Height);
+    if (p_entry == NULL) {
+        return BC_MEMPOOL_FULL;
+    }
+    //置き換えられるtxは子孫ごと空く分として数え、入ることがわかってから外す
+    for (int lp = 0; lp < conflict_num; lp++) {
+        mark_tree(p_conflict[lp]);
+    }
+    if (!make_room(p_entry->size, fee, vsize)) {
+        LOGD("full: %d tx, %lu bytes\n", mCount, (unsigned long)mUsage);
+        unmark_all();
+        FREE(p_entry);
+        return BC_MEMPOOL_FULL;
+    }
+    if (conflict_num > 0) {
+        //置き換えられるtx同士が親子の場合もあるので、outpointから引き直して外す
+        bc_txview_vin_begin(pView, &it);
+        while (bc_txview_vin_next(pView, &it, &vin)) {
+            spend_t *p_spend = find_spend(vin.p_outpoint);
+            if (p_spend != NULL) {
+                remove_tree(p_spend->p_entry, true);
+            }
+        }
+    }
+    p_entry->fee = fee;
+    p_entry->vsize = vsize;
+    insert(p_entry);
+    update_children(p_entry);
+    return (conflict_num > 0) ? BC_MEMPOOL_REPLACED : BC_MEMPOOL_ADDED;
+}
+
+
+/** FNAME_MEMPOOLの内容を追加する
+ *
+ * 監視対象のtxはbc_watch_txview()を通し、outputのoutpoint監視を戻す。
+ */
+static bool load(const uint8_t *pData, size_t Len)
+{
+    uint8_t hash[BC_SHA256_SZ_HASH];
+    struct snap_t snap;
+
+    bc_sha256_hash256(hash, pData, Len - BC_SHA256_SZ_HASH);
+    if (MEMCMP(hash, pData + Len - BC_SHA256_SZ_HASH, BC_SHA256_SZ_HASH) != 0) {
+        LOGE("fail: checksum(%s)\n", FNAME_MEMPOOL);
+        return false;
+    }
+    MEMCPY(&snap, pData, sizeof(snap));
+    if ((snap.magic != SNAP_MAGIC) || (snap.version != SNAP_VERSION)) {
+        LOGE("fail: invalid %s\n", FNAME_MEMPOOL);
+        return false;
+    }
+
+    const uint8_t *p = pData + sizeof(snap);
+    const uint8_t *p_end = pData + Len - BC_SHA256_SZ_HASH;
+    uint64_t now = (uint64_t)time(NULL);
+    int added = 0;
+    for (uint32_t lp = 0; lp < snap.count; lp++) {
+        struct record_t rec;
+        bc_txview_t view;
+        if ((size_t)(p_end - p) < sizeof(rec)) {
+            break;
+        }
+        MEMCPY(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if (((size_t)(p_end - p) < rec.len) || !bc_txview_parse(&view, p, rec.len) || (view.len != rec.len)) {
+            break;
+        }
+        p += rec.len;
+        if (rec.time + EXPIRE_SEC < now) {
+            continue;
+        }
+        bool b_watch = bc_watch_txview(&view) || rec.watch;
+        uint8_t txid[BTC_SZ_TXID];
+        bc_txview_txid(&view, txid);
+        bc_known_check_add(txid);
+        pthread_mutex_lock(&mMux);
+        bc_mempool_result_t ret = add(&view, b_watch, rec.time, rec.height);
+        if ((ret == BC_MEMPOOL_ADDED) || (ret == BC_MEMPOOL_REPLACED)) {
+            added++;
+        }
+        pthread_mutex_unlock(&mMux);
+    }
+    if (p != p_end) {
+        LOGE("fail: invalid record(%s)\n", FNAME_MEMPOOL);
+    }
+    LOGD("load: %d/%" PRIu32 " tx\n", added, snap.count);
+    return p == p_end;
+}
+
+
+
+static uint32_t get_index(const uint8_t *pOutpoint)
+{
+    const uint8_t *p = OUTPOINT_IDX(pOutpoint);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void set_index(uint8_t *pOutpoint, uint32_t Idx)
+{
+    uint8_t *p = OUTPOINT_IDX(pOutpoint);
+    for (int lp = 0; lp < 4; lp++) {
+        p[lp] = (uint8_t)(Idx >> (8 * lp));
+    }
+}
+
+
+static uint32_t hash_txid(const uint8_t *pTxid)
+{
+    //txidはhash値なのでそのまま使う
+    uint32_t h = pTxid[0] | (pTxid[1] << 8) | (pTxid[2] << 16) | ((uint32_t)pTxid[3] << 24);
+    return h & (BUCKET_NUM - 1);
+}
+
+
+static uint32_t hash_outpoint(const uint8_t *pOutpoint)
+{
+    return (hash_txid(pOutpoint) ^ (get_index(pOutpoint) * 0x9e3779b1)) & (BUCKET_NUM - 1);
+}
+
+
+static entry_t *find(const uint8_t *pTxid)
+{
+    entry_t *p = mTxid[hash_txid(pTxid)];
+    while ((p != NULL) && (MEMCMP(p->txid, pTxid, BTC_SZ_TXID) != 0)) {
+        p = p->p_hnext;
+    }
+    return p;
+}
+
+
+static spend_t *find_spend(const uint8_t *pOutpoint)
+{
+    spend_t *p = mSpend[hash_outpoint(pOutpoint)];
+    while ((p != NULL) && (MEMCMP(p->p_outpoint, pOutpoint, BC_TXVIEW_OUTPOINT_SZ) != 0)) {
+        p = p->p_hnext;
+    }
+    return p;
+}
+
+
+/** entry作成
+ *
+ * raw txをコピーし、viewとspendをコピーを指すようにする。まだ表には入れない。
+ */
+static entry_t *new_entry(const bc_txview_t *pView, const uint8_t *pTxid, bool bWatch, uint64_t Time, uint32_t Height)
+{
+    size_t size = sizeof(entry_t) + sizeof(spend_t) * pView->vin_cnt + pView->len;
+    if (size > (size_t)MEMPOOL_MAX_KB * 1024) {
+        LOGE("fail: tx too large(%lu)\n", (unsigned long)size);
+        return NULL;
+    }
+    entry_t *p_entry = (entry_t *)MALLOC(size);
+    if (p_entry == NULL) {
+        LOGE("fail: MALLOC(%lu)\n", (unsigned long)size);
+        return NULL;
+    }
+    uint8_t *p_tx = (uint8_t *)&p_entry->spend[pView->vin_cnt];
+    MEMCPY(p_tx, pView->p_tx, pView->len);
+    if (!bc_txview_parse(&p_entry->view, p_tx, pView->len)) {
+        //解析済みのコピーなので失敗しない
+        FREE(p_entry);
+        return NULL;
+    }
+    MEMCPY(p_entry->txid, pTxid, BTC_SZ_TXID);
+    p_entry->size = (uint32_t)size;
+    p_entry->time = Time;
+    p_entry->height = Height;
+    p_entry->watch = bWatch;
+    p_entry->mark = false;
+
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    uint32_t lp = 0;
+    bc_txview_vin_begin(&p_entry->view, &it);
+    while (bc_txview_vin_next(&p_entry->view, &it, &vin)) {
+        p_entry->spend[lp].p_entry = p_entry;
+        p_entry->spend[lp].p_outpoint = vin.p_outpoint;
+        lp++;
+    }
+    return p_entry;
+}
+
+
+/** 表とlistに入れる
+ *
+ * 同じtx中で同じoutpointを使うvinは無効なtxなので、先のものだけ表に入る形になる。
+ */
+static void insert(entry_t *pEntry)
+{
+    uint32_t h = hash_txid(pEntry->txid);
+    pEntry->p_hnext = mTxid[h];
+    mTxid[h] = pEntry;
+    for (uint32_t lp = 0; lp < pEntry->view.vin_cnt; lp++) {
+        spend_t *p_spend = &pEntry->spend[lp];
+        h = hash_outpoint(p_spend->p_outpoint);
+        p_spend->p_hnext = mSpend[h];
+        mSpend[h] = p_spend;
+    }
+    pEntry->p_prev = NULL;
+    pEntry->p_next = mpHead;
+    if (mpHead != NULL) {
+        mpHead->p_prev = pEntry;
+    }
+    mpHead = pEntry;
+    mCount++;
+    mUsage += pEntry->size;
+}
+
+
+/** 表とlistから外して解放する */
+static void remove_entry(entry_t *pEntry)
+{
+    entry_t **pp = &mTxid[hash_txid(pEntry->txid)];
+    while (*pp != pEntry) {
+        pp = &(*pp)->p_hnext;
+    }
+    *pp = pEntry->p_hnext;
+    for (uint32_t lp = 0; lp < pEntry->view.vin_cnt; lp++) {
+        spend_t *p_spend = &pEntry->spend[lp];
+        spend_t **pp_spend = &mSpend[hash_outpoint(p_spend->p_outpoint)];
+        while (*pp_spend != p_spend) {
+            pp_spend = &(*pp_spend)->p_hnext;
+        }
+        *pp_spend = p_spend->p_hnext;
+    }
+    if (pEntry->p_prev != NULL) {
+        pEntry->p_prev->p_next = pEntry->p_next;
+    } else {
+        mpHead = pEntry->p_next;
+    }
+    if (pEntry->p_next != NULL) {
+        pEntry->p_next->p_prev = pEntry->p_prev;
+    }
+    mCount--;
+    mUsage -= pEntry->size;
+    FREE(pEntry);
+}
+
+
+/** 子孫ごと外す
+ *
+ * @param[in]   pEntry      外すtx
+ * @param[in]   bFailed     true:blockに入らなかったtxとしてbc_fee_failed()に記録する
+ */
+static void remove_tree(entry_t *pEntry, bool bFailed)
+{
+    uint8_t outpoint[BC_TXVIEW_OUTPOINT_SZ];
+
+    MEMCPY(outpoint, pEntry->txid, BTC_SZ_TXID);
+    for (uint32_t idx = 0; idx < pEntry->view.vout_cnt; idx++) {
+        set_index(outpoint, idx);
+        spend_t *p_spend = find_spend(outpoint);
+        if (p_spend != NULL) {
+            remove_tree(p_spend->p_entry, bFailed);
+        }
+    }
+    //blockに入らずに無くなった
+    uint32_t height = bc_headers_tip(NULL, NULL);
+    if (bFailed && (pEntry->fee != BC_MEMPOOL_FEE_UNKNOWN) && (pEntry->height > 0) && (height >= pEntry->height)) {
+        bc_fee_failed(height, feerate(pEntry), height - pEntry->height);
+    }
+    remove_entry(pEntry);
+}
+
+
+/** fee rate(satoshi/kvB) */
+static uint64_t feerate(const entry_t *pEntry)
+{
+    return (uint64_t)pEntry->fee * 1000 / pEntry->vsize;
+}
+
+
+/** txのoutputを使っているtxがmempoolにあるか(祖先か) */
+static bool has_child(const uint8_t *pTxid, uint32_t VoutCnt)
+{
+    uint8_t outpoint[BC_TXVIEW_OUTPOINT_SZ];
+
+    MEMCPY(outpoint, pTxid, BTC_SZ_TXID);
+    for (uint32_t idx = 0; idx < VoutCnt; idx++) {
+        set_index(outpoint, idx);
+        if (find_spend(outpoint) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** 祖先が届いてfeeがわかるようになった子を計算し直す */
+static void update_children(const entry_t *pEntry)
+{
+    uint8_t outpoint[BC_TXVIEW_OUTPOINT_SZ];
+
+    MEMCPY(outpoint, pEntry->txid, BTC_SZ_TXID);
+    for (uint32_t idx = 0; idx < pEntry->view.vout_cnt; idx++) {
+        set_index(outpoint, idx);
+        spend_t *p_spend = find_spend(outpoint);
+        if ((p_spend != NULL) && (p_spend->p_entry->fee == BC_MEMPOOL_FEE_UNKNOWN)) {
+            p_spend->p_entry->fee = calc_fee(&p_spend->p_entry->view);
+        }
+    }
+}
+
+
+/** fee計算
+ *
+ * @return      fee(BC_MEMPOOL_FEE_UNKNOWN:入力元のtxがmempoolに無い)
+ */
+static int64_t calc_fee(const bc_txview_t *pView)
+{
+    uint64_t in = 0;
+    uint64_t out = 0;
+    bc_txview_iter_t it;
+
+    bc_txview_vin_t vin;
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        const entry_t *p_parent = find(vin.p_outpoint);
+        if (p_parent == NULL) {
+            return BC_MEMPOOL_FEE_UNKNOWN;
+        }
+        uint32_t idx = get_index(vin.p_outpoint);
+        bc_txview_iter_t it_parent;
+        bc_txview_vout_t vout;
+        bool found = false;
+        bc_txview_vout_begin(&p_parent->view, &it_parent);
+        while (bc_txview_vout_next(&p_parent->view, &it_parent, &vout)) {
+            if (it_parent.idx - 1 == idx) {
+                found = true;
+                break;
+            }
+        }
+        if (!found || (vout.value > MAX_MONEY)) {
+            return BC_MEMPOOL_FEE_UNKNOWN;
+        }
+        in += vout.value;
+    }
+
+    bc_txview_vout_t vout;
+    bc_txview_vout_begin(pView, &it);
+    while (bc_txview_vout_next(pView, &it, &vout)) {
+        if (vout.value > MAX_MONEY) {
+            return BC_MEMPOOL_FEE_UNKNOWN;
+        }
+        out += vout.value;
+    }
+    //各額をMAX_MONEY以下にしておけば、足しても溢れない
+    if ((in > MAX_MONEY) || (in < out)) {
+        return BC_MEMPOOL_FEE_UNKNOWN;
+    }
+    return (int64_t)(in - out);
+}
+
+
+/** vsize計算(BIP141) */
+static uint32_t calc_vsize(const bc_txview_t *pView)
+{
+    uint32_t base = pView->len;
+    if (pView->segwit) {
+        //marker, flag, witness部分を除く
+        base -= 2 + (uint32_t)(pView->p_locktime - pView->p_wit);
+    }
+    uint32_t weight = base * 3 + pView->len;
+    return (weight + 3) / 4;
+}
+
+
+/** Fee1/Vsize1 > Fee2/Vsize2
+ *
+ * feeが不明なものは0として比べる。
+ * fee(63bit)とvsize(32bit)をそのまま掛けると溢れるので、商を比べてから余り(vsize未満)を掛けて比べる。
+ */
+static bool feerate_higher(int64_t Fee1, uint32_t Vsize1, int64_t Fee2, uint32_t Vsize2)
+{
+    uint64_t fee1 = (Fee1 == BC_MEMPOOL_FEE_UNKNOWN) ? 0 : (uint64_t)Fee1;
+    uint64_t fee2 = (Fee2 == BC_MEMPOOL_FEE_UNKNOWN) ? 0 : (uint64_t)Fee2;
+    uint64_t v1 = (Vsize1 > 0) ? Vsize1 : 1;
+    uint64_t v2 = (Vsize2 > 0) ? Vsize2 : 1;
+    uint64_t q1 = fee1 / v1;
+    uint64_t q2 = fee2 / v2;
+    if (q1 != q2) {
+        return q1 > q2;
+    }
+    return (fee1 % v1) * v2 > (fee2 % v2) * v1;
+}
+
+
+/** 子孫ごと印を付ける */
+static void mark_tree(entry_t *pEntry)
+{
+    uint8_t outpoint[BC_TXVIEW_OUTPOINT_SZ];
+
+    if (pEntry->mark) {
+        return;
+    }
+    pEntry->mark = true;
+    MEMCPY(outpoint, pEntry->txid, BTC_SZ_TXID);
+    for (uint32_t idx = 0; idx < pEntry->view.vout_cnt; idx++) {
+        set_index(outpoint, idx);
+        spend_t *p_spend = find_spend(outpoint);
+        if (p_spend != NULL) {
+            mark_tree(p_spend->p_entry);
+        }
+    }
+}
+
+
+static void unmark_all(void)
+{
+    for (entry_t *p = mpHead; p != NULL; p = p->p_next) {
+        p->mark = false;
+    }
+}
+
+
+/** Sizeが入るまでfee rateの低いtxを子孫ごと捨てる
+ *
+ * 印の付いたtx(置き換えで外す)は空く分として数え、捨てる候補にしない。
+ *
+ * @retval  false   追加するtxよりfee rateの低いtxを全て捨てても入らない
+ */
+static bool make_room(uint32_t Size, int64_t Fee, uint32_t Vsize)
+{
+    const size_t max = (size_t)MEMPOOL_MAX_KB * 1024;
+
+    for (;;) {
+        //捨てたtxの子孫に印の付いたものがあるかもしれないので、毎回数え直す
+        size_t marked = 0;
+        entry_t *p_low = NULL;
+        for (entry_t *p = mpHead; p != NULL; p = p->p_next) {
+            if (p->mark) {
+                marked += p->size;
+            } else if ((p_low == NULL) || feerate_higher(p_low->fee, p_low->vsize, p->fee, p->vsize)) {
+                p_low = p;
+            }
+        }
+        if (mUsage - marked + Size <= max) {
+            break;
+        }
+        if ((p_low == NULL) || !feerate_higher(Fee, Vsize, p_low->fee, p_low->vsize)) {
+            return false;
+        }
+        LOGD("evict(fee=%" PRId64 ", vsize=%" PRIu32 "):\n", p_low->fee, p_low->vsize);
+        TXIDD(p_low->txid);
+        remove_tree(p_low, false);
+    }
+    return true;
+}
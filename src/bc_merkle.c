@@ -0,0 +1,179 @@
+/**************************************************************************
+ * @file    bc_merkle.c
+ * @brief   merkle tree計算・partial merkle tree検証(BIP37)
+ * @note
+ *      - bc_merkle_verify()はCPartialMerkleTree::TraverseAndExtract()を明示的なstackで展開したもの
+ **************************************************************************/
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bc_misc.h"
+#include "bc_merkle.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "merkle"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct node_t
+ *
+ * 子を辿っている途中のnode
+ */
+typedef struct {
+    uint32_t    height;
+    uint32_t    pos;
+    bool        b_right;                        ///< true:右の子を辿っている
+    uint8_t     hash[2 * BC_SHA256_SZ_HASH];    ///< 左の子 || 右の子
+} node_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static inline uint32_t tree_width(uint32_t TxCount, uint32_t Height);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_merkle_verify(uint8_t *pRoot,
+                uint8_t *pMatched, uint32_t *pMatchedNum, uint32_t MatchedMax,
+                uint32_t TxCount,
+                const uint8_t *pHashes, uint32_t HashCount,
+                const uint8_t *pFlags, uint32_t FlagBytes)
+{
+    node_t stack[BC_MERKLE_DEPTH_MAX];
+    int sp = 0;
+    uint32_t bits = 0;
+    uint32_t hashes = 0;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+
+    *pMatchedNum = 0;
+    if ((TxCount == 0) || (TxCount > BC_MERKLE_TX_MAX) || (HashCount > TxCount) || (FlagBytes * 8 < HashCount)) {
+        LOGE("fail: invalid size(tx=%" PRIu32 ", hashes=%" PRIu32 ", flags=%" PRIu32 ")\n", TxCount, HashCount, FlagBytes);
+        return false;
+    }
+
+    uint32_t height = 0;
+    while (tree_width(TxCount, height) > 1) {
+        height++;
+    }
+    uint32_t pos = 0;
+
+    for (;;) {
+        //nodeに入る
+        if (bits >= FlagBytes * 8) {
+            LOGE("fail: flags overflow\n");
+            return false;
+        }
+        bool flag = (pFlags[bits / 8] >> (bits % 8)) & 1;
+        bits++;
+        if ((height > 0) && flag) {
+            //子を辿る
+            node_t *p_node = &stack[sp++];
+            p_node->height = height;
+            p_node->pos = pos;
+            p_node->b_right = false;
+            height--;
+            pos <<= 1;
+            continue;
+        }
+
+        //hashを使う
+        if (hashes >= HashCount) {
+            LOGE("fail: hashes overflow\n");
+            return false;
+        }
+        MEMCPY(hash, pHashes + hashes * BC_SHA256_SZ_HASH, BC_SHA256_SZ_HASH);
+        if ((height == 0) && flag) {
+            if (*pMatchedNum < MatchedMax) {
+                MEMCPY(pMatched + *pMatchedNum * BC_SHA256_SZ_HASH, hash, BC_SHA256_SZ_HASH);
+            }
+            (*pMatchedNum)++;
+        }
+        hashes++;
+
+        //親に戻る
+        while (sp > 0) {
+            node_t *p_node = &stack[sp - 1];
+            if (!p_node->b_right) {
+                MEMCPY(p_node->hash, hash, BC_SHA256_SZ_HASH);
+                if ((p_node->pos << 1) + 1 < tree_width(TxCount, p_node->height - 1)) {
+                    //右の子へ
+                    p_node->b_right = true;
+                    height = p_node->height - 1;
+                    pos = (p_node->pos << 1) + 1;
+                    break;
+                }
+                //右の子が無いときは左の子を重ねる
+                MEMCPY(p_node->hash + BC_SHA256_SZ_HASH, hash, BC_SHA256_SZ_HASH);
+            } else {
+                if (MEMCMP(p_node->hash, hash, BC_SHA256_SZ_HASH) == 0) {
+                    //CVE-2012-2459
+                    LOGE("fail: duplicate hash\n");
+                    return false;
+                }
+                MEMCPY(p_node->hash + BC_SHA256_SZ_HASH, hash, BC_SHA256_SZ_HASH);
+            }
+            bc_sha256_hash256(hash, p_node->hash, sizeof(p_node->hash));
+            sp--;
+        }
+        if (sp == 0) {
+            //rootまで戻った
+            break;
+        }
+    }
+
+    //全hash・flagを使い切っていること
+    if ((hashes != HashCount) || ((bits + 7) / 8 != FlagBytes)) {
+        LOGE("fail: unused data(hashes=%" PRIu32 "/%" PRIu32 ", bits=%" PRIu32 "/%" PRIu32 ")\n", hashes, HashCount, bits, FlagBytes * 8);
+        return false;
+    }
+    MEMCPY(pRoot, hash, BC_SHA256_SZ_HASH);
+    return true;
+}
+
+
+bool bc_merkle_root(uint8_t *pRoot, bool *pMutated, uint8_t *pHashes, uint32_t Num)
+{
+    *pMutated = false;
+    if (Num == 0) {
+        return false;
+    }
+
+    while (Num > 1) {
+        for (uint32_t lp = 0; lp + 1 < Num; lp += 2) {
+            if (MEMCMP(pHashes + lp * BC_SHA256_SZ_HASH, pHashes + (lp + 1) * BC_SHA256_SZ_HASH, BC_SHA256_SZ_HASH) == 0) {
+                *pMutated = true;
+            }
+        }
+        if (Num & 1) {
+            //奇数なら最後を重ねる
+            MEMCPY(pHashes + Num * BC_SHA256_SZ_HASH, pHashes + (Num - 1) * BC_SHA256_SZ_HASH, BC_SHA256_SZ_HASH);
+            Num++;
+        }
+        Num /= 2;
+        bc_sha256_hash256_d64(pHashes, pHashes, Num);
+    }
+    MEMCPY(pRoot, pHashes, BC_SHA256_SZ_HASH);
+    return true;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 高さHeightのnode数
+ *
+ */
+static inline uint32_t tree_width(uint32_t TxCount, uint32_t Height)
+{
+    return (TxCount + (1 << Height) - 1) >> Height;
+}
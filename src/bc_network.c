@@ -12,10 +12,13 @@
 #include <arpa/inet.h>
 #include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 
 #include "user_config.h"
 #include "bc_misc.h"
 #include "bc_proto.h"
+#include "bc_txreq.h"
+#include "bc_rescan.h"
 
 #define LOG_TAG     "net"
 #include "utl_log.h"
@@ -27,6 +30,13 @@
     #error need MAINNET or TESTNET
 #endif
 
+#ifndef HDRSYNC_PEERS
+#define HDRSYNC_PEERS           (0)
+#endif
+
+#define HELPER_IDLE_MSEC        (1000)          ///< helperの受信待ちtimeout
+#define READ_IDLE_MSEC          (1000)          ///< 受信待ちtimeout(tx要求のtimeout確認)
+
 
 /**************************************************************************
  * static variables
@@ -35,6 +45,14 @@
 static bc_protoval_t    mProtoVal;
 
 static volatile bool mLoopRead;
+static volatile sig_atomic_t mStop;             ///< bc_network_stop()
+
+#if HDRSYNC_PEERS > 0
+static bc_protoval_t    mHelperVal[HDRSYNC_PEERS];
+static volatile bool    mHelperRun[HDRSYNC_PEERS];
+static pthread_t        mHelperTh[HDRSYNC_PEERS];
+static bool             mHelperJoin[HDRSYNC_PEERS];     ///< true:mHelperThをjoinしていない
+#endif
 
 
 /**************************************************************************
@@ -43,6 +61,11 @@ static volatile bool mLoopRead;
 
 static bool connect_sub(int *pSock, const char *pAddr, const char *pService);
 static void *read_proc(void *pArg);
+#if HDRSYNC_PEERS > 0
+static void *helper_proc(void *pArg);
+static void join_helper(int Idx);
+#endif
+static void stop_threads(void);
 
 
 /**************************************************************************
@@ -86,7 +109,7 @@ bool bc_network_connect(void)
     bool retval;
     pthread_t th;
 
-    while (true) {
+    while (!mStop) {
         LOGD("search node\n");
 
 #if defined(USERPEER)
@@ -118,6 +141,8 @@ LABEL_NEXT:
 
         mLoopRead = true;
         mProtoVal.loop = true;
+        //start_sub()で割り当てるまでに受信threadが使わないように
+        mProtoVal.txreq_peer = -1;
         ret = pthread_create(&th, NULL, read_proc, (void *)&mProtoVal);
         if (ret != 0) {
             LOGE("pthread_create: %s\n", strerror(errno));
@@ -135,9 +160,14 @@ LABEL_NEXT:
 
         mLoopRead = false;
         pthread_join(th, NULL);
+        bc_arena_free(&mProtoVal.arena);
+        bc_txreq_peer_remove(mProtoVal.txreq_peer);
+        mProtoVal.txreq_peer = -1;
     }
+    stop_threads();
+    LOGD("stop\n");
 
-    return retval;
+    return true;
 }
 
 
@@ -148,7 +178,8 @@ ssize_t bc_network_read(int fd, void *buf, size_t nbytes)
 
     while (nbytes > 0) {
         ssize_t len = read(fd, p, nbytes);
-        if (len < 0) {
+        if (len <= 0) {
+            //切断(0)やエラーでは待ち続けず、読めた分だけ返す
             ret -= nbytes;
             break;
         }
@@ -159,6 +190,52 @@ ssize_t bc_network_read(int fd, void *buf, size_t nbytes)
 }
 
 
+/** 接続を終了してbc_network_connect()から戻す
+ *
+ * signal handlerから呼ぶので、flagを立てるだけにする。
+ * 受信threadがflagを見て接続を閉じる。
+ */
+void bc_network_stop(void)
+{
+    mStop = true;
+}
+
+
+/** checkpoint区間・compact filter取得用の接続開始
+ *
+ * 動作中の接続はそのままにする。
+ *
+ * @retval  true    helperを使う設定(HDRSYNC_PEERS > 0)
+ */
+bool bc_network_start_helpers(void)
+{
+#if HDRSYNC_PEERS > 0
+    for (int lp = 0; lp < HDRSYNC_PEERS; lp++) {
+        if (mHelperRun[lp] || mStop) {
+            continue;
+        }
+        //終わったthreadを回収してから作り直す
+        join_helper(lp);
+
+        MEMSET(&mHelperVal[lp], 0, sizeof(bc_protoval_t));
+        mHelperVal[lp].socket = -1;
+        mHelperVal[lp].txreq_peer = -1;
+        mHelperRun[lp] = true;
+        int ret = pthread_create(&mHelperTh[lp], NULL, helper_proc, (void *)(intptr_t)lp);
+        if (ret != 0) {
+            LOGE("pthread_create: %s\n", strerror(ret));
+            mHelperRun[lp] = false;
+            break;
+        }
+        mHelperJoin[lp] = true;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
 /**************************************************************************
  * private functions
  **************************************************************************/
@@ -215,25 +292,136 @@ static void *read_proc(void *pArg)
     int ret;
     bc_protoval_t *p_protoval = (bc_protoval_t *)pArg;
 
-    while (mLoopRead) {
-        struct pollfd fds;
-        fds.fd = p_protoval->socket;
-        fds.events = POLLIN;
-        ret = poll(&fds, 1, -1);
+    while (mLoopRead && !mStop) {
+        struct pollfd fds[2];
+        fds[0].fd = p_protoval->socket;
+        fds[0].events = POLLIN;
+        fds[1].fd = bc_rescan_fd();     //rescan停止中は-1(pollは無視する)
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        ret = poll(fds, ARRAY_SIZE(fds), READ_IDLE_MSEC);
         if (ret < 0) {
             perror("poll");
         }
         else if (ret == 0) {
-            LOGD("poll: timeout\n");
-        }
-        else {
-            p_protoval->loop = bc_read_message(p_protoval);
+            p_protoval->loop = bc_idle(p_protoval);
             if (!p_protoval->loop) {
-                LOGE("fail: bc_read_message()\n");
+                LOGE("fail: bc_idle()\n");
                 break;
             }
         }
+        else {
+            if (fds[1].revents & POLLIN) {
+                p_protoval->loop = bc_read_rescan(p_protoval);
+                if (!p_protoval->loop) {
+                    LOGE("fail: bc_read_rescan()\n");
+                    break;
+                }
+            }
+            if (fds[0].revents != 0) {
+                p_protoval->loop = bc_read_message(p_protoval);
+                if (!p_protoval->loop) {
+                    LOGE("fail: bc_read_message()\n");
+                    break;
+                }
+            }
+        }
+    }
+    if (mStop) {
+        p_protoval->loop = false;
     }
 
     return NULL;
 }
+
+
+#if HDRSYNC_PEERS > 0
+/** checkpoint区間・compact filter取得用の接続
+ *
+ * 接続先はmainと異なるDNS seedから選ぶ。
+ */
+static void *helper_proc(void *pArg)
+{
+    int idx = (int)(intptr_t)pArg;
+    bc_protoval_t *p_protoval = &mHelperVal[idx];
+    bool retval;
+
+#if defined(USERPEER)
+    retval = connect_sub(&p_protoval->socket, PEER_ADDR_STR, PEER_PORT_STR);
+#else
+    retval = connect_sub(&p_protoval->socket, SEEDS[(idx + 1) % ARRAY_SIZE(SEEDS)], SERVICE);
+#endif
+    if (!retval) {
+        LOGE("fail: helper[%d] connect\n", idx);
+        mHelperRun[idx] = false;
+        return NULL;
+    }
+
+    bc_start_helper(p_protoval);
+    while (p_protoval->loop && !mStop) {
+        struct pollfd fds;
+        fds.fd = p_protoval->socket;
+        fds.events = POLLIN;
+        int ret = poll(&fds, 1, HELPER_IDLE_MSEC);
+        if (ret < 0) {
+            perror("poll");
+            break;
+        }
+        if ((ret > 0) && !bc_read_message(p_protoval)) {
+            LOGE("fail: helper[%d] bc_read_message()\n", idx);
+            break;
+        }
+        if ((ret == 0) && !bc_idle(p_protoval)) {
+            LOGE("fail: helper[%d] bc_idle()\n", idx);
+            break;
+        }
+    }
+
+    LOGD("helper[%d] disconnect\n", idx);
+    bc_hdrsync_release(&p_protoval->hdrsync);
+    bc_rescan_release(&p_protoval->rescan);
+    bc_arena_free(&p_protoval->arena);
+    bc_txreq_peer_remove(p_protoval->txreq_peer);
+    //closeはjoin_helper()で行う(stop_threads()がshutdownするので)
+    shutdown(p_protoval->socket, SHUT_RDWR);
+    mHelperRun[idx] = false;
+
+    return NULL;
+}
+
+
+/** helper threadの回収
+ *
+ */
+static void join_helper(int Idx)
+{
+    if (!mHelperJoin[Idx]) {
+        return;
+    }
+    pthread_join(mHelperTh[Idx], NULL);
+    mHelperJoin[Idx] = false;
+    if (mHelperVal[Idx].socket >= 0) {
+        close(mHelperVal[Idx].socket);
+        mHelperVal[Idx].socket = -1;
+    }
+}
+#endif
+
+
+/** 終了時にhelperとrescanの照合threadを止める
+ *
+ * 各moduleの_term()より前に、それらを使うthreadを終わらせておく。
+ */
+static void stop_threads(void)
+{
+#if HDRSYNC_PEERS > 0
+    for (int lp = 0; lp < HDRSYNC_PEERS; lp++) {
+        if (mHelperRun[lp] && (mHelperVal[lp].socket >= 0)) {
+            //受信待ちで止まっていれば起こす
+            shutdown(mHelperVal[lp].socket, SHUT_RDWR);
+        }
+        join_helper(lp);
+    }
+#endif
+    bc_rescan_stop();
+}
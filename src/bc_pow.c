@@ -0,0 +1,319 @@
+/**************************************************************************
+ * @file    bc_pow.c
+ * @brief   Proof of Work / chainwork計算
+ * @note
+ *      - chainworkは起点checkpointからの相対値として扱う(genesisからの絶対値ではない)
+ **************************************************************************/
+#include <stdio.h>
+
+#include "bc_misc.h"
+#include "bc_pow.h"
+
+#define LOG_TAG     "pow"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define SZ_TARGET               (32)
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void block_work(bc_pow_work_t *pWork, uint32_t Bits);
+static bool target_muldiv(uint8_t *pTarget, uint32_t Mul, uint32_t Div);
+static uint32_t target_compact(const uint8_t *pTarget);
+static int cmp_le256(const uint8_t *pA, const uint8_t *pB);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_pow_target(uint8_t *pTarget, uint32_t Bits)
+{
+    int exp = (int)(Bits >> 24);
+    uint32_t mant = Bits & 0x007fffff;
+
+    MEMSET(pTarget, 0, SZ_TARGET);
+    if ((Bits & 0x00800000) || (mant == 0)) {
+        //負数 or 0
+        return false;
+    }
+    if (exp < 3) {
+        mant >>= 8 * (3 - exp);
+        exp = 3;
+    }
+    for (int lp = 0; lp < 3; lp++) {
+        uint8_t b = (uint8_t)(mant >> (8 * lp));
+        int pos = exp - 3 + lp;
+        if (pos >= SZ_TARGET) {
+            if (b != 0) {
+                //overflow
+                return false;
+            }
+            continue;
+        }
+        pTarget[pos] = b;
+    }
+    return true;
+}
+
+
+bool bc_pow_check(const uint8_t *pHash, uint32_t Bits)
+{
+    uint8_t target[SZ_TARGET];
+    uint8_t limit[SZ_TARGET];
+
+    if (!bc_pow_target(target, Bits)) {
+        LOGE("fail: invalid bits(%08x)\n", Bits);
+        return false;
+    }
+    bc_pow_target(limit, BC_POW_LIMIT_BITS);
+    if (cmp_le256(target, limit) > 0) {
+        LOGE("fail: bits(%08x) above powLimit\n", Bits);
+        return false;
+    }
+    if (cmp_le256(pHash, target) > 0) {
+        LOGE("fail: hash above target(bits=%08x)\n", Bits);
+        return false;
+    }
+    return true;
+}
+
+
+uint32_t bc_pow_retarget(uint32_t LastBits, uint32_t FirstTime, uint32_t LastTime)
+{
+    uint8_t target[SZ_TARGET];
+    uint8_t limit[SZ_TARGET];
+
+    int64_t span = (int64_t)LastTime - (int64_t)FirstTime;
+    if (span < BC_POW_TIMESPAN / 4) {
+        span = BC_POW_TIMESPAN / 4;
+    } else if (span > BC_POW_TIMESPAN * 4) {
+        span = BC_POW_TIMESPAN * 4;
+    }
+
+    bc_pow_target(limit, BC_POW_LIMIT_BITS);
+    if (!bc_pow_target(target, LastBits) ||
+            !target_muldiv(target, (uint32_t)span, BC_POW_TIMESPAN) ||
+            (cmp_le256(target, limit) > 0)) {
+        MEMCPY(target, limit, SZ_TARGET);
+    }
+    return target_compact(target);
+}
+
+
+bool bc_pow_check_range(uint32_t Bits, uint32_t LastBits)
+{
+    uint8_t target[SZ_TARGET];
+    uint8_t lower[SZ_TARGET];
+    uint8_t upper[SZ_TARGET];
+    uint8_t limit[SZ_TARGET];
+
+    if (!bc_pow_target(target, Bits) || !bc_pow_target(lower, LastBits)) {
+        return false;
+    }
+    MEMCPY(upper, lower, SZ_TARGET);
+    target_muldiv(lower, 1, 4);
+    target_muldiv(upper, 4, 1);
+    bc_pow_target(limit, BC_POW_LIMIT_BITS);
+    if (cmp_le256(upper, limit) > 0) {
+        MEMCPY(upper, limit, SZ_TARGET);
+    }
+    //nBitsにすると切り捨てられるので、範囲も同じように丸める
+    bc_pow_target(lower, target_compact(lower));
+    bc_pow_target(upper, target_compact(upper));
+    if ((cmp_le256(target, lower) < 0) || (cmp_le256(target, upper) > 0)) {
+        LOGE("fail: bits(%08x) out of range(last=%08x)\n", Bits, LastBits);
+        return false;
+    }
+    return true;
+}
+
+
+void bc_pow_work_add(bc_pow_work_t *pWork, uint32_t Bits)
+{
+    bc_pow_work_t work;
+
+    block_work(&work, Bits);
+    uint64_t carry = 0;
+    for (int lp = 0; lp < BC_POW_WORK_LIMBS; lp++) {
+        uint64_t sum = (uint64_t)pWork->limb[lp] + work.limb[lp] + carry;
+        pWork->limb[lp] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+}
+
+
+void bc_pow_work_sub(bc_pow_work_t *pWork, uint32_t Bits)
+{
+    bc_pow_work_t work;
+
+    block_work(&work, Bits);
+    int64_t borrow = 0;
+    for (int lp = 0; lp < BC_POW_WORK_LIMBS; lp++) {
+        int64_t diff = (int64_t)pWork->limb[lp] - work.limb[lp] - borrow;
+        borrow = (diff < 0) ? 1 : 0;
+        pWork->limb[lp] = (uint32_t)diff;
+    }
+    if (borrow) {
+        //起点より前には戻らない
+        MEMSET(pWork, 0, sizeof(bc_pow_work_t));
+    }
+}
+
+
+int bc_pow_work_cmp(const bc_pow_work_t *pWork1, const bc_pow_work_t *pWork2)
+{
+    for (int lp = BC_POW_WORK_LIMBS - 1; lp >= 0; lp--) {
+        if (pWork1->limb[lp] != pWork2->limb[lp]) {
+            return (pWork1->limb[lp] > pWork2->limb[lp]) ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 1block分のwork計算
+ *
+ * @param[out]  pWork       2^256 / target
+ * @param[in]   Bits        nBits
+ */
+static void block_work(bc_pow_work_t *pWork, uint32_t Bits)
+{
+    //target = mant * 2^shift とすると work = 2^(256 - shift) / mant
+    //  - mantは24bit未満なので、32bit limbの筆算で割り切れる
+    int exp = (int)(Bits >> 24);
+    uint32_t mant = Bits & 0x007fffff;
+
+    MEMSET(pWork, 0, sizeof(bc_pow_work_t));
+    if ((Bits & 0x00800000) || (mant == 0)) {
+        return;
+    }
+    if (exp < 3) {
+        mant >>= 8 * (3 - exp);
+        exp = 3;
+        if (mant == 0) {
+            return;
+        }
+    }
+    int shift = 8 * (exp - 3);
+    if (shift >= 256) {
+        //target >= 2^256: workは0扱い
+        return;
+    }
+
+    //被除数2^(256 - shift)は最大9limb
+    uint32_t dividend[BC_POW_WORK_LIMBS + 1];
+    uint32_t quot[BC_POW_WORK_LIMBS + 1];
+    int bit = 256 - shift;
+    MEMSET(dividend, 0, sizeof(dividend));
+    dividend[bit / 32] = (uint32_t)1 << (bit % 32);
+
+    uint64_t rem = 0;
+    for (int lp = BC_POW_WORK_LIMBS; lp >= 0; lp--) {
+        uint64_t cur = (rem << 32) | dividend[lp];
+        quot[lp] = (uint32_t)(cur / mant);
+        rem = cur % mant;
+    }
+    if (quot[BC_POW_WORK_LIMBS] != 0) {
+        //2^256 / 1 の場合のみ。256bitに丸める
+        MEMSET(quot, 0xff, sizeof(uint32_t) * BC_POW_WORK_LIMBS);
+    }
+    MEMCPY(pWork->limb, quot, sizeof(pWork->limb));
+}
+
+
+/** target * Mul / Div
+ *
+ * @param[in,out]   pTarget     target(32byte, little endian)
+ * @param[in]       Mul         乗数
+ * @param[in]       Div         除数(0以外)
+ * @retval  true    256bitに収まった
+ */
+static bool target_muldiv(uint8_t *pTarget, uint32_t Mul, uint32_t Div)
+{
+    //積は最大9limb
+    uint32_t val[BC_POW_WORK_LIMBS + 1];
+    uint64_t carry = 0;
+
+    for (int lp = 0; lp < BC_POW_WORK_LIMBS; lp++) {
+        uint32_t limb = (uint32_t)pTarget[lp * 4] |
+                        ((uint32_t)pTarget[lp * 4 + 1] << 8) |
+                        ((uint32_t)pTarget[lp * 4 + 2] << 16) |
+                        ((uint32_t)pTarget[lp * 4 + 3] << 24);
+        uint64_t prod = (uint64_t)limb * Mul + carry;
+        val[lp] = (uint32_t)prod;
+        carry = prod >> 32;
+    }
+    val[BC_POW_WORK_LIMBS] = (uint32_t)carry;
+
+    uint64_t rem = 0;
+    for (int lp = BC_POW_WORK_LIMBS; lp >= 0; lp--) {
+        uint64_t cur = (rem << 32) | val[lp];
+        val[lp] = (uint32_t)(cur / Div);
+        rem = cur % Div;
+    }
+    if (val[BC_POW_WORK_LIMBS] != 0) {
+        return false;
+    }
+    for (int lp = 0; lp < SZ_TARGET; lp++) {
+        pTarget[lp] = (uint8_t)(val[lp / 4] >> (8 * (lp % 4)));
+    }
+    return true;
+}
+
+
+/** targetからnBitsに変換
+ *
+ * 上位3byteを残して切り捨てる。
+ *
+ * @param[in]   pTarget     target(32byte, little endian)
+ * @return      nBits
+ */
+static uint32_t target_compact(const uint8_t *pTarget)
+{
+    int size = SZ_TARGET;
+    while ((size > 0) && (pTarget[size - 1] == 0)) {
+        size--;
+    }
+    uint32_t mant = 0;
+    for (int lp = 1; lp <= 3; lp++) {
+        mant <<= 8;
+        if (size - lp >= 0) {
+            mant |= pTarget[size - lp];
+        }
+    }
+    if (mant & 0x00800000) {
+        //符号bitを避ける
+        mant >>= 8;
+        size++;
+    }
+    return ((uint32_t)size << 24) | mant;
+}
+
+
+/** 256bit little endian値の比較
+ *
+ * @retval  <0  pA < pB
+ * @retval  0   pA == pB
+ * @retval  >0  pA > pB
+ */
+static int cmp_le256(const uint8_t *pA, const uint8_t *pB)
+{
+    for (int lp = SZ_TARGET - 1; lp >= 0; lp--) {
+        if (pA[lp] != pB[lp]) {
+            return (pA[lp] > pB[lp]) ? 1 : -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,290 @@
+/**************************************************************************
+ * @file    bc_presync.c
+ * @brief   headers presync
+ * @note
+ *      - 低workのheadersを大量に送られてもメモリが増えないよう、
+ *        自chainよりworkが多いと分かるまでheaderを保存しない
+ *      - commitmentはthresholdを超えた時点のBlock Hash。
+ *        prev_blockでつながっているため、それ以前の全headerを固定できる
+ **************************************************************************/
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bc_misc.h"
+#include "bc_presync.h"
+#include "bc_checkpoint.h"
+
+#define LOG_TAG     "presync"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool start(bc_presync_t *pSync, const uint8_t *pHeader);
+static bool reorg(bc_presync_t *pSync);
+static void reorg_undo(bc_presync_t *pSync);
+static bool flush_redownload(bc_presync_t *pSync);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void bc_presync_reset(bc_presync_t *pSync)
+{
+    if (pSync->fp != NULL) {
+        fclose(pSync->fp);
+    }
+    if (pSync->undo != NULL) {
+        fclose(pSync->undo);
+    }
+    MEMSET(pSync, 0, sizeof(bc_presync_t));
+    pSync->state = BC_PRESYNC_STATE_IDLE;
+}
+
+
+bc_presync_ret_t bc_presync_headers(bc_presync_t *pSync, uint8_t *pNextHash, const uint8_t *pHeaders, uint32_t Count)
+{
+    if (Count == 0) {
+        switch (pSync->state) {
+        case BC_PRESYNC_STATE_PRESYNC:
+            LOGD("ignore low-work headers(fork=%" PRIu32 ", last=%" PRIu32 ")\n", pSync->fork_height, pSync->height);
+            break;
+        case BC_PRESYNC_STATE_REDOWNLOAD:
+            LOGE("fail: peer stopped before commitment(height=%" PRIu32 ")\n", pSync->end_height);
+            bc_presync_reset(pSync);
+            return BC_PRESYNC_ERROR;
+        default:
+            break;
+        }
+        bc_presync_reset(pSync);
+        return BC_PRESYNC_END;
+    }
+
+    if (pSync->state == BC_PRESYNC_STATE_IDLE) {
+        if (!start(pSync, pHeaders)) {
+            bc_presync_reset(pSync);
+            return BC_PRESYNC_ERROR;
+        }
+    }
+
+    for (uint32_t lp = 0; lp < Count; lp++) {
+        const uint8_t *p = pHeaders + lp * BC_PRESYNC_REC_SZ;
+        uint32_t height = pSync->height + 1;
+        uint8_t hash[BTC_SZ_HASH256];
+
+        if (!bc_headers_check(hash, p, height, pSync->last_hash, &pSync->diff)) {
+            goto LABEL_ERROR;
+        }
+
+        switch (pSync->state) {
+        case BC_PRESYNC_STATE_DIRECT:
+            if (!bc_headers_append(p)) {
+                goto LABEL_ERROR;
+            }
+            break;
+        case BC_PRESYNC_STATE_PRESYNC:
+            {
+                uint32_t bits;
+                MEMCPY(&bits, p + BC_HEADERS_OFFSET_BITS, sizeof(bits));
+                bc_pow_work_add(&pSync->work, bits);
+            }
+            if (bc_pow_work_cmp(&pSync->work, &pSync->threshold) <= 0) {
+                break;
+            }
+            if (pSync->b_first) {
+                //分岐点からのheaderが全てここにある
+                if (!reorg(pSync)) {
+                    goto LABEL_ERROR;
+                }
+                for (uint32_t lp2 = 0; lp2 <= lp; lp2++) {
+                    if (!bc_headers_append(pHeaders + lp2 * BC_PRESYNC_REC_SZ)) {
+                        reorg_undo(pSync);
+                        goto LABEL_ERROR;
+                    }
+                }
+                pSync->state = BC_PRESYNC_STATE_DIRECT;
+            } else {
+                //分岐点から取り直す
+                pSync->end_height = height;
+                MEMCPY(pSync->end_hash, hash, BTC_SZ_HASH256);
+                pSync->fp = tmpfile();
+                if (pSync->fp == NULL) {
+                    LOGE("fail: tmpfile\n");
+                    goto LABEL_ERROR;
+                }
+                LOGD("redownload: fork=%" PRIu32 ", commitment=%" PRIu32 "\n", pSync->fork_height, pSync->end_height);
+                pSync->state = BC_PRESYNC_STATE_REDOWNLOAD;
+                pSync->height = pSync->fork_height;
+                MEMCPY(pSync->last_hash, pSync->fork_hash, BTC_SZ_HASH256);
+                bc_headers_diff_init(&pSync->diff, pSync->fork_height);
+                MEMCPY(pNextHash, pSync->fork_hash, BTC_SZ_HASH256);
+                return BC_PRESYNC_NEXT;
+            }
+            break;
+        case BC_PRESYNC_STATE_REDOWNLOAD:
+            if (fwrite(p, BC_HEADERS_SZ, 1, pSync->fp) != 1) {
+                LOGE("fail: fwrite\n");
+                goto LABEL_ERROR;
+            }
+            if (height == pSync->end_height) {
+                if (MEMCMP(hash, pSync->end_hash, BTC_SZ_HASH256) != 0) {
+                    LOGE("fail: commitment mismatch(height=%" PRIu32 ")\n", height);
+                    goto LABEL_ERROR;
+                }
+                if (!reorg(pSync)) {
+                    goto LABEL_ERROR;
+                }
+                if (!flush_redownload(pSync)) {
+                    reorg_undo(pSync);
+                    goto LABEL_ERROR;
+                }
+                pSync->state = BC_PRESYNC_STATE_DIRECT;
+            }
+            break;
+        default:
+            goto LABEL_ERROR;
+        }
+
+        pSync->height = height;
+        MEMCPY(pSync->last_hash, hash, BTC_SZ_HASH256);
+    }
+    pSync->b_first = false;
+
+    if (Count < BC_PRESYNC_HEADERS_MAX) {
+        //peerのchainはここまで(空のheadersを待たない)
+        switch (pSync->state) {
+        case BC_PRESYNC_STATE_PRESYNC:
+            LOGD("ignore low-work headers(fork=%" PRIu32 ", last=%" PRIu32 ")\n", pSync->fork_height, pSync->height);
+            //fall through
+        case BC_PRESYNC_STATE_DIRECT:
+            bc_presync_reset(pSync);
+            return BC_PRESYNC_END;
+        default:
+            break;
+        }
+    }
+
+    MEMCPY(pNextHash, pSync->last_hash, BTC_SZ_HASH256);
+    return BC_PRESYNC_NEXT;
+
+LABEL_ERROR:
+    bc_presync_reset(pSync);
+    return BC_PRESYNC_ERROR;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 分岐点の決定
+ *
+ * @param[in,out]   pSync       presync状態
+ * @param[in]       pHeader     最初に受信したheader
+ * @retval  true    OK
+ */
+static bool start(bc_presync_t *pSync, const uint8_t *pHeader)
+{
+    const uint8_t *p_prev = pHeader + BC_HEADERS_OFFSET_PREV;
+    uint32_t tip = bc_headers_tip(NULL, NULL);
+
+    if (!bc_headers_find(&pSync->fork_height, p_prev)) {
+        LOGE("fail: headers not connected\n");
+        return false;
+    }
+    if ((pSync->fork_height < tip) && (pSync->fork_height < bc_checkpoint_last()->height)) {
+        LOGE("fail: fork below checkpoint(fork=%" PRIu32 ")\n", pSync->fork_height);
+        return false;
+    }
+    MEMCPY(pSync->fork_hash, p_prev, BTC_SZ_HASH256);
+    pSync->height = pSync->fork_height;
+    MEMCPY(pSync->last_hash, p_prev, BTC_SZ_HASH256);
+    MEMSET(&pSync->work, 0, sizeof(pSync->work));
+    bc_headers_diff_init(&pSync->diff, pSync->fork_height);
+    pSync->b_first = true;
+
+    if (pSync->fork_height == tip) {
+        pSync->state = BC_PRESYNC_STATE_DIRECT;
+    } else {
+        bc_headers_work_above(&pSync->threshold, pSync->fork_height);
+        pSync->state = BC_PRESYNC_STATE_PRESYNC;
+        LOGD("presync: fork=%" PRIu32 ", tip=%" PRIu32 "\n", pSync->fork_height, tip);
+    }
+    return true;
+}
+
+
+/** 分岐点まで保存headerを戻す
+ *
+ * 外したheaderはpSync->undoに置き、新しいheaderを保存できなければreorg_undo()で戻す。
+ *
+ * @param[in,out]   pSync       presync状態
+ * @retval  true    OK
+ */
+static bool reorg(bc_presync_t *pSync)
+{
+    uint8_t header[BC_HEADERS_SZ];
+    uint32_t tip = bc_headers_tip(NULL, NULL);
+
+    LOGD("reorg: fork=%" PRIu32 "\n", pSync->fork_height);
+    pSync->undo = tmpfile();
+    if (pSync->undo == NULL) {
+        LOGE("fail: tmpfile\n");
+        return false;
+    }
+    for (uint32_t height = pSync->fork_height + 1; height <= tip; height++) {
+        if (!bc_headers_get(header, height) || (fwrite(header, sizeof(header), 1, pSync->undo) != 1)) {
+            LOGE("fail: save header(height=%" PRIu32 ")\n", height);
+            return false;
+        }
+    }
+    return bc_headers_truncate(pSync->fork_height, pSync->fork_hash);
+}
+
+
+/** reorg()前のheaderに戻す
+ *
+ * @param[in,out]   pSync       presync状態
+ */
+static void reorg_undo(bc_presync_t *pSync)
+{
+    uint8_t header[BC_HEADERS_SZ];
+
+    LOGE("reorg failed: restore(fork=%" PRIu32 ")\n", pSync->fork_height);
+    if (!bc_headers_truncate(pSync->fork_height, pSync->fork_hash)) {
+        return;
+    }
+    rewind(pSync->undo);
+    while (fread(header, sizeof(header), 1, pSync->undo) == 1) {
+        if (!bc_headers_append(header)) {
+            LOGE("fail: restore\n");
+            break;
+        }
+    }
+}
+
+
+/** 再取得したheaderを保存
+ *
+ * @param[in,out]   pSync       presync状態
+ * @retval  true    OK
+ */
+static bool flush_redownload(bc_presync_t *pSync)
+{
+    uint8_t header[BC_HEADERS_SZ];
+    bool ret = true;
+
+    rewind(pSync->fp);
+    while (fread(header, sizeof(header), 1, pSync->fp) == 1) {
+        if (!bc_headers_append(header)) {
+            ret = false;
+            break;
+        }
+    }
+    fclose(pSync->fp);
+    pSync->fp = NULL;
+    return ret;
+}
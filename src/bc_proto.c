@@ -12,6 +12,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
@@ -19,6 +20,23 @@
 #include "bc_proto.h"
 #include "bc_flash.h"
 #include "bc_network.h"
+#include "bc_headers.h"
+#include "bc_presync.h"
+#include "bc_hdrsync.h"
+#include "bc_merkle.h"
+#include "bc_fblock.h"
+#include "bc_cfilter.h"
+#include "bc_cfstore.h"
+#include "bc_bloom.h"
+#include "bc_watch.h"
+#include "bc_gcs.h"
+#include "bc_sha256.h"
+#include "bc_slab.h"
+#include "bc_block.h"
+#include "bc_known.h"
+#include "bc_txreq.h"
+#include "bc_mempool.h"
+#include "bc_fee.h"
 #include "libbloom/bloom.h"
 
 #define LOG_TAG     "proto"
@@ -51,17 +69,40 @@
 #define BC_CMD_LEN              (12)
 #define BC_CHKSUM_LEN           (4)
 
-//Elements=200, Rate=0.00001で、600バイト程度
-//Elements=700, Rate=0.00001で、2096バイト程度
-//Elements=700, Rate=0.0001で、1677バイト程度
-#define BLOOM_ELEMENTS              (700)           //bitcoinjのwallettemplate参考
+#ifndef BLOOM_RATE
 #define BLOOM_RATE                  (0.0001)        //bitcoinjのwallettemplate参考
-#define BLOOM_TWEAK                 rand()
+#endif
 
 #define BLOOM_UPDATE_NONE           (0)
 #define BLOOM_UPDATE_ALL            (1)
 #define BLOOM_UPDATE_P2PUBKEY_ONLY  (2)
 
+#ifndef MEMPOOL_SAVE_SEC
+#define MEMPOOL_SAVE_SEC            (600)
+#endif
+
+#ifndef FBLOCK_WINDOW
+#define FBLOCK_WINDOW               (BC_FBLOCK_WINDOW_MAX / 2)
+#endif
+#define FBLOCK_REORG_DEPTH          (6)             ///< 保存したhashが変わっていた場合に戻るblock数
+
+#define NODE_COMPACT_FILTERS        (1 << 6)        ///< BIP157
+#define CFILTER_SZ_MAX              (4000000)       ///< cfilter長の上限(block weight上限)
+#define CFCHECKPT_WAIT_USEC         ((uint64_t)30 * 1000000)    ///< cfcheckpt照合待ちでhelperを起動し直す間隔
+#if defined(CFILTER)
+#define M_USE_CFILTER(services)     (((services) & NODE_COMPACT_FILTERS) != 0)
+#else
+#define M_USE_CFILTER(services)     (false)
+#endif
+#if defined(CFILTER) && defined(CFILTER_TXRELAY)
+#define M_CFILTER_TXRELAY           (true)
+#else
+#define M_CFILTER_TXRELAY           (false)
+#endif
+
+#define INV_MAX                     (50000)         ///< inv, getdataの要素数上限
+#define TXREQ_POLL_NUM              (64)            ///< 要求し直すtxを1回に取り出す数
+#define PARENT_REQ_MAX              (16)            ///< 監視対象txの入力元txを1回に要求する数
 #define INV_MSG_MSK_WIT             (0x40000000)
 #define INV_MSG_ERROR               (0)
 #define INV_MSG_TX                  (1)
@@ -155,8 +196,8 @@ struct cheaders_t {
     uint8_t     filter_type;
     uint8_t     stop_hash[BTC_SZ_HASH256];
     uint8_t     prev_filter_headers[BTC_SZ_HASH256];
-    //NumFilterBytes + FilterBytes
-    uint8_t     filter_bytes[];
+    //FilterHashesLength + FilterHashes
+    uint8_t     filter_hashes[];
 };
 
 
@@ -179,13 +220,24 @@ struct cfcheckpt {
 typedef bool (*read_function_t)(bc_protoval_t *pProtoVal, uint32_t Len);
 
 
+/** @struct load_watch_t
+ *
+ * FNAME_WATCH再読込み(load_watch())
+ */
+typedef struct {
+    bc_protoval_t   *p_protoval;
+    bool            ok;                 ///< false:送信失敗
+} load_watch_t;
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
 
-static bool send_data(bc_protoval_t *pProtoVal, struct bc_proto_t *pProto);
-static void set_header(struct bc_proto_t *pProto, const char *pCmd);
+static struct bc_proto_t *new_msg(bc_sendbuf_t **ppBuf, const char *pCmd, size_t PayloadLen);
+static bool send_data(bc_protoval_t *pProtoVal, bc_sendbuf_t *pBuf);
 static int64_t get_current_time(void);
+static uint64_t get_current_usec(void);
 static void print_time(uint64_t tm);
 
 static void add_netaddr(uint8_t **pp, uint64_t serv, int ip0, int ip1, int ip2, int ip3, uint16_t port);
@@ -208,29 +260,60 @@ static bool recv_ping(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_pong(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_addr(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_inv(bc_protoval_t *pProtoVal, uint32_t Len);
-static bool recv_inv_tx(bc_protoval_t *pProtoVal, const struct inv_t *pInv);
+static bool recv_notfound(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_inv_block(bc_protoval_t *pProtoVal, const struct inv_t *pInv);
 static bool recv_block(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_tx(bc_protoval_t *pProtoVal, uint32_t Len);
+static bool recv_tx_merkle(bc_protoval_t *pProtoVal, const bc_txview_t *pView);
 static bool recv_headers(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_merkleblock(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_feefilter(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_sendheaders(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_sendcmpct(bc_protoval_t *pProtoVal, uint32_t Len);
+static bool recv_cfcheckpt(bc_protoval_t *pProtoVal, uint32_t Len);
+static bool recv_cfheaders(bc_protoval_t *pProtoVal, uint32_t Len);
+static bool recv_cfilter(bc_protoval_t *pProtoVal, uint32_t Len);
 // static bool recv_cmpctblock(bc_protoval_t *pProtoVal, uint32_t Len);
 // static bool recv_getblocktxn(bc_protoval_t *pProtoVal, uint32_t Len);
 // static bool recv_blocktxn(bc_protoval_t *pProtoVal, uint32_t Len);
 static bool recv_unknown(bc_protoval_t *pProtoVal, uint32_t Len);
+static bool recv_nomem(bc_protoval_t *pProtoVal, uint32_t Len);
+static void start_sub(bc_protoval_t *pProtoVal);
+static bool start_getheaders(bc_protoval_t *pProtoVal);
+static bool request_announced(bc_protoval_t *pProtoVal, bool bHeaders);
+static void announce_processed(bc_protoval_t *pProtoVal);
+static uint32_t get_scan_start(bc_protoval_t *pProtoVal);
+static void start_fblock(bc_protoval_t *pProtoVal);
+static bool request_fblock(bc_protoval_t *pProtoVal);
+static bool retry_fblock(bc_protoval_t *pProtoVal);
+static bool start_cfilter(bc_protoval_t *pProtoVal);
+static void start_cfstore(bc_protoval_t *pProtoVal);
+static bool feed_cfstore(bc_protoval_t *pProtoVal);
+static bool request_cfheaders(bc_protoval_t *pProtoVal);
+static bool request_rescan(bc_protoval_t *pProtoVal);
+static bool check_checkpt(bc_protoval_t *pProtoVal);
+static bool reload_watch(bc_protoval_t *pProtoVal);
+static bool load_watch(void *pArg, bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+static bool crosscheck_checkpt(bc_protoval_t *pProtoVal);
+static bool request_txreq(bc_protoval_t *pProtoVal);
+static bool request_parents(bc_protoval_t *pProtoVal, const bc_txview_t *pView);
 
 static bool send_version(bc_protoval_t *pProtoVal);
 static bool send_verack(bc_protoval_t *pProtoVal);
 //static bool send_ping(bc_protoval_t *pProtoVal);
 static bool send_pong(bc_protoval_t *pProtoVal, uint64_t Nonce);
 static bool send_getblocks(bc_protoval_t *pProtoVal, const uint8_t *pHash);
-static bool send_getheaders(bc_protoval_t *pProtoVal, const uint8_t *pHash);
+static bool send_getheaders(bc_protoval_t *pProtoVal, const uint8_t *pLocator, int Num, const uint8_t *pStop);
 static bool send_getdata(bc_protoval_t *pProtoVal, const struct inv_t *pInv);
-static bool send_filterload(bc_protoval_t *pProtoVal, const uint8_t *pPubKeyHash, size_t Len);
+static bool send_getdata_list(bc_protoval_t *pProtoVal, const struct inv_t *pInvs, int Num);
+static bool send_getdata_fblock(bc_protoval_t *pProtoVal, const uint8_t *pHashes, int Num);
+static bool send_filterload(bc_protoval_t *pProtoVal);
+static bool send_filteradd(bc_protoval_t *pProtoVal, const uint8_t *pData, size_t Len);
+static bool send_filterclear(bc_protoval_t *pProtoVal);
 static bool send_mempool(bc_protoval_t *pProtoVal);
+static bool send_sendheaders(bc_protoval_t *pProtoVal);
+static bool send_getcfcheckpt(bc_protoval_t *pProtoVal, const uint8_t *pStopHash);
+static bool send_getcfheaders(bc_protoval_t *pProtoVal, const char *pCmd, uint32_t StartHeight, const uint8_t *pStopHash);
 
 
 /**************************************************************************
@@ -243,12 +326,15 @@ const char kCMD_PING[] = "ping";                    ///< [message]ping
 const char kCMD_PONG[] = "pong";                    ///< [message]pong
 const char kCMD_ADDR[] = "addr";                    ///< [message]addr
 const char kCMD_INV[] = "inv";                      ///< [message]inv
+const char kCMD_NOTFOUND[] = "notfound";            ///< [message]notfound
 const char kCMD_GETBLOCKS[] = "getblocks";          ///< [message]getblocks
 const char kCMD_GETHEADERS[] = "getheaders";        ///< [message]getheaders
 const char kCMD_GETDATA[] = "getdata";              ///< [message]getdata
 const char kCMD_BLOCK[] = "block";                  ///< [message]block
 const char kCMD_HEADERS[] = "headers";              ///< [message]headers
 const char kCMD_FILTERLOAD[] = "filterload";        ///< [message]filterload
+const char kCMD_FILTERADD[] = "filteradd";          ///< [message]filteradd
+const char kCMD_FILTERCLEAR[] = "filterclear";      ///< [message]filterclear
 const char kCMD_TX[] = "tx";                        ///< [message]tx
 const char kCMD_MEMPOOL[] = "mempool";              ///< [message]mempool
 const char kCMD_MERKLEBLOCK[] = "merkleblock";      ///< [message]merkleblock
@@ -258,6 +344,12 @@ const char kCMD_SENDCMPCT[] = "sendcmpct";          ///< [message]sendcmpct
 const char kCMD_CMPCTBLOCK[] = "cmpctblock";        ///< [message]cmpctblock
 const char kCMD_GETBLOCKTXN[] = "getblocktxn";      ///< [message]getblocktxn
 const char kCMD_BLOCKTXN[] = "blocktxn";            ///< [message]blocktxn
+const char kCMD_GETCFILTERS[] = "getcfilters";      ///< [message]getcfilters
+const char kCMD_CFILTER[] = "cfilter";              ///< [message]cfilter
+const char kCMD_GETCFHEADERS[] = "getcfheaders";    ///< [message]getcfheaders
+const char kCMD_CFHEADERS[] = "cfheaders";          ///< [message]cfheaders
+const char kCMD_GETCFCHECKPT[] = "getcfcheckpt";    ///< [message]getcfcheckpt
+const char kCMD_CFCHECKPT[] = "cfcheckpt";          ///< [message]cfcheckpt
 
 
 /** 受信解析用 */
@@ -269,6 +361,7 @@ static const struct {
     {   kCMD_HEADERS,           recv_headers,       },
     {   kCMD_MERKLEBLOCK,       recv_merkleblock,   },
     {   kCMD_INV,               recv_inv,           },
+    {   kCMD_NOTFOUND,          recv_notfound,      },
     {   kCMD_TX,                recv_tx,            },
     {   kCMD_BLOCK,             recv_block,         },
     {   kCMD_PONG,              recv_pong,          },
@@ -278,22 +371,25 @@ static const struct {
     {   kCMD_FEEFILTER,         recv_feefilter,     },
     {   kCMD_SENDHEADERS,       recv_sendheaders,   },
     {   kCMD_SENDCMPCT,         recv_sendcmpct,     },
+    {   kCMD_CFILTER,           recv_cfilter,       },
+    {   kCMD_CFHEADERS,         recv_cfheaders,     },
+    {   kCMD_CFCHECKPT,         recv_cfcheckpt,     },
     {   NULL,                   recv_unknown,       },
 };
 
 
-//PubKeyHash(script部分は除くこと)
-const uint8_t kPubKeyHash[] = {
-    //tb1qv8vryy3656pkkj3vpmewmpj2aqg9gemlf582lh
-    0x61, 0xd8, 0x32, 0x12, 0x3a, 0xa6,
-    0x83, 0x6b, 0x4a, 0x2c, 0x0e, 0xf2, 0xed, 0x86,
-    0x4a, 0xe8, 0x10, 0x54, 0x67, 0x7f,
+/**************************************************************************
+ * static variables
+ **************************************************************************/
 
-    //n19wazVXRaUKZSXUr4JBwVHHGFYDx8t7Wh
-    // 0xd7, 0x69, 0x30, 0x82, 0xfb,
-    // 0x18, 0xe4, 0xf6, 0x7d, 0x5d, 0xe3, 0x36, 0x57,
-    // 0x64, 0xc7, 0x92, 0x1b, 0x08, 0xf2, 0x14
-};
+static volatile sig_atomic_t    mReloadWatch;   ///< FNAME_WATCH再読込み要求
+
+/** 新block通知から保存までの時間 */
+static struct {
+    uint32_t    count;
+    uint64_t    sum;                    ///< usec
+    uint64_t    max;                    ///< usec
+} mAnnounceLatency[2];                  ///< [0]:inv, [1]:headers
 
 
 /**************************************************************************
@@ -304,12 +400,30 @@ void bc_start(bc_protoval_t *pProtoVal)
 {
     LOGD("\n");
 
-    bc_flash_get_last_bhash(&pProtoVal->height, pProtoVal->last_headers_bhash);
-
-    pProtoVal->loop = send_version(pProtoVal);
+    pProtoVal->helper = false;
+    start_sub(pProtoVal);
+    time_t save = time(NULL);
     while (pProtoVal->loop) {
         sleep(10);
+        //再起動で取得し直さないよう、mempoolと既知txidを保存しておく
+        if (time(NULL) - save >= MEMPOOL_SAVE_SEC) {
+            bc_mempool_save();
+            bc_known_save();
+            bc_fee_save();
+            save = time(NULL);
+        }
     }
+    bc_hdrsync_release(&pProtoVal->hdrsync);
+    bc_rescan_release(&pProtoVal->rescan);
+}
+
+
+void bc_start_helper(bc_protoval_t *pProtoVal)
+{
+    LOGD("\n");
+
+    pProtoVal->helper = true;
+    start_sub(pProtoVal);
 }
 
 
@@ -322,6 +436,10 @@ bool bc_read_message(bc_protoval_t *pProtoVal)
     uint8_t *buf = (uint8_t *)&proto;
     while (sz > 0) {
         ssize_t len = bc_network_read(pProtoVal->socket, buf, sz);
+        if (len <= 0) {
+            LOGE("fail: read header\n");
+            return false;
+        }
         buf += len;
         sz -= len;
     }
@@ -339,7 +457,10 @@ bool bc_read_message(bc_protoval_t *pProtoVal)
             }
             lp++;
         }
+        MEMCPY(pProtoVal->recv_chksum, proto.checksum, BC_CHKSUM_LEN);
         ret = (*kReplyFunc[lp].pFunc)(pProtoVal, proto.length);
+        //受信処理で確保したものはまとめて解放する
+        bc_arena_reset(&pProtoVal->arena);
     } else {
         //不一致
         LOGD("[%s()]  invalid magic(%08x)\n", __func__, proto.magic);
@@ -349,6 +470,124 @@ bool bc_read_message(bc_protoval_t *pProtoVal)
 }
 
 
+bool bc_read_rescan(bc_protoval_t *pProtoVal)
+{
+    bc_rescan_result_t result;
+    bool b_pop = false;
+
+    bc_rescan_clear_event();
+    while (bc_rescan_pop(&result)) {
+        //次のrescan用に保存する(保存済みの続きのみ)
+        bc_cfstore_append(result.height, result.bhash, result.filter_header, result.p_filter, result.len);
+        FREE(result.p_filter);
+        if (result.matched) {
+            //一致したblockだけ取得する
+            struct inv_t inv;
+            LOGD("cfilter match(height=%" PRIu32 ")\n", result.height);
+            inv.type = INV_MSG_BLOCK;
+            MEMCPY(inv.hash, result.bhash, BTC_SZ_HASH256);
+            if (!send_getdata(pProtoVal, &inv)) {
+                return false;
+            }
+        }
+        b_pop = true;
+    }
+    if (b_pop) {
+        bc_flash_save_last_bhash(result.height, result.bhash);
+        if (bc_rescan_done()) {
+            LOGD("rescan done(height=%" PRIu32 ")\n", result.height);
+        }
+    }
+
+    //空いた分を要求する
+    return request_cfheaders(pProtoVal) && request_rescan(pProtoVal);
+}
+
+
+bool bc_idle(bc_protoval_t *pProtoVal)
+{
+    //追加された監視要素をfilteraddする
+    if (!pProtoVal->helper && mReloadWatch && !reload_watch(pProtoVal)) {
+        return false;
+    }
+    //応答の無いtx要求を他の接続に回す
+    if (!request_txreq(pProtoVal)) {
+        return false;
+    }
+    //応答の無いfiltered blockを要求し直す
+    if (!retry_fblock(pProtoVal)) {
+        return false;
+    }
+    if (!pProtoVal->cfilter) {
+        return true;
+    }
+    //応答の無いgetcfiltersを他の接続に回す
+    bc_rescan_expire(&pProtoVal->rescan, get_current_usec());
+    if (!pProtoVal->helper) {
+        //cfcheckptの照合待ち
+        return check_checkpt(pProtoVal) && request_rescan(pProtoVal);
+    }
+    if (bc_rescan_done() && (pProtoVal->rescan.num == 0)) {
+        LOGD("helper done\n");
+        pProtoVal->loop = false;
+        return true;
+    }
+    return request_rescan(pProtoVal);
+}
+
+
+void bc_reload_watch(void)
+{
+    mReloadWatch = 1;
+}
+
+
+bool bc_add_watch(bc_protoval_t *pProtoVal, bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    if (!bc_watch_add(Type, pData, Len)) {
+        //登録済み
+        return true;
+    }
+
+    utl_buf_t elem;
+    bc_watch_bloom_element(Type, pData, Len, &elem);
+    switch (bc_bloom_add(&pProtoVal->bloom, elem.len)) {
+    case BC_BLOOM_ACT_ADD:
+        return send_filteradd(pProtoVal, elem.buf, elem.len);
+    case BC_BLOOM_ACT_RELOAD:
+        return send_filterload(pProtoVal);
+    default:
+        return true;
+    }
+}
+
+
+bc_sendbuf_t *bc_msg_new(const char *pCmd, const uint8_t *pPayload, size_t Len)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, pCmd, Len);
+    if (pProto == NULL) {
+        return NULL;
+    }
+    MEMCPY(pProto->payload, pPayload, Len);
+    pProto->length = Len;
+
+    //checksum
+    uint8_t hash[BTC_SZ_HASH256];
+    btc_util_hash256(hash, pProto->payload, pProto->length);
+    MEMCPY(pProto->checksum, hash, BC_CHKSUM_LEN);
+    p_buf->len = BC_PACKET_LEN(pProto);
+    return p_buf;
+}
+
+
+bool bc_send_msg(bc_protoval_t *pProtoVal, bc_sendbuf_t *pBuf)
+{
+    bc_sendbuf_ref(pBuf);
+    return send_data(pProtoVal, pBuf);
+}
+
+
 /**************************************************************************
  * private functions
  **************************************************************************/
@@ -363,6 +602,19 @@ static int64_t get_current_time(void)
 }
 
 
+/** 現在時刻の取得(経過時間計測用)
+ *
+ * @return  単調増加時刻(usec)
+ */
+static uint64_t get_current_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 /** (コンソール)時刻出力
  *
  * @param[in]   tm       時刻データ(epoch:Little Endian)
@@ -374,34 +626,65 @@ static void print_time(uint64_t tm)
 
 
 /** TCP送信
+ *
+ * 未設定ならchecksumを計算する。pBufの参照を1つ解放する。
  *
  * @param[in]       pProtoVal   protocol value
- * @param[in]       pProto      Bitcoinプロトコルデータ
+ * @param[in]       pBuf        new_msg()で作成したバッファ
  * @return  true    OK
  */
-static bool send_data(bc_protoval_t *pProtoVal, struct bc_proto_t *pProto)
+static bool send_data(bc_protoval_t *pProtoVal, bc_sendbuf_t *pBuf)
 {
+    struct bc_proto_t *pProto = (struct bc_proto_t *)pBuf->data;
     LOGD("%s\n", pProto->command);
 
-    //checksum
-    uint8_t hash[BTC_SZ_HASH256];
-    btc_util_hash256(hash, pProto->payload, pProto->length);
-    MEMCPY(pProto->checksum, hash, BC_CHKSUM_LEN);
+    if (pBuf->len == 0) {
+        //checksum
+        uint8_t hash[BTC_SZ_HASH256];
+        btc_util_hash256(hash, pProto->payload, pProto->length);
+        MEMCPY(pProto->checksum, hash, BC_CHKSUM_LEN);
+        pBuf->len = BC_PACKET_LEN(pProto);
+    }
 
-    return (write(pProtoVal->socket, pProto, BC_PACKET_LEN(pProto)) == BC_PACKET_LEN(pProto));
+    bool ret = true;
+    const uint8_t *p = pBuf->data;
+    size_t len = pBuf->len;
+    while (len > 0) {
+        ssize_t sz = write(pProtoVal->socket, p, len);
+        if (sz <= 0) {
+            ret = false;
+            break;
+        }
+        p += sz;
+        len -= sz;
+    }
+    bc_sendbuf_release(pBuf);
+    return ret;
 }
 
 
-/** Bitcoinパケットヘッダ設定
+/** 送信メッセージ作成
  *
- * @param[in]   pProto      Bitconプロトコルデータ
+ * headerを設定したバッファを確保する。payloadとlengthは呼び元で設定する。
+ *
+ * @param[out]  ppBuf       確保したバッファ(send_data()に渡す)
  * @param[in]   pCmd        送信コマンド
+ * @param[in]   PayloadLen  payload最大長
+ * @return      Bitcoinプロトコルデータ(失敗時NULL)
  */
-static void set_header(struct bc_proto_t *pProto, const char *pCmd)
+static struct bc_proto_t *new_msg(bc_sendbuf_t **ppBuf, const char *pCmd, size_t PayloadLen)
 {
+    *ppBuf = bc_sendbuf_get(sizeof(struct bc_proto_t) + PayloadLen);
+    if (*ppBuf == NULL) {
+        return NULL;
+    }
+
+    struct bc_proto_t *pProto = (struct bc_proto_t *)(*ppBuf)->data;
     pProto->magic = BC_MAGIC;
     MEMSET(pProto->command, 0, BC_CMD_LEN);
     STRCPY(pProto->command, pCmd);
+    pProto->length = 0;
+    return pProto;
 }
 
 
@@ -659,7 +942,7 @@ static void print_headers(const struct headers_t* pHeaders)
 
     //block hash
     uint8_t hash[BTC_SZ_HASH256];
-    btc_util_hash256(hash, (const uint8_t *)pHeaders, sizeof(struct headers_t) - 1); //block hash
+    btc_util_hash256(hash, (const uint8_t *)pHeaders, BC_HEADERS_SZ); //block hash
     LOGD2("    block hash: ");
     TXIDD(hash);
 }
@@ -701,6 +984,14 @@ static void print_services(const uint64_t Services)
         LOGD2("WITNESS");
         b = true;
     }
+    if (Services & NODE_COMPACT_FILTERS) {
+        if (b) {
+            LOGD2(",");
+        }
+        //BIP157
+        LOGD2("COMPACT_FILTERS");
+        b = true;
+    }
     if (Services & 1024) {
         if (b) {
             LOGD2(",");
@@ -731,6 +1022,7 @@ static bool recv_version(bc_protoval_t *pProtoVal, uint32_t Len)
     //services
     uint64_t services;
     Len -= get64(pProtoVal->socket, &services);
+    pProtoVal->services = services;
     LOGD2("   services: %016" PRIx64 "(", services);
     print_services(services);
     LOGD2(")\n");
@@ -797,11 +1089,14 @@ static bool recv_verack(bc_protoval_t *pProtoVal, uint32_t Len)
     send_verack(pProtoVal);
 
     LOGD("*** SYNC START(height=%" PRIu32 ") ***\n", pProtoVal->height);
-    send_getheaders(pProtoVal, pProtoVal->last_headers_bhash);
+    if (!pProtoVal->helper && bc_hdrsync_plan()) {
+        //checkpoint区間を別peerからも取得する
+        bc_network_start_helpers();
+    }
 
     //これ以降、headersが送られてくる
 
-    return true;
+    return start_getheaders(pProtoVal);
 }
 
 
@@ -882,10 +1177,19 @@ static bool recv_addr(bc_protoval_t *pProtoVal, uint32_t Len)
 static bool recv_inv(bc_protoval_t *pProtoVal, uint32_t Len)
 {
     uint64_t count;
-    bool b_block = false;
-    uint8_t last_inv_bhash[BTC_SZ_HASH256];
+    bool retval = true;
 
     Len -= get_varint(pProtoVal->socket, &count);
+    if ((count > INV_MAX) || (count * sizeof(struct inv_t) > Len)) {
+        LOGE("fail: inv count(%" PRIu64 ")\n", count);
+        return false;
+    }
+    //要求するtxは1つのgetdataにまとめる
+    struct inv_t *p_req = (struct inv_t *)bc_arena_alloc(&pProtoVal->arena, sizeof(struct inv_t) * (count + 1));
+    int req_num = 0;
+    int known_num = 0;
+    int inflight_num = 0;
+    uint64_t now = get_current_usec();
     while (count--) {
         struct inv_t inv;
         ssize_t sz = bc_network_read(pProtoVal->socket, &inv, sizeof(inv));
@@ -898,14 +1202,28 @@ static bool recv_inv(bc_protoval_t *pProtoVal, uint32_t Len)
             case INV_MSG_ERROR:
                 break;
             case INV_MSG_TX:
-                ret = recv_inv_tx(pProtoVal, &inv);
+                if (!pProtoVal->txrelay) {
+                    //filterload前(または通知を受けない設定のcfilter照合)
+                    break;
+                }
+                if (p_req == NULL) {
+                    //getdataできないので要求中にしない(他の接続か次の通知で要求する)
+                    break;
+                }
+                if (bc_known_find(inv.hash)) {
+                    //受信済み
+                    known_num++;
+                    break;
+                }
+                if (!bc_txreq_announce(pProtoVal->txreq_peer, inv.hash, now)) {
+                    //他の接続で要求中(応答が無ければbc_txreq_poll()で回ってくる)か、通知が多すぎる
+                    inflight_num++;
+                    break;
+                }
+                p_req[req_num++] = inv;
                 break;
             case INV_MSG_BLOCK:
                 ret = recv_inv_block(pProtoVal, &inv);
-                if (ret) {
-                    MEMCPY(last_inv_bhash, inv.hash, BTC_SZ_HASH256);
-                    b_block = true;
-                }
                 break;
             case INV_MSG_FILTERED_BLOCK:
                 break;
@@ -914,40 +1232,82 @@ static bool recv_inv(bc_protoval_t *pProtoVal, uint32_t Len)
             default:
                 ;
             }
+            if (!ret) {
+                retval = false;
+            }
         } else {
-            ;
+            retval = false;
+            break;
         }
     }
 
-    //MSG_BLOCKがあるなら、次回のgetheaders負荷を減らすために更新
-    if (b_block && (pProtoVal->synced)) {
-        bc_flash_save_last_bhash(pProtoVal->height, last_inv_bhash);
+    if (req_num > 0) {
+        LOGD("getdata tx x %d (known=%d, inflight=%d)\n", req_num, known_num, inflight_num);
+        if (!send_getdata_list(pProtoVal, p_req, req_num)) {
+            retval = false;
+        }
+    }
+    //通知が続いて受信待ちtimeoutにならない場合もここで要求し直す
+    if (!request_txreq(pProtoVal)) {
+        retval = false;
     }
 
-    // if (mpPayload != NULL) {
-    //     //ここまでをgetdataする
-    //     LOGD("  *** send getdata[cnt:%d] ***\n", *pProto->payload);
-    //     send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
-    //     mpPayload = NULL;
-    // }
-
-    return Len == 0;
+    return retval && (Len == 0);
 }
 
 
-static bool recv_inv_tx(bc_protoval_t *pProtoVal, const struct inv_t *pInv)
+/** 受信データ解析(notfound)
+ *
+ * 要求したtxが無かった場合は、他に通知した接続があればそちらで要求し直す。
+ * filtered blockは同じ接続で要求し直す(BC_FBLOCK_RETRY_MAX回まで)。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       Len         パケット長
+ * @retval      true    OK
+ */
+static bool recv_notfound(bc_protoval_t *pProtoVal, uint32_t Len)
 {
-    return send_getdata(pProtoVal, pInv);
+    uint64_t count;
+
+    Len -= get_varint(pProtoVal->socket, &count);
+    if ((count > INV_MAX) || (count * sizeof(struct inv_t) > Len)) {
+        LOGE("fail: notfound count(%" PRIu64 ")\n", count);
+        return false;
+    }
+    while (count--) {
+        struct inv_t inv;
+        ssize_t sz = bc_network_read(pProtoVal->socket, &inv, sizeof(inv));
+        if (sz != sizeof(inv)) {
+            return false;
+        }
+        Len -= sz;
+        if ((inv.type & ~INV_MSG_MSK_WIT) == INV_MSG_TX) {
+            LOGD("notfound tx: ");
+            TXIDD(inv.hash);
+            bc_txreq_notfound(pProtoVal->txreq_peer, inv.hash);
+        } else if ((inv.type & ~INV_MSG_MSK_WIT) == INV_MSG_FILTERED_BLOCK) {
+            bc_fblock_notfound(&pProtoVal->fblock, inv.hash);
+        }
+    }
+    if (Len != 0) {
+        return false;
+    }
+
+    return retry_fblock(pProtoVal);
 }
 
 
 static bool recv_inv_block(bc_protoval_t *pProtoVal, const struct inv_t *pInv)
 {
-    //最後に通知されたBhash更新
-    pProtoVal->height++;
-    LOGD("*** Height=%" PRIu32 "\n", pProtoVal->height);
+    uint32_t height;
 
-    return true;
+    if (!pProtoVal->synced || bc_headers_find(&height, pInv->hash)) {
+        //同期中 or 保存済み
+        return true;
+    }
+
+    //sendheadersに対応していないpeer: headersを取りに行く
+    return request_announced(pProtoVal, false);
 }
 
 
@@ -959,25 +1319,63 @@ static bool recv_inv_block(bc_protoval_t *pProtoVal, const struct inv_t *pInv)
  */
 static bool recv_block(bc_protoval_t *pProtoVal, uint32_t Len)
 {
-    uint64_t lp;
+    uint8_t bhash[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+    uint32_t height;
 
-    struct headers_t headers;
-    Len -= bc_network_read(pProtoVal->socket, &headers, sizeof(headers));
-    print_headers(&headers);
+    if ((Len < BC_HEADERS_SZ) || (Len > BC_SLAB_SZ)) {
+        LOGE("fail: block size(%" PRIu32 ")\n", Len);
+        return false;
+    }
+    //4MBまであるのでarenaではなく使い回しのバッファに直接読む
+    uint8_t *p_block = bc_slab_get();
+    if (p_block == NULL) {
+        return false;
+    }
+    ssize_t sz = bc_network_read(pProtoVal->socket, p_block, Len);
+    if (sz != (ssize_t)Len) {
+        LOGE("fail: block bc_network_read size(%ld)\n", sz);
+        bc_slab_put(p_block);
+        return false;
+    }
+    btc_util_hash256(hash, p_block, Len);
+    if (MEMCMP(hash, pProtoVal->recv_chksum, BC_CHKSUM_LEN) != 0) {
+        //読み切っているので、捨てて続ける
+        LOGE("fail: block checksum\n");
+        bc_slab_put(p_block);
+        return true;
+    }
+    print_headers((const struct headers_t *)p_block);
 
-    //tx
-    uint64_t txn_count;
-    Len -= get_varint(pProtoVal->socket, &txn_count);
-    LOGD("   txn_count: %" PRIu64 "\n", txn_count);
-    for (lp = 0; lp < txn_count; lp++) {
-        uint8_t data;
-        (void)bc_network_read(pProtoVal->socket, &data, 1);
-        LOGD2("%02x", data);
+    btc_util_hash256(bhash, p_block, BC_HEADERS_SZ);
+    bool b_chain = bc_headers_find(&height, bhash);
+    if (!b_chain) {
+        height = 0;
     }
-    Len -= txn_count;
-    LOGD2("\n");
+    LOGD("block(height=%" PRIu32 ", size=%" PRIu32 "): ", height, Len);
+    TXIDD(bhash);
+    //merkle root, witness commitmentが合わないblockは使わない
+    if (!bc_block_verify(p_block, Len, &pProtoVal->arena, NULL)) {
+        LOGE("fail: block verify\n");
+        bc_slab_put(p_block);
+        return true;
+    }
+    int matched = bc_watch_block(p_block, Len, b_chain);
+    if (matched > 0) {
+        LOGD("  watch tx: %d\n", matched);
+    } else if (matched < 0) {
+        LOGE("fail: invalid block\n");
+    }
+    if (b_chain) {
+        bc_mempool_block(p_block, Len, height);
+    } else {
+        //分岐などheadersにないblockのtxはまだ承認されていない
+        LOGD("  not in headers: keep mempool\n");
+    }
+    bc_slab_put(p_block);
+    bc_fee_print();
 
-    return Len == 0;
+    return true;
 }
 
 
@@ -989,16 +1387,80 @@ static bool recv_block(bc_protoval_t *pProtoVal, uint32_t Len)
  */
 static bool recv_tx(bc_protoval_t *pProtoVal, uint32_t Len)
 {
-    uint8_t *p_tx = (uint8_t *)MALLOC(Len);
+    uint8_t *p_tx = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len);
+    if (p_tx == NULL) {
+        return recv_nomem(pProtoVal, Len);
+    }
     ssize_t sz = bc_network_read(pProtoVal->socket, p_tx, Len);
-    btc_print_rawtx(p_tx, Len);
-    FREE(p_tx);
+    bc_txview_t view;
+    if ((sz == (ssize_t)Len) && bc_txview_parse(&view, p_tx, Len) && (view.len == Len)) {
+        uint8_t txid[BTC_SZ_TXID];
+        bc_txview_txid(&view, txid);
+        bc_known_check_add(txid);
+        bc_txreq_received(txid);
+        bool b_watch = bc_watch_txview(&view);
+        bool b_block = (pProtoVal->merkle_cnt > 0) && recv_tx_merkle(pProtoVal, &view);
+        if (b_block && (pProtoVal->merkle_height > 0)) {
+            bc_watch_spent(&view);
+        }
+        if (b_watch) {
+            //btc_tx_tとして読むのは一致した場合だけ
+            LOGD("watch tx\n");
+            btc_print_rawtx(p_tx, Len);
+        }
+        if (b_block && (pProtoVal->merkle_height > 0)) {
+            bc_mempool_confirm(&view, pProtoVal->merkle_height);
+        } else {
+            //headersにないblockのtxは未承認として扱う
+            bc_mempool_result_t ret = bc_mempool_add(&view, b_watch);
+            if ((ret == BC_MEMPOOL_ADDED) || (ret == BC_MEMPOOL_REPLACED)) {
+                bc_mempool_print();
+                //祖先は先に届いて捨てているので取り直す
+                if (b_watch && !request_parents(pProtoVal, &view)) {
+                    return false;
+                }
+            }
+        }
+        if (bc_bloom_tx(&pProtoVal->bloom, &view, b_watch, b_block) && !send_filterload(pProtoVal)) {
+            //BLOOM_UPDATE_ALLでpeer側のfilterが飽和したが、送れなかった
+            return false;
+        }
+    } else if (sz == (ssize_t)Len) {
+        LOGE("fail: invalid tx\n");
+    }
     Len -= sz;
 
     return Len == 0;
 }
 
 
+/** merkleblockで一致したtxか
+ *
+ * 一致した場合はmerkleblockの待ちtxから外す。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @param[in]       pView       解析済みtx
+ * @retval  true    merkleblockで一致したtx
+ */
+static bool recv_tx_merkle(bc_protoval_t *pProtoVal, const bc_txview_t *pView)
+{
+    uint8_t txid[BTC_SZ_TXID];
+
+    bc_txview_txid(pView, txid);
+
+    for (int lp = 0; lp < pProtoVal->merkle_cnt; lp++) {
+        if (MEMCMP(pProtoVal->merkle_txid[lp], txid, BTC_SZ_TXID) == 0) {
+            LOGD("tx in block(height=%" PRIu32 "): ", pProtoVal->merkle_height);
+            TXIDD(txid);
+            pProtoVal->merkle_cnt--;
+            MEMCPY(pProtoVal->merkle_txid[lp], pProtoVal->merkle_txid[pProtoVal->merkle_cnt], BTC_SZ_TXID);
+            return true;
+        }
+    }
+    return false;
+}
+
+
 /** 受信データ解析(headers)
  *
  * @param[in]       pProtoVal   protocol value
@@ -1008,60 +1470,106 @@ static bool recv_tx(bc_protoval_t *pProtoVal, uint32_t Len)
 static bool recv_headers(bc_protoval_t *pProtoVal, uint32_t Len)
 {
     uint64_t count;
+    uint8_t *p_headers = NULL;
+    uint8_t next_hash[BTC_SZ_HASH256];
 
     Len -= get_varint(pProtoVal->socket, &count);
-    if (count == 0) {
-        //countが0だった場合はここで終わり
+    if ((count > BC_PRESYNC_HEADERS_MAX) || (Len != count * BC_PRESYNC_REC_SZ)) {
+        LOGE("fail: invalid headers(count=%" PRIu64 ", len=%" PRIu32 ")\n", count, Len);
+        return false;
+    }
+    if (count > 0) {
+        p_headers = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len);
+        if (p_headers == NULL) {
+            return recv_nomem(pProtoVal, Len);
+        }
+        ssize_t sz = bc_network_read(pProtoVal->socket, p_headers, Len);
+        if (sz != (ssize_t)Len) {
+            LOGD("fail: headers bc_network_read size(%ld)\n", sz);
+            return false;
+        }
+        print_headers((const struct headers_t *)(p_headers + (count - 1) * BC_PRESYNC_REC_SZ));
+    }
+    if (pProtoVal->hdrsync.seg >= 0) {
+        //checkpoint区間
+        bc_hdrsync_ret_t ret = bc_hdrsync_headers(&pProtoVal->hdrsync, next_hash, p_headers, (uint32_t)count);
+        switch (ret) {
+        case BC_HDRSYNC_NEXT:
+            return send_getheaders(pProtoVal, next_hash, 1, pProtoVal->hdrsync.stop_hash);
+        case BC_HDRSYNC_DONE:
+            return start_getheaders(pProtoVal);
+        default:
+            return false;
+        }
+    }
 
+    if (pProtoVal->synced && (pProtoVal->presync.state == BC_PRESYNC_STATE_IDLE) && (count > 0)) {
+        //新block通知(BIP130)
         uint32_t height;
-        uint8_t bhash[BTC_SZ_HASH256];
-        bc_flash_get_last_bhash(&height, bhash);
-        if (height != pProtoVal->height) {
-            //最後にheadersで受信したblock hashを保存する
-            bc_flash_save_last_bhash(pProtoVal->height, pProtoVal->last_headers_bhash);
+        if (pProtoVal->announce_usec == 0) {
+            pProtoVal->announce_usec = get_current_usec();
+            pProtoVal->announce_headers = true;
         }
+        if (!bc_headers_find(&height, p_headers + BC_HEADERS_OFFSET_PREV)) {
+            //間が抜けている
+            return request_announced(pProtoVal, true);
+        }
+    }
 
-        //全headersが終わったので、mempoolを受け付ける
-        send_filterload(pProtoVal, kPubKeyHash, sizeof(kPubKeyHash));
-        send_mempool(pProtoVal);
+    bc_presync_ret_t ret = bc_presync_headers(&pProtoVal->presync, next_hash, p_headers, (uint32_t)count);
+
+    pProtoVal->height = bc_headers_tip(pProtoVal->last_headers_bhash, NULL);
+    switch (ret) {
+    case BC_PRESYNC_NEXT:
+        //続きを要求する
+        LOGD("*** Height=%" PRIu32 "\n", pProtoVal->height);
+        send_getheaders(pProtoVal, next_hash, 1, NULL);
+        break;
+    case BC_PRESYNC_END:
+        {
+            //全headersが終わった
+            if (pProtoVal->synced) {
+                announce_processed(pProtoVal);
+                LOGD("*** Height=%" PRIu32 "\n", pProtoVal->height);
+                if (pProtoVal->cfilter) {
+                    bc_cfilter_extend(&pProtoVal->cfilter_val, pProtoVal->height);
+                    bc_rescan_extend(pProtoVal->height);
+                    return request_cfheaders(pProtoVal);
+                }
+                bc_fblock_extend(&pProtoVal->fblock, pProtoVal->height);
+                return request_fblock(pProtoVal);
+            }
 
-        pProtoVal->synced = true;
+            //新blockはheadersで通知してもらう
+            send_sendheaders(pProtoVal);
 
-        LOGD("*** SYNCED ***\n");
-        LOGD("  Height=%" PRIu32 "\n", pProtoVal->height);
-        LOGD("  blockhash : ");
-        TXIDD(pProtoVal->last_headers_bhash);
+            pProtoVal->synced = true;
 
-        return true;
-    }
+            LOGD("*** SYNCED ***\n");
+            LOGD("  Height=%" PRIu32 "\n", pProtoVal->height);
+            LOGD("  blockhash : ");
+            TXIDD(pProtoVal->last_headers_bhash);
 
+            if (M_USE_CFILTER(pProtoVal->services)) {
+                //前回からのblockをcompact filterで照合する
+                return start_cfilter(pProtoVal);
+            }
 
-    struct headers_t headers;
-    bool ret = true;
-    while (count--) {
-        ssize_t sz = bc_network_read(pProtoVal->socket, &headers, sizeof(headers));
-        if (sz == sizeof(headers)) {
-            if (MEMCMP(btc_util_get_genesis_block(BC_GENESIS), headers.prev_block, BTC_SZ_HASH256) == 0) {
-                LOGD("genesis block!!\n");
-                pProtoVal->height = 0;
+            //mempoolを受け付ける
+            if (!send_filterload(pProtoVal) || !send_mempool(pProtoVal)) {
+                return false;
             }
-            pProtoVal->height++;
-            LOGD("*** Height=%" PRIu32 "\n", pProtoVal->height);
-            print_headers(&headers);
-        } else {
-            LOGD("fail: headers bc_network_read size(%ld)\n", sz);
-            ret = false;
-            break;
-        }
-    }
 
-    if (ret) {
-        //続きを要求する
-        btc_util_hash256(pProtoVal->last_headers_bhash, (const uint8_t *)&headers, sizeof(struct headers_t) - sizeof(uint8_t));    //txn_countを除く
-        send_getheaders(pProtoVal, pProtoVal->last_headers_bhash);
+            //前回からのblockをfilterloadで絞って取得する
+            start_fblock(pProtoVal);
+            return request_fblock(pProtoVal);
+        }
+        break;
+    default:
+        return false;
     }
 
-    return ret;
+    return true;
 }
 
 
@@ -1073,44 +1581,104 @@ static bool recv_headers(bc_protoval_t *pProtoVal, uint32_t Len)
  */
 static bool recv_merkleblock(bc_protoval_t *pProtoVal, uint32_t Len)
 {
-    return recv_unknown(pProtoVal, Len);
-
-#if 0
-    int ret;
+    bool ret = false;
+    struct headers_t headers;
+    uint32_t total_tx;
+    uint64_t hash_count;
+    uint64_t flag_bytes;
+    uint8_t *p_hashes = NULL;
+    uint8_t *p_flags = NULL;
+    uint8_t bhash[BTC_SZ_HASH256];
+    uint8_t root[BTC_SZ_HASH256];
+    uint32_t matched;
+
+    if (Len < BC_HEADERS_SZ + sizeof(uint32_t)) {
+        LOGE("fail: invalid merkleblock(len=%" PRIu32 ")\n", Len);
+        return false;
+    }
+    Len -= bc_network_read(pProtoVal->socket, &headers, BC_HEADERS_SZ);
+    Len -= get32(pProtoVal->socket, &total_tx);
+    Len -= get_varint(pProtoVal->socket, &hash_count);
+    if ((hash_count > BC_MERKLE_TX_MAX) || (Len < hash_count * BTC_SZ_HASH256)) {
+        LOGE("fail: invalid hash count(%" PRIu64 ")\n", hash_count);
+        return false;
+    }
+    p_hashes = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, hash_count * BTC_SZ_HASH256 + 1);
+    if (p_hashes == NULL) {
+        return recv_nomem(pProtoVal, Len);
+    }
+    Len -= bc_network_read(pProtoVal->socket, p_hashes, hash_count * BTC_SZ_HASH256);
+    Len -= get_varint(pProtoVal->socket, &flag_bytes);
+    if (Len != flag_bytes) {
+        LOGE("fail: invalid flag bytes(%" PRIu64 ")\n", flag_bytes);
+        goto LABEL_EXIT;
+    }
+    p_flags = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, flag_bytes + 1);
+    if (p_flags == NULL) {
+        return recv_nomem(pProtoVal, Len);
+    }
+    Len -= bc_network_read(pProtoVal->socket, p_flags, flag_bytes);
+    if (Len != 0) {
+        goto LABEL_EXIT;
+    }
 
-    //LOGD("  [merkleblock]\n");
+    btc_util_hash256(bhash, (const uint8_t *)&headers, BC_HEADERS_SZ);
+    LOGD("merkleblock: ");
+    TXIDD(bhash);
 
-    //解析の必要あり？
-    //今のところ感じていないので、ここで直接見てみる。
-    //print_headers((const struct headers_t *)pData);
+    //前のmerkleblockのtxを全部受け取っていなくても、ここで切り替える
+    if (pProtoVal->merkle_cnt > 0) {
+        LOGD("  %" PRIu32 " tx not received\n", (uint32_t)pProtoVal->merkle_cnt);
+    }
+    pProtoVal->merkle_cnt = 0;
 
-    if (mProto.length > *pLen) {
-        //まだデータが来る
-        LOGD("m");
-        mProto.length -= *pLen;
-        *pLen = 0;
-        ret = BC_PROTO_CONT;
-        //LOGD("   rest: %d\n", mProto.length);
+    if (!bc_merkle_verify(root, (uint8_t *)pProtoVal->merkle_txid, &matched, SZ_MERKLE_MATCH,
+                total_tx, p_hashes, (uint32_t)hash_count, p_flags, (uint32_t)flag_bytes)) {
+        goto LABEL_EXIT;
     }
-    else {
-        //もうデータは来ない
-        LOGD("M");
-        *pLen -= mProto.length;
-        ret = BC_PROTO_FIN;
-        //LOGD("   rest: 0\n");
-    }
-
-    if (pProtoVal->merkle_cnt) {
-        pProtoVal->merkle_cnt--;
-        //LOGD("  rest merkleblock: %d\n", pProtoVal->merkle_cnt);
-        if (pProtoVal->merkle_cnt == 0) {
-            //全部返ってきた --> 次のgetheaders
-            send_getheaders(pProtoVal, pProtoVal->last_headers_bhash);
+    if (MEMCMP(root, headers.merkle_root, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: merkle root mismatch\n");
+        goto LABEL_EXIT;
+    }
+    bool b_req = bc_fblock_received(&pProtoVal->fblock, &pProtoVal->merkle_height, bhash, matched);
+    if (!b_req && !bc_headers_find(&pProtoVal->merkle_height, bhash)) {
+        //headersにないblock
+        pProtoVal->merkle_height = 0;
+    }
+    MEMCPY(pProtoVal->merkle_bhash, bhash, BTC_SZ_HASH256);
+    LOGD("  height=%" PRIu32 ", tx=%" PRIu32 ", matched=%" PRIu32 "\n", pProtoVal->merkle_height, total_tx, matched);
+    bc_bloom_block(&pProtoVal->bloom, total_tx);
+    if (!b_req) {
+        //新blockごとに集計を出す
+        bc_bloom_print(&pProtoVal->bloom);
+        bc_fee_print();
+    }
+    if (matched > SZ_MERKLE_MATCH) {
+        LOGD("  track first %d tx\n", SZ_MERKLE_MATCH);
+        matched = SZ_MERKLE_MATCH;
+    }
+    pProtoVal->merkle_cnt = (uint16_t)matched;
+    ret = true;
+
+    if (b_req) {
+        //Block Heightの順に完了させる
+        uint32_t height;
+        uint32_t num;
+        bool b_done = false;
+        while (bc_fblock_pop(&pProtoVal->fblock, &height, bhash, &num)) {
+            if (num > 0) {
+                LOGD("block %" PRIu32 ": %" PRIu32 " tx\n", height, num);
+            }
+            b_done = true;
         }
+        if (b_done) {
+            bc_flash_save_last_bhash(height, bhash);
+        }
+        ret = request_fblock(pProtoVal);
     }
 
+LABEL_EXIT:
     return ret;
-#endif
 }
 
 
@@ -1126,6 +1694,7 @@ static bool recv_feefilter(bc_protoval_t *pProtoVal, uint32_t Len)
     uint64_t feerate;
     Len -= get64(pProtoVal->socket, &feerate);
     LOGD("   feerate: %" PRIu64 "\n", feerate);
+    bc_fee_feefilter(feerate);
 
     return Len == 0;
 }
@@ -1179,37 +1748,680 @@ static bool recv_sendcmpct(bc_protoval_t *pProtoVal, uint32_t Len)
 // }
 
 
-/** 受信データ解析(未処理)
+/** 受信データ解析(cfcheckpt)
  *
  * @param[in]       pProtoVal   protocol value
  * @param[in]       Len         パケット長
  * @retval      true    OK
+ * @note        BIP157
  */
-static bool recv_unknown(bc_protoval_t *pProtoVal, uint32_t Len)
+static bool recv_cfcheckpt(bc_protoval_t *pProtoVal, uint32_t Len)
 {
-    LOGD("bc_network_read data: ");
-    for (uint32_t lp = 0; lp < Len; lp++) {
-        uint8_t c;
-        bc_network_read(pProtoVal->socket, &c, 1);
-        LOGD2("%02x", c);
+    struct cfcheckpt hdr;
+    uint64_t count;
+
+    if (Len < sizeof(hdr)) {
+        return false;
     }
-    LOGD2("\n\n");
-    return true;
+    Len -= bc_network_read(pProtoVal->socket, &hdr, sizeof(hdr));
+    Len -= get_varint(pProtoVal->socket, &count);
+    if ((hdr.filter_type != BC_GCS_BASIC) || (Len != count * BTC_SZ_HASH256)) {
+        LOGE("fail: invalid cfcheckpt\n");
+        return false;
+    }
+    uint8_t *p_headers = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len + 1);
+    if (p_headers == NULL) {
+        return recv_nomem(pProtoVal, Len);
+    }
+    ssize_t sz = bc_network_read(pProtoVal->socket, p_headers, Len);
+    if (sz != (ssize_t)Len) {
+        return false;
+    }
+    LOGD("cfcheckpt: %" PRIu64 "\n", count);
+    if (pProtoVal->helper) {
+        //mainのcfcheckptと照合する
+        if (!bc_cfilter_crosscheck(hdr.stop_hash, p_headers, (uint32_t)count)) {
+            return false;
+        }
+        return request_rescan(pProtoVal);
+    }
+    if (!bc_cfilter_checkpt(&pProtoVal->cfilter_val, hdr.stop_hash, p_headers, (uint32_t)count)) {
+        return false;
+    }
+    pProtoVal->cfilter_val.checkpt_wait = get_current_usec();
+    return check_checkpt(pProtoVal);
 }
 
 
-/** Bitcoinパケット送信(version)
+/** 受信データ解析(cfheaders)
  *
  * @param[in]       pProtoVal   protocol value
- * @return          送信結果(0..OK)
+ * @param[in]       Len         パケット長
+ * @retval      true    OK
+ * @note        BIP157
+ */
+static bool recv_cfheaders(bc_protoval_t *pProtoVal, uint32_t Len)
+{
+    struct cheaders_t hdr;
+    uint64_t count;
+    uint32_t start;
+    uint32_t num;
+
+    if (Len < sizeof(hdr)) {
+        return false;
+    }
+    Len -= bc_network_read(pProtoVal->socket, &hdr, sizeof(hdr));
+    Len -= get_varint(pProtoVal->socket, &count);
+    if ((hdr.filter_type != BC_GCS_BASIC) || (count > BC_CFILTER_BATCH) || (Len != count * BTC_SZ_HASH256)) {
+        LOGE("fail: invalid cfheaders\n");
+        return false;
+    }
+    uint8_t *p_hashes = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len + 1);
+    uint8_t *p_fheaders = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len + 1);
+    if ((p_hashes == NULL) || (p_fheaders == NULL)) {
+        return recv_nomem(pProtoVal, Len);
+    }
+    ssize_t sz = bc_network_read(pProtoVal->socket, p_hashes, Len);
+    bool ret = (sz == (ssize_t)Len) &&
+            bc_cfilter_headers(&pProtoVal->cfilter_val, &start, &num, p_fheaders,
+                    hdr.stop_hash, hdr.prev_filter_headers, p_hashes, (uint32_t)count) &&
+            ((num == 0) || bc_rescan_hashes(start,
+                    p_hashes + (count - num) * BTC_SZ_HASH256, p_fheaders + (count - num) * BTC_SZ_HASH256, num));
+    if (!ret) {
+        return false;
+    }
+
+    //filterの取得と次のcfheadersを並行させる
+    return request_rescan(pProtoVal) && request_cfheaders(pProtoVal);
+}
+
+
+/** 受信データ解析(cfilter)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       Len         パケット長
+ * @retval      true    OK
+ * @note        BIP157
+ */
+static bool recv_cfilter(bc_protoval_t *pProtoVal, uint32_t Len)
+{
+    struct cfilter_t hdr;
+    uint64_t count;
+
+    if (Len < sizeof(hdr)) {
+        return false;
+    }
+    Len -= bc_network_read(pProtoVal->socket, &hdr, sizeof(hdr));
+    //NumFilterBytes: filter hashはこの後ろの部分で計算する
+    Len -= get_varint(pProtoVal->socket, &count);
+    if ((hdr.filter_type != BC_GCS_BASIC) || (count > CFILTER_SZ_MAX) || (Len != count)) {
+        LOGE("fail: invalid cfilter\n");
+        return false;
+    }
+    uint8_t *p_filter = (uint8_t *)bc_arena_alloc(&pProtoVal->arena, Len + 1);
+    if (p_filter == NULL) {
+        return recv_nomem(pProtoVal, Len);
+    }
+    ssize_t sz = bc_network_read(pProtoVal->socket, p_filter, Len);
+    bool ret = (sz == (ssize_t)Len) &&
+            bc_rescan_filter(&pProtoVal->rescan, hdr.block_hash, p_filter, Len);
+    if (!ret) {
+        return false;
+    }
+
+    //照合はbc_rescanの照合threadで行う
+    return request_rescan(pProtoVal);
+}
+
+
+/** 受信データ解析(未処理)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       Len         パケット長
+ * @retval      true    OK
+ */
+static bool recv_unknown(bc_protoval_t *pProtoVal, uint32_t Len)
+{
+    LOGD("bc_network_read data: ");
+    for (uint32_t lp = 0; lp < Len; lp++) {
+        uint8_t c;
+        bc_network_read(pProtoVal->socket, &c, 1);
+        LOGD2("%02x", c);
+    }
+    LOGD2("\n\n");
+    return true;
+}
+
+
+/** 受信データ解析(確保失敗)
+ *
+ * 次のメッセージから読めるよう、残りを読み捨てる。
+ * 要求したものは受信待ちtimeoutで要求し直す。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       Len         残りのパケット長
+ * @retval      true    読み捨てた
+ */
+static bool recv_nomem(bc_protoval_t *pProtoVal, uint32_t Len)
+{
+    uint8_t buf[256];
+
+    LOGE("fail: arena(%" PRIu32 ")\n", Len);
+    while (Len > 0) {
+        ssize_t sz = bc_network_read(pProtoVal->socket, buf, (Len < sizeof(buf)) ? Len : sizeof(buf));
+        if (sz <= 0) {
+            return false;
+        }
+        Len -= (uint32_t)sz;
+    }
+    return true;
+}
+
+
+/** 接続開始
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ */
+static void start_sub(bc_protoval_t *pProtoVal)
+{
+    pProtoVal->height = bc_headers_tip(pProtoVal->last_headers_bhash, NULL);
+    bc_presync_reset(&pProtoVal->presync);
+    bc_hdrsync_init(&pProtoVal->hdrsync);
+    pProtoVal->synced = false;
+    pProtoVal->merkle_cnt = 0;
+    pProtoVal->announce_usec = 0;
+    MEMSET(&pProtoVal->fblock, 0, sizeof(pProtoVal->fblock));
+    pProtoVal->cfilter = false;
+    pProtoVal->txrelay = false;
+    bc_cfilter_free(&pProtoVal->cfilter_val);
+    bc_rescan_release(&pProtoVal->rescan);
+    pProtoVal->cfstore_next = 1;
+    pProtoVal->cfstore_end = 0;
+    MEMSET(&pProtoVal->bloom, 0, sizeof(pProtoVal->bloom));
+    pProtoVal->txreq_peer = bc_txreq_peer_add();
+
+    pProtoVal->loop = send_version(pProtoVal);
+}
+
+
+/** getheaders開始
+ *
+ * checkpoint区間が残っていればその区間、無ければtipからのlocatorで要求する。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool start_getheaders(bc_protoval_t *pProtoVal)
+{
+    uint8_t locator[BC_HEADERS_LOCATOR_MAX * BTC_SZ_HASH256];
+
+    if (bc_hdrsync_assign(&pProtoVal->hdrsync, locator)) {
+        return send_getheaders(pProtoVal, locator, 1, pProtoVal->hdrsync.stop_hash);
+    }
+    if (pProtoVal->helper) {
+        if (M_USE_CFILTER(pProtoVal->services) && !bc_rescan_done()) {
+            //rescan中はcompact filter取得に回る
+            LOGD("helper: rescan\n");
+            pProtoVal->cfilter = true;
+            return request_rescan(pProtoVal);
+        }
+        //区間取得用の接続は終わる
+        LOGD("helper done\n");
+        pProtoVal->loop = false;
+        return true;
+    }
+
+    pProtoVal->height = bc_headers_tip(pProtoVal->last_headers_bhash, NULL);
+    int num = bc_headers_locator(locator);
+    return send_getheaders(pProtoVal, locator, num, NULL);
+}
+
+
+/** 新block通知に対するgetheaders
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @param[in]       bHeaders    true:headersで通知された
+ * @retval      true    OK
+ */
+static bool request_announced(bc_protoval_t *pProtoVal, bool bHeaders)
+{
+    uint8_t locator[BC_HEADERS_LOCATOR_MAX * BTC_SZ_HASH256];
+
+    if (pProtoVal->announce_usec == 0) {
+        pProtoVal->announce_usec = get_current_usec();
+        pProtoVal->announce_headers = bHeaders;
+    }
+    int num = bc_headers_locator(locator);
+    return send_getheaders(pProtoVal, locator, num, NULL);
+}
+
+
+/** 新block通知から保存までの時間を記録
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ */
+static void announce_processed(bc_protoval_t *pProtoVal)
+{
+    if (pProtoVal->announce_usec == 0) {
+        return;
+    }
+
+    uint64_t latency = get_current_usec() - pProtoVal->announce_usec;
+    int idx = (pProtoVal->announce_headers) ? 1 : 0;
+    mAnnounceLatency[idx].count++;
+    mAnnounceLatency[idx].sum += latency;
+    if (mAnnounceLatency[idx].max < latency) {
+        mAnnounceLatency[idx].max = latency;
+    }
+    pProtoVal->announce_usec = 0;
+
+    LOGD("announce latency(%s): %" PRIu64 "us (count=%" PRIu32 ", avg=%" PRIu64 "us, max=%" PRIu64 "us)\n",
+            (idx) ? "headers" : "inv",
+            latency,
+            mAnnounceLatency[idx].count,
+            mAnnounceLatency[idx].sum / mAnnounceLatency[idx].count,
+            mAnnounceLatency[idx].max);
+#ifdef ALLOCATOR
+    bc_alloc_print();
+#endif
+}
+
+
+/** block照合の開始Block Height
+ *
+ * 前回完了したblockの次。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @return      Block Height
+ */
+static uint32_t get_scan_start(bc_protoval_t *pProtoVal)
+{
+    uint32_t height;
+    uint8_t bhash[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+
+    bc_flash_get_last_bhash(&height, bhash);
+    if (height > pProtoVal->height) {
+        height = pProtoVal->height;
+    } else if (bc_headers_get_hash(hash, height) && (MEMCMP(hash, bhash, BTC_SZ_HASH256) != 0)) {
+        //前回完了したblockがreorgで外れた
+        LOGD("reorg below last block(%" PRIu32 ")\n", height);
+        height = (height > FBLOCK_REORG_DEPTH) ? height - FBLOCK_REORG_DEPTH : 0;
+    }
+    return height + 1;
+}
+
+
+/** filtered block取得開始
+ *
+ * 前回完了したblockの次からtipまで。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ */
+static void start_fblock(bc_protoval_t *pProtoVal)
+{
+    bc_fblock_start(&pProtoVal->fblock, get_scan_start(pProtoVal), pProtoVal->height, FBLOCK_WINDOW);
+}
+
+
+/** filtered block要求
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool request_fblock(bc_protoval_t *pProtoVal)
+{
+    uint8_t hashes[BC_FBLOCK_WINDOW_MAX * BTC_SZ_HASH256];
+
+    int num = bc_fblock_request(&pProtoVal->fblock, hashes, get_current_usec());
+    if (num == 0) {
+        return true;
+    }
+    return send_getdata_fblock(pProtoVal, hashes, num);
+}
+
+
+/** filtered block再要求
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ * @retval      false   要求し直しても受信できない(接続をやめる)
+ */
+static bool retry_fblock(bc_protoval_t *pProtoVal)
+{
+    uint8_t hashes[BC_FBLOCK_WINDOW_MAX * BTC_SZ_HASH256];
+
+    int num = bc_fblock_retry(&pProtoVal->fblock, hashes, get_current_usec());
+    if (num < 0) {
+        return false;
+    }
+    if (num == 0) {
+        return true;
+    }
+    return send_getdata_fblock(pProtoVal, hashes, num);
+}
+
+
+/** compact filter取得開始(BIP157)
+ *
+ * 前回完了したblockの次からtipまで。
+ * filter headerはこのpeerから、filterはhelperとも分担して取得する。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool start_cfilter(bc_protoval_t *pProtoVal)
+{
+    uint32_t from = get_scan_start(pProtoVal);
+    int num;
+
+    if (!bc_cfilter_genesis_check()) {
+        return false;
+    }
+    pProtoVal->cfilter = true;
+    pProtoVal->txrelay = M_CFILTER_TXRELAY;
+    bc_cfilter_start(&pProtoVal->cfilter_val, from, pProtoVal->height);
+    utl_buf_t *p_scripts = bc_watch_scripts(&num);
+    if (p_scripts == NULL) {
+        return false;
+    }
+    bool ret = bc_rescan_start(from, pProtoVal->height, p_scripts, num);
+    FREE(p_scripts);
+    if (!ret) {
+        return false;
+    }
+    bc_network_start_helpers();
+    return send_getcfcheckpt(pProtoVal, pProtoVal->last_headers_bhash);
+}
+
+
+/** 保存済みcompact filterの利用開始
+ *
+ * 照合開始位置から保存済みの分は、filter headerも含めて取得しない。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ */
+static void start_cfstore(bc_protoval_t *pProtoVal)
+{
+    uint32_t base;
+    uint32_t tip;
+    uint32_t from = pProtoVal->cfilter_val.filter_start;
+    uint8_t header[BTC_SZ_HASH256];
+
+    if (!bc_cfstore_range(&base, &tip) || (from < base) || (tip < from)) {
+        return;
+    }
+    if (tip > pProtoVal->cfilter_val.end) {
+        tip = pProtoVal->cfilter_val.end;
+    }
+    if (!bc_cfstore_get_header(header, tip)) {
+        return;
+    }
+    bc_cfilter_skip(&pProtoVal->cfilter_val, tip, header);
+    pProtoVal->cfstore_next = from;
+    pProtoVal->cfstore_end = tip;
+    LOGD("stored filters: %" PRIu32 " - %" PRIu32 "\n", from, tip);
+}
+
+
+/** 保存済みcompact filterをrescanに渡す
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool feed_cfstore(bc_protoval_t *pProtoVal)
+{
+    uint32_t room = bc_rescan_room();
+
+    while ((room > 0) && (pProtoVal->cfstore_next <= pProtoVal->cfstore_end)) {
+        uint8_t bhash[BTC_SZ_HASH256];
+        uint8_t header[BTC_SZ_HASH256];
+        size_t len;
+        uint8_t *p_filter = bc_cfstore_get(pProtoVal->cfstore_next, bhash, header, &len);
+        if (p_filter == NULL) {
+            //破棄した分は再接続後にpeerから取得する
+            LOGE("fail: stored filter(%" PRIu32 ")\n", pProtoVal->cfstore_next);
+            return false;
+        }
+        if (!bc_rescan_local(pProtoVal->cfstore_next, bhash, header, p_filter, len)) {
+            return false;
+        }
+        pProtoVal->cfstore_next++;
+        room--;
+    }
+    return true;
+}
+
+
+/** compact filter header要求(getcfheaders)
+ *
+ * 保存済みの分を渡し終えてから要求する。
+ * rescanに空きがあれば、filterの受信を待たずに次のbatchを要求する。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool request_cfheaders(bc_protoval_t *pProtoVal)
+{
+    uint32_t start;
+    uint8_t stop_hash[BTC_SZ_HASH256];
+
+    if (!feed_cfstore(pProtoVal)) {
+        return false;
+    }
+    if (pProtoVal->cfstore_next <= pProtoVal->cfstore_end) {
+        return true;
+    }
+    if (bc_rescan_room() < BC_CFILTER_BATCH) {
+        return true;
+    }
+    if (!bc_cfilter_next(&pProtoVal->cfilter_val, &start, stop_hash)) {
+        return true;
+    }
+    return send_getcfheaders(pProtoVal, kCMD_GETCFHEADERS, start, stop_hash);
+}
+
+
+/** compact filter要求(getcfilters)
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool request_rescan(bc_protoval_t *pProtoVal)
+{
+    uint32_t start;
+    uint8_t stop_hash[BTC_SZ_HASH256];
+
+    if (!crosscheck_checkpt(pProtoVal)) {
+        return false;
+    }
+    while (bc_rescan_assign(&pProtoVal->rescan, &start, stop_hash, get_current_usec())) {
+        if (!send_getcfheaders(pProtoVal, kCMD_GETCFILTERS, start, stop_hash)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** cfcheckptの照合結果待ち(main)
+ *
+ * helperのcfcheckptと一致してから、保存済みfilterの確認とfilter header取得を始める。
+ * 異なる場合は接続を切り、別peerからやり直す。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool check_checkpt(bc_protoval_t *pProtoVal)
+{
+    bc_cfilter_t *p_cf = &pProtoVal->cfilter_val;
+
+    if ((p_cf->p_checkpt == NULL) || p_cf->checkpt_ok) {
+        return true;
+    }
+    switch (bc_cfilter_crosscheck_state()) {
+    case BC_CFILTER_CP_AGREED:
+        break;
+    case BC_CFILTER_CP_CONFLICT:
+        LOGE("fail: cfcheckpt differs from other peer\n");
+        return false;
+    default:
+        if (get_current_usec() - p_cf->checkpt_wait < CFCHECKPT_WAIT_USEC) {
+            return true;
+        }
+        p_cf->checkpt_wait = get_current_usec();
+        if (bc_network_start_helpers()) {
+            //応答が無ければhelperをつなぎ直して待つ
+            LOGD("cfcheckpt: waiting for other peer\n");
+            return true;
+        }
+        LOGE("cfcheckpt: not cross-checked(HDRSYNC_PEERS=0)\n");
+        break;
+    }
+
+    p_cf->checkpt_ok = true;
+    bc_cfstore_verify(p_cf->p_checkpt, p_cf->checkpt_num);
+    start_cfstore(pProtoVal);
+    return request_cfheaders(pProtoVal);
+}
+
+
+/** cfcheckptの照合用要求(helper)
+ *
+ * mainのcfcheckptが照合待ちなら、同じstop_hashで要求する。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool crosscheck_checkpt(bc_protoval_t *pProtoVal)
+{
+    uint8_t stop_hash[BTC_SZ_HASH256];
+    uint32_t gen;
+
+    if (!pProtoVal->helper || !bc_cfilter_crosscheck_stop(stop_hash, &gen) ||
+            (gen == pProtoVal->cfilter_val.checkpt_gen)) {
+        return true;
+    }
+    pProtoVal->cfilter_val.checkpt_gen = gen;
+    return send_getcfcheckpt(pProtoVal, stop_hash);
+}
+
+
+/** FNAME_WATCH再読込み
+ *
+ * 新しい要素だけbc_add_watch()する(filteraddまたはfilterload)。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool reload_watch(bc_protoval_t *pProtoVal)
+{
+    load_watch_t arg;
+
+    mReloadWatch = 0;
+    arg.p_protoval = pProtoVal;
+    arg.ok = true;
+    bc_watch_load(FNAME_WATCH, load_watch, &arg);
+    return arg.ok;
+}
+
+
+/** FNAME_WATCHの1要素(bc_watch_add_t)
+ *
+ * @retval  true    追加した
+ */
+static bool load_watch(void *pArg, bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    load_watch_t *p_arg = (load_watch_t *)pArg;
+
+    if (!p_arg->ok || bc_watch_find(Type, pData, Len)) {
+        return false;
+    }
+    p_arg->ok = bc_add_watch(p_arg->p_protoval, Type, pData, Len);
+    return true;
+}
+
+
+/** timeoutしたtx要求の引き取り
+ *
+ * 他の接続で応答が無かったtxのうち、この接続で通知されていたものを要求する。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @retval      true    OK
+ */
+static bool request_txreq(bc_protoval_t *pProtoVal)
+{
+    uint8_t txids[TXREQ_POLL_NUM * BTC_SZ_TXID];
+    struct inv_t invs[TXREQ_POLL_NUM];
+    int num;
+
+    do {
+        num = bc_txreq_poll(pProtoVal->txreq_peer, get_current_usec(), txids, TXREQ_POLL_NUM);
+        if (num == 0) {
+            break;
+        }
+        for (int lp = 0; lp < num; lp++) {
+            invs[lp].type = INV_MSG_TX;
+            MEMCPY(invs[lp].hash, txids + lp * BTC_SZ_TXID, BTC_SZ_TXID);
+        }
+        LOGD("getdata tx x %d (retry)\n", num);
+        if (!send_getdata_list(pProtoVal, invs, num)) {
+            return false;
+        }
+    } while (num == TXREQ_POLL_NUM);
+    return true;
+}
+
+
+/** 監視対象txの入力元txを要求
+ *
+ * feeは入力元のtxが全てmempoolにある場合だけわかる。
+ * 入力元は監視対象ではないので先に届いても捨てていて、子が入ってからなら祖先として入る。
+ * 承認済みのものはnotfoundになる。
+ *
+ * @param[in,out]   pProtoVal   protocol value
+ * @param[in]       pView       mempoolに入れた監視対象tx
+ * @retval      true    OK
+ */
+static bool request_parents(bc_protoval_t *pProtoVal, const bc_txview_t *pView)
+{
+    uint8_t txids[PARENT_REQ_MAX * BTC_SZ_TXID];
+    struct inv_t invs[PARENT_REQ_MAX];
+    int req_num = 0;
+    uint64_t now = get_current_usec();
+
+    int num = bc_mempool_missing(pView, txids, PARENT_REQ_MAX);
+    for (int lp = 0; lp < num; lp++) {
+        const uint8_t *p_txid = txids + lp * BTC_SZ_TXID;
+        if (!bc_txreq_announce(pProtoVal->txreq_peer, p_txid, now)) {
+            continue;
+        }
+        invs[req_num].type = INV_MSG_TX;
+        MEMCPY(invs[req_num].hash, p_txid, BTC_SZ_TXID);
+        req_num++;
+    }
+    if (req_num == 0) {
+        return true;
+    }
+    LOGD("getdata tx x %d (parent)\n", req_num);
+    return send_getdata_list(pProtoVal, invs, req_num);
+}
+
+
+/** Bitcoinパケット送信(version)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @return          送信結果(0..OK)
  */
 static bool send_version(bc_protoval_t *pProtoVal)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_VERSION, 100 + STRLEN(BC_VER_UA));
+    if (pProto == NULL) {
+        return false;
+    }
     uint8_t *p = pProto->payload;
 
-    set_header(pProto, kCMD_VERSION);
-
     //version
     bc_misc_add(&p, BC_PROTOCOL_VERSION, sizeof(int32_t));
     //services
@@ -1233,12 +2445,13 @@ static bool send_version(bc_protoval_t *pProtoVal)
     //start_height(0固定)
     bc_misc_add(&p, 0, sizeof(int32_t));
     //relay
-    bc_misc_add(&p, 0, 1);
+    //  CFILTER_TXRELAYならcfilter照合でも全txの通知を受ける(filterloadする場合はそれまでの通知を読み捨てる)
+    bc_misc_add(&p, (M_CFILTER_TXRELAY && !pProtoVal->helper) ? 1 : 0, 1);
 
     //payload length
     pProto->length = p - pProto->payload;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
 
@@ -1249,12 +2462,15 @@ static bool send_version(bc_protoval_t *pProtoVal)
  */
 static bool send_verack(bc_protoval_t *pProtoVal)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_VERACK, 0);
+    if (pProto == NULL) {
+        return false;
+    }
 
-    set_header(pProto, kCMD_VERACK);
     pProto->length = 0;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
 
@@ -1266,10 +2482,13 @@ static bool send_verack(bc_protoval_t *pProtoVal)
  */
 static bool send_ping(bc_protoval_t *pProtoVal)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_PING, sizeof(uint64_t));
+    if (pProto == NULL) {
+        return false;
+    }
     uint8_t *p = pProto->payload;
 
-    set_header(pProto, kCMD_PING);
     //nonce
     pProtoVal->nonce_ping = rand();
     pProtoVal->nonce_ping <<= 32;
@@ -1277,7 +2496,7 @@ static bool send_ping(bc_protoval_t *pProtoVal)
     bc_misc_add(&p, pProtoVal->nonce_ping, sizeof(uint64_t));
     pProto->length = sizeof(uint64_t);
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 #endif
 
@@ -1290,14 +2509,17 @@ static bool send_ping(bc_protoval_t *pProtoVal)
  */
 static bool send_pong(bc_protoval_t *pProtoVal, uint64_t Nonce)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_PONG, sizeof(uint64_t));
+    if (pProto == NULL) {
+        return false;
+    }
 
-    set_header(pProto, kCMD_PONG);
     pProto->length = 8;
     //nonce
     MEMCPY(pProto->payload, &Nonce, pProto->length);
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
 
@@ -1308,11 +2530,13 @@ static bool send_pong(bc_protoval_t *pProtoVal, uint64_t Nonce)
  */
 static bool send_getblocks(bc_protoval_t *pProtoVal, const uint8_t *pHash)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_GETBLOCKS, 4 + 1 + 2 * BTC_SZ_HASH256);
+    if (pProto == NULL) {
+        return false;
+    }
     uint8_t *p = pProto->payload;
 
-    set_header(pProto, kCMD_GETBLOCKS);
-
     //version
     bc_misc_add(&p, BC_PROTOCOL_VERSION, sizeof(int32_t));
     //hash count
@@ -1327,40 +2551,49 @@ static bool send_getblocks(bc_protoval_t *pProtoVal, const uint8_t *pHash)
     //payload length
     pProto->length = p - pProto->payload;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
 
 /** Bitcoinパケット送信(getheaders)
  *
  * @param[in]       pProtoVal   protocol value
+ * @param[in]       pLocator    block locator hashes(BTC_SZ_HASH256 * Num)
+ * @param[in]       Num         block locator hash数
+ * @param[in]       pStop       hash_stop(NULL:最大数)
  * @return          送信結果(0..OK)
  */
-static bool send_getheaders(bc_protoval_t *pProtoVal, const uint8_t *pHash)
+static bool send_getheaders(bc_protoval_t *pProtoVal, const uint8_t *pLocator, int Num, const uint8_t *pStop)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_GETHEADERS, 4 + 9 + BTC_SZ_HASH256 * (Num + 1));
+    if (pProto == NULL) {
+        return false;
+    }
     uint8_t *p = pProto->payload;
 
-    set_header(pProto, kCMD_GETHEADERS);
-
     //version
     bc_misc_add(&p, BC_PROTOCOL_VERSION, sizeof(int32_t));
     //hash count
-    bc_misc_add(&p, 1, sizeof(uint8_t));        //varintだが1byte固定なので省略
+    add_varint(&p, Num);
     //block locator hashes
-    MEMCPY(p, pHash, BTC_SZ_HASH256);
-    p += BTC_SZ_HASH256;
-    //hash_stop           :最大数
-    MEMSET(p, 0, BTC_SZ_HASH256);
+    MEMCPY(p, pLocator, BTC_SZ_HASH256 * Num);
+    p += BTC_SZ_HASH256 * Num;
+    //hash_stop
+    if (pStop != NULL) {
+        MEMCPY(p, pStop, BTC_SZ_HASH256);
+    } else {
+        MEMSET(p, 0, BTC_SZ_HASH256);
+    }
     p += BTC_SZ_HASH256;
 
     LOGD("    block locator hash(getheaders) : ");
-    TXIDD(pHash);
+    TXIDD(pLocator);
 
     //payload length
     pProto->length = p - pProto->payload;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
 
@@ -1372,38 +2605,104 @@ static bool send_getheaders(bc_protoval_t *pProtoVal, const uint8_t *pHash)
  */
 static bool send_getdata(bc_protoval_t *pProtoVal, const struct inv_t *pInv)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    return send_getdata_list(pProtoVal, pInv, 1);
+}
 
-    set_header(pProto, kCMD_GETDATA);
 
+/** Bitcoinパケット送信(getdata: 複数)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       pInvs       取得要求するINV
+ * @param[in]       Num         要求数(INV_MAX以下)
+ * @return          送信結果(0..OK)
+ */
+static bool send_getdata_list(bc_protoval_t *pProtoVal, const struct inv_t *pInvs, int Num)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_GETDATA, 9 + sizeof(struct inv_t) * Num);
+    if (pProto == NULL) {
+        return false;
+    }
     uint8_t *p = pProto->payload;
-    pProto->length = 1 + sizeof(struct inv_t);
 
     //inv
-    *p = 1;
-    p++;
-    MEMCPY(p, pInv, sizeof(struct inv_t));
+    add_varint(&p, Num);
+    MEMCPY(p, pInvs, sizeof(struct inv_t) * Num);
+    p += sizeof(struct inv_t) * Num;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    //payload length
+    pProto->length = p - pProto->payload;
+
+    return send_data(pProtoVal, p_buf);
 }
 
 
-/** Bitcoinパケット送信(filterload)
+/** Bitcoinパケット送信(getdata: MSG_FILTERED_BLOCK)
  *
  * @param[in]       pProtoVal   protocol value
+ * @param[in]       pHashes     Block Hash(BTC_SZ_HASH256 * Num)
+ * @param[in]       Num         要求数
  * @return          送信結果(0..OK)
  */
-static bool send_filterload(bc_protoval_t *pProtoVal, const uint8_t *pPubKeyHash, size_t Len)
+static bool send_getdata_fblock(bc_protoval_t *pProtoVal, const uint8_t *pHashes, int Num)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
-    //struct bc_flash_wlt_t wlt;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_GETDATA, 9 + sizeof(struct inv_t) * Num);
+    if (pProto == NULL) {
+        return false;
+    }
+    uint8_t *p = pProto->payload;
 
+    //inv
+    add_varint(&p, Num);
+    for (int lp = 0; lp < Num; lp++) {
+        struct inv_t *p_inv = (struct inv_t *)p;
+        p_inv->type = INV_MSG_FILTERED_BLOCK;
+        MEMCPY(p_inv->hash, pHashes + lp * BTC_SZ_HASH256, BTC_SZ_HASH256);
+        p += sizeof(struct inv_t);
+    }
+    LOGD("getdata filtered block x %d\n", Num);
+
+    //payload length
+    pProto->length = p - pProto->payload;
+
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(filterload)
+ *
+ * 監視要素数から大きさを決める。大きすぎて役に立たない場合はfilterclearを送る。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @return          送信結果(0..OK)
+ */
+static bool send_filterload(bc_protoval_t *pProtoVal)
+{
+    int num;
 
-    set_header(pProto, kCMD_FILTERLOAD);
+    if (pProtoVal->bloom.loaded) {
+        bc_bloom_print(&pProtoVal->bloom);
+    }
 
     struct bloom bloom;
-    bloom_init(&bloom, BLOOM_ELEMENTS, BLOOM_RATE, BLOOM_TWEAK);
-    bloom_add(&bloom, pPubKeyHash, Len);
+    utl_buf_t *p_elems = bc_watch_bloom_elements(&num);
+    if (p_elems == NULL) {
+        //filterclearにすると全txが来るので送らない
+        return false;
+    }
+    bool ret = bc_bloom_build(&pProtoVal->bloom, &bloom, p_elems, num, BLOOM_RATE);
+    FREE(p_elems);
+    if (!ret) {
+        return send_filterclear(pProtoVal);
+    }
+
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_FILTERLOAD, 9 + bloom.bytes + 4 + 4 + 1);
+    if (pProto == NULL) {
+        bloom_free(&bloom);
+        return false;
+    }
 
     //filter
     uint8_t *p = pProto->payload;
@@ -1424,17 +2723,145 @@ static bool send_filterload(bc_protoval_t *pProtoVal, const uint8_t *pPubKeyHash
     //payload length
     pProto->length = p - pProto->payload;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    pProtoVal->txrelay = true;
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(filteradd)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       pData       追加する要素
+ * @param[in]       Len         pData長(BC_BLOOM_ELEMENT_MAX以下)
+ * @return          送信結果(0..OK)
+ */
+static bool send_filteradd(bc_protoval_t *pProtoVal, const uint8_t *pData, size_t Len)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_FILTERADD, 9 + Len);
+    if (pProto == NULL) {
+        return false;
+    }
+
+    uint8_t *p = pProto->payload;
+    add_varint(&p, Len);
+    MEMCPY(p, pData, Len);
+    p += Len;
+
+    //payload length
+    pProto->length = p - pProto->payload;
+
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(filterclear)
+ *
+ * 以降は全txが通知される。
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @return          送信結果(0..OK)
+ */
+static bool send_filterclear(bc_protoval_t *pProtoVal)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_FILTERCLEAR, 0);
+    if (pProto == NULL) {
+        return false;
+    }
+
+    bc_bloom_clear(&pProtoVal->bloom);
+
+    pProto->length = 0;
+
+    pProtoVal->txrelay = true;
+
+    return send_data(pProtoVal, p_buf);
 }
 
 
 static bool send_mempool(bc_protoval_t *pProtoVal)
 {
-    struct bc_proto_t *pProto = (struct bc_proto_t *)pProtoVal->buffer;
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_MEMPOOL, 0);
+    if (pProto == NULL) {
+        return false;
+    }
+
+    pProto->length = 0;
+
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(getcfcheckpt)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       pStopHash   stop_hash
+ * @return          送信結果(0..OK)
+ * @note        BIP157
+ */
+static bool send_getcfcheckpt(bc_protoval_t *pProtoVal, const uint8_t *pStopHash)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_GETCFCHECKPT, sizeof(struct getcfcheckpt));
+    if (pProto == NULL) {
+        return false;
+    }
+    struct getcfcheckpt *p_msg = (struct getcfcheckpt *)pProto->payload;
+
+    p_msg->filter_type = BC_GCS_BASIC;
+    MEMCPY(p_msg->stop_hash, pStopHash, BTC_SZ_HASH256);
+    pProto->length = sizeof(struct getcfcheckpt);
+
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(getcfheaders, getcfilters)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @param[in]       pCmd        kCMD_GETCFHEADERS or kCMD_GETCFILTERS
+ * @param[in]       StartHeight start_height
+ * @param[in]       pStopHash   stop_hash
+ * @return          送信結果(0..OK)
+ * @note        BIP157
+ */
+static bool send_getcfheaders(bc_protoval_t *pProtoVal, const char *pCmd, uint32_t StartHeight, const uint8_t *pStopHash)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, pCmd, sizeof(struct getcfilters_t));
+    if (pProto == NULL) {
+        return false;
+    }
+    struct getcfilters_t *p_msg = (struct getcfilters_t *)pProto->payload;
+
+    p_msg->filter_type = BC_GCS_BASIC;
+    p_msg->start_height = StartHeight;
+    MEMCPY(p_msg->stop_hash, pStopHash, BTC_SZ_HASH256);
+    pProto->length = sizeof(struct getcfilters_t);
+    LOGD("%s: start=%" PRIu32 "\n", pCmd, StartHeight);
+
+    return send_data(pProtoVal, p_buf);
+}
+
+
+/** Bitcoinパケット送信(sendheaders)
+ *
+ * @param[in]       pProtoVal   protocol value
+ * @return          送信結果(0..OK)
+ * @note        BIP130
+ */
+static bool send_sendheaders(bc_protoval_t *pProtoVal)
+{
+    bc_sendbuf_t *p_buf;
+    struct bc_proto_t *pProto = new_msg(&p_buf, kCMD_SENDHEADERS, 0);
+    if (pProto == NULL) {
+        return false;
+    }
 
-    set_header(pProto, kCMD_MEMPOOL);
     pProto->length = 0;
 
-    return send_data(pProtoVal, (struct bc_proto_t *)pProtoVal->buffer);
+    return send_data(pProtoVal, p_buf);
 }
 
@@ -0,0 +1,590 @@
+/**************************************************************************
+ * @file    bc_rescan.c
+ * @brief   compact filterによる並列rescan
+ * @note
+ *      - filter hash(cfheaders)を受信したBlock HeightからBC_RESCAN_CHUNKずつ
+ *        複数peerにgetcfiltersを割り当てる
+ *      - 受信したfilterは照合threadがBlock Height範囲ごとに照合する
+ *      - 照合結果はBlock Height順に取り出す(filterも渡すので順に保存できる)
+ *      - 期限までに届かないgetcfiltersは他peerに割り当て直す(bc_rescan_expire())
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "user_config.h"
+#include "bc_misc.h"
+#include "bc_rescan.h"
+#include "bc_headers.h"
+#include "bc_gcs.h"
+#include "bc_sha256.h"
+
+#define LOG_TAG     "rescan"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#ifndef RESCAN_WORKERS
+#define RESCAN_WORKERS          (0)             ///< 照合thread数(0:CPU数)
+#endif
+
+#define SLOT(height)            (&mSlot[(height) % BC_RESCAN_WINDOW])
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @enum   slot_state_t
+ */
+typedef enum {
+    SLOT_EMPTY,                         ///< filter hash未受信
+    SLOT_HASH,                          ///< filter hash受信済み(未要求)
+    SLOT_REQUESTED,                     ///< getcfilters要求中
+    SLOT_RECEIVED,                      ///< cfilter受信済み(未照合)
+    SLOT_MATCHING,                      ///< 照合中
+    SLOT_DONE,                          ///< 照合済み
+} slot_state_t;
+
+
+/** @struct slot_t
+ *
+ */
+typedef struct {
+    slot_state_t    state;
+    bool            matched;
+    uint8_t         filter_hash[BTC_SZ_HASH256];
+    uint8_t         filter_header[BTC_SZ_HASH256];
+    uint8_t         bhash[BTC_SZ_HASH256];
+    uint8_t         *p_filter;
+    size_t          len;
+} slot_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static slot_t           mSlot[BC_RESCAN_WINDOW];
+static bool             mActive;
+static uint32_t         mGen;                   ///< rescan開始毎に更新
+static uint32_t         mBase;                  ///< 次にpopするBlock Height
+static uint32_t         mHashNext;              ///< 次にfilter hashを追加するBlock Height
+static uint32_t         mEnd;                   ///< 最後のBlock Height
+static utl_buf_t        *mItems;                ///< 照合するscriptPubKey(複製)
+static int              mItemNum;
+static pthread_t        mWorker[BC_RESCAN_WORKER_MAX];
+static int              mWorkerNum;
+static int              mNotify[2] = { -1, -1 };
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   mCond = PTHREAD_COND_INITIALIZER;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void *worker_proc(void *pArg);
+static bool claim(uint32_t *pStart, uint32_t *pNum);
+static void notify(void);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_rescan_start(uint32_t From, uint32_t To, const utl_buf_t *pItems, int Num)
+{
+    bc_rescan_stop();
+
+    if (pipe(mNotify) != 0) {
+        LOGE("pipe: %s\n", strerror(errno));
+        mNotify[0] = mNotify[1] = -1;
+        return false;
+    }
+    fcntl(mNotify[0], F_SETFL, O_NONBLOCK);
+    fcntl(mNotify[1], F_SETFL, O_NONBLOCK);
+
+    int workers = RESCAN_WORKERS;
+    if (workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > BC_RESCAN_WORKER_MAX) {
+        workers = BC_RESCAN_WORKER_MAX;
+    }
+
+    //呼び出し元のscriptPubKeyは照合中に変わることがあるので複製する
+    size_t sz = 0;
+    for (int lp = 0; lp < Num; lp++) {
+        sz += pItems[lp].len;
+    }
+    utl_buf_t *p_items = (utl_buf_t *)MALLOC(sizeof(utl_buf_t) * Num + sz + 1);
+    if (p_items == NULL) {
+        LOGE("fail: malloc\n");
+        bc_rescan_stop();
+        return false;
+    }
+    uint8_t *p = (uint8_t *)(p_items + Num);
+    for (int lp = 0; lp < Num; lp++) {
+        MEMCPY(p, pItems[lp].buf, pItems[lp].len);
+        p_items[lp].buf = p;
+        p_items[lp].len = pItems[lp].len;
+        p += pItems[lp].len;
+    }
+
+    pthread_mutex_lock(&mMux);
+    mGen++;
+    mBase = From;
+    mHashNext = From;
+    mEnd = To;
+    mItems = p_items;
+    mItemNum = Num;
+    mActive = true;
+    pthread_mutex_unlock(&mMux);
+
+    for (mWorkerNum = 0; mWorkerNum < workers; mWorkerNum++) {
+        int ret = pthread_create(&mWorker[mWorkerNum], NULL, worker_proc, NULL);
+        if (ret != 0) {
+            LOGE("pthread_create: %s\n", strerror(ret));
+            break;
+        }
+    }
+    if (mWorkerNum == 0) {
+        bc_rescan_stop();
+        return false;
+    }
+    LOGD("rescan: %" PRIu32 " - %" PRIu32 "(workers=%d)\n", From, To, mWorkerNum);
+    return true;
+}
+
+
+void bc_rescan_stop(void)
+{
+    pthread_mutex_lock(&mMux);
+    mActive = false;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mMux);
+
+    for (int lp = 0; lp < mWorkerNum; lp++) {
+        pthread_join(mWorker[lp], NULL);
+    }
+    mWorkerNum = 0;
+    FREE(mItems);
+    mItems = NULL;
+    mItemNum = 0;
+
+    for (int lp = 0; lp < BC_RESCAN_WINDOW; lp++) {
+        FREE(mSlot[lp].p_filter);
+        mSlot[lp].p_filter = NULL;
+        mSlot[lp].state = SLOT_EMPTY;
+    }
+    if (mNotify[0] >= 0) {
+        close(mNotify[0]);
+        close(mNotify[1]);
+        mNotify[0] = mNotify[1] = -1;
+    }
+}
+
+
+void bc_rescan_extend(uint32_t To)
+{
+    pthread_mutex_lock(&mMux);
+    if (mEnd < To) {
+        mEnd = To;
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+uint32_t bc_rescan_room(void)
+{
+    uint32_t room = 0;
+
+    pthread_mutex_lock(&mMux);
+    if (mActive) {
+        room = mBase + BC_RESCAN_WINDOW - mHashNext;
+    }
+    pthread_mutex_unlock(&mMux);
+    return room;
+}
+
+
+bool bc_rescan_hashes(uint32_t Start, const uint8_t *pHashes, const uint8_t *pHeaders, uint32_t Num)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive || (Start != mHashNext) || (Num > mBase + BC_RESCAN_WINDOW - mHashNext)) {
+        LOGE("fail: filter hash(%" PRIu32 ", %" PRIu32 ")\n", Start, Num);
+        goto LABEL_EXIT;
+    }
+    for (uint32_t lp = 0; lp < Num; lp++) {
+        slot_t *p_slot = SLOT(Start + lp);
+        MEMCPY(p_slot->filter_hash, pHashes + lp * BTC_SZ_HASH256, BTC_SZ_HASH256);
+        MEMCPY(p_slot->filter_header, pHeaders + lp * BTC_SZ_HASH256, BTC_SZ_HASH256);
+        p_slot->state = SLOT_HASH;
+    }
+    mHashNext += Num;
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_rescan_local(uint32_t Height, const uint8_t *pBlockHash, const uint8_t *pHeader, uint8_t *pFilter, size_t Len)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive || (Height != mHashNext) || (mHashNext >= mBase + BC_RESCAN_WINDOW)) {
+        LOGE("fail: local filter(%" PRIu32 ")\n", Height);
+        goto LABEL_EXIT;
+    }
+    slot_t *p_slot = SLOT(Height);
+    MEMCPY(p_slot->filter_header, pHeader, BTC_SZ_HASH256);
+    MEMCPY(p_slot->bhash, pBlockHash, BTC_SZ_HASH256);
+    p_slot->p_filter = pFilter;
+    p_slot->len = Len;
+    p_slot->state = SLOT_RECEIVED;
+    pFilter = NULL;
+    mHashNext++;
+    pthread_cond_signal(&mCond);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    FREE(pFilter);
+    return ret;
+}
+
+
+bool bc_rescan_assign(bc_rescan_peer_t *pPeer, uint32_t *pStart, uint8_t *pStopHash, uint64_t Now)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive) {
+        goto LABEL_EXIT;
+    }
+    if (pPeer->gen != mGen) {
+        //以前のrescanで割り当てた分は無効
+        pPeer->gen = mGen;
+        pPeer->num = 0;
+        pPeer->skip = 0;
+    }
+    if ((pPeer->skip > 0) && (pPeer->skip_expire <= Now)) {
+        LOGE("cfilter skip timeout(%" PRIu32 ")\n", pPeer->skip);
+        pPeer->skip = 0;
+    }
+    if ((pPeer->num >= BC_RESCAN_PIPELINE) || (pPeer->skip > 0)) {
+        goto LABEL_EXIT;
+    }
+
+    uint32_t start = mBase;
+    while ((start < mHashNext) && (SLOT(start)->state != SLOT_HASH)) {
+        start++;
+    }
+    if (start >= mHashNext) {
+        goto LABEL_EXIT;
+    }
+    uint32_t stop = start;
+    while ((stop + 1 < mHashNext) && (stop + 1 - start < BC_RESCAN_CHUNK) && (SLOT(stop + 1)->state == SLOT_HASH)) {
+        stop++;
+    }
+    if (!bc_headers_get_hash(pStopHash, stop)) {
+        LOGE("fail: no header(%" PRIu32 ")\n", stop);
+        goto LABEL_EXIT;
+    }
+    for (uint32_t height = start; height <= stop; height++) {
+        SLOT(height)->state = SLOT_REQUESTED;
+    }
+    if (pPeer->num == 0) {
+        pPeer->next = start;
+    }
+    pPeer->chunk[pPeer->num].start = start;
+    pPeer->chunk[pPeer->num].stop = stop;
+    pPeer->chunk[pPeer->num].expire = Now + BC_RESCAN_TIMEOUT_USEC * (pPeer->num + 1);
+    pPeer->num++;
+    *pStart = start;
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+uint32_t bc_rescan_expire(bc_rescan_peer_t *pPeer, uint64_t Now)
+{
+    uint32_t ret = 0;
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive || (pPeer->gen != mGen) || (pPeer->num == 0) || (pPeer->chunk[0].expire > Now)) {
+        goto LABEL_EXIT;
+    }
+    for (int lp = 0; lp < pPeer->num; lp++) {
+        uint32_t start = (lp == 0) ? pPeer->next : pPeer->chunk[lp].start;
+        for (uint32_t height = start; height <= pPeer->chunk[lp].stop; height++) {
+            if (SLOT(height)->state == SLOT_REQUESTED) {
+                SLOT(height)->state = SLOT_HASH;
+            }
+            ret++;
+        }
+    }
+    LOGE("cfilter timeout(%" PRIu32 " - %" PRIu32 ")\n", pPeer->next, pPeer->chunk[pPeer->num - 1].stop);
+    pPeer->skip += ret;
+    pPeer->skip_expire = Now + BC_RESCAN_TIMEOUT_USEC;
+    pPeer->num = 0;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_rescan_filter(bc_rescan_peer_t *pPeer, const uint8_t *pBlockHash, const uint8_t *pFilter, size_t Len)
+{
+    bool ret = false;
+    uint8_t hash[BTC_SZ_HASH256];
+    uint8_t filter_hash[BTC_SZ_HASH256];
+
+    //hash計算とコピーはlock外で行う
+    bc_sha256_hash256(filter_hash, pFilter, Len);
+    uint8_t *p_filter = (uint8_t *)MALLOC(Len + 1);
+    if (p_filter == NULL) {
+        LOGE("fail: malloc\n");
+        return false;
+    }
+    MEMCPY(p_filter, pFilter, Len);
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive || (pPeer->gen != mGen)) {
+        LOGD("discard cfilter\n");
+        ret = true;
+        goto LABEL_EXIT;
+    }
+    if (pPeer->skip > 0) {
+        //期限切れで他peerに回した分
+        LOGD("discard expired cfilter\n");
+        pPeer->skip--;
+        ret = true;
+        goto LABEL_EXIT;
+    }
+    if (pPeer->num == 0) {
+        LOGE("fail: unrequested cfilter\n");
+        goto LABEL_EXIT;
+    }
+    uint32_t height = pPeer->next;
+    slot_t *p_slot = SLOT(height);
+    if (p_slot->state != SLOT_REQUESTED) {
+        LOGE("fail: cfilter state(%" PRIu32 ")\n", height);
+        goto LABEL_EXIT;
+    }
+    if (!bc_headers_get_hash(hash, height) || (MEMCMP(hash, pBlockHash, BTC_SZ_HASH256) != 0)) {
+        LOGE("fail: cfilter block hash(%" PRIu32 ")\n", height);
+        goto LABEL_EXIT;
+    }
+    if (MEMCMP(filter_hash, p_slot->filter_hash, BTC_SZ_HASH256) != 0) {
+        LOGE("fail: cfilter hash(%" PRIu32 ")\n", height);
+        goto LABEL_EXIT;
+    }
+    MEMCPY(p_slot->bhash, pBlockHash, BTC_SZ_HASH256);
+    p_slot->p_filter = p_filter;
+    p_slot->len = Len;
+    p_slot->state = SLOT_RECEIVED;
+    p_filter = NULL;
+    pthread_cond_signal(&mCond);
+
+    pPeer->next++;
+    if (pPeer->next > pPeer->chunk[0].stop) {
+        pPeer->num--;
+        for (int lp = 0; lp < pPeer->num; lp++) {
+            pPeer->chunk[lp] = pPeer->chunk[lp + 1];
+        }
+        pPeer->next = pPeer->chunk[0].start;
+    }
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    FREE(p_filter);
+    return ret;
+}
+
+
+void bc_rescan_release(bc_rescan_peer_t *pPeer)
+{
+    pthread_mutex_lock(&mMux);
+    if (mActive && (pPeer->gen == mGen)) {
+        for (int lp = 0; lp < pPeer->num; lp++) {
+            uint32_t start = (lp == 0) ? pPeer->next : pPeer->chunk[lp].start;
+            for (uint32_t height = start; height <= pPeer->chunk[lp].stop; height++) {
+                if (SLOT(height)->state == SLOT_REQUESTED) {
+                    SLOT(height)->state = SLOT_HASH;
+                }
+            }
+        }
+    }
+    pPeer->num = 0;
+    pPeer->skip = 0;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+int bc_rescan_fd(void)
+{
+    pthread_mutex_lock(&mMux);
+    int fd = (mActive) ? mNotify[0] : -1;
+    pthread_mutex_unlock(&mMux);
+    return fd;
+}
+
+
+void bc_rescan_clear_event(void)
+{
+    uint8_t buf[64];
+
+    if (mNotify[0] >= 0) {
+        while (read(mNotify[0], buf, sizeof(buf)) > 0) {
+            ;
+        }
+    }
+}
+
+
+bool bc_rescan_pop(bc_rescan_result_t *pResult)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (mActive && (mBase <= mEnd) && (mBase < mHashNext) && (SLOT(mBase)->state == SLOT_DONE)) {
+        slot_t *p_slot = SLOT(mBase);
+        pResult->height = mBase;
+        pResult->matched = p_slot->matched;
+        MEMCPY(pResult->bhash, p_slot->bhash, BTC_SZ_HASH256);
+        MEMCPY(pResult->filter_header, p_slot->filter_header, BTC_SZ_HASH256);
+        pResult->p_filter = p_slot->p_filter;
+        pResult->len = p_slot->len;
+        p_slot->p_filter = NULL;
+        p_slot->state = SLOT_EMPTY;
+        mBase++;
+        ret = true;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_rescan_done(void)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = !mActive || (mBase > mEnd);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 照合thread
+ *
+ * 受信済みの連続したBlock Height範囲を取って照合する。
+ */
+static void *worker_proc(void *pArg)
+{
+    (void)pArg;
+
+    bc_gcs_query_t query;
+    bool b_query = bc_gcs_query_init(&query, mItems, mItemNum);
+    if (!b_query) {
+        //照合できないので全blockを一致扱いにする
+        LOGE("fail: bc_gcs_query_init\n");
+    }
+
+    pthread_mutex_lock(&mMux);
+    while (mActive) {
+        uint32_t start;
+        uint32_t num;
+        if (!claim(&start, &num)) {
+            pthread_cond_wait(&mCond, &mMux);
+            continue;
+        }
+        pthread_mutex_unlock(&mMux);
+
+        //SLOT_MATCHINGの間は他から触られない
+        for (uint32_t lp = 0; lp < num; lp++) {
+            slot_t *p_slot = SLOT(start + lp);
+            p_slot->matched = !b_query ||
+                    bc_gcs_match_any(&query, p_slot->p_filter, p_slot->len, p_slot->bhash);
+        }
+
+        pthread_mutex_lock(&mMux);
+        for (uint32_t lp = 0; lp < num; lp++) {
+            //filterはbc_rescan_pop()で渡す
+            SLOT(start + lp)->state = SLOT_DONE;
+        }
+        if ((mBase < mHashNext) && (SLOT(mBase)->state == SLOT_DONE)) {
+            notify();
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+
+    if (b_query) {
+        bc_gcs_query_free(&query);
+    }
+    return NULL;
+}
+
+
+/** 照合範囲の取得
+ *
+ * mMuxをlockして呼ぶ。
+ *
+ * @param[out]  pStart      先頭Block Height
+ * @param[out]  pNum        Block数
+ * @retval  true    取得した(SLOT_MATCHINGにする)
+ */
+static bool claim(uint32_t *pStart, uint32_t *pNum)
+{
+    uint32_t start = mBase;
+    while ((start < mHashNext) && (SLOT(start)->state != SLOT_RECEIVED)) {
+        start++;
+    }
+    if (start >= mHashNext) {
+        return false;
+    }
+    uint32_t num = 0;
+    while ((start + num < mHashNext) && (num < BC_RESCAN_CHUNK) && (SLOT(start + num)->state == SLOT_RECEIVED)) {
+        SLOT(start + num)->state = SLOT_MATCHING;
+        num++;
+    }
+    *pStart = start;
+    *pNum = num;
+    return true;
+}
+
+
+/** 照合完了通知
+ *
+ * pipeが一杯ならば未読の通知があるので捨ててよい。
+ */
+static void notify(void)
+{
+    uint8_t c = 0;
+    ssize_t ret = write(mNotify[1], &c, 1);
+    (void)ret;
+}
@@ -0,0 +1,131 @@
+/**************************************************************************
+ * @file    bc_sendbuf.c
+ * @brief   送信バッファpool
+ * @note
+ *      - 小さい制御メッセージ、getheaders/getdata、filterloadの3段階で確保する
+ *      - 解放されたバッファはsize classごとにBC_SENDBUF_KEEP個まで残して再利用する
+ *      - 複数threadの送信から使うので、poolと参照数はmutexで守る
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_sendbuf.h"
+
+#define LOG_TAG     "sendbuf"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+/** size class(header込みのメッセージ長) */
+static const uint32_t kClassSize[BC_SENDBUF_CLASS_NUM] = {
+    512,                                        //version, ping, getcfilters等
+    8 * 1024,                                   //getheaders, getdata(200件程度まで)
+    64 * 1024,                                  //filterload(36000byte), 大きいgetdata
+};
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static bc_sendbuf_t     *mpFree[BC_SENDBUF_CLASS_NUM];
+static int              mFreeNum[BC_SENDBUF_CLASS_NUM];
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bc_sendbuf_t *bc_sendbuf_get(size_t Size)
+{
+    bc_sendbuf_t *p_buf = NULL;
+    int cls = -1;
+
+    for (int lp = 0; lp < BC_SENDBUF_CLASS_NUM; lp++) {
+        if (Size <= kClassSize[lp]) {
+            cls = lp;
+            break;
+        }
+    }
+    if (cls >= 0) {
+        pthread_mutex_lock(&mMux);
+        p_buf = mpFree[cls];
+        if (p_buf != NULL) {
+            mpFree[cls] = p_buf->p_next;
+            mFreeNum[cls]--;
+        }
+        pthread_mutex_unlock(&mMux);
+    }
+    if (p_buf == NULL) {
+        if (Size > UINT32_MAX - sizeof(bc_sendbuf_t)) {
+            return NULL;
+        }
+        uint32_t size = (cls >= 0) ? kClassSize[cls] : (uint32_t)Size;
+        p_buf = (bc_sendbuf_t *)MALLOC(sizeof(bc_sendbuf_t) + size);
+        if (p_buf == NULL) {
+            LOGE("fail: MALLOC(%lu)\n", (unsigned long)size);
+            return NULL;
+        }
+        p_buf->size = size;
+        p_buf->cls = cls;
+    }
+    p_buf->p_next = NULL;
+    p_buf->ref = 1;
+    p_buf->len = 0;
+    return p_buf;
+}
+
+
+void bc_sendbuf_ref(bc_sendbuf_t *pBuf)
+{
+    pthread_mutex_lock(&mMux);
+    pBuf->ref++;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_sendbuf_release(bc_sendbuf_t *pBuf)
+{
+    if (pBuf == NULL) {
+        return;
+    }
+
+    bool b_free = false;
+    pthread_mutex_lock(&mMux);
+    if (--pBuf->ref == 0) {
+        int cls = pBuf->cls;
+        if ((cls >= 0) && (mFreeNum[cls] < BC_SENDBUF_KEEP)) {
+            pBuf->p_next = mpFree[cls];
+            mpFree[cls] = pBuf;
+            mFreeNum[cls]++;
+        } else {
+            b_free = true;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    if (b_free) {
+        FREE(pBuf);
+    }
+}
+
+
+void bc_sendbuf_term(void)
+{
+    pthread_mutex_lock(&mMux);
+    for (int lp = 0; lp < BC_SENDBUF_CLASS_NUM; lp++) {
+        while (mpFree[lp] != NULL) {
+            bc_sendbuf_t *p_buf = mpFree[lp];
+            mpFree[lp] = p_buf->p_next;
+            FREE(p_buf);
+        }
+        mFreeNum[lp] = 0;
+    }
+    pthread_mutex_unlock(&mMux);
+}
@@ -0,0 +1,279 @@
+/**************************************************************************
+ * @file    bc_sha256.c
+ * @brief   SHA256
+ * @note
+ *      - FIPS 180-4
+ *      - bc_sha256_hash256_d64()は独立したBC_SHA256_LANES個の入力を1roundずつ並べて計算する
+ *        (lane毎の同じ演算が並ぶので、compilerがSIMD命令にできる)
+ *      - btc_util_hash256()を使わない理由
+ *          - 長さがuint16_tで、block・filter・保存ファイルを渡せない。途中までの計算も続けられない
+ *          - 64byteのHASH256(x86_64, -O2): btc_util_hash256() 1700ns, bc_sha256_hash256() 1060ns,
+ *            bc_sha256_hash256_d64() 420ns/個
+ **************************************************************************/
+#include "bc_misc.h"
+#include "bc_sha256.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)     (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)    (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BSIG0(x)        (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x)        (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x)        (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x)        (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void transform(uint32_t *pState, const uint8_t *pBlock);
+static void transform_lanes(uint32_t pState[8][BC_SHA256_LANES], const uint32_t pW[16][BC_SHA256_LANES]);
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+static const uint32_t kInit[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+
+static const uint32_t kK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void bc_sha256_init(bc_sha256_t *pCtx)
+{
+    MEMCPY(pCtx->state, kInit, sizeof(kInit));
+    pCtx->total = 0;
+}
+
+
+void bc_sha256_update(bc_sha256_t *pCtx, const void *pData, size_t Len)
+{
+    const uint8_t *p = (const uint8_t *)pData;
+    size_t used = (size_t)(pCtx->total % BC_SHA256_SZ_BLOCK);
+
+    pCtx->total += Len;
+    if (used > 0) {
+        size_t fill = BC_SHA256_SZ_BLOCK - used;
+        if (Len < fill) {
+            MEMCPY(pCtx->block + used, p, Len);
+            return;
+        }
+        MEMCPY(pCtx->block + used, p, fill);
+        transform(pCtx->state, pCtx->block);
+        p += fill;
+        Len -= fill;
+    }
+    while (Len >= BC_SHA256_SZ_BLOCK) {
+        transform(pCtx->state, p);
+        p += BC_SHA256_SZ_BLOCK;
+        Len -= BC_SHA256_SZ_BLOCK;
+    }
+    if (Len > 0) {
+        MEMCPY(pCtx->block, p, Len);
+    }
+}
+
+
+void bc_sha256_final(uint8_t *pHash, bc_sha256_t *pCtx)
+{
+    uint64_t bits = pCtx->total * 8;
+    size_t used = (size_t)(pCtx->total % BC_SHA256_SZ_BLOCK);
+
+    pCtx->block[used++] = 0x80;
+    if (used > BC_SHA256_SZ_BLOCK - 8) {
+        MEMSET(pCtx->block + used, 0, BC_SHA256_SZ_BLOCK - used);
+        transform(pCtx->state, pCtx->block);
+        used = 0;
+    }
+    MEMSET(pCtx->block + used, 0, BC_SHA256_SZ_BLOCK - 8 - used);
+    for (int lp = 0; lp < 8; lp++) {
+        pCtx->block[BC_SHA256_SZ_BLOCK - 1 - lp] = (uint8_t)(bits >> (8 * lp));
+    }
+    transform(pCtx->state, pCtx->block);
+
+    for (int lp = 0; lp < 8; lp++) {
+        pHash[4 * lp + 0] = (uint8_t)(pCtx->state[lp] >> 24);
+        pHash[4 * lp + 1] = (uint8_t)(pCtx->state[lp] >> 16);
+        pHash[4 * lp + 2] = (uint8_t)(pCtx->state[lp] >> 8);
+        pHash[4 * lp + 3] = (uint8_t)pCtx->state[lp];
+    }
+}
+
+
+void bc_sha256_hash256(uint8_t *pHash, const void *pData, size_t Len)
+{
+    bc_sha256_t ctx;
+    uint8_t hash[BC_SHA256_SZ_HASH];
+
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, pData, Len);
+    bc_sha256_final(hash, &ctx);
+    bc_sha256_second(pHash, hash);
+}
+
+
+void bc_sha256_second(uint8_t *pHash, const uint8_t *pSha256)
+{
+    bc_sha256_t ctx;
+
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, pSha256, BC_SHA256_SZ_HASH);
+    bc_sha256_final(pHash, &ctx);
+}
+
+
+void bc_sha256_hash256_d64(uint8_t *pHash, const uint8_t *pData, size_t Num)
+{
+    uint32_t state[8][BC_SHA256_LANES];
+    uint32_t w[16][BC_SHA256_LANES];
+    size_t idx = 0;
+
+    for (; idx + BC_SHA256_LANES <= Num; idx += BC_SHA256_LANES) {
+        const uint8_t *p = pData + idx * BC_SHA256_SZ_BLOCK;
+
+        //1回目: data(64byte) + padding(1block)
+        for (int lp = 0; lp < 8; lp++) {
+            for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+                state[lp][ln] = kInit[lp];
+            }
+        }
+        for (int lp = 0; lp < 16; lp++) {
+            for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+                const uint8_t *q = p + ln * BC_SHA256_SZ_BLOCK + 4 * lp;
+                w[lp][ln] = ((uint32_t)q[0] << 24) | ((uint32_t)q[1] << 16) | ((uint32_t)q[2] << 8) | (uint32_t)q[3];
+            }
+        }
+        transform_lanes(state, (const uint32_t (*)[BC_SHA256_LANES])w);
+        for (int lp = 0; lp < 16; lp++) {
+            uint32_t val = (lp == 0) ? 0x80000000 : (lp == 15) ? 512 : 0;
+            for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+                w[lp][ln] = val;
+            }
+        }
+        transform_lanes(state, (const uint32_t (*)[BC_SHA256_LANES])w);
+
+        //2回目: hash(32byte) + padding
+        for (int lp = 0; lp < 16; lp++) {
+            for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+                w[lp][ln] = (lp < 8) ? state[lp][ln] : (lp == 8) ? 0x80000000 : (lp == 15) ? 256 : 0;
+            }
+        }
+        for (int lp = 0; lp < 8; lp++) {
+            for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+                state[lp][ln] = kInit[lp];
+            }
+        }
+        transform_lanes(state, (const uint32_t (*)[BC_SHA256_LANES])w);
+
+        for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+            uint8_t *q = pHash + (idx + ln) * BC_SHA256_SZ_HASH;
+            for (int lp = 0; lp < 8; lp++) {
+                q[4 * lp + 0] = (uint8_t)(state[lp][ln] >> 24);
+                q[4 * lp + 1] = (uint8_t)(state[lp][ln] >> 16);
+                q[4 * lp + 2] = (uint8_t)(state[lp][ln] >> 8);
+                q[4 * lp + 3] = (uint8_t)state[lp][ln];
+            }
+        }
+    }
+    //端数
+    for (; idx < Num; idx++) {
+        uint8_t hash[BC_SHA256_SZ_HASH];
+        bc_sha256_hash256(hash, pData + idx * BC_SHA256_SZ_BLOCK, BC_SHA256_SZ_BLOCK);
+        MEMCPY(pHash + idx * BC_SHA256_SZ_HASH, hash, BC_SHA256_SZ_HASH);
+    }
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 1block(64byte)処理
+ *
+ * @param[in,out]   pState  state
+ * @param[in]       pBlock  入力block
+ */
+static void transform(uint32_t *pState, const uint8_t *pBlock)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for (int lp = 0; lp < 16; lp++) {
+        w[lp] = ((uint32_t)pBlock[4 * lp] << 24) | ((uint32_t)pBlock[4 * lp + 1] << 16) |
+                ((uint32_t)pBlock[4 * lp + 2] << 8) | (uint32_t)pBlock[4 * lp + 3];
+    }
+    for (int lp = 16; lp < 64; lp++) {
+        w[lp] = SSIG1(w[lp - 2]) + w[lp - 7] + SSIG0(w[lp - 15]) + w[lp - 16];
+    }
+
+    a = pState[0]; b = pState[1]; c = pState[2]; d = pState[3];
+    e = pState[4]; f = pState[5]; g = pState[6]; h = pState[7];
+    for (int lp = 0; lp < 64; lp++) {
+        uint32_t t1 = h + BSIG1(e) + CH(e, f, g) + kK[lp] + w[lp];
+        uint32_t t2 = BSIG0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e;
+        e = d + t1;
+        d = c; c = b; b = a;
+        a = t1 + t2;
+    }
+    pState[0] += a; pState[1] += b; pState[2] += c; pState[3] += d;
+    pState[4] += e; pState[5] += f; pState[6] += g; pState[7] += h;
+}
+
+
+/** 1block(64byte)処理(BC_SHA256_LANES個同時)
+ *
+ * @param[in,out]   pState  state(lane毎)
+ * @param[in]       pW      入力block(big endianで読んだword, lane毎)
+ */
+static void transform_lanes(uint32_t pState[8][BC_SHA256_LANES], const uint32_t pW[16][BC_SHA256_LANES])
+{
+    uint32_t w[64][BC_SHA256_LANES];
+    uint32_t v[8][BC_SHA256_LANES];
+
+    MEMCPY(w, pW, sizeof(uint32_t) * 16 * BC_SHA256_LANES);
+    for (int lp = 16; lp < 64; lp++) {
+        for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+            w[lp][ln] = SSIG1(w[lp - 2][ln]) + w[lp - 7][ln] + SSIG0(w[lp - 15][ln]) + w[lp - 16][ln];
+        }
+    }
+
+    MEMCPY(v, pState, sizeof(v));
+    for (int lp = 0; lp < 64; lp++) {
+        for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+            uint32_t t1 = v[7][ln] + BSIG1(v[4][ln]) + CH(v[4][ln], v[5][ln], v[6][ln]) + kK[lp] + w[lp][ln];
+            uint32_t t2 = BSIG0(v[0][ln]) + MAJ(v[0][ln], v[1][ln], v[2][ln]);
+            v[7][ln] = v[6][ln]; v[6][ln] = v[5][ln]; v[5][ln] = v[4][ln];
+            v[4][ln] = v[3][ln] + t1;
+            v[3][ln] = v[2][ln]; v[2][ln] = v[1][ln]; v[1][ln] = v[0][ln];
+            v[0][ln] = t1 + t2;
+        }
+    }
+    for (int lp = 0; lp < 8; lp++) {
+        for (int ln = 0; ln < BC_SHA256_LANES; ln++) {
+            pState[lp][ln] += v[lp][ln];
+        }
+    }
+}
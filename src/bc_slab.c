@@ -0,0 +1,75 @@
+/**************************************************************************
+ * @file    bc_slab.c
+ * @brief   block受信用の大きいバッファpool
+ * @note
+ *      - blockは最大4MBあり、毎回確保するとmmap/munmapになるので使い回す
+ *      - 通常の接続とhelper接続から使うのでmutexで守る
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_slab.h"
+
+#define LOG_TAG     "slab"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t          *mpFree[BC_SLAB_KEEP];
+static int              mFreeNum;
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+uint8_t *bc_slab_get(void)
+{
+    uint8_t *p = NULL;
+
+    pthread_mutex_lock(&mMux);
+    if (mFreeNum > 0) {
+        p = mpFree[--mFreeNum];
+    }
+    pthread_mutex_unlock(&mMux);
+    if (p == NULL) {
+        p = (uint8_t *)MALLOC(BC_SLAB_SZ);
+        if (p == NULL) {
+            LOGE("fail: MALLOC(%d)\n", BC_SLAB_SZ);
+        }
+    }
+    return p;
+}
+
+
+void bc_slab_put(uint8_t *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mMux);
+    if (mFreeNum < BC_SLAB_KEEP) {
+        mpFree[mFreeNum++] = p;
+        p = NULL;
+    }
+    pthread_mutex_unlock(&mMux);
+    FREE(p);
+}
+
+
+void bc_slab_term(void)
+{
+    pthread_mutex_lock(&mMux);
+    while (mFreeNum > 0) {
+        FREE(mpFree[--mFreeNum]);
+    }
+    pthread_mutex_unlock(&mMux);
+}
@@ -0,0 +1,431 @@
+/**************************************************************************
+ * @file    bc_txreq.c
+ * @brief   接続をまたいだtx要求管理
+ * @note
+ *      - 同じtxidは1つの接続にだけ要求し、他の接続の通知は候補(bit)として覚える
+ *      - 要求中のtxは要求順のlistに並べる。timeoutは一定なので、先頭から見るだけでよい
+ *      - 要求先が無くなったtxは待ちlistに移し、候補のpeerがbc_txreq_poll()で引き取る
+ *      - entryはindexでつなぎ、追加・削除はlistの付け替えだけで済ませる
+ *      - txidは外から与えられるので、起動毎の乱数keyを混ぜてからbucketを決める
+ *      - 1つの接続の通知で表が埋まらないよう、接続毎に要求中・候補の数を数えて上限を設ける
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bc_misc.h"
+#include "bc_txreq.h"
+
+#define LOG_TAG     "txreq"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define HASH_SZ                 (BC_TXREQ_MAX * 2)  ///< bucket数(2のべき)
+#define NONE                    (-1)
+#define PEER_BIT(peer)          ((uint32_t)1 << (peer))
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** 管理中のtx */
+typedef struct {
+    uint8_t     txid[32];
+    uint32_t    peers;                          ///< 通知したが要求していないpeer
+    int32_t     req_peer;                       ///< 要求中のpeer(NONE:待ち)
+    uint64_t    expire;                         ///< 要求のtimeout時刻
+    int32_t     hnext;                          ///< 同じbucketの次
+    int32_t     prev;                           ///< list(要求中 or 待ち or 空き)
+    int32_t     next;
+} entry_t;
+
+
+/** 双方向list */
+typedef struct {
+    int32_t     head;
+    int32_t     tail;
+} list_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void init(void);
+static uint32_t hash_idx(const uint8_t *pTxid);
+static int32_t find(const uint8_t *pTxid, int32_t **ppLink);
+static int32_t new_entry(const uint8_t *pTxid);
+static void forget(int32_t Idx);
+static void request(int32_t Idx, int Peer, uint64_t Now);
+static void release(int32_t Idx);
+static void list_push(list_t *pList, int32_t Idx);
+static void list_unlink(list_t *pList, int32_t Idx);
+static bool has_peer(int32_t Idx, int Peer);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+static entry_t          mEntry[BC_TXREQ_MAX];
+static int32_t          mBucket[HASH_SZ];
+static list_t           mInflight;              ///< 要求中(要求順)
+static list_t           mWaiting;               ///< 要求先なし
+static list_t           mFree;
+static uint32_t         mPeers;                 ///< 使用中のpeer番号
+static uint32_t         mPeerAnn[BC_TXREQ_PEER_MAX];    ///< peer毎の要求中・候補の数
+static uint64_t         mKey[2];                ///< hash_idx()の乱数key
+static bool             mInit;
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+int bc_txreq_peer_add(void)
+{
+    int peer = NONE;
+
+    pthread_mutex_lock(&mMux);
+    init();
+    for (int lp = 0; lp < BC_TXREQ_PEER_MAX; lp++) {
+        if ((mPeers & PEER_BIT(lp)) == 0) {
+            mPeers |= PEER_BIT(lp);
+            peer = lp;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return peer;
+}
+
+
+void bc_txreq_peer_remove(int Peer)
+{
+    if (Peer == NONE) {
+        return;
+    }
+
+    pthread_mutex_lock(&mMux);
+    init();
+    //要求中だったものを戻す
+    int32_t idx = mInflight.head;
+    while (idx != NONE) {
+        int32_t next = mEntry[idx].next;
+        if (mEntry[idx].req_peer == Peer) {
+            release(idx);
+        }
+        idx = next;
+    }
+    //候補から外す
+    idx = mWaiting.head;
+    while (idx != NONE) {
+        int32_t next = mEntry[idx].next;
+        mEntry[idx].peers &= ~PEER_BIT(Peer);
+        if (mEntry[idx].peers == 0) {
+            forget(idx);
+        }
+        idx = next;
+    }
+    for (idx = mInflight.head; idx != NONE; idx = mEntry[idx].next) {
+        mEntry[idx].peers &= ~PEER_BIT(Peer);
+    }
+    mPeerAnn[Peer] = 0;
+    mPeers &= ~PEER_BIT(Peer);
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_txreq_announce(int Peer, const uint8_t *pTxid, uint64_t Now)
+{
+    bool ret = false;
+
+    if (Peer == NONE) {
+        return true;
+    }
+    pthread_mutex_lock(&mMux);
+    init();
+    int32_t idx = find(pTxid, NULL);
+    if ((mPeerAnn[Peer] >= BC_TXREQ_PEER_ANN_MAX) && ((idx == NONE) || !has_peer(idx, Peer))) {
+        //通知が多すぎる
+        ret = false;
+    } else if (idx == NONE) {
+        idx = new_entry(pTxid);
+        if (idx != NONE) {
+            request(idx, Peer, Now);
+        }
+        //管理できなくても取得はする
+        ret = true;
+    } else if (mEntry[idx].req_peer == NONE) {
+        //待ち: 引き取る
+        list_unlink(&mWaiting, idx);
+        request(idx, Peer, Now);
+        ret = true;
+    } else if (!has_peer(idx, Peer)) {
+        mEntry[idx].peers |= PEER_BIT(Peer);
+        mPeerAnn[Peer]++;
+    }
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+void bc_txreq_received(const uint8_t *pTxid)
+{
+    pthread_mutex_lock(&mMux);
+    init();
+    int32_t idx = find(pTxid, NULL);
+    if (idx != NONE) {
+        forget(idx);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void bc_txreq_notfound(int Peer, const uint8_t *pTxid)
+{
+    if (Peer == NONE) {
+        return;
+    }
+    pthread_mutex_lock(&mMux);
+    init();
+    int32_t idx = find(pTxid, NULL);
+    if (idx != NONE) {
+        if (mEntry[idx].peers & PEER_BIT(Peer)) {
+            mEntry[idx].peers &= ~PEER_BIT(Peer);
+            mPeerAnn[Peer]--;
+        }
+        if (mEntry[idx].req_peer == Peer) {
+            release(idx);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+int bc_txreq_poll(int Peer, uint64_t Now, uint8_t *pTxids, int Max)
+{
+    int num = 0;
+
+    pthread_mutex_lock(&mMux);
+    init();
+    //timeout
+    while ((mInflight.head != NONE) && (mEntry[mInflight.head].expire <= Now)) {
+        int32_t idx = mInflight.head;
+        LOGD("timeout(peer=%d)\n", mEntry[idx].req_peer);
+        release(idx);
+    }
+    //Peerが候補のものを引き取る
+    if (Peer != NONE) {
+        int32_t idx = mWaiting.head;
+        while ((idx != NONE) && (num < Max)) {
+            int32_t next = mEntry[idx].next;
+            if (mEntry[idx].peers & PEER_BIT(Peer)) {
+                list_unlink(&mWaiting, idx);
+                request(idx, Peer, Now);
+                MEMCPY(pTxids + num * 32, mEntry[idx].txid, 32);
+                num++;
+            }
+            idx = next;
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+    return num;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 初期化(mMux取得済み)
+ *
+ */
+static void init(void)
+{
+    if (mInit) {
+        return;
+    }
+    for (int lp = 0; lp < HASH_SZ; lp++) {
+        mBucket[lp] = NONE;
+    }
+    mInflight.head = mInflight.tail = NONE;
+    mWaiting.head = mWaiting.tail = NONE;
+    mFree.head = mFree.tail = NONE;
+    for (int32_t lp = 0; lp < BC_TXREQ_MAX; lp++) {
+        list_push(&mFree, lp);
+    }
+    mKey[0] = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ (uint64_t)time(NULL);
+    mKey[1] = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    mInit = true;
+}
+
+
+/** bucket位置
+ *
+ * txidは相手が選べるので、そのままではなくmKeyを混ぜる(bc_knownと同じ)。
+ */
+static uint32_t hash_idx(const uint8_t *pTxid)
+{
+    uint64_t a;
+    uint64_t b;
+    MEMCPY(&a, pTxid, sizeof(a));
+    MEMCPY(&b, pTxid + 8, sizeof(b));
+    uint64_t x = a ^ mKey[0] ^ ((b ^ mKey[1]) * 0x9e3779b97f4a7c15ULL);
+    //murmur3 finalizer
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (uint32_t)x & (HASH_SZ - 1);
+}
+
+
+/** 検索
+ *
+ * @param[in]   pTxid       txid
+ * @param[out]  ppLink      見つかったentryを指しているlink(NULL可)
+ * @return      entry index(NONE:なし)
+ */
+static int32_t find(const uint8_t *pTxid, int32_t **ppLink)
+{
+    int32_t *p_link = &mBucket[hash_idx(pTxid)];
+    while (*p_link != NONE) {
+        if (MEMCMP(mEntry[*p_link].txid, pTxid, 32) == 0) {
+            if (ppLink != NULL) {
+                *ppLink = p_link;
+            }
+            return *p_link;
+        }
+        p_link = &mEntry[*p_link].hnext;
+    }
+    return NONE;
+}
+
+
+/** entry追加(listにはつながない)
+ *
+ */
+static int32_t new_entry(const uint8_t *pTxid)
+{
+    int32_t idx = mFree.head;
+    if (idx == NONE) {
+        return NONE;
+    }
+    list_unlink(&mFree, idx);
+
+    entry_t *p_ent = &mEntry[idx];
+    MEMCPY(p_ent->txid, pTxid, 32);
+    p_ent->peers = 0;
+    p_ent->req_peer = NONE;
+    uint32_t h = hash_idx(pTxid);
+    p_ent->hnext = mBucket[h];
+    mBucket[h] = idx;
+    return idx;
+}
+
+
+/** entry削除
+ *
+ */
+static void forget(int32_t Idx)
+{
+    entry_t *p_ent = &mEntry[Idx];
+    int32_t *p_link = NULL;
+
+    list_unlink((p_ent->req_peer != NONE) ? &mInflight : &mWaiting, Idx);
+    if (p_ent->req_peer != NONE) {
+        mPeerAnn[p_ent->req_peer]--;
+    }
+    for (int lp = 0; lp < BC_TXREQ_PEER_MAX; lp++) {
+        if (p_ent->peers & PEER_BIT(lp)) {
+            mPeerAnn[lp]--;
+        }
+    }
+    find(p_ent->txid, &p_link);
+    *p_link = p_ent->hnext;
+    list_push(&mFree, Idx);
+}
+
+
+/** 要求中にする(どのlistにもつながっていないこと)
+ *
+ * 候補だったPeerは数を変えずに要求中へ移す。
+ */
+static void request(int32_t Idx, int Peer, uint64_t Now)
+{
+    entry_t *p_ent = &mEntry[Idx];
+    if (p_ent->peers & PEER_BIT(Peer)) {
+        p_ent->peers &= ~PEER_BIT(Peer);
+    } else {
+        mPeerAnn[Peer]++;
+    }
+    p_ent->req_peer = Peer;
+    p_ent->expire = Now + BC_TXREQ_TIMEOUT_USEC;
+    list_push(&mInflight, Idx);
+}
+
+
+/** 要求中から外す
+ *
+ * 候補が残っていれば待ち、無ければ忘れる。
+ */
+static void release(int32_t Idx)
+{
+    entry_t *p_ent = &mEntry[Idx];
+    if (p_ent->peers == 0) {
+        forget(Idx);
+        return;
+    }
+    list_unlink(&mInflight, Idx);
+    mPeerAnn[p_ent->req_peer]--;
+    p_ent->req_peer = NONE;
+    list_push(&mWaiting, Idx);
+}
+
+
+static void list_push(list_t *pList, int32_t Idx)
+{
+    mEntry[Idx].prev = pList->tail;
+    mEntry[Idx].next = NONE;
+    if (pList->tail != NONE) {
+        mEntry[pList->tail].next = Idx;
+    } else {
+        pList->head = Idx;
+    }
+    pList->tail = Idx;
+}
+
+
+static void list_unlink(list_t *pList, int32_t Idx)
+{
+    entry_t *p_ent = &mEntry[Idx];
+    if (p_ent->prev != NONE) {
+        mEntry[p_ent->prev].next = p_ent->next;
+    } else {
+        pList->head = p_ent->next;
+    }
+    if (p_ent->next != NONE) {
+        mEntry[p_ent->next].prev = p_ent->prev;
+    } else {
+        pList->tail = p_ent->prev;
+    }
+}
+
+
+/** Peerが要求中か候補か
+ *
+ */
+static bool has_peer(int32_t Idx, int Peer)
+{
+    return (mEntry[Idx].req_peer == Peer) || ((mEntry[Idx].peers & PEER_BIT(Peer)) != 0);
+}
@@ -0,0 +1,264 @@
+/**************************************************************************
+ * @file    bc_txview.c
+ * @brief   raw txの部分読み(確保なし)
+ * @note
+ *      - 照合に要るのはoutpointとscriptPubKeyだけなので、btc_tx_read()のようにscriptごとに確保しない
+ *      - bc_txview_parse()で範囲を確認済みなので、走査時は長さを確認しない
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_txview.h"
+#include "bc_sha256.h"
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool get_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal);
+static uint64_t read_varint(const uint8_t **pp);
+static uint32_t read_le(const uint8_t *p, int Len);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_txview_parse(bc_txview_t *pView, const uint8_t *pData, size_t Len)
+{
+    const uint8_t *p = pData;
+    const uint8_t *p_end = pData + Len;
+    uint64_t cnt;
+    uint64_t len;
+
+#define SKIP(n) do { if ((uint64_t)(p_end - p) < (uint64_t)(n)) return false; p += (n); } while (0)
+#define VARINT(v) do { if (!get_varint(&p, p_end, &(v))) return false; } while (0)
+
+    MEMSET(pView, 0, sizeof(bc_txview_t));
+    pView->p_tx = pData;
+
+    SKIP(4);            //version
+    if ((p_end - p >= 2) && (p[0] == 0x00) && (p[1] == 0x01)) {
+        pView->segwit = true;
+        SKIP(2);
+    }
+    pView->p_vin = p;
+    VARINT(cnt);
+    if (cnt > (uint64_t)(p_end - p) / (BC_TXVIEW_OUTPOINT_SZ + 1 + 4)) {
+        return false;
+    }
+    pView->vin_cnt = (uint32_t)cnt;
+    for (uint64_t lp = 0; lp < cnt; lp++) {
+        SKIP(BC_TXVIEW_OUTPOINT_SZ);
+        VARINT(len);
+        SKIP(len);      //scriptSig
+        SKIP(4);        //sequence
+    }
+    pView->p_vout = p;
+    VARINT(cnt);
+    if (cnt > (uint64_t)(p_end - p) / (8 + 1)) {
+        return false;
+    }
+    pView->vout_cnt = (uint32_t)cnt;
+    for (uint64_t lp = 0; lp < cnt; lp++) {
+        SKIP(8);        //value
+        VARINT(len);
+        SKIP(len);      //scriptPubKey
+    }
+    if (pView->segwit) {
+        pView->p_wit = p;
+        for (uint32_t lp = 0; lp < pView->vin_cnt; lp++) {
+            uint64_t items;
+            VARINT(items);
+            for (uint64_t item = 0; item < items; item++) {
+                VARINT(len);
+                SKIP(len);
+            }
+        }
+    }
+    pView->p_locktime = p;
+    SKIP(4);            //locktime
+
+#undef VARINT
+#undef SKIP
+
+    pView->len = (uint32_t)(p - pData);
+    return true;
+}
+
+
+void bc_txview_vin_begin(const bc_txview_t *pView, bc_txview_iter_t *pIter)
+{
+    pIter->idx = 0;
+    pIter->p = pView->p_vin;
+    read_varint(&pIter->p);
+    pIter->p_wit = pView->p_wit;
+}
+
+
+bool bc_txview_vin_next(const bc_txview_t *pView, bc_txview_iter_t *pIter, bc_txview_vin_t *pVin)
+{
+    if (pIter->idx >= pView->vin_cnt) {
+        return false;
+    }
+    pVin->p_outpoint = pIter->p;
+    pIter->p += BC_TXVIEW_OUTPOINT_SZ;
+    pVin->script_len = (uint32_t)read_varint(&pIter->p);
+    pVin->p_script = pIter->p;
+    pIter->p += pVin->script_len;
+    pVin->sequence = read_le(pIter->p, 4);
+    pIter->p += 4;
+
+    pVin->p_wit = NULL;
+    pVin->wit_cnt = 0;
+    if (pIter->p_wit != NULL) {
+        pVin->wit_cnt = (uint32_t)read_varint(&pIter->p_wit);
+        pVin->p_wit = pIter->p_wit;
+        for (uint32_t lp = 0; lp < pVin->wit_cnt; lp++) {
+            uint64_t len = read_varint(&pIter->p_wit);
+            pIter->p_wit += len;
+        }
+    }
+    pIter->idx++;
+    return true;
+}
+
+
+void bc_txview_vout_begin(const bc_txview_t *pView, bc_txview_iter_t *pIter)
+{
+    pIter->idx = 0;
+    pIter->p = pView->p_vout;
+    read_varint(&pIter->p);
+    pIter->p_wit = NULL;
+}
+
+
+bool bc_txview_vout_next(const bc_txview_t *pView, bc_txview_iter_t *pIter, bc_txview_vout_t *pVout)
+{
+    if (pIter->idx >= pView->vout_cnt) {
+        return false;
+    }
+    pVout->value = read_le(pIter->p, 4) | ((uint64_t)read_le(pIter->p + 4, 4) << 32);
+    pIter->p += 8;
+    pVout->script_len = (uint32_t)read_varint(&pIter->p);
+    pVout->p_script = pIter->p;
+    pIter->p += pVout->script_len;
+    pIter->idx++;
+    return true;
+}
+
+
+bool bc_txview_wit_item(const bc_txview_vin_t *pVin, uint32_t Idx, const uint8_t **ppData, uint32_t *pLen)
+{
+    if (Idx >= pVin->wit_cnt) {
+        return false;
+    }
+    const uint8_t *p = pVin->p_wit;
+    for (uint32_t lp = 0; lp < Idx; lp++) {
+        uint64_t len = read_varint(&p);
+        p += len;
+    }
+    *pLen = (uint32_t)read_varint(&p);
+    *ppData = p;
+    return true;
+}
+
+
+void bc_txview_txid(const bc_txview_t *pView, uint8_t *pTxid)
+{
+    if (!pView->segwit) {
+        bc_sha256_hash256(pTxid, pView->p_tx, pView->len);
+        return;
+    }
+
+    //version | vin, vout | locktime
+    bc_sha256_t ctx;
+    uint8_t sha[BC_SHA256_SZ_HASH];
+    bc_sha256_init(&ctx);
+    bc_sha256_update(&ctx, pView->p_tx, 4);
+    bc_sha256_update(&ctx, pView->p_vin, pView->p_wit - pView->p_vin);
+    bc_sha256_update(&ctx, pView->p_locktime, 4);
+    bc_sha256_final(sha, &ctx);
+    bc_sha256_second(pTxid, sha);
+}
+
+
+void bc_txview_wtxid(const bc_txview_t *pView, uint8_t *pWtxid)
+{
+    bc_sha256_hash256(pWtxid, pView->p_tx, pView->len);
+}
+
+
+bool bc_txview_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal)
+{
+    return get_varint(pp, pEnd, pVal);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** varint読込み(長さ確認あり)
+ *
+ */
+static bool get_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal)
+{
+    const uint8_t *p = *pp;
+    if (p >= pEnd) {
+        return false;
+    }
+    int sz = (*p == 0xff) ? 8 : (*p == 0xfe) ? 4 : (*p == 0xfd) ? 2 : 0;
+    if (p + 1 + sz > pEnd) {
+        return false;
+    }
+    *pVal = read_varint(pp);
+    return true;
+}
+
+
+/** varint読込み(確認済みの範囲)
+ *
+ */
+static uint64_t read_varint(const uint8_t **pp)
+{
+    const uint8_t *p = *pp;
+    uint64_t val;
+
+    switch (*p) {
+    case 0xff:
+        val = read_le(p + 1, 4) | ((uint64_t)read_le(p + 5, 4) << 32);
+        *pp = p + 9;
+        break;
+    case 0xfe:
+        val = read_le(p + 1, 4);
+        *pp = p + 5;
+        break;
+    case 0xfd:
+        val = read_le(p + 1, 2);
+        *pp = p + 3;
+        break;
+    default:
+        val = *p;
+        *pp = p + 1;
+        break;
+    }
+    return val;
+}
+
+
+/** little endian読込み
+ *
+ */
+static uint32_t read_le(const uint8_t *p, int Len)
+{
+    uint32_t val = 0;
+    for (int lp = Len - 1; lp >= 0; lp--) {
+        val = (val << 8) | p[lp];
+    }
+    return val;
+}
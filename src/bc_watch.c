@@ -0,0 +1,809 @@
+/**************************************************************************
+ * @file    bc_watch.c
+ * @brief   監視対象(watch list)
+ * @note
+ *      - scriptPubKey, pubkey hash, outpointをopen addressing(線形探索)のhash setで持つ
+ *      - slotは(hash, index)の8byteだけにし、要素本体は連続した領域に詰める
+ *      - bloom filter, compact filter用の一覧は呼び出し毎に複製を返す(呼び元で解放)
+ *      - 削除はslotを後ろから詰め、要素は末尾と入れ替える。mpKeysの穴が半分を超えたら詰め直す
+ *      - outpointはblockに入ったtxで使われたら削除する
+ *      - txはbc_txviewで確保せずに読む
+ **************************************************************************/
+#include "user_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "btc.h"
+
+#include "bc_misc.h"
+#include "bc_watch.h"
+#include "bc_txview.h"
+
+#define LOG_TAG     "watch"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define SLOT_INIT               (1024)          ///< slot数初期値(2のべき乗)
+#define LINE_MAX_LEN            (BC_WATCH_DATA_MAX * 2 + 64)
+
+#define OP_PUSHDATA1            (0x4c)
+#define OP_PUSHDATA2            (0x4d)
+#define OP_PUSHDATA4            (0x4e)
+#define OP_DUP                  (0x76)
+#define OP_HASH160              (0xa9)
+#define OP_EQUALVERIFY          (0x88)
+#define OP_CHECKSIG             (0xac)
+
+#define SZ_PUBKEY_UNCOMP        (65)
+#define SZ_SCRIPT_P2PKH         (25)
+#define SZ_SCRIPT_P2WPKH        (22)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+typedef struct {
+    uint32_t    hash;                   ///< hash値
+    uint32_t    idx;                    ///< mpEntry index + 1(0:空き)
+} slot_t;
+
+
+typedef struct {
+    uint32_t    offset;                 ///< mpKeys内の位置
+    uint16_t    len;
+    uint8_t     type;                   ///< bc_watch_type_t
+} entry_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static uint32_t hash_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+static bool find_key(uint32_t Hash, bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+static bool grow_slot(void);
+static bool add_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+static bool remove_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len);
+static void compact_keys(void);
+static bool find_pubkey(const uint8_t *pPub, size_t Len);
+static bool read_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal);
+static bool hex2bin(uint8_t *pOut, size_t *pLen, const char *pStr, size_t Max);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+//FNAME_WATCHが無い場合の監視対象
+static const uint8_t kDefaultPubKeyHash[] = {
+    //tb1qv8vryy3656pkkj3vpmewmpj2aqg9gemlf582lh
+    0x61, 0xd8, 0x32, 0x12, 0x3a, 0xa6,
+    0x83, 0x6b, 0x4a, 0x2c, 0x0e, 0xf2, 0xed, 0x86,
+    0x4a, 0xe8, 0x10, 0x54, 0x67, 0x7f,
+};
+
+static slot_t           *mpSlot;
+static uint32_t         mSlotNum;               ///< 2のべき乗
+static entry_t          *mpEntry;
+static uint32_t         mEntryNum;
+static uint32_t         mEntryCap;
+static uint8_t          *mpKeys;
+static size_t           mKeySize;
+static size_t           mKeyCap;
+static size_t           mKeyHole;               ///< mpKeys中の削除済みbyte数
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool bc_watch_init(void)
+{
+    bool ret = true;
+    FILE *fp = fopen(FNAME_WATCH, "r");
+    if (fp != NULL) {
+        fclose(fp);
+        ret = bc_watch_load(FNAME_WATCH, NULL, NULL);
+    }
+    if (bc_watch_count() == 0) {
+        LOGD("no watch list: use default\n");
+        bc_watch_add(BC_WATCH_PKH, kDefaultPubKeyHash, sizeof(kDefaultPubKeyHash));
+    }
+    return ret;
+}
+
+
+void bc_watch_term(void)
+{
+    pthread_mutex_lock(&mMux);
+    FREE(mpSlot);
+    FREE(mpEntry);
+    FREE(mpKeys);
+    mpSlot = NULL;
+    mpEntry = NULL;
+    mpKeys = NULL;
+    mSlotNum = 0;
+    mEntryNum = 0;
+    mEntryCap = 0;
+    mKeySize = 0;
+    mKeyCap = 0;
+    mKeyHole = 0;
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool bc_watch_load(const char *pFname, bc_watch_add_t pAdd, void *pArg)
+{
+    FILE *fp = fopen(pFname, "r");
+    if (fp == NULL) {
+        LOGE("fail: open %s: %s\n", pFname, strerror(errno));
+        return false;
+    }
+
+    char *p_line = (char *)MALLOC(LINE_MAX_LEN);
+    uint8_t *p_data = (uint8_t *)MALLOC(BC_WATCH_DATA_MAX);
+    int line = 0;
+    int added = 0;
+    if ((p_line == NULL) || (p_data == NULL)) {
+        LOGE("fail: malloc\n");
+        FREE(p_data);
+        FREE(p_line);
+        fclose(fp);
+        return false;
+    }
+    while (fgets(p_line, LINE_MAX_LEN, fp) != NULL) {
+        line++;
+        char *p = strchr(p_line, '#');
+        if (p != NULL) {
+            *p = '\0';
+        }
+        char *p_save;
+        char *p_type = strtok_r(p_line, " \t\r\n", &p_save);
+        char *p_val = strtok_r(NULL, " \t\r\n", &p_save);
+        if (p_type == NULL) {
+            continue;
+        }
+
+        bc_watch_type_t type;
+        size_t len = 0;
+        bool ok = (p_val != NULL);
+        if (ok && (strcmp(p_type, "pkh") == 0)) {
+            type = BC_WATCH_PKH;
+            ok = hex2bin(p_data, &len, p_val, BC_WATCH_DATA_MAX) && (len == BTC_SZ_HASH160);
+        } else if (ok && (strcmp(p_type, "script") == 0)) {
+            type = BC_WATCH_SCRIPT;
+            ok = hex2bin(p_data, &len, p_val, BC_WATCH_DATA_MAX) && (len > 0);
+        } else if (ok && (strcmp(p_type, "outpoint") == 0)) {
+            type = BC_WATCH_OUTPOINT;
+            char *p_idx = strchr(p_val, ':');
+            ok = (p_idx != NULL);
+            if (ok) {
+                *p_idx++ = '\0';
+                ok = hex2bin(p_data, &len, p_val, BC_WATCH_DATA_MAX) && (len == BTC_SZ_TXID);
+            }
+            if (ok) {
+                //表示順から内部順にする
+                for (int lp = 0; lp < BTC_SZ_TXID / 2; lp++) {
+                    uint8_t tmp = p_data[lp];
+                    p_data[lp] = p_data[BTC_SZ_TXID - 1 - lp];
+                    p_data[BTC_SZ_TXID - 1 - lp] = tmp;
+                }
+                char *p_end;
+                errno = 0;
+                unsigned long idx = strtoul(p_idx, &p_end, 10);
+                ok = (*p_idx != '\0') && (*p_end == '\0') && (errno == 0) && (idx <= UINT32_MAX);
+                for (int lp = 0; lp < 4; lp++) {
+                    p_data[BTC_SZ_TXID + lp] = (uint8_t)(idx >> (8 * lp));
+                }
+                len = BC_WATCH_OUTPOINT_SZ;
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            LOGE("fail: %s:%d: invalid line\n", pFname, line);
+            continue;
+        }
+        if ((pAdd != NULL) ? (*pAdd)(pArg, type, p_data, len) : bc_watch_add(type, p_data, len)) {
+            added++;
+        }
+    }
+    FREE(p_data);
+    FREE(p_line);
+    fclose(fp);
+
+    LOGD("%s: %d added(total=%d)\n", pFname, added, bc_watch_count());
+    return true;
+}
+
+
+bool bc_watch_add(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    if ((Len == 0) || (Len > BC_WATCH_DATA_MAX)) {
+        return false;
+    }
+    pthread_mutex_lock(&mMux);
+    bool ret = add_key(Type, pData, Len);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_watch_remove(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = remove_key(Type, pData, Len);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+bool bc_watch_find(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = find_key(hash_key(Type, pData, Len), Type, pData, Len);
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+int bc_watch_count(void)
+{
+    pthread_mutex_lock(&mMux);
+    int num = (int)mEntryNum;
+    pthread_mutex_unlock(&mMux);
+    return num;
+}
+
+
+bool bc_watch_output(const uint8_t *pScript, size_t Len)
+{
+    if (bc_watch_find(BC_WATCH_SCRIPT, pScript, Len)) {
+        return true;
+    }
+    if ((Len == SZ_SCRIPT_P2PKH) && (pScript[0] == OP_DUP) && (pScript[1] == OP_HASH160) &&
+            (pScript[2] == BTC_SZ_HASH160) && (pScript[23] == OP_EQUALVERIFY) && (pScript[24] == OP_CHECKSIG)) {
+        return bc_watch_find(BC_WATCH_PKH, pScript + 3, BTC_SZ_HASH160);
+    }
+    if ((Len == SZ_SCRIPT_P2WPKH) && (pScript[0] == 0x00) && (pScript[1] == BTC_SZ_HASH160)) {
+        return bc_watch_find(BC_WATCH_PKH, pScript + 2, BTC_SZ_HASH160);
+    }
+    //P2PK
+    if ((Len >= 2) && (pScript[0] == Len - 2) && (pScript[Len - 1] == OP_CHECKSIG)) {
+        return find_pubkey(pScript + 1, Len - 2);
+    }
+    return false;
+}
+
+
+bool bc_watch_tx(const uint8_t *pTx, uint32_t Len)
+{
+    bc_txview_t view;
+
+    if (!bc_txview_parse(&view, pTx, Len) || (view.len != Len)) {
+        return false;
+    }
+    return bc_watch_txview(&view);
+}
+
+
+bool bc_watch_txview(const bc_txview_t *pView)
+{
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    bc_txview_vout_t vout;
+    bool ret = false;
+
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        if (bc_watch_find(BC_WATCH_OUTPOINT, vin.p_outpoint, BC_WATCH_OUTPOINT_SZ)) {
+            ret = true;
+            break;
+        }
+        //公開鍵: P2WPKHはwitness[1]、P2PKHはscriptSigの最後のpush
+        const uint8_t *p_pub;
+        uint32_t pub_len;
+        if ((vin.wit_cnt == 2) && bc_txview_wit_item(&vin, 1, &p_pub, &pub_len) && find_pubkey(p_pub, pub_len)) {
+            ret = true;
+            break;
+        }
+        if ((vin.script_len > BTC_SZ_PUBKEY) && (vin.p_script[vin.script_len - BTC_SZ_PUBKEY - 1] == BTC_SZ_PUBKEY) &&
+                find_pubkey(vin.p_script + vin.script_len - BTC_SZ_PUBKEY, BTC_SZ_PUBKEY)) {
+            ret = true;
+            break;
+        }
+        if ((vin.script_len > SZ_PUBKEY_UNCOMP) && (vin.p_script[vin.script_len - SZ_PUBKEY_UNCOMP - 1] == SZ_PUBKEY_UNCOMP) &&
+                find_pubkey(vin.p_script + vin.script_len - SZ_PUBKEY_UNCOMP, SZ_PUBKEY_UNCOMP)) {
+            ret = true;
+            break;
+        }
+    }
+
+    bool b_txid = false;
+    uint8_t outpoint[BC_WATCH_OUTPOINT_SZ];
+    bc_txview_vout_begin(pView, &it);
+    while (bc_txview_vout_next(pView, &it, &vout)) {
+        if (!bc_watch_output(vout.p_script, vout.script_len)) {
+            continue;
+        }
+        ret = true;
+        //使われた時にわかるようoutpointを監視する
+        if (!b_txid) {
+            bc_txview_txid(pView, outpoint);
+            b_txid = true;
+        }
+        uint32_t idx = it.idx - 1;
+        uint8_t *p = outpoint + BTC_SZ_TXID;
+        for (int lp = 0; lp < 4; lp++) {
+            *p++ = (uint8_t)(idx >> (8 * lp));
+        }
+        if (bc_watch_add(BC_WATCH_OUTPOINT, outpoint, sizeof(outpoint))) {
+            LOGD("watch outpoint: %" PRIu32 "\n", idx);
+        }
+    }
+    return ret;
+}
+
+
+int bc_watch_spent(const bc_txview_t *pView)
+{
+    bc_txview_iter_t it;
+    bc_txview_vin_t vin;
+    int removed = 0;
+
+    bc_txview_vin_begin(pView, &it);
+    while (bc_txview_vin_next(pView, &it, &vin)) {
+        if (bc_watch_remove(BC_WATCH_OUTPOINT, vin.p_outpoint, BC_WATCH_OUTPOINT_SZ)) {
+            LOGD("unwatch outpoint: %" PRIu32 "\n", it.idx - 1);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+
+int bc_watch_block(const uint8_t *pBlock, size_t Len, bool bConfirmed)
+{
+    const uint8_t *p = pBlock + BC_WATCH_HEADERS_SZ;
+    const uint8_t *p_end = pBlock + Len;
+    uint64_t count;
+    int matched = 0;
+
+    if ((Len < BC_WATCH_HEADERS_SZ) || !read_varint(&p, p_end, &count)) {
+        return -1;
+    }
+    for (uint64_t lp = 0; lp < count; lp++) {
+        bc_txview_t view;
+        if (!bc_txview_parse(&view, p, p_end - p)) {
+            LOGE("fail: invalid tx(%" PRIu64 ")\n", lp);
+            return -1;
+        }
+        if (bc_watch_txview(&view)) {
+            matched++;
+        }
+        if (bConfirmed) {
+            bc_watch_spent(&view);
+        }
+        p += view.len;
+    }
+    return matched;
+}
+
+
+void bc_watch_bloom_element(bc_watch_type_t Type, const uint8_t *pData, size_t Len, utl_buf_t *pElem)
+{
+    pElem->buf = (uint8_t *)pData;
+    pElem->len = (uint32_t)Len;
+    if (Type != BC_WATCH_SCRIPT) {
+        return;
+    }
+
+    //BIP37はscriptPubKeyのdata pushと照合する
+    size_t pos = 0;
+    size_t best = 0;
+    while (pos < Len) {
+        uint8_t op = pData[pos++];
+        size_t sz;
+        if ((0x01 <= op) && (op < OP_PUSHDATA1)) {
+            sz = op;
+        } else if ((op == OP_PUSHDATA1) && (pos + 1 <= Len)) {
+            sz = pData[pos];
+            pos += 1;
+        } else if ((op == OP_PUSHDATA2) && (pos + 2 <= Len)) {
+            sz = pData[pos] | (pData[pos + 1] << 8);
+            pos += 2;
+        } else if ((op == OP_PUSHDATA4) && (pos + 4 <= Len)) {
+            sz = pData[pos] | (pData[pos + 1] << 8) | (pData[pos + 2] << 16) | ((size_t)pData[pos + 3] << 24);
+            pos += 4;
+        } else {
+            continue;
+        }
+        if (pos + sz > Len) {
+            break;
+        }
+        if (sz > best) {
+            best = sz;
+            pElem->buf = (uint8_t *)pData + pos;
+            pElem->len = (uint32_t)sz;
+        }
+        pos += sz;
+    }
+}
+
+
+utl_buf_t *bc_watch_bloom_elements(int *pNum)
+{
+    pthread_mutex_lock(&mMux);
+    //要素はpData内の一部なので、元の長さの合計で足りる
+    utl_buf_t *p_elems = (utl_buf_t *)MALLOC(sizeof(utl_buf_t) * mEntryNum + mKeySize + 1);
+    if (p_elems == NULL) {
+        LOGE("fail: malloc\n");
+        pthread_mutex_unlock(&mMux);
+        return NULL;
+    }
+    uint8_t *p = (uint8_t *)(p_elems + mEntryNum);
+    for (uint32_t lp = 0; lp < mEntryNum; lp++) {
+        const entry_t *p_ent = &mpEntry[lp];
+        utl_buf_t elem;
+        bc_watch_bloom_element((bc_watch_type_t)p_ent->type, mpKeys + p_ent->offset, p_ent->len, &elem);
+        MEMCPY(p, elem.buf, elem.len);
+        p_elems[lp].buf = p;
+        p_elems[lp].len = elem.len;
+        p += elem.len;
+    }
+    *pNum = (int)mEntryNum;
+    pthread_mutex_unlock(&mMux);
+    return p_elems;
+}
+
+
+utl_buf_t *bc_watch_scripts(int *pNum)
+{
+    pthread_mutex_lock(&mMux);
+    size_t sz = 0;
+    int num = 0;
+    for (uint32_t lp = 0; lp < mEntryNum; lp++) {
+        if (mpEntry[lp].type == BC_WATCH_PKH) {
+            sz += SZ_SCRIPT_P2PKH + SZ_SCRIPT_P2WPKH;
+            num += 2;
+        } else if (mpEntry[lp].type == BC_WATCH_SCRIPT) {
+            sz += mpEntry[lp].len;
+            num++;
+        }
+    }
+    utl_buf_t *p_scripts = (utl_buf_t *)MALLOC(sizeof(utl_buf_t) * num + sz + 1);
+    if (p_scripts == NULL) {
+        LOGE("fail: malloc\n");
+        pthread_mutex_unlock(&mMux);
+        return NULL;
+    }
+
+    uint8_t *p = (uint8_t *)(p_scripts + num);
+    num = 0;
+    for (uint32_t lp = 0; lp < mEntryNum; lp++) {
+        const entry_t *p_ent = &mpEntry[lp];
+        if (p_ent->type == BC_WATCH_PKH) {
+            //P2PKH
+            p[0] = OP_DUP;
+            p[1] = OP_HASH160;
+            p[2] = BTC_SZ_HASH160;
+            MEMCPY(p + 3, mpKeys + p_ent->offset, BTC_SZ_HASH160);
+            p[23] = OP_EQUALVERIFY;
+            p[24] = OP_CHECKSIG;
+            p_scripts[num].buf = p;
+            p_scripts[num].len = SZ_SCRIPT_P2PKH;
+            num++;
+            p += SZ_SCRIPT_P2PKH;
+            //P2WPKH
+            p[0] = 0x00;
+            p[1] = BTC_SZ_HASH160;
+            MEMCPY(p + 2, mpKeys + p_ent->offset, BTC_SZ_HASH160);
+            p_scripts[num].buf = p;
+            p_scripts[num].len = SZ_SCRIPT_P2WPKH;
+            num++;
+            p += SZ_SCRIPT_P2WPKH;
+        } else if (p_ent->type == BC_WATCH_SCRIPT) {
+            MEMCPY(p, mpKeys + p_ent->offset, p_ent->len);
+            p_scripts[num].buf = p;
+            p_scripts[num].len = p_ent->len;
+            num++;
+            p += p_ent->len;
+        }
+    }
+    *pNum = num;
+    pthread_mutex_unlock(&mMux);
+    return p_scripts;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 要素のhash値(FNV-1a)
+ *
+ */
+static uint32_t hash_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)Type;
+    for (size_t lp = 0; lp < Len; lp++) {
+        h ^= pData[lp];
+        h *= 0x100000001b3ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+
+/** 要素検索(mMux取得済み)
+ *
+ */
+static bool find_key(uint32_t Hash, bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    if (mSlotNum == 0) {
+        return false;
+    }
+    uint32_t mask = mSlotNum - 1;
+    for (uint32_t pos = Hash & mask; mpSlot[pos].idx != 0; pos = (pos + 1) & mask) {
+        if (mpSlot[pos].hash != Hash) {
+            continue;
+        }
+        const entry_t *p_ent = &mpEntry[mpSlot[pos].idx - 1];
+        if ((p_ent->type == Type) && (p_ent->len == Len) &&
+                (MEMCMP(mpKeys + p_ent->offset, pData, Len) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** slot数を倍にする(mMux取得済み)
+ *
+ */
+static bool grow_slot(void)
+{
+    uint32_t num = (mSlotNum == 0) ? SLOT_INIT : mSlotNum * 2;
+    slot_t *p_slot = (slot_t *)CALLOC(num, sizeof(slot_t));
+    if (p_slot == NULL) {
+        LOGE("fail: calloc\n");
+        return false;
+    }
+    uint32_t mask = num - 1;
+    for (uint32_t lp = 0; lp < mSlotNum; lp++) {
+        if (mpSlot[lp].idx == 0) {
+            continue;
+        }
+        uint32_t pos = mpSlot[lp].hash & mask;
+        while (p_slot[pos].idx != 0) {
+            pos = (pos + 1) & mask;
+        }
+        p_slot[pos] = mpSlot[lp];
+    }
+    FREE(mpSlot);
+    mpSlot = p_slot;
+    mSlotNum = num;
+    return true;
+}
+
+
+/** 要素追加(mMux取得済み)
+ *
+ * 使用率が1/2を超えないようにslotを広げる。
+ */
+static bool add_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    uint32_t hash = hash_key(Type, pData, Len);
+    if (find_key(hash, Type, pData, Len)) {
+        return false;
+    }
+    if (((mEntryNum + 1) * 2 > mSlotNum) && !grow_slot()) {
+        return false;
+    }
+    if (mEntryNum == mEntryCap) {
+        uint32_t cap = (mEntryCap == 0) ? SLOT_INIT / 2 : mEntryCap * 2;
+        entry_t *p_ent = (entry_t *)REALLOC(mpEntry, sizeof(entry_t) * cap);
+        if (p_ent == NULL) {
+            LOGE("fail: realloc\n");
+            return false;
+        }
+        mpEntry = p_ent;
+        mEntryCap = cap;
+    }
+    if (mKeySize + Len > mKeyCap) {
+        size_t cap = (mKeyCap == 0) ? SLOT_INIT * BTC_SZ_HASH160 : mKeyCap * 2;
+        while (mKeySize + Len > cap) {
+            cap *= 2;
+        }
+        uint8_t *p_keys = (uint8_t *)REALLOC(mpKeys, cap);
+        if (p_keys == NULL) {
+            LOGE("fail: realloc\n");
+            return false;
+        }
+        mpKeys = p_keys;
+        mKeyCap = cap;
+    }
+
+    entry_t *p_ent = &mpEntry[mEntryNum];
+    p_ent->offset = (uint32_t)mKeySize;
+    p_ent->len = (uint16_t)Len;
+    p_ent->type = (uint8_t)Type;
+    MEMCPY(mpKeys + mKeySize, pData, Len);
+    mKeySize += Len;
+    mEntryNum++;
+
+    uint32_t mask = mSlotNum - 1;
+    uint32_t pos = hash & mask;
+    while (mpSlot[pos].idx != 0) {
+        pos = (pos + 1) & mask;
+    }
+    mpSlot[pos].hash = hash;
+    mpSlot[pos].idx = mEntryNum;
+    return true;
+}
+
+
+/** 要素削除(mMux取得済み)
+ *
+ * 線形探索なので、空いたslotより後ろで本来の位置が手前のものを詰める。
+ * 要素本体は末尾と入れ替え、移したもののslotを付け替える。
+ */
+static bool remove_key(bc_watch_type_t Type, const uint8_t *pData, size_t Len)
+{
+    if (mSlotNum == 0) {
+        return false;
+    }
+    uint32_t hash = hash_key(Type, pData, Len);
+    uint32_t mask = mSlotNum - 1;
+    uint32_t pos;
+    uint32_t idx = 0;
+    for (pos = hash & mask; mpSlot[pos].idx != 0; pos = (pos + 1) & mask) {
+        if (mpSlot[pos].hash != hash) {
+            continue;
+        }
+        const entry_t *p_ent = &mpEntry[mpSlot[pos].idx - 1];
+        if ((p_ent->type == Type) && (p_ent->len == Len) &&
+                (MEMCMP(mpKeys + p_ent->offset, pData, Len) == 0)) {
+            idx = mpSlot[pos].idx;
+            break;
+        }
+    }
+    if (idx == 0) {
+        return false;
+    }
+
+    //slot
+    uint32_t hole = pos;
+    for (uint32_t next = (hole + 1) & mask; mpSlot[next].idx != 0; next = (next + 1) & mask) {
+        uint32_t home = mpSlot[next].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            mpSlot[hole] = mpSlot[next];
+            hole = next;
+        }
+    }
+    mpSlot[hole].idx = 0;
+
+    //要素本体
+    mKeyHole += mpEntry[idx - 1].len;
+    if (idx != mEntryNum) {
+        const entry_t *p_last = &mpEntry[mEntryNum - 1];
+        uint32_t h = hash_key((bc_watch_type_t)p_last->type, mpKeys + p_last->offset, p_last->len);
+        for (pos = h & mask; mpSlot[pos].idx != mEntryNum; pos = (pos + 1) & mask) {
+        }
+        mpSlot[pos].idx = idx;
+        mpEntry[idx - 1] = *p_last;
+    }
+    mEntryNum--;
+
+    if (mKeyHole * 2 > mKeySize) {
+        compact_keys();
+    }
+    return true;
+}
+
+
+/** mpKeysの穴を詰める(mMux取得済み)
+ *
+ * 確保できなければ穴は残したままにする。
+ */
+static void compact_keys(void)
+{
+    uint8_t *p_keys = (uint8_t *)MALLOC(mKeyCap);
+    if (p_keys == NULL) {
+        return;
+    }
+    size_t size = 0;
+    for (uint32_t lp = 0; lp < mEntryNum; lp++) {
+        entry_t *p_ent = &mpEntry[lp];
+        MEMCPY(p_keys + size, mpKeys + p_ent->offset, p_ent->len);
+        p_ent->offset = (uint32_t)size;
+        size += p_ent->len;
+    }
+    FREE(mpKeys);
+    mpKeys = p_keys;
+    mKeySize = size;
+    mKeyHole = 0;
+}
+
+
+/** 公開鍵のHASH160が監視対象か
+ *
+ */
+static bool find_pubkey(const uint8_t *pPub, size_t Len)
+{
+    if ((Len != BTC_SZ_PUBKEY) && (Len != SZ_PUBKEY_UNCOMP)) {
+        return false;
+    }
+    uint8_t pkh[BTC_SZ_HASH160];
+    btc_util_hash160(pkh, pPub, (uint16_t)Len);
+    return bc_watch_find(BC_WATCH_PKH, pkh, BTC_SZ_HASH160);
+}
+
+
+/** varint読込み
+ *
+ */
+static bool read_varint(const uint8_t **pp, const uint8_t *pEnd, uint64_t *pVal)
+{
+    const uint8_t *p = *pp;
+    if (p >= pEnd) {
+        return false;
+    }
+    int sz = (*p == 0xff) ? 8 : (*p == 0xfe) ? 4 : (*p == 0xfd) ? 2 : 0;
+    if (sz == 0) {
+        *pVal = *p;
+        *pp = p + 1;
+        return true;
+    }
+    if (p + 1 + sz > pEnd) {
+        return false;
+    }
+    *pVal = 0;
+    for (int lp = 0; lp < sz; lp++) {
+        *pVal |= (uint64_t)p[1 + lp] << (8 * lp);
+    }
+    *pp = p + 1 + sz;
+    return true;
+}
+
+
+/** 16進文字列 → バイナリ
+ *
+ */
+static bool hex2bin(uint8_t *pOut, size_t *pLen, const char *pStr, size_t Max)
+{
+    size_t len = strlen(pStr);
+    if ((len % 2 != 0) || (len / 2 > Max)) {
+        return false;
+    }
+    for (size_t lp = 0; lp < len; lp++) {
+        char c = pStr[lp];
+        uint8_t v;
+        if (('0' <= c) && (c <= '9')) {
+            v = c - '0';
+        } else if (('a' <= c) && (c <= 'f')) {
+            v = c - 'a' + 10;
+        } else if (('A' <= c) && (c <= 'F')) {
+            v = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        if (lp % 2 == 0) {
+            pOut[lp / 2] = v << 4;
+        } else {
+            pOut[lp / 2] |= v;
+        }
+    }
+    *pLen = len / 2;
+    return true;
+}
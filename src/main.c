@@ -1,12 +1,43 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <getopt.h>
+#include <signal.h>
 
 #define LOG_TAG "main"
 #include "btc.h"
 #include "utl_log.h"
 
+#include "bc_misc.h"
 #include "bc_network.h"
+#include "bc_proto.h"
+#include "bc_sendbuf.h"
+#include "bc_slab.h"
+#include "bc_headers.h"
+#include "bc_cfstore.h"
+#include "bc_watch.h"
+#include "bc_known.h"
+#include "bc_fee.h"
+#include "bc_mempool.h"
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+static const struct option kOptions[] = {
+    { "export-headers",     required_argument,  NULL,   'E' },
+    { "import-headers",     required_argument,  NULL,   'I' },
+    { NULL,                 0,                  NULL,   0   },
+};
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void stop_handler(int Sig);
+static void reload_handler(int Sig);
 
 
 /**************************************************************************
@@ -16,16 +47,98 @@
 int main(int argc, char *argv[])
 {
     bool retval;
+    const char *p_export = NULL;
+    const char *p_import = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", kOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'E':
+            p_export = optarg;
+            break;
+        case 'I':
+            p_import = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--export-headers FILE | --import-headers FILE]\n", argv[0]);
+            return -1;
+        }
+    }
 
     utl_log_init_stdout();
     btc_init(BTC_TESTNET, true);
 
+    retval = bc_headers_init();
+    if (!retval) {
+        LOGE("fail: bc_headers_init()\n");
+        return -1;
+    }
+
+    if (p_export != NULL) {
+        retval = bc_headers_export(p_export);
+        goto LABEL_EXIT;
+    }
+    if (p_import != NULL) {
+        retval = bc_headers_import(p_import);
+        goto LABEL_EXIT;
+    }
+
+    if (!bc_cfstore_init()) {
+        //filterは毎回取得する
+        LOGE("fail: bc_cfstore_init()\n");
+    }
+    if (!bc_watch_init()) {
+        LOGE("fail: bc_watch_init()\n");
+    }
+    //無くてもよい(再起動直後のtx再取得が減るだけ)
+    bc_known_init();
+    bc_fee_init();
+    bc_mempool_init();
+
+    //Ctrl+C, killで保存してから終わる
+    struct sigaction sa;
+    MEMSET(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    //SIGHUPでFNAME_WATCHを読み直す
+    sa.sa_handler = reload_handler;
+    sigaction(SIGHUP, &sa, NULL);
+
     retval = bc_network_connect();
     if (!retval) {
         LOGE("fail: tcp_connect()\n");
-        return -1;
     }
+    bc_mempool_term();
+    bc_known_term();
+    bc_fee_term();
+    bc_watch_term();
+    bc_cfstore_term();
+    bc_sendbuf_term();
+    bc_slab_term();
 
+LABEL_EXIT:
+    bc_headers_term();
     btc_term();
-    return 0;
+#ifdef ALLOCATOR
+    bc_alloc_print();
+#endif
+    return (retval) ? 0 : -1;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static void stop_handler(int Sig)
+{
+    bc_network_stop();
+}
+
+
+static void reload_handler(int Sig)
+{
+    bc_reload_watch();
 }
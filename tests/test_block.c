@@ -0,0 +1,350 @@
+/**************************************************************************
+ * @file    test_block.c
+ * @brief   bc_block_verify()のテスト
+ * @note
+ *      - mainnetのgenesis block
+ *      - 組み立てたblockのmerkle rootとwitness commitment。比較する値はbtc_util_hash256()で別に計算する
+ *      - CVE-2012-2459: 末尾のtxを重ねてもmerkle rootは変わらないが、検証は失敗すること
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_block.h"
+#include "bc_arena.h"
+#include "btc.h"
+
+#include "test_misc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define TX_MAX                  (8)             ///< 1blockのtx数上限
+#define TX_SZ_MAX               (256)
+#define BLOCK_SZ_MAX            (80 + 1 + TX_MAX * TX_SZ_MAX)
+#define HEADERS_MERKLE_POS      (36)
+
+#define TX_COINBASE             (0)             ///< make_tx()のTag: coinbase
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+/** mainnetのgenesis block */
+static const char kGenesisBlock[] =
+    "0100000000000000000000000000000000000000000000000000000000000000"
+    "000000003ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa"
+    "4b1e5e4a29ab5f49ffff001d1dac2b7c01010000000100000000000000000000"
+    "00000000000000000000000000000000000000000000ffffffff4d04ffff001d"
+    "0104455468652054696d65732030332f4a616e2f32303039204368616e63656c"
+    "6c6f72206f6e206272696e6b206f66207365636f6e64206261696c6f75742066"
+    "6f722062616e6b73ffffffff0100f2052a01000000434104678afdb0fe554827"
+    "1967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4"
+    "f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac00000000";
+
+static const uint8_t kCommitHeader[] = { 0x6a, 0x24, 0xaa, 0x21, 0xa9, 0xed };
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct tx_t
+ *
+ * 組み立てたtx
+ */
+typedef struct {
+    uint8_t     raw[TX_SZ_MAX];                 ///< blockに入れる形(witnessあり)
+    size_t      len;
+    uint8_t     txid[BTC_SZ_HASH256];
+    uint8_t     wtxid[BTC_SZ_HASH256];
+} tx_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool verify(const uint8_t *pBlock, size_t Len, uint32_t *pCount);
+static size_t make_block(uint8_t *pBlock, const tx_t *pTxs, const int *pOrder, int Num, const uint8_t *pRoot);
+static void make_tx(tx_t *pTx, uint8_t Tag, bool bWitness, const uint8_t *pCommit);
+static size_t write_tx(uint8_t *pBuf, uint8_t Tag, bool bWitness, const uint8_t *pCommit, uint8_t WitTag);
+static void merkle_root(uint8_t *pRoot, const uint8_t *pHashes, int Num);
+static void put(uint8_t **pp, const void *pData, size_t Len);
+static void put_u32(uint8_t **pp, uint32_t Val);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static bc_arena_t       mArena;
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(void)
+{
+    uint8_t block[BLOCK_SZ_MAX];
+    uint8_t hashes[TX_MAX * BTC_SZ_HASH256];
+    uint8_t root[BTC_SZ_HASH256];
+    uint8_t root2[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+    tx_t txs[6];
+    uint32_t count;
+    size_t len;
+
+    bc_arena_init(&mArena);
+
+    //genesis
+    int genesis_len = test_hex2bin(block, sizeof(block), kGenesisBlock);
+    TEST_CHECK(genesis_len == 285);
+    btc_util_hash256(hash, block, 80);
+    TEST_CHECK(MEMCMP(hash, btc_util_get_genesis_block(BTC_GENESIS_BTCMAIN), BTC_SZ_HASH256) == 0);
+    TEST_CHECK(verify(block, genesis_len, &count) && (count == 1));
+    block[HEADERS_MERKLE_POS] ^= 0x01;
+    TEST_CHECK(!verify(block, genesis_len, NULL));
+
+    //witnessなし: coinbase + 2tx
+    make_tx(&txs[0], TX_COINBASE, false, NULL);
+    for (int lp = 1; lp < 6; lp++) {
+        make_tx(&txs[lp], (uint8_t)lp, false, NULL);
+    }
+    for (int lp = 0; lp < 3; lp++) {
+        MEMCPY(hashes + lp * BTC_SZ_HASH256, txs[lp].txid, BTC_SZ_HASH256);
+    }
+    merkle_root(root, hashes, 3);
+    static const int kOrder3[] = { 0, 1, 2 };
+    len = make_block(block, txs, kOrder3, 3, root);
+    TEST_CHECK(verify(block, len, &count) && (count == 3));
+    //後ろに余分なdata
+    block[len] = 0x00;
+    TEST_CHECK(!verify(block, len + 1, NULL));
+    //途中で切れている
+    TEST_CHECK(!verify(block, len - 1, NULL));
+    //tx数だけ多い
+    block[80]++;
+    TEST_CHECK(!verify(block, len, NULL));
+
+    //CVE-2012-2459: [0,1,2,2]は[0,1,2]と同じmerkle root
+    static const int kOrderDup[] = { 0, 1, 2, 2 };
+    for (int lp = 0; lp < 4; lp++) {
+        MEMCPY(hashes + lp * BTC_SZ_HASH256, txs[kOrderDup[lp]].txid, BTC_SZ_HASH256);
+    }
+    merkle_root(root2, hashes, 4);
+    TEST_CHECK(MEMCMP(root, root2, BTC_SZ_HASH256) == 0);
+    len = make_block(block, txs, kOrderDup, 4, root);
+    TEST_CHECK(!verify(block, len, NULL));
+
+    //上の段で重ねた場合: [0..5]と[0..5,4,5]
+    static const int kOrder6[] = { 0, 1, 2, 3, 4, 5 };
+    static const int kOrder6Dup[] = { 0, 1, 2, 3, 4, 5, 4, 5 };
+    for (int lp = 0; lp < 6; lp++) {
+        MEMCPY(hashes + lp * BTC_SZ_HASH256, txs[kOrder6[lp]].txid, BTC_SZ_HASH256);
+    }
+    merkle_root(root, hashes, 6);
+    for (int lp = 0; lp < 8; lp++) {
+        MEMCPY(hashes + lp * BTC_SZ_HASH256, txs[kOrder6Dup[lp]].txid, BTC_SZ_HASH256);
+    }
+    merkle_root(root2, hashes, 8);
+    TEST_CHECK(MEMCMP(root, root2, BTC_SZ_HASH256) == 0);
+    len = make_block(block, txs, kOrder6, 6, root);
+    TEST_CHECK(verify(block, len, &count) && (count == 6));
+    len = make_block(block, txs, kOrder6Dup, 8, root);
+    TEST_CHECK(!verify(block, len, NULL));
+
+    //witnessあり: commitment = HASH256(witness merkle root || reserved value(0))
+    uint8_t commit[2 * BTC_SZ_HASH256];
+    make_tx(&txs[1], 1, true, NULL);
+    MEMSET(hashes, 0, BTC_SZ_HASH256);
+    MEMCPY(hashes + BTC_SZ_HASH256, txs[1].wtxid, BTC_SZ_HASH256);
+    merkle_root(commit, hashes, 2);
+    MEMSET(commit + BTC_SZ_HASH256, 0, BTC_SZ_HASH256);
+    btc_util_hash256(hash, commit, sizeof(commit));
+    make_tx(&txs[0], TX_COINBASE, true, hash);
+    MEMCPY(hashes, txs[0].txid, BTC_SZ_HASH256);
+    MEMCPY(hashes + BTC_SZ_HASH256, txs[1].txid, BTC_SZ_HASH256);
+    merkle_root(root, hashes, 2);
+    static const int kOrder2[] = { 0, 1 };
+    len = make_block(block, txs, kOrder2, 2, root);
+    TEST_CHECK(verify(block, len, &count) && (count == 2));
+    //witnessだけ変える(TXIDとmerkle rootは変わらない)
+    tx_t tx_wit = txs[1];
+    txs[1].len = write_tx(txs[1].raw, 1, true, NULL, 0xee);
+    len = make_block(block, txs, kOrder2, 2, root);
+    TEST_CHECK(!verify(block, len, NULL));
+    txs[1] = tx_wit;
+    //commitmentが無い
+    make_tx(&txs[0], TX_COINBASE, false, NULL);
+    MEMCPY(hashes, txs[0].txid, BTC_SZ_HASH256);
+    MEMCPY(hashes + BTC_SZ_HASH256, txs[1].txid, BTC_SZ_HASH256);
+    merkle_root(root, hashes, 2);
+    len = make_block(block, txs, kOrder2, 2, root);
+    TEST_CHECK(!verify(block, len, NULL));
+
+    bc_arena_free(&mArena);
+
+    return TEST_RESULT("test_block");
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static bool verify(const uint8_t *pBlock, size_t Len, uint32_t *pCount)
+{
+    bool ret = bc_block_verify(pBlock, Len, &mArena, pCount);
+    bc_arena_reset(&mArena);
+    return ret;
+}
+
+
+/** block組み立て
+ *
+ * @param[out]  pBlock      block
+ * @param[in]   pTxs        tx
+ * @param[in]   pOrder      並べるpTxsのindex
+ * @param[in]   Num         pOrder数
+ * @param[in]   pRoot       headerに入れるmerkle root
+ * @return      block長
+ */
+static size_t make_block(uint8_t *pBlock, const tx_t *pTxs, const int *pOrder, int Num, const uint8_t *pRoot)
+{
+    uint8_t *p = pBlock;
+    uint8_t zero[BTC_SZ_HASH256];
+
+    MEMSET(zero, 0, sizeof(zero));
+    put_u32(&p, 1);
+    put(&p, zero, BTC_SZ_HASH256);
+    put(&p, pRoot, BTC_SZ_HASH256);
+    put_u32(&p, 1231006505);
+    put_u32(&p, 0x207fffff);
+    put_u32(&p, 0);
+    *p++ = (uint8_t)Num;
+    for (int lp = 0; lp < Num; lp++) {
+        put(&p, pTxs[pOrder[lp]].raw, pTxs[pOrder[lp]].len);
+    }
+    return p - pBlock;
+}
+
+
+/** tx組み立て
+ *
+ * TXIDはwitnessを除いて、WTXIDはwitnessを含めて書いたものをhashする。
+ *
+ * @param[out]  pTx         tx
+ * @param[in]   Tag         TX_COINBASE, または入力元txidと出力scriptに使う値
+ * @param[in]   bWitness    true:witnessを付ける
+ * @param[in]   pCommit     coinbaseに入れるwitness commitment(NULL:なし)
+ */
+static void make_tx(tx_t *pTx, uint8_t Tag, bool bWitness, const uint8_t *pCommit)
+{
+    uint8_t buf[TX_SZ_MAX];
+
+    size_t len = write_tx(buf, Tag, false, pCommit, 0);
+    btc_util_hash256(pTx->txid, buf, len);
+    pTx->len = write_tx(pTx->raw, Tag, bWitness, pCommit, Tag);
+    btc_util_hash256(pTx->wtxid, pTx->raw, pTx->len);
+}
+
+
+/** tx serialize
+ *
+ * @param[out]  pBuf        raw tx
+ * @param[in]   Tag         make_tx()と同じ
+ * @param[in]   bWitness    true:marker, flag, witnessを書く
+ * @param[in]   pCommit     make_tx()と同じ
+ * @param[in]   WitTag      witness itemの値(coinbaseはreserved valueなので0)
+ * @return      tx長
+ */
+static size_t write_tx(uint8_t *pBuf, uint8_t Tag, bool bWitness, const uint8_t *pCommit, uint8_t WitTag)
+{
+    uint8_t *p = pBuf;
+    uint8_t data[BTC_SZ_HASH256];
+    static const uint8_t kCoinbaseScript[] = { 0x03, 0x01, 0x00, 0x00 };
+
+    put_u32(&p, 1);
+    if (bWitness) {
+        *p++ = 0x00;
+        *p++ = 0x01;
+    }
+    //vin
+    *p++ = 1;
+    MEMSET(data, (Tag == TX_COINBASE) ? 0x00 : Tag, sizeof(data));
+    put(&p, data, sizeof(data));
+    put_u32(&p, (Tag == TX_COINBASE) ? 0xffffffff : 0);
+    if (Tag == TX_COINBASE) {
+        *p++ = sizeof(kCoinbaseScript);
+        put(&p, kCoinbaseScript, sizeof(kCoinbaseScript));
+    } else {
+        *p++ = 0;
+    }
+    put_u32(&p, 0xffffffff);
+    //vout
+    *p++ = (pCommit != NULL) ? 2 : 1;
+    put_u32(&p, 1000 + Tag);
+    put_u32(&p, 0);
+    *p++ = 22;
+    *p++ = 0x00;
+    *p++ = 0x14;
+    MEMSET(data, Tag, 20);
+    put(&p, data, 20);
+    if (pCommit != NULL) {
+        put_u32(&p, 0);
+        put_u32(&p, 0);
+        *p++ = sizeof(kCommitHeader) + BTC_SZ_HASH256;
+        put(&p, kCommitHeader, sizeof(kCommitHeader));
+        put(&p, pCommit, BTC_SZ_HASH256);
+    }
+    //witness: 1item(32byte)
+    if (bWitness) {
+        *p++ = 1;
+        *p++ = BTC_SZ_HASH256;
+        MEMSET(data, (Tag == TX_COINBASE) ? 0x00 : WitTag, sizeof(data));
+        put(&p, data, sizeof(data));
+    }
+    put_u32(&p, 0);
+    return p - pBuf;
+}
+
+
+/** merkle root(段の要素数が奇数なら最後を重ねる) */
+static void merkle_root(uint8_t *pRoot, const uint8_t *pHashes, int Num)
+{
+    uint8_t level[TX_MAX * BTC_SZ_HASH256];
+
+    MEMCPY(level, pHashes, Num * BTC_SZ_HASH256);
+    while (Num > 1) {
+        if (Num & 1) {
+            MEMCPY(level + Num * BTC_SZ_HASH256, level + (Num - 1) * BTC_SZ_HASH256, BTC_SZ_HASH256);
+            Num++;
+        }
+        for (int lp = 0; lp < Num / 2; lp++) {
+            btc_util_hash256(level + lp * BTC_SZ_HASH256, level + lp * 2 * BTC_SZ_HASH256, 2 * BTC_SZ_HASH256);
+        }
+        Num /= 2;
+    }
+    MEMCPY(pRoot, level, BTC_SZ_HASH256);
+}
+
+
+static void put(uint8_t **pp, const void *pData, size_t Len)
+{
+    MEMCPY(*pp, pData, Len);
+    *pp += Len;
+}
+
+
+static void put_u32(uint8_t **pp, uint32_t Val)
+{
+    for (int lp = 0; lp < 4; lp++) {
+        *(*pp)++ = (uint8_t)(Val >> (8 * lp));
+    }
+}
@@ -0,0 +1,164 @@
+/**************************************************************************
+ * @file    test_gcs.c
+ * @brief   bc_gcs_match_any()のテスト
+ * @note
+ *      - genesisのbasic filterはBIP158のtest vector(mainnet, testnet)
+ *      - 40要素のfilterはBIP158の手順どおりに別実装で作ったもの
+ *        (要素は 0x00 0x14 + SHA256("m" || index(LE32))の先頭20byte)
+ *      - 同じ手順の"n"の1000要素は、どれもfilterの値と一致しないことを確認してある
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_gcs.h"
+#include "btc.h"
+
+#include "test_misc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define ITEM_LEN                (22)            ///< P2WPKHと同じ長さ
+#define MEMBER_NUM              (40)
+#define NONMEMBER_NUM           (1000)
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+/** genesis coinbaseのscriptPubKey */
+static const char kGenesisScript[] =
+    "4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61de"
+    "b649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac";
+
+/** genesisのbasic filter(BIP158) */
+static const char kFilterMain[] = "017fa880";
+static const char kFilterTest[] = "019dfca8";
+
+/** mainnet genesisのBlock Hashをkeyにした40要素のfilter */
+static const char kFilter40[] =
+    "288c36089600ab879995b99b27cea0f9f957a206d1a4574b51b95cdf1299e4e2"
+    "224e8453afadbb2c5e5bf3a0e5fa3b7eb4adae7e6ee4ead17860c92c7aa6df30"
+    "335dca09effd8549a3eab46d4552c4c54a0ce150a64a8f1be8c5cbe724c13b61"
+    "af2ac8e971da81e9c012";
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool match(const utl_buf_t *pItems, int Num, const uint8_t *pFilter, size_t Len, const uint8_t *pBlockHash);
+static void make_item(uint8_t *pItem, char Tag, uint32_t Idx);
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(void)
+{
+    uint8_t script[80];
+    uint8_t filter[128];
+    utl_buf_t item;
+    int len;
+
+    const uint8_t *p_main = btc_util_get_genesis_block(BTC_GENESIS_BTCMAIN);
+    const uint8_t *p_test = btc_util_get_genesis_block(BTC_GENESIS_BTCTEST);
+    int script_len = test_hex2bin(script, sizeof(script), kGenesisScript);
+    TEST_CHECK(script_len == 67);
+    item.buf = script;
+    item.len = (uint32_t)script_len;
+
+    //genesis(BIP158)
+    len = test_hex2bin(filter, sizeof(filter), kFilterMain);
+    TEST_CHECK(match(&item, 1, filter, len, p_main));
+    TEST_CHECK(!match(&item, 1, filter, len, p_test));
+    len = test_hex2bin(filter, sizeof(filter), kFilterTest);
+    TEST_CHECK(match(&item, 1, filter, len, p_test));
+
+    //要素数0のfilter, 要素の無いquery
+    filter[0] = 0x00;
+    TEST_CHECK(!match(&item, 1, filter, 1, p_main));
+    len = test_hex2bin(filter, sizeof(filter), kFilterMain);
+    TEST_CHECK(!match(&item, 0, filter, len, p_main));
+
+    //40要素
+    uint8_t *p_data = (uint8_t *)MALLOC(ITEM_LEN * NONMEMBER_NUM);
+    utl_buf_t *p_items = (utl_buf_t *)MALLOC(sizeof(utl_buf_t) * NONMEMBER_NUM);
+    len = test_hex2bin(filter, sizeof(filter), kFilter40);
+    TEST_CHECK(len == 106);
+    int matched = 0;
+    int matched_half = 0;
+    for (uint32_t lp = 0; lp < MEMBER_NUM; lp++) {
+        make_item(p_data, 'm', lp);
+        item.buf = p_data;
+        item.len = ITEM_LEN;
+        if (match(&item, 1, filter, len, p_main)) {
+            matched++;
+        }
+        //途中で切れたfilterは、切れた所より後の要素を復号できない
+        if (match(&item, 1, filter, len / 2, p_main)) {
+            matched_half++;
+        }
+    }
+    TEST_CHECK(matched == MEMBER_NUM);
+    TEST_CHECK((matched_half > 0) && (matched_half < MEMBER_NUM));
+
+    for (uint32_t lp = 0; lp < NONMEMBER_NUM; lp++) {
+        make_item(p_data + lp * ITEM_LEN, 'n', lp);
+        p_items[lp].buf = p_data + lp * ITEM_LEN;
+        p_items[lp].len = ITEM_LEN;
+    }
+    TEST_CHECK(!match(p_items, NONMEMBER_NUM, filter, len, p_main));
+    //1つだけ一致する要素を混ぜる
+    make_item(p_data + (NONMEMBER_NUM / 2) * ITEM_LEN, 'm', MEMBER_NUM - 1);
+    TEST_CHECK(match(p_items, NONMEMBER_NUM, filter, len, p_main));
+
+    //N(varint)が大きすぎる
+    filter[0] = 0xff;
+    TEST_CHECK(!match(p_items, 1, filter, len, p_main));
+
+    FREE(p_items);
+    FREE(p_data);
+
+    return TEST_RESULT("test_gcs");
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static bool match(const utl_buf_t *pItems, int Num, const uint8_t *pFilter, size_t Len, const uint8_t *pBlockHash)
+{
+    bc_gcs_query_t query;
+
+    if (!bc_gcs_query_init(&query, pItems, Num)) {
+        return false;
+    }
+    bool ret = bc_gcs_match_any(&query, pFilter, Len, pBlockHash);
+    bc_gcs_query_free(&query);
+    return ret;
+}
+
+
+/** 0x00 0x14 + SHA256(Tag || Idx(LE32))[0:20] */
+static void make_item(uint8_t *pItem, char Tag, uint32_t Idx)
+{
+    uint8_t data[5];
+    uint8_t hash[BTC_SZ_HASH256];
+
+    data[0] = (uint8_t)Tag;
+    for (int lp = 0; lp < 4; lp++) {
+        data[1 + lp] = (uint8_t)(Idx >> (8 * lp));
+    }
+    btc_util_sha256(hash, data, sizeof(data));
+    pItem[0] = 0x00;
+    pItem[1] = 0x14;
+    MEMCPY(pItem + 2, hash, ITEM_LEN - 2);
+}
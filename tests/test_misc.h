@@ -0,0 +1,63 @@
+/**************************************************************************
+ * @file    test_misc.h
+ * @brief   テスト共通
+ * @note
+ *      - 各テストは単独の実行ファイルで、失敗があれば1を返す
+ **************************************************************************/
+#ifndef TEST_MISC_H__
+#define TEST_MISC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+/** 条件が偽なら場所を出して失敗数を数える */
+#define TEST_CHECK(cond) do { \
+    mTestNum++; \
+    if (!(cond)) { \
+        printf("%s:%d: fail: %s\n", __FILE__, __LINE__, #cond); \
+        mTestFail++; \
+    } \
+} while (0)
+
+/** 結果を出してmain()から返す値 */
+#define TEST_RESULT(name) \
+    (printf("%s: %d/%d ok\n", (name), mTestNum - mTestFail, mTestNum), (mTestFail == 0) ? 0 : 1)
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static int mTestNum;
+static int mTestFail;
+
+
+/**************************************************************************
+ * static functions
+ **************************************************************************/
+
+/** hex文字列(表示順のまま)をbinaryにする
+ *
+ * @return  長さ(-1:不正)
+ */
+static inline int test_hex2bin(uint8_t *pData, size_t Max, const char *pHex)
+{
+    size_t len = 0;
+    while ((pHex[0] != '\0') && (pHex[1] != '\0')) {
+        unsigned int val;
+        if ((len >= Max) || (sscanf(pHex, "%2x", &val) != 1)) {
+            return -1;
+        }
+        pData[len++] = (uint8_t)val;
+        pHex += 2;
+    }
+    return (pHex[0] == '\0') ? (int)len : -1;
+}
+
+#endif /* TEST_MISC_H__ */
@@ -0,0 +1,286 @@
+/**************************************************************************
+ * @file    test_txview.c
+ * @brief   bc_txview_parse()のテスト
+ * @note
+ *      - 組み立てたsegwit txを走査した値と、btc_util_hash256()で別に計算したTXID, WTXID
+ *      - 途中で切れたtxは、ちょうどの大きさで確保した領域にcopyして解析する(範囲外を読めばASanで分かる)
+ *      - 個数や長さのvarintが大きすぎるtx
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bc_misc.h"
+#include "bc_txview.h"
+#include "btc.h"
+
+#include "test_misc.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define TX_SZ_MAX               (512)
+
+#define VOUT0_VALUE             (0x0000000100000005ULL)     ///< 上位32bitも使う
+#define VOUT1_VALUE             (1234)
+#define LOCKTIME                (0x00123456)
+
+
+/**************************************************************************
+ * const variables
+ **************************************************************************/
+
+static const uint8_t kScriptSig1[] = { 0x51, 0x52, 0x53 };
+static const uint8_t kScriptOpReturn[] = { 0x6a, 0x00 };
+
+/** 大きすぎる値(varint) */
+static const uint8_t kHuge2[] = { 0xfd, 0xff, 0xff };
+static const uint8_t kHuge4[] = { 0xfe, 0xff, 0xff, 0xff, 0x7f };
+static const uint8_t kHuge8[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool parse_copy(bc_txview_t *pView, const uint8_t *pData, size_t Len);
+static bool check_truncated(const uint8_t *pTx, size_t Len);
+static bool check_huge(const uint8_t *pTx, size_t Len, size_t Pos);
+static size_t write_tx(uint8_t *pBuf, bool bWitness);
+static void put(uint8_t **pp, const void *pData, size_t Len);
+static void put_u32(uint8_t **pp, uint32_t Val);
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(void)
+{
+    uint8_t tx[TX_SZ_MAX];
+    uint8_t tx_nowit[TX_SZ_MAX];
+    uint8_t txid[BTC_SZ_HASH256];
+    uint8_t wtxid[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+    bc_txview_t view;
+    bc_txview_iter_t iter;
+    bc_txview_vin_t vin;
+    bc_txview_vout_t vout;
+    const uint8_t *p_item;
+    uint32_t item_len;
+
+    size_t len = write_tx(tx, true);
+    size_t len_nowit = write_tx(tx_nowit, false);
+    btc_util_hash256(txid, tx_nowit, len_nowit);
+    btc_util_hash256(wtxid, tx, len);
+
+    //segwit
+    TEST_CHECK(parse_copy(&view, tx, len) && (view.len == len));
+    TEST_CHECK(bc_txview_parse(&view, tx, len));
+    TEST_CHECK(view.segwit && (view.vin_cnt == 2) && (view.vout_cnt == 2));
+    bc_txview_txid(&view, hash);
+    TEST_CHECK(MEMCMP(hash, txid, BTC_SZ_HASH256) == 0);
+    bc_txview_wtxid(&view, hash);
+    TEST_CHECK(MEMCMP(hash, wtxid, BTC_SZ_HASH256) == 0);
+
+    bc_txview_vin_begin(&view, &iter);
+    TEST_CHECK(bc_txview_vin_next(&view, &iter, &vin));
+    TEST_CHECK((vin.p_outpoint[0] == 0x11) && (vin.p_outpoint[32] == 1));
+    TEST_CHECK((vin.script_len == 0) && (vin.sequence == 0xfffffffd) && (vin.wit_cnt == 2));
+    TEST_CHECK(bc_txview_wit_item(&vin, 0, &p_item, &item_len) && (item_len == 72) && (p_item[0] == 0x30));
+    TEST_CHECK(bc_txview_wit_item(&vin, 1, &p_item, &item_len) && (item_len == 33) && (p_item[0] == 0x02));
+    TEST_CHECK(!bc_txview_wit_item(&vin, 2, &p_item, &item_len));
+    TEST_CHECK(bc_txview_vin_next(&view, &iter, &vin));
+    TEST_CHECK((vin.p_outpoint[0] == 0x22) && (vin.p_outpoint[32] == 0));
+    TEST_CHECK((vin.script_len == sizeof(kScriptSig1)) && (MEMCMP(vin.p_script, kScriptSig1, sizeof(kScriptSig1)) == 0));
+    TEST_CHECK((vin.sequence == 0xffffffff) && (vin.wit_cnt == 0));
+    TEST_CHECK(!bc_txview_vin_next(&view, &iter, &vin));
+
+    bc_txview_vout_begin(&view, &iter);
+    TEST_CHECK(bc_txview_vout_next(&view, &iter, &vout));
+    TEST_CHECK((vout.value == VOUT0_VALUE) && (vout.script_len == 22) && (vout.p_script[1] == 0x14));
+    TEST_CHECK(bc_txview_vout_next(&view, &iter, &vout));
+    TEST_CHECK((vout.value == VOUT1_VALUE) && (vout.script_len == sizeof(kScriptOpReturn)));
+    TEST_CHECK(!bc_txview_vout_next(&view, &iter, &vout));
+    TEST_CHECK((size_t)(view.p_locktime - tx) == len - 4);
+
+    //witnessなし
+    TEST_CHECK(parse_copy(&view, tx_nowit, len_nowit) && (view.len == len_nowit));
+    TEST_CHECK(bc_txview_parse(&view, tx_nowit, len_nowit) && !view.segwit);
+    bc_txview_txid(&view, hash);
+    TEST_CHECK(MEMCMP(hash, txid, BTC_SZ_HASH256) == 0);
+    bc_txview_wtxid(&view, hash);
+    TEST_CHECK(MEMCMP(hash, txid, BTC_SZ_HASH256) == 0);
+    bc_txview_vin_begin(&view, &iter);
+    TEST_CHECK(bc_txview_vin_next(&view, &iter, &vin) && (vin.wit_cnt == 0) && (vin.p_wit == NULL));
+
+    //後ろに続きがある(block中のtx)
+    tx[len] = 0x01;
+    TEST_CHECK(parse_copy(&view, tx, len + 1) && (view.len == len));
+
+    //途中で切れている
+    TEST_CHECK(check_truncated(tx, len));
+    TEST_CHECK(check_truncated(tx_nowit, len_nowit));
+
+    //個数, 長さが大きすぎる
+    TEST_CHECK(bc_txview_parse(&view, tx, len));
+    size_t pos_vin = view.p_vin - tx;
+    size_t pos_vout = view.p_vout - tx;
+    size_t pos_wit = view.p_wit - tx;
+    TEST_CHECK(check_huge(tx, len, pos_vin));                                   //vin数
+    TEST_CHECK(check_huge(tx, len, pos_vin + 1 + BC_TXVIEW_OUTPOINT_SZ));       //scriptSig長
+    TEST_CHECK(check_huge(tx, len, pos_vout));                                  //vout数
+    TEST_CHECK(check_huge(tx, len, pos_vout + 1 + 8));                          //scriptPubKey長
+    TEST_CHECK(check_huge(tx, len, pos_wit));                                   //witness item数
+    TEST_CHECK(check_huge(tx, len, pos_wit + 1));                               //witness item長
+
+    //varint
+    static const uint8_t kVarint[] = { 0xfd, 0x34, 0x12 };
+    const uint8_t *p = kVarint;
+    uint64_t val;
+    TEST_CHECK(bc_txview_varint(&p, kVarint + sizeof(kVarint), &val) && (val == 0x1234) && (p == kVarint + 3));
+    p = kVarint;
+    TEST_CHECK(!bc_txview_varint(&p, kVarint + 2, &val) && (p == kVarint));
+    p = kHuge8;
+    TEST_CHECK(bc_txview_varint(&p, kHuge8 + sizeof(kHuge8), &val) && (val == UINT64_MAX));
+
+    return TEST_RESULT("test_txview");
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** ちょうどの大きさで確保してから解析 */
+static bool parse_copy(bc_txview_t *pView, const uint8_t *pData, size_t Len)
+{
+    uint8_t *p_buf = (uint8_t *)MALLOC((Len > 0) ? Len : 1);
+    if (p_buf == NULL) {
+        return false;
+    }
+    MEMCPY(p_buf, pData, Len);
+    bool ret = bc_txview_parse(pView, p_buf, Len);
+    FREE(p_buf);
+    return ret;
+}
+
+
+/** 途中で切れたtxはすべて失敗すること */
+static bool check_truncated(const uint8_t *pTx, size_t Len)
+{
+    bc_txview_t view;
+
+    for (size_t lp = 0; lp < Len; lp++) {
+        if (parse_copy(&view, pTx, lp)) {
+            fprintf(stderr, "  truncated: %zu/%zu parsed\n", lp, Len);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** pTx[Pos]の1byte varintを大きい値に置き換えると失敗すること */
+static bool check_huge(const uint8_t *pTx, size_t Len, size_t Pos)
+{
+    static const struct {
+        const uint8_t   *p;
+        size_t          len;
+    } kHuge[] = {
+        { kHuge2, sizeof(kHuge2) },
+        { kHuge4, sizeof(kHuge4) },
+        { kHuge8, sizeof(kHuge8) },
+    };
+    uint8_t buf[TX_SZ_MAX + sizeof(kHuge8)];
+    bc_txview_t view;
+
+    for (size_t lp = 0; lp < ARRAY_SIZE(kHuge); lp++) {
+        uint8_t *p = buf;
+        put(&p, pTx, Pos);
+        put(&p, kHuge[lp].p, kHuge[lp].len);
+        put(&p, pTx + Pos + 1, Len - Pos - 1);
+        if (parse_copy(&view, buf, p - buf)) {
+            fprintf(stderr, "  huge: pos=%zu parsed\n", Pos);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** tx serialize
+ *
+ * vin 2(1つ目だけwitness 2item), vout 2
+ *
+ * @param[out]  pBuf        raw tx
+ * @param[in]   bWitness    true:marker, flag, witnessを書く
+ * @return      tx長
+ */
+static size_t write_tx(uint8_t *pBuf, bool bWitness)
+{
+    uint8_t *p = pBuf;
+    uint8_t data[72];
+
+    put_u32(&p, 2);
+    if (bWitness) {
+        *p++ = 0x00;
+        *p++ = 0x01;
+    }
+    //vin
+    *p++ = 2;
+    MEMSET(data, 0x11, BTC_SZ_HASH256);
+    put(&p, data, BTC_SZ_HASH256);
+    put_u32(&p, 1);
+    *p++ = 0;
+    put_u32(&p, 0xfffffffd);
+    MEMSET(data, 0x22, BTC_SZ_HASH256);
+    put(&p, data, BTC_SZ_HASH256);
+    put_u32(&p, 0);
+    *p++ = sizeof(kScriptSig1);
+    put(&p, kScriptSig1, sizeof(kScriptSig1));
+    put_u32(&p, 0xffffffff);
+    //vout
+    *p++ = 2;
+    put_u32(&p, (uint32_t)VOUT0_VALUE);
+    put_u32(&p, (uint32_t)(VOUT0_VALUE >> 32));
+    *p++ = 22;
+    *p++ = 0x00;
+    *p++ = 0x14;
+    MEMSET(data, 0x33, 20);
+    put(&p, data, 20);
+    put_u32(&p, VOUT1_VALUE);
+    put_u32(&p, 0);
+    *p++ = sizeof(kScriptOpReturn);
+    put(&p, kScriptOpReturn, sizeof(kScriptOpReturn));
+    //witness
+    if (bWitness) {
+        *p++ = 2;
+        *p++ = 72;
+        MEMSET(data, 0x30, 72);
+        put(&p, data, 72);
+        *p++ = 33;
+        MEMSET(data, 0x02, 33);
+        put(&p, data, 33);
+        *p++ = 0;
+    }
+    put_u32(&p, LOCKTIME);
+    return p - pBuf;
+}
+
+
+static void put(uint8_t **pp, const void *pData, size_t Len)
+{
+    MEMCPY(*pp, pData, Len);
+    *pp += Len;
+}
+
+
+static void put_u32(uint8_t **pp, uint32_t Val)
+{
+    for (int lp = 0; lp < 4; lp++) {
+        *(*pp)++ = (uint8_t)(Val >> (8 * lp));
+    }
+}
@@ -0,0 +1,219 @@
+/**************************************************************************
+ * @file    bench_gcs.c
+ * @brief   bc_gcs_match_any()の計測
+ * @note
+ *      - usage: bench_gcs [filter数]
+ *      - 監視script数 1, 100, 10000で、1 filterあたりの照合時間を出力する
+ *      - filterは乱数値をBIP158と同じGolomb-Rice符号(P=19)にしたもの
+ *        (一致はfalse positiveだけなので、ほぼ全filterで要素が尽きるまでmergeする)
+ *      - scriptはP2WPKHと同じ22byte
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "bc_misc.h"
+#include "bc_gcs.h"
+#include "utl_buf.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define FILTER_NUM              (1000)          ///< 既定のfilter数
+#define FILTER_ELEMS            (2000)          ///< 1 filterの要素数(1 blockのscript数相当)
+#define SCRIPT_LEN              (22)
+#define ROUNDS                  (3)             ///< 計測回数(最小値を使う)
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct bitwriter_t
+ *
+ */
+typedef struct {
+    uint8_t     *p_data;
+    uint64_t    pos;                ///< bit位置
+} bitwriter_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static uint64_t rand64(void);
+static int cmp_u64(const void *pA, const void *pB);
+static void put_bit(bitwriter_t *pWriter, int Bit);
+static size_t make_filter(uint8_t *pFilter, uint64_t *pTmp, uint32_t Num);
+static uint64_t now_nsec(void);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static uint64_t         mRand = 0x6e7974636f696e31ULL;      ///< xorshift64の状態
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    static const int kScripts[] = { 1, 100, 10000 };
+    int filter_num = FILTER_NUM;
+
+    if (argc >= 2) {
+        filter_num = atoi(argv[1]);
+        if (filter_num <= 0) {
+            fprintf(stderr, "usage: %s [filter数]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    //filter: varint(3byte) + 要素あたり平均約21bit
+    const size_t filter_max = 3 + FILTER_ELEMS * 4 + 8;
+    uint8_t *p_filters = (uint8_t *)MALLOC(filter_max * filter_num);
+    size_t *p_len = (size_t *)MALLOC(sizeof(size_t) * filter_num);
+    uint8_t *p_bhash = (uint8_t *)MALLOC(BTC_SZ_HASH256 * filter_num);
+    uint64_t *p_tmp = (uint64_t *)MALLOC(sizeof(uint64_t) * FILTER_ELEMS);
+    for (int lp = 0; lp < filter_num; lp++) {
+        p_len[lp] = make_filter(p_filters + filter_max * lp, p_tmp, FILTER_ELEMS);
+        for (int lp2 = 0; lp2 < BTC_SZ_HASH256; lp2++) {
+            p_bhash[BTC_SZ_HASH256 * lp + lp2] = (uint8_t)rand64();
+        }
+    }
+    FREE(p_tmp);
+
+    printf("filters=%d, elements/filter=%d\n", filter_num, FILTER_ELEMS);
+    for (int idx = 0; idx < ARRAY_SIZE(kScripts); idx++) {
+        const int num = kScripts[idx];
+        utl_buf_t *p_items = (utl_buf_t *)MALLOC(sizeof(utl_buf_t) * num);
+        uint8_t *p_scripts = (uint8_t *)MALLOC(SCRIPT_LEN * num);
+        for (int lp = 0; lp < num; lp++) {
+            uint8_t *p = p_scripts + SCRIPT_LEN * lp;
+            p[0] = 0x00;
+            p[1] = 0x14;
+            for (int lp2 = 2; lp2 < SCRIPT_LEN; lp2++) {
+                p[lp2] = (uint8_t)rand64();
+            }
+            p_items[lp].buf = p;
+            p_items[lp].len = SCRIPT_LEN;
+        }
+
+        bc_gcs_query_t query;
+        if (!bc_gcs_query_init(&query, p_items, num)) {
+            fprintf(stderr, "fail: bc_gcs_query_init\n");
+            return 1;
+        }
+        uint64_t best = UINT64_MAX;
+        int match = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            match = 0;
+            uint64_t start = now_nsec();
+            for (int lp = 0; lp < filter_num; lp++) {
+                if (bc_gcs_match_any(&query, p_filters + filter_max * lp, p_len[lp], p_bhash + BTC_SZ_HASH256 * lp)) {
+                    match++;
+                }
+            }
+            uint64_t elapsed = now_nsec() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        printf("scripts=%5d: %10.1f us/filter (match=%d)\n", num, (double)best / filter_num / 1000.0, match);
+        bc_gcs_query_free(&query);
+        FREE(p_scripts);
+        FREE(p_items);
+    }
+
+    FREE(p_bhash);
+    FREE(p_len);
+    FREE(p_filters);
+    return 0;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** xorshift64
+ *
+ */
+static uint64_t rand64(void)
+{
+    mRand ^= mRand << 13;
+    mRand ^= mRand >> 7;
+    mRand ^= mRand << 17;
+    return mRand;
+}
+
+
+static int cmp_u64(const void *pA, const void *pB)
+{
+    uint64_t a = *(const uint64_t *)pA;
+    uint64_t b = *(const uint64_t *)pB;
+    return (a > b) - (a < b);
+}
+
+
+static void put_bit(bitwriter_t *pWriter, int Bit)
+{
+    if (Bit) {
+        pWriter->p_data[pWriter->pos >> 3] |= (uint8_t)(0x80 >> (pWriter->pos & 7));
+    }
+    pWriter->pos++;
+}
+
+
+/** filter作成
+ *
+ * [0, Num * BC_GCS_M)の乱数をsortし、差分をGolomb-Rice符号にする。
+ *
+ * @return  filter長
+ */
+static size_t make_filter(uint8_t *pFilter, uint64_t *pTmp, uint32_t Num)
+{
+    const uint64_t f = (uint64_t)Num * BC_GCS_M;
+    for (uint32_t lp = 0; lp < Num; lp++) {
+        pTmp[lp] = rand64() % f;
+    }
+    qsort(pTmp, Num, sizeof(uint64_t), cmp_u64);
+
+    //N(varint): 0xfd + uint16_t
+    pFilter[0] = 0xfd;
+    pFilter[1] = (uint8_t)Num;
+    pFilter[2] = (uint8_t)(Num >> 8);
+
+    bitwriter_t writer;
+    writer.p_data = pFilter + 3;
+    writer.pos = 0;
+    MEMSET(writer.p_data, 0, Num * 4 + 8);
+    uint64_t prev = 0;
+    for (uint32_t lp = 0; lp < Num; lp++) {
+        uint64_t delta = pTmp[lp] - prev;
+        prev = pTmp[lp];
+        for (uint64_t q = delta >> BC_GCS_P; q > 0; q--) {
+            put_bit(&writer, 1);
+        }
+        put_bit(&writer, 0);
+        for (int bit = BC_GCS_P - 1; bit >= 0; bit--) {
+            put_bit(&writer, (int)((delta >> bit) & 1));
+        }
+    }
+    return 3 + (size_t)((writer.pos + 7) >> 3);
+}
+
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
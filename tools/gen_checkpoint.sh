@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# checkpoints/*.txtからbc_checkpoint.c用のテーブルを生成する
+#
+#   usage: gen_checkpoint.sh <mainnet.txt> <testnet.txt>
+#
+#   - 入力は1行に "height block_hash" (block hashはRPC表示と同じ並び)
+#   - 出力は内部バイト順(逆順)に並べ替える
+#   - 行はheight昇順で並べること
+#
+
+set -e
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <mainnet.txt> <testnet.txt>" >&2
+    exit 1
+fi
+
+gen_table() {
+    awk -v name="$2" '
+        BEGIN {
+            printf("static const bc_checkpoint_t %s[] = {\n", name);
+            prev = -1;
+        }
+        /^[ \t]*(#|$)/ { next }
+        {
+            if (length($2) != 64) {
+                printf("%s:%d: invalid hash\n", FILENAME, NR) > "/dev/stderr";
+                exit 1;
+            }
+            if ($1 + 0 <= prev) {
+                printf("%s:%d: height not ascending\n", FILENAME, NR) > "/dev/stderr";
+                exit 1;
+            }
+            prev = $1 + 0;
+            printf("    { %8d, {", $1);
+            for (i = 64; i > 0; i -= 2) {
+                if ((i % 16) == 0) {
+                    printf("\n       ");
+                }
+                printf(" 0x%s,", substr($2, i - 1, 2));
+            }
+            printf("\n    } },\n");
+        }
+        END {
+            printf("};\n");
+        }
+    ' "$1"
+}
+
+cat <<HEAD
+/**************************************************************************
+ * @file    bc_checkpoint_tbl.h
+ * @brief   checkpoint table
+ * @note
+ *      - generated by tools/gen_checkpoint.sh. DO NOT EDIT.
+ **************************************************************************/
+#ifndef BC_CHECKPOINT_TBL_H__
+#define BC_CHECKPOINT_TBL_H__
+
+#if defined(MAINNET)
+HEAD
+gen_table "$1" kCheckpoint
+echo "#elif defined(TESTNET)"
+gen_table "$2" kCheckpoint
+cat <<TAIL
+#endif
+
+#endif /* BC_CHECKPOINT_TBL_H__ */
+TAIL